@@ -0,0 +1,74 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Interpreter of the GDB agent expressions. These bytecode expressions are
+ * compiled by GDB for conditions of breakpoints and tracepoints, and for
+ * data to be collected by tracepoints. They are evaluated by the simulator
+ * without a round-trip to the GDB client.
+ *
+ * Addresses are the ones used by avr-gdb: program memory starts at 0x0,
+ * data memory at 0x800000. Registers are numbered as in the 'g' packet:
+ * r0-r31, SREG (32), SP (33) and PC (34, a byte address).
+ */
+#ifndef MSIM_AVR_AGENT_H_
+#define MSIM_AVR_AGENT_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Forward declaration of the structure to describe AVR microcontroller
+ * instance. */
+struct MSIM_AVR;
+
+#define MSIM_AVR_AX_STACK	64		/* Depth of the value stack */
+#define MSIM_AVR_AX_STEPS	65536		/* Opcodes to evaluate at most */
+#define MSIM_AVR_AX_DATA	0x800000U	/* Data memory in GDB */
+
+/* Function to collect a memory region requested by an expression. */
+typedef void (*MSIM_AVR_AXTraceFunc)(void *arg, uint32_t addr,
+                                     uint32_t len);
+
+/* Function to collect a trace state variable requested by an expression. */
+typedef void (*MSIM_AVR_AXTraceVFunc)(void *arg, uint32_t n, int64_t val);
+
+/* Environment of the expression to be evaluated in. */
+typedef struct MSIM_AVR_AXEnv {
+	struct MSIM_AVR *mcu;		/* MCU instance */
+	MSIM_AVR_AXTraceFunc trace;	/* Collects memory, may be NULL */
+	MSIM_AVR_AXTraceVFunc tracev;	/* Collects variables, may be NULL */
+	void *arg;			/* Argument of the trace functions */
+	int64_t *tsv;			/* Trace state variables */
+	uint32_t tsv_num;		/* Number of trace state variables */
+} MSIM_AVR_AXEnv;
+
+int	MSIM_AVR_AXEval(MSIM_AVR_AXEnv *env, const uint8_t *ax, uint32_t len,
+	                int64_t *val);
+int	MSIM_AVR_AXReg(struct MSIM_AVR *mcu, uint32_t n, int64_t *val);
+int	MSIM_AVR_AXMem(struct MSIM_AVR *mcu, uint32_t addr, uint8_t *buf,
+	               uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_AGENT_H_ */
@@ -0,0 +1,81 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Code coverage of the firmware. Bitmaps of the executed instructions and
+ * branches taken (or not taken) are kept per word of the program memory.
+ *
+ * Coverage file consists of a header:
+ *
+ *	magic		8 bytes, "MSIMCOV" and version byte (1)
+ *	words		4 bytes, little-endian, program memory size in words
+ *	hash		4 bytes, little-endian, FNV-1a hash of program memory
+ *	name		20 bytes, name of the MCU, zero-padded
+ *
+ * followed by the 'exec', 'taken' and 'ntaken' bitmaps, (words+7)/8 bytes
+ * each. Bit N of the bitmap corresponds to the word N of the program memory.
+ * Coverage files of the same firmware (equal hashes) can be merged by OR-ing
+ * their bitmaps (see mcusim-cov).
+ */
+#ifndef MSIM_AVR_COVERAGE_H_
+#define MSIM_AVR_COVERAGE_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Forward declaration of the structure to describe AVR microcontroller
+ * instance. */
+struct MSIM_AVR;
+
+#define MSIM_AVR_COV_MAGIC	"MSIMCOV"	/* Coverage file signature */
+#define MSIM_AVR_COV_VER	1		/* Coverage format version */
+#define MSIM_AVR_COV_WORDS	(256*1024)	/* Max PM words covered */
+#define MSIM_AVR_COV_BMSZ	(MSIM_AVR_COV_WORDS/8)
+
+/* Coverage bitmaps of the program memory. */
+typedef struct MSIM_AVR_Cov {
+	uint8_t on;			/* Coverage is being collected */
+	char file[4096];		/* Coverage file to save bitmaps to */
+	char name[20];			/* Name of the MCU */
+	uint32_t words;			/* Program memory size, in words */
+	uint32_t hash;			/* Hash of the program memory */
+	uint8_t exec[MSIM_AVR_COV_BMSZ]; /* Instructions executed */
+	uint8_t taken[MSIM_AVR_COV_BMSZ]; /* Branches taken (or skips) */
+	uint8_t ntaken[MSIM_AVR_COV_BMSZ]; /* Branches not taken */
+} MSIM_AVR_Cov;
+
+/* Functions to collect coverage during the simulation. */
+int	MSIM_AVR_CovOpen(struct MSIM_AVR *mcu, const char *f);
+int	MSIM_AVR_CovSave(struct MSIM_AVR *mcu);
+void	MSIM_AVR_CovReset(struct MSIM_AVR *mcu);
+void	MSIM_AVR_CovInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst);
+
+/* Functions to work with the coverage files. */
+int	MSIM_AVR_CovRead(MSIM_AVR_Cov *cov, const char *f);
+int	MSIM_AVR_CovWrite(const MSIM_AVR_Cov *cov, const char *f);
+int	MSIM_AVR_CovMerge(MSIM_AVR_Cov *dst, const MSIM_AVR_Cov *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_COVERAGE_H_ */
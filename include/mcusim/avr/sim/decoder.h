@@ -31,6 +31,11 @@ int MSIM_AVR_Step(struct MSIM_AVR *mcu);
 
 int MSIM_AVR_Is32(unsigned int inst);
 
+int MSIM_AVR_IsCond(unsigned int inst);
+
+int MSIM_AVR_Disasm(char *buf, unsigned int len, unsigned int inst,
+                    unsigned int inst2);
+
 #ifdef __cplusplus
 }
 #endif
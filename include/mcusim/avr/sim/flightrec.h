@@ -0,0 +1,72 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flight recorder keeps a state of the MCU before each of the last executed
+ * instructions. It is always on and dumped to a file when the simulation
+ * crashes.
+ */
+#ifndef MSIM_AVR_FLIGHTREC_H_
+#define MSIM_AVR_FLIGHTREC_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Forward declaration of the structure to describe AVR microcontroller
+ * instance. */
+struct MSIM_AVR;
+
+/* Number of entries in the recorder, it should be a power of two. */
+#define MSIM_AVR_FRSZ		(64*1024)
+
+/* File to dump the flight recorder to. The other MCUs of a simulation
+ * append their index to it, i.e. ".mcusim.flightrec.1" and so on. */
+#define MSIM_AVR_FRFILE		".mcusim.flightrec"
+#define MSIM_AVR_FRFILESZ	32
+
+/* State of the MCU before an instruction. */
+typedef struct MSIM_AVR_FREntry {
+	uint64_t tick;			/* Cycles passed since reset */
+	uint32_t pc;			/* Program counter, in 16-bits words */
+	uint16_t sp;			/* Stack pointer */
+	uint8_t sreg;			/* Status register */
+} MSIM_AVR_FREntry;
+
+/* Ring buffer of the flight recorder. Head counts all of the entries
+ * written (64 bits don't wrap in practice), the oldest entry is
+ * overwritten once the buffer is full. */
+typedef struct MSIM_AVR_FR {
+	MSIM_AVR_FREntry ent[MSIM_AVR_FRSZ];
+	uint64_t head;			/* Number of entries written */
+	uint8_t underflow;		/* Stack underflow is reported */
+	char file[MSIM_AVR_FRFILESZ];	/* MSIM_AVR_FRFILE if empty */
+} MSIM_AVR_FR;
+
+/* Writes entries of the flight recorder (oldest first) to its file with
+ * a reason of the dump. */
+int MSIM_AVR_FRDump(struct MSIM_AVR *mcu, const char *reason);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_FLIGHTREC_H_ */
@@ -31,9 +31,17 @@
 extern "C" {
 #endif
 
+/* Cycles between checks for a break from GDB client while MCU is running */
+#define MSIM_AVR_RSP_POLL		(4*1024)
+
 void MSIM_AVR_RSPInit(struct MSIM_AVR *mcu, uint16_t portn);
+int MSIM_AVR_RSPAddMCU(struct MSIM_AVR *mcu);
+void MSIM_AVR_RSPStop(struct MSIM_AVR *mcu);
 void MSIM_AVR_RSPClose(struct MSIM_AVR *mcu);
 int MSIM_AVR_RSPHandle(struct MSIM_AVR *mcu);
+int MSIM_AVR_RSPPoll(struct MSIM_AVR *mcu);
+int MSIM_AVR_RSPBreak(struct MSIM_AVR *mcu);
+void MSIM_AVR_RSPWatch(struct MSIM_AVR *mcu, uint32_t loc, uint8_t write);
 
 #ifdef __cplusplus
 }
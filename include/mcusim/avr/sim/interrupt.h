@@ -40,6 +40,7 @@ typedef struct MSIM_AVR_INT {
 	uint32_t reset_pc;		/* Reset address */
 	uint32_t ivt;			/* Interrupt vectors table address */
 	uint8_t irq[MSIM_AVR_IRQNUM];	/* Flags for interrupt requests */
+	uint64_t served[MSIM_AVR_IRQNUM]; /* Interrupts served per vector */
 	uint8_t exec_main;		/* Exe instruction from the main
 					   program after an exit from ISR */
 	uint8_t trap_at_isr;		/* Flag to enter stopped mode when
@@ -29,12 +29,28 @@ extern "C" {
  * during a simulation. */
 #define MSIM_AVR_LUAMODELS			256
 
+/* Maximum number of callbacks scheduled by a single model. */
+#define MSIM_AVR_LUATIMERS			32
+
+/* Maximum number of events queued for a model on a worker thread before
+ * it's synchronized with the MCU. */
+#define MSIM_AVR_LUAEVENTS			256
+
 /* Load peripherals written in Lua from a given list file. */
 int MSIM_AVR_LUALoadModel(struct MSIM_AVR *mcu, char *model);
 /* Close previously created Lua states. */
 void MSIM_AVR_LUACleanModels(void);
 /* Call a "tick" function of the models during each cycle of simulation. */
 void MSIM_AVR_LUATickModels(struct MSIM_AVR *mcu);
+/* Call callbacks of the models scheduled for the current cycle. Returns
+ * the cycle of the next scheduled call. */
+uint64_t MSIM_AVR_LUARunScheduled(struct MSIM_AVR *mcu);
+/* Notify models about I/O register written by the firmware. */
+void MSIM_AVR_LUAOnWrite(struct MSIM_AVR *mcu, uint32_t reg, uint8_t old,
+                         uint8_t val);
+/* Notify models about a pin changed. */
+void MSIM_AVR_LUAOnPinEdge(struct MSIM_AVR *mcu, uint32_t port, uint8_t bit,
+                           uint8_t level);
 
 #ifdef __cplusplus
 }
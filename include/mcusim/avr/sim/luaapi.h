@@ -33,6 +33,23 @@ extern "C" {
 #include "lauxlib.h"
 #include "mcusim/mcusim.h"
 
+/* MCU as it's seen by a model, it's passed to the functions below as
+ * 'struct MSIM_AVR *mcu'. Model on a worker thread sees a copy of the data
+ * memory, state and frequency of the MCU taken at the last sync point.
+ * Layout of the registers and ports is read from the MCU itself, it
+ * doesn't change during simulation. */
+typedef struct MSIM_AVR_LUAView {
+	struct MSIM_AVR *avr;		/* MCU the model is loaded for */
+	uint8_t *dm;			/* Data memory */
+	enum MSIM_AVR_State *state;	/* State of the MCU */
+	uint32_t *freq;			/* Clock frequency, in Hz */
+	uint32_t ramend;		/* Last byte of the on-chip SRAM */
+	uint32_t sfr_off;		/* Offset to I/O registers in DM */
+	uint32_t regs_num;		/* # of general purpose registers */
+	uint32_t ioregs_num;		/* # of I/O registers */
+	char log[MSIM_AVR_LOGSZ];	/* Buffer to print a log message to */
+} MSIM_AVR_LUAView;
+
 /* Reads bit of a general purpose AVR register (from register file).
  *
  * Lua parameters:
@@ -140,6 +157,51 @@ int MSIM_LUAF_AVRWriteIO(lua_State *L);
  */
 int MSIM_LUAF_AVRWriteIO16(lua_State *L);
 
+/* Reads a block of the data space, i.e. general purpose and I/O registers
+ * or SRAM. It's much faster than reading the block byte by byte.
+ *
+ * Lua parameters:
+ * 	struct MSIM_AVR *mcu;
+ * 	uint32_t addr;
+ * 	uint32_t len;
+ * Returns:
+ * 	string block;			Bytes of the block
+ */
+int MSIM_LUAF_AVRReadBlock(lua_State *L);
+
+/* Writes a block of the data space.
+ *
+ * Lua parameters:
+ * 	struct MSIM_AVR *mcu;
+ * 	uint32_t addr;
+ * 	string block;			Bytes to write
+ */
+int MSIM_LUAF_AVRWriteBlock(lua_State *L);
+
+/* Reads registers of an I/O port at once. Port is either a name ("B" for
+ * PORTB) or address of any of its registers (PORTB, DDRB or PINB).
+ *
+ * Lua parameters:
+ * 	struct MSIM_AVR *mcu;
+ * 	string|uint32_t port;
+ * Returns:
+ * 	unsigned char pin;
+ * 	unsigned char port;
+ * 	unsigned char ddr;
+ */
+int MSIM_LUAF_AVRReadPort(lua_State *L);
+
+/* Drives levels of the pins of an I/O port, i.e. writes PINx bits selected
+ * by a mask. Port is addressed as in AVR_ReadPort.
+ *
+ * Lua parameters:
+ * 	struct MSIM_AVR *mcu;
+ * 	string|uint32_t port;
+ * 	unsigned char mask;
+ * 	unsigned char val;
+ */
+int MSIM_LUAF_AVRWritePins(lua_State *L);
+
 /* Set state of a simulated AVR microcontroller. This function is helpful to
  * terminate simulation if it's necessary (test failure, etc.).
  *
@@ -0,0 +1,149 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Device models compiled as shared objects (native models). They're loaded
+ * using "native_model" option of the configuration file and called by the
+ * simulator at the same points as the Lua models.
+ *
+ * A model exports C functions with the names below. All of them but
+ * module_conf are optional, the model isn't called if it doesn't export
+ * the function.
+ *
+ *	int module_conf(MSIM_AVR_NativeMCU *mcu);
+ *		Called once the model is loaded, non-zero result rejects
+ *		the model. Model should reject an MCU with unknown version
+ *		of the interface (abi).
+ *	void module_tick(MSIM_AVR_NativeMCU *mcu);
+ *		Called every cycle of the MCU.
+ *	void module_on_write(MSIM_AVR_NativeMCU *mcu, uint32_t reg,
+ *	                     uint8_t old, uint8_t val);
+ *		I/O register has been written by the firmware.
+ *	void module_on_pin_edge(MSIM_AVR_NativeMCU *mcu, uint32_t port,
+ *	                        uint8_t bit, uint8_t level);
+ *		Level of the pin (bit of PORTx) has been changed.
+ *	void module_close(MSIM_AVR_NativeMCU *mcu);
+ *		Called before the model is unloaded.
+ *
+ * Models written in C++ should declare these functions as extern "C".
+ */
+#ifndef MSIM_AVR_NATIVE_H_
+#define MSIM_AVR_NATIVE_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of native device models to be loaded during
+ * a simulation. */
+#define MSIM_AVR_NATIVEMODELS			64
+
+/* Maximum number of callbacks scheduled by a single model. */
+#define MSIM_AVR_NATIVETIMERS			32
+
+/* Version of the interface between the simulator and native models. It's
+ * changed every time MSIM_AVR_NativeMCU is changed incompatibly. */
+#define MSIM_AVR_NATIVE_ABI			1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mcusim/mcusim.h"
+
+typedef struct MSIM_AVR_NativeMCU MSIM_AVR_NativeMCU;
+
+/* Function of the model scheduled to be called later. */
+typedef void (*MSIM_AVR_NativeFunc)(MSIM_AVR_NativeMCU *mcu);
+
+/* MCU as it's seen by a native model. */
+struct MSIM_AVR_NativeMCU {
+	uint32_t abi;			/* Version of the interface */
+	const char *name;		/* Name of the MCU */
+	const uint32_t *freq;		/* Clock frequency, in Hz */
+	const uint64_t *tick;		/* Cycles passed since reset */
+
+	uint8_t *dm;			/* Data memory */
+	uint32_t dm_size;		/* Size of the data memory */
+	const MSIM_AVR_IOPort *ports;	/* I/O ports */
+	uint32_t ports_num;		/* Number of I/O ports */
+
+	/* Calls the function once the given number of cycles passed (at
+	 * least one). Returns non-zero if too many calls scheduled. */
+	int (*schedule)(MSIM_AVR_NativeMCU *mcu, uint64_t delay,
+	                MSIM_AVR_NativeFunc fn);
+	/* Changes state of the MCU (AVR_MSIM_STOP, AVR_MSIM_TESTFAIL, etc.) */
+	void (*set_state)(MSIM_AVR_NativeMCU *mcu, enum MSIM_AVR_State s);
+
+	void *data;			/* Free to use by the model */
+	void *sim;			/* Private to the simulator */
+};
+
+/* Entry points of the native model (module_tick and module_close are
+ * MSIM_AVR_NativeFunc). */
+typedef int (*MSIM_AVR_NativeConfFunc)(MSIM_AVR_NativeMCU *mcu);
+typedef void (*MSIM_AVR_NativeWriteFunc)(MSIM_AVR_NativeMCU *mcu,
+                                         uint32_t reg, uint8_t old,
+                                         uint8_t val);
+typedef void (*MSIM_AVR_NativeEdgeFunc)(MSIM_AVR_NativeMCU *mcu,
+                                        uint32_t port, uint8_t bit,
+                                        uint8_t level);
+
+/* Reads a byte of the data memory, zero is returned beyond its end. */
+static inline uint8_t
+MSIM_AVR_NativeRead(const MSIM_AVR_NativeMCU *mcu, uint32_t addr)
+{
+	return (addr < mcu->dm_size) ? mcu->dm[addr] : 0U;
+}
+
+/* Writes a byte of the data memory, writes beyond its end are ignored. */
+static inline void
+MSIM_AVR_NativeWrite(MSIM_AVR_NativeMCU *mcu, uint32_t addr, uint8_t v)
+{
+	if (addr < mcu->dm_size) {
+		mcu->dm[addr] = v;
+	}
+}
+
+/* Returns the I/O port, or NULL if the MCU doesn't have it. */
+static inline const MSIM_AVR_IOPort *
+MSIM_AVR_NativePort(const MSIM_AVR_NativeMCU *mcu, uint32_t i)
+{
+	return (i < mcu->ports_num) ? &mcu->ports[i] : NULL;
+}
+
+/* Load a native model from a shared object. */
+int MSIM_AVR_NativeLoadModel(struct MSIM_AVR *mcu, const char *model);
+/* Unload previously loaded native models. */
+void MSIM_AVR_NativeCleanModels(void);
+/* Call a "tick" function of the models during each cycle of simulation. */
+void MSIM_AVR_NativeTickModels(struct MSIM_AVR *mcu);
+/* Call functions of the models scheduled for the current cycle. Returns
+ * the cycle of the next scheduled call. */
+uint64_t MSIM_AVR_NativeRunScheduled(struct MSIM_AVR *mcu);
+/* Notify models about I/O register written by the firmware. */
+void MSIM_AVR_NativeOnWrite(struct MSIM_AVR *mcu, uint32_t reg, uint8_t old,
+                            uint8_t val);
+/* Notify models about a pin changed. */
+void MSIM_AVR_NativeOnPinEdge(struct MSIM_AVR *mcu, uint32_t port,
+                              uint8_t bit, uint8_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_NATIVE_H_ */
@@ -50,13 +50,17 @@
 #define PM(v)			(mcu->pm[(v)])
 #define DM(v)			(mcu->dm[(v)])
 #define IOR(v)			(DM(SFR + (v)))
-#define MPM(v)			(mcu->mpm[(v)])
+#define BP_ISSET(v)		(mcu->bp[(v) >> 3] & (1U << ((v) & 7U)))
 
 #define LOG			(mcu->log)
 #define LOGSZ			(MSIM_AVR_LOGSZ)
 #define TICKS_MAX		(UINT64_MAX)
 #define ARRSZ(a)		(sizeof(a)/sizeof((a)[0]))
 
+/* MCU executes instructions and counts cycles in these states only */
+#define IS_MCU_ACTIVE(mcu) 	(((mcu)->state == AVR_RUNNING) ||	\
+                                 ((mcu)->state == AVR_MSIM_STEP))
+
 /* Macro to provide a result of writing value to I/O register with its
  * access mask applied.
  *
@@ -121,16 +125,58 @@
 	mcu->mci = 0;						\
 } while (0)
 
+/* Remember a data space location written by the current instruction and
+ * its value before the write. Nobody needs them unless the instructions
+ * are traced or models are notified about the writes. */
+#define MARK_DS(loc) do {						\
+	if (((mcu->trace.file != NULL) || (mcu->mod_events > 0U)) &&	\
+	                (mcu->writ_ds_num < ARRSZ(mcu->writ_ds))) {	\
+		mcu->writ_old[mcu->writ_ds_num] = DM(loc);		\
+		mcu->writ_ds[mcu->writ_ds_num++] = (uint32_t)(loc);	\
+	}								\
+} while (0)
+
+/* Check a data space location read or written by the current instruction
+ * if memory sanitizer is enabled. */
+#define SAN_READ(loc) do {						\
+	if (mcu->san.on) {						\
+		MSIM_AVR_SanRead(mcu, (uint32_t)(loc));			\
+	}								\
+} while (0)
+#define SAN_WRITE(loc) do {						\
+	if (mcu->san.on) {						\
+		MSIM_AVR_SanWrite(mcu, (uint32_t)(loc), 0);		\
+	}								\
+} while (0)
+
+/* Stop MCU if a data space location is watched by GDB client. */
+#define WP_ISSET(wp, loc)						\
+	(((uint32_t)(loc) < MSIM_AVR_DMSZ) &&				\
+	 (mcu->wp[(uint32_t)(loc) >> 3] & (1U << ((loc) & 7U))))
+#define WATCH_READ(loc) do {						\
+	if ((mcu->wp_num > 0U) && WP_ISSET(wp_r, loc)) {		\
+		MSIM_AVR_RSPWatch(mcu, (uint32_t)(loc), 0);		\
+	}								\
+} while (0)
+#define WATCH_WRITE(loc) do {						\
+	if ((mcu->wp_num > 0U) && WP_ISSET(wp_w, loc)) {		\
+		MSIM_AVR_RSPWatch(mcu, (uint32_t)(loc), 1);		\
+	}								\
+} while (0)
+
 /* Write value to the data space. Location will be checked against space of
  * I/O registers and access mask will be applied if necessary. */
 #ifndef DEBUG
 #define WRITE_DS(loc, v) do {						\
+	MARK_DS(loc);							\
 	if (IS_IO(mcu, loc)) {						\
 		DM(loc) = ((uint8_t)IO(loc, v));			\
 		mcu->writ_io[0] = loc;					\
 	} else {							\
 		DM(loc) = v;						\
 	}								\
+	SAN_WRITE(loc);							\
+	WATCH_WRITE(loc);						\
 } while (0)
 #endif
 
@@ -139,6 +185,7 @@
  * I/O registers and access mask will be applied if necessary. */
 #ifdef DEBUG
 #define WRITE_DS(loc, v) do {						\
+	MARK_DS(loc);							\
 	if (IS_IO(mcu, loc)) {						\
 		if (mcu->ioregs[loc].off < 0) {				\
 			snprintf(LOG, LOGSZ, "firmware is trying to "	\
@@ -151,6 +198,8 @@
 	} else {							\
 		DM(loc) = v;						\
 	}								\
+	SAN_WRITE(loc);							\
+	WATCH_WRITE(loc);						\
 } while (0)
 #endif
 
@@ -0,0 +1,84 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory sanitizer of the firmware. Each byte of the data memory has
+ * a shadow byte which tells whether the byte has been initialized and
+ * whether it belongs to the stack or to the static data (.data, .bss or
+ * heap). Stores above the stack pointer are owned by the stack, the other
+ * stores are owned by the static data.
+ *
+ * The following violations are detected:
+ *	- read of the SRAM byte which hasn't been written yet;
+ *	- access beyond RAMEND;
+ *	- access to I/O register which isn't present in the MCU;
+ *	- stack pointer below RAMSTART;
+ *	- stack growing over the static data.
+ *
+ * The first violation is reported with PC and a call stack of the firmware,
+ * and the MCU is stopped (or the firmware test is failed).
+ */
+#ifndef MSIM_AVR_SANITIZER_H_
+#define MSIM_AVR_SANITIZER_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Forward declaration of the structure to describe AVR microcontroller
+ * instance. */
+struct MSIM_AVR;
+
+#define MSIM_AVR_SAN_DMSZ	(64*1024)	/* Data memory shadowed */
+#define MSIM_AVR_SAN_CALLS	64		/* Max depth of call stack */
+
+/* Bits of the shadow byte */
+#define MSIM_AVR_SAN_INIT	0x01		/* Byte has been written */
+#define MSIM_AVR_SAN_STACK	0x02		/* Byte is owned by stack */
+#define MSIM_AVR_SAN_DATA	0x04		/* Byte is owned by data */
+
+/* Subroutine call of the firmware. */
+typedef struct MSIM_AVR_SanCall {
+	uint32_t pc;			/* Address of call, in words */
+	uint32_t sp;			/* SP after return address pushed */
+} MSIM_AVR_SanCall;
+
+/* Shadow memory of the sanitizer. */
+typedef struct MSIM_AVR_San {
+	uint8_t on;			/* Sanitizer is enabled */
+	uint8_t failed;			/* Violation has been reported */
+	uint8_t ft;			/* Fail firmware test on violation */
+	uint8_t sh[MSIM_AVR_SAN_DMSZ];	/* Shadow of the data memory */
+	MSIM_AVR_SanCall calls[MSIM_AVR_SAN_CALLS]; /* Call stack */
+	uint32_t calls_num;		/* Depth of the call stack */
+} MSIM_AVR_San;
+
+void	MSIM_AVR_SanInit(struct MSIM_AVR *mcu, uint8_t ft);
+void	MSIM_AVR_SanWrite(struct MSIM_AVR *mcu, uint32_t loc, uint8_t push);
+void	MSIM_AVR_SanRead(struct MSIM_AVR *mcu, uint32_t loc);
+void	MSIM_AVR_SanInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst);
+void	MSIM_AVR_SanEnter(struct MSIM_AVR *mcu, uint32_t pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_SANITIZER_H_ */
@@ -22,8 +22,12 @@
 #include <stdint.h>
 #include <pthread.h>
 #include "mcusim/pty.h"
-#include "mcusim/tsq.h"
+#include "mcusim/ring.h"
 #include "mcusim/avr/sim/vcd.h"
+#include "mcusim/avr/sim/trace.h"
+#include "mcusim/avr/sim/coverage.h"
+#include "mcusim/avr/sim/sanitizer.h"
+#include "mcusim/avr/sim/flightrec.h"
 #include "mcusim/avr/sim/io.h"
 #include "mcusim/avr/sim/wdt.h"
 #include "mcusim/avr/sim/usart.h"
@@ -33,10 +37,13 @@
 
 #define MSIM_AVR_PMSZ		(256*1024)	/* Program Memory size */
 #define MSIM_AVR_PM_PAGESZ	(1024)		/* PM page size */
+#define MSIM_AVR_BPSZ		(MSIM_AVR_PMSZ/8) /* Breakpoints bitmap size */
 #define MSIM_AVR_DMSZ		(64*1024)	/* Data Memory size */
+#define MSIM_AVR_WPSZ		(MSIM_AVR_DMSZ/8) /* Watchpoints bitmap size */
 #define MSIM_AVR_LOGSZ		(64*1024)	/* Log buffer size */
 #define MSIM_AVR_MAXTMRS	(32)		/* Maximum # of timers */
 #define MSIM_AVR_MAXIOPORTS	(32)		/* Maximum # of I/O ports */
+#define MSIM_AVR_MCUS		(8)		/* Max MCUs simulated together */
 
 #ifdef __cplusplus
 extern "C" {
@@ -93,6 +100,14 @@ typedef struct MSIM_AVR {
 
 	uint64_t tick;			/* Cycles passed sinse reset */
 	uint8_t tovf;			/* Cycles overflow flag */
+	uint64_t insts;			/* Instructions completed */
+	uint64_t *prof;			/* Cycles per PM word, if profiled */
+	uint8_t realtime;		/* Keep pace with the wall clock */
+	uint32_t mod_ticks;		/* # of models ticked every cycle */
+	uint32_t mod_events;		/* # of models subscribed to events */
+	uint64_t mod_next;		/* Cycle of the next model callback */
+	uint8_t mod_pins[MSIM_AVR_MAXIOPORTS]; /* PINx seen by models */
+	uint32_t rsp_poll;		/* Cycles till GDB client is polled */
 
 	uint32_t flashstart;		/* First byte of the PM */
 	uint32_t flashend;		/* Last byte of the PM */
@@ -115,9 +130,6 @@ typedef struct MSIM_AVR {
 
 	uint32_t pc;			/* Program counter, in 16-bits words */
 	uint8_t pc_bits;		/* PC bits (16-bit, 22-bit, etc.) */
-#ifdef DEBUG
-	uint32_t last_pc[8];		/* N previous PC values */
-#endif
 
 	uint8_t ic_left;		/* Cycles to finish cur. instruction */
 	uint8_t mci;			/* Multi-cycle instruction flag */
@@ -133,15 +145,26 @@ typedef struct MSIM_AVR {
 
 	uint16_t pm[MSIM_AVR_PMSZ];	/* Program memory (PM) */
 	uint16_t pmp[MSIM_AVR_PMSZ];	/* Page buffer for program memory */
-	uint16_t mpm[MSIM_AVR_PMSZ];	/* Match points memory (MPM) */
 	uint32_t pm_size;		/* Actual PM size */
-	uint8_t read_from_mpm;		/* Read instruction from MPM flag */
+
+	uint8_t bp[MSIM_AVR_BPSZ];	/* Breakpoints, bit per PM word */
+	uint32_t bp_num;		/* Number of breakpoints set */
+	uint8_t bp_pass;		/* Pass breakpoint at bp_pc once */
+	uint32_t bp_pc;			/* PC the MCU is stopped at */
+
+	uint8_t wp_r[MSIM_AVR_WPSZ];	/* Read watchpoints, bit per byte */
+	uint8_t wp_w[MSIM_AVR_WPSZ];	/* Write watchpoints, bit per byte */
+	uint32_t wp_num;		/* Number of watchpoints set */
 
 	uint8_t dm[MSIM_AVR_DMSZ];	/* Data memory (DM) */
 	uint32_t dm_size;		/* Actual DM size */
 
 	uint32_t writ_io[4];		/* I/O written on a previous cycle */
 	uint32_t read_io[4];		/* I/O read on a previous cycle */
+	uint32_t writ_ds[MSIM_AVR_TRACE_WRITES]; /* DS written by inst. */
+	uint8_t writ_old[MSIM_AVR_TRACE_WRITES]; /* DS values before write */
+	uint8_t writ_ds_num;		/* # of DS locations written */
+	uint8_t writ_irq;		/* # of them written on IRQ entry */
 
 	uint32_t sfr_off;		/* Offset to I/O registers in DM */
 	uint32_t regs_num;		/* # of general purpose registers */
@@ -161,6 +184,10 @@ typedef struct MSIM_AVR {
 	MSIM_AVR_INT intr;		/* Details to work with IRQs */
 	MSIM_AVR_WDT wdt;		/* Watchdog timer of the MCU */
 	MSIM_AVR_VCD vcd;		/* Details to work with VCD file */
+	MSIM_AVR_Trace trace;		/* Binary trace of instructions */
+	MSIM_AVR_FR fr;			/* Flight recorder */
+	MSIM_AVR_Cov cov;		/* Code coverage */
+	MSIM_AVR_San san;		/* Memory sanitizer */
 	MSIM_AVR_USART usart;		/* Details to work with USART */
 	MSIM_PTY pty;			/* Details to work with POSIX PTY */
 
@@ -35,7 +35,9 @@ extern "C" {
 
 int	MSIM_AVR_Init(MSIM_AVR *mcu, MSIM_CFG *conf);
 int	MSIM_AVR_Simulate(MSIM_AVR *mcu, uint8_t ft);
+int	MSIM_AVR_SimulateAll(MSIM_AVR *mcus, uint32_t n, uint8_t ft);
 int	MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft);
+void	MSIM_AVR_Signal(int s);
 int	MSIM_AVR_SaveProgMem(MSIM_AVR *mcu, const char *f);
 int	MSIM_AVR_LoadProgMem(MSIM_AVR *mcu, const char *f);
 int	MSIM_AVR_LoadDataMem(MSIM_AVR *mcu, const char *f);
@@ -0,0 +1,130 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Data types and functions to record a compact binary trace of the executed
+ * AVR instructions.
+ *
+ * Trace file starts with a header:
+ *
+ *	magic		8 bytes, "MSIMTRC" and version byte (1)
+ *	freq		4 bytes, little-endian, MCU clock frequency in Hz
+ *	name		20 bytes, name of the MCU, zero-padded
+ *
+ * and it is followed by one record per completed instruction:
+ *
+ *	tag		1 byte, see MSIM_AVR_TRACE_* flags below
+ *	pc_delta	varint, zigzag-encoded difference to the expected PC,
+ *			present if MSIM_AVR_TRACE_PCJMP is set
+ *	tick_delta	varint, cycles passed since the previous record,
+ *			present if MSIM_AVR_TRACE_TICKS is set (1 otherwise)
+ *	opcode		2 bytes, little-endian
+ *	opcode2		2 bytes, little-endian, second word of a 32-bit
+ *			instruction, present if MSIM_AVR_TRACE_OP32 is set
+ *	wnum		varint, number of writes, present if the number
+ *			in the tag is MSIM_AVR_TRACE_WMASK
+ *	writes		(varint address, 1 byte value) per data space location
+ *			written by the instruction
+ *
+ * Return address pushed on interrupt entry is written along with the first
+ * instruction of the interrupt handler.
+ *
+ * If the trace records a state of the MCU (see 'trace_state' option),
+ * writes also include all of the general purpose and I/O registers which
+ * have been changed since the previous record, by the instruction itself
+ * or by the peripherals. These changes are sampled when the instruction is
+ * completed, so two traces of the same firmware can be compared record by
+ * record (see mcusim-tracediff).
+ *
+ * Expected PC is a PC of the previous record plus its instruction length,
+ * i.e. sequential execution costs nothing. Varint is a little-endian base
+ * 128 number, 7 bits per byte, high bit set if more bytes follow.
+ */
+#ifndef MSIM_AVR_TRACE_H_
+#define MSIM_AVR_TRACE_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Forward declaration of the structure to describe AVR microcontroller
+ * instance. */
+struct MSIM_AVR;
+
+#define MSIM_AVR_TRACE_MAGIC	"MSIMTRC"	/* Trace file signature */
+#define MSIM_AVR_TRACE_VER	1		/* Trace format version */
+#define MSIM_AVR_TRACE_BUFSZ	(64*1024)	/* Writer buffer size */
+#define MSIM_AVR_TRACE_WRITES	4		/* Max DS writes per inst. */
+#define MSIM_AVR_TRACE_STATESZ	1024		/* Max GPRs and I/O tracked */
+#define MSIM_AVR_TRACE_RECW	(MSIM_AVR_TRACE_STATESZ+MSIM_AVR_TRACE_WRITES)
+
+/* Bits of the record tag */
+#define MSIM_AVR_TRACE_WMASK	0x07		/* # of writes, or varint */
+#define MSIM_AVR_TRACE_PCJMP	0x08		/* PC delta follows */
+#define MSIM_AVR_TRACE_TICKS	0x10		/* Cycles delta follows */
+#define MSIM_AVR_TRACE_OP32	0x20		/* 32-bit instruction */
+
+/* Trace writer attached to the MCU instance. */
+typedef struct MSIM_AVR_Trace {
+	FILE *file;			/* Trace file, NULL if disabled */
+	char file_name[4096];		/* Name of the trace file */
+	uint8_t buf[MSIM_AVR_TRACE_BUFSZ]; /* Records to be written */
+	uint32_t len;			/* Bytes in the buffer */
+	uint32_t next_pc;		/* Expected PC of the next record */
+	uint64_t tick;			/* Cycle of the previous record */
+	uint8_t state;			/* Record changes of GPRs and I/O */
+	uint8_t shadow[MSIM_AVR_TRACE_STATESZ]; /* Previous GPRs and I/O */
+} MSIM_AVR_Trace;
+
+/* Decoded trace record. */
+typedef struct MSIM_AVR_TraceRec {
+	uint64_t tick;			/* Cycle the instruction completed */
+	uint32_t pc;			/* Instruction address, in words */
+	uint16_t op[2];			/* Opcode (one or two words) */
+	uint8_t op32;			/* 32-bit instruction flag */
+	uint32_t wnum;			/* # of data space writes */
+	uint32_t waddr[MSIM_AVR_TRACE_RECW]; /* Locations written */
+	uint8_t wval[MSIM_AVR_TRACE_RECW]; /* Values written */
+} MSIM_AVR_TraceRec;
+
+/* Functions to record a trace during the simulation. */
+int	MSIM_AVR_TraceOpen(struct MSIM_AVR *mcu, const char *f,
+	                   uint8_t state);
+int	MSIM_AVR_TraceClose(struct MSIM_AVR *mcu);
+int	MSIM_AVR_TraceFlush(struct MSIM_AVR *mcu);
+void	MSIM_AVR_TraceInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst);
+
+/* Functions to read a previously recorded trace back. */
+int	MSIM_AVR_TraceReadHeader(FILE *f, uint32_t *freq, char *name,
+	                         uint32_t len);
+int	MSIM_AVR_TraceReadRec(FILE *f, MSIM_AVR_TraceRec *rec,
+	                      uint32_t *next_pc);
+int	MSIM_AVR_TraceCmpRec(const MSIM_AVR_TraceRec *a,
+	                     const MSIM_AVR_TraceRec *b);
+void	MSIM_AVR_TracePrintRec(FILE *f, const MSIM_AVR_TraceRec *rec,
+	                       uint8_t disasm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_AVR_TRACE_H_ */
@@ -24,12 +24,14 @@ extern "C" {
 #endif
 
 typedef struct MSIM_AVR_USART {
-	uint32_t baud;		/* Current baud rate value */
+	uint32_t baud;		/* Current baud rate value, UBRR */
+	uint32_t frame;		/* Cycles to shift a frame in or out */
 	uint8_t txb;		/* Transmit Buffer */
-	uint32_t rx_ticks;	/* USART ticks passed since last Rx */
-	uint32_t tx_ticks;	/* USART ticks passed since last Tx */
-	uint32_t rx_presc;	/* Rx clock prescaler, (UBRR+1) */
-	uint32_t tx_presc;	/* Tx clock prescaler, m*(UBRR+1) */
+	uint8_t tsr;		/* Transmit Shift Register */
+	uint8_t tx_busy;	/* Frame is being transmitted */
+	uint64_t tx_done;	/* Cycle to complete the frame transmitted at */
+	uint64_t rx_next;	/* Cycle to receive the next frame at */
+	uint64_t next;		/* Cycle of the next event of any kind */
 } MSIM_AVR_USART;
 
 #ifdef __cplusplus
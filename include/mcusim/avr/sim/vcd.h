@@ -63,6 +63,7 @@ typedef struct MSIM_AVR_VCDReg {
 /* The main structure to describe a VCD dump. */
 typedef struct MSIM_AVR_VCD {
 	FILE *dump;
+	uint8_t pause;			/* Dump is paused */
 	struct MSIM_AVR_VCDReg regs[MSIM_AVR_VCD_REGS];
 	char dump_file[4096];
 } MSIM_AVR_VCD;
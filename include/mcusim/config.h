@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include "mcusim/avr/sim/vcd.h"
 #include "mcusim/avr/sim/lua.h"
+#include "mcusim/avr/sim/native.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,9 +61,17 @@ typedef struct MSIM_CFG {
 	char lua_models[MSIM_AVR_LUAMODELS][4096];
 	uint32_t lua_models_num;
 
+	char native_models[MSIM_AVR_NATIVEMODELS][4096];
+	uint32_t native_models_num;
+
 	char vcd_file[4096];
 	char dump_regs[MSIM_AVR_VCD_REGS][16];
 	uint32_t dump_regs_num;
+
+	char trace_file[4096];
+	uint8_t trace_state;
+	char coverage_file[4096];
+	uint8_t sanitize_mem;
 } MSIM_CFG;
 
 int	MSIM_CFG_Read(MSIM_CFG *cfg, const char *f);
@@ -0,0 +1,63 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal reader of the 32-bit little-endian ELF files produced by AVR GCC.
+ * It is able to look up sections by name and decode the DWARF (versions 2
+ * to 5) line number program to map addresses of the firmware to lines of
+ * its source files.
+ */
+#ifndef MSIM_ELF_H_
+#define MSIM_ELF_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Max number of files and directories in a single line number program */
+#define MSIM_ELF_MAXFILES	1024
+
+/* ELF file loaded into memory. */
+typedef struct MSIM_ELF {
+	uint8_t *buf;			/* Contents of the file */
+	uint32_t len;			/* Length of the file, in bytes */
+} MSIM_ELF;
+
+/*
+ * Function to be called for each row of the line number table. The row
+ * 'addr' begins a sequence of instructions of the source 'line'; the
+ * sequence lasts till the address of the next row. The last row of each
+ * sequence has 'end_seq' set, its line is meaningless.
+ */
+typedef void (*MSIM_ELF_LineFunc)(void *arg, uint32_t addr, const char *file,
+                                  uint32_t line, uint8_t end_seq);
+
+int	MSIM_ELF_Load(MSIM_ELF *elf, const char *file);
+void	MSIM_ELF_Free(MSIM_ELF *elf);
+const uint8_t *MSIM_ELF_Section(const MSIM_ELF *elf, const char *name,
+                                uint32_t *addr, uint32_t *size);
+int	MSIM_ELF_Lines(const MSIM_ELF *elf, MSIM_ELF_LineFunc f, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_ELF_H_ */
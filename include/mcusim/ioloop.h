@@ -0,0 +1,104 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Single I/O loop which services file descriptors (pseudo-terminals,
+ * sockets, FIFOs) of all the simulated MCUs. Bytes are exchanged with the
+ * simulation thread via lock-free rings, the loop reads and writes them in
+ * batches, so a busy USART doesn't cost the simulation a system call per
+ * character.
+ */
+#ifndef MSIM_IOLOOP_H_
+#define MSIM_IOLOOP_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "mcusim/ring.h"
+
+/* Size of the rings of a channel (a power of two). */
+#define MSIM_IOL_BUFSIZE	16384
+/* Maximum number of channels serviced by the loop. */
+#define MSIM_IOL_CHANS		64
+/* Period to flush the data written by the simulation thread, in ms. */
+#define MSIM_IOL_FLUSHMS	1
+
+/* Return codes of the loop functions. */
+#define MSIM_IOL_OK		0
+#define MSIM_IOL_ERR		75
+
+/* Channel between a file descriptor and the simulation thread.
+ *
+ * fd			Descriptor, it's switched to non-blocking mode.
+ * rx			Bytes read from the descriptor.
+ * tx			Bytes to be written to the descriptor.
+ * idle			Flag set by the loop if it waits for the simulation
+ * 			thread to write something.
+ * full			Flag set by the loop if it waits for the simulation
+ * 			thread to read the full rx ring.
+ *
+ * Other fields are private to the loop. */
+typedef struct MSIM_IOL_Chan {
+	int32_t fd;
+	struct MSIM_RING rx;
+	struct MSIM_RING tx;
+	uint32_t idle;
+	uint32_t full;
+	uint32_t events;		/* Events the loop waits for */
+	uint8_t eof;			/* Descriptor can't be read anymore */
+	uint32_t out_off;		/* Bytes of 'out' written already */
+	uint32_t out_len;		/* Bytes taken from tx to 'out' */
+	uint8_t out[1024];
+	uint8_t rx_buf[MSIM_IOL_BUFSIZE];
+	uint8_t tx_buf[MSIM_IOL_BUFSIZE];
+} MSIM_IOL_Chan;
+
+/* Adds a descriptor to the loop. The loop is started with the first one.
+ *
+ * Returns:
+ * MSIM_IOL_OK		If the descriptor is serviced by the loop.
+ * MSIM_IOL_ERR		If there are too many of them or the loop cannot be
+ * 			started. */
+int MSIM_IOL_Add(MSIM_IOL_Chan *c, int32_t fd);
+
+/* Removes a descriptor from the loop, bytes which are still in the ring
+ * are written if it's possible without blocking. The loop is stopped with
+ * the last descriptor. It doesn't close the descriptor. */
+int MSIM_IOL_Remove(MSIM_IOL_Chan *c);
+
+/* Writes bytes to the channel without blocking. It's called by the
+ * simulation thread only.
+ *
+ * Returns a number of bytes written, it's less than 'len' if the ring
+ * is full. */
+uint32_t MSIM_IOL_Write(MSIM_IOL_Chan *c, const uint8_t *buf, uint32_t len);
+
+/* Reads bytes from the channel without blocking. It's called by the
+ * simulation thread only.
+ *
+ * Returns a number of bytes read, zero if there is nothing to read. */
+uint32_t MSIM_IOL_Read(MSIM_IOL_Chan *c, uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_IOLOOP_H_ */
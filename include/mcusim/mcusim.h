@@ -26,9 +26,14 @@
 #include "mcusim/avr/sim/gdb.h"
 #include "mcusim/avr/sim/interrupt.h"
 #include "mcusim/avr/sim/lua.h"
+#include "mcusim/avr/sim/native.h"
 #include "mcusim/avr/sim/sim.h"
 #include "mcusim/avr/sim/simcore.h"
 #include "mcusim/avr/sim/vcd.h"
+#include "mcusim/avr/sim/trace.h"
+#include "mcusim/avr/sim/flightrec.h"
+#include "mcusim/avr/sim/coverage.h"
+#include "mcusim/avr/sim/sanitizer.h"
 #include "mcusim/avr/sim/wdt.h"
 #include "mcusim/avr/sim/usart.h"
 #include "mcusim/avr/sim/io.h"
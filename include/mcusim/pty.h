@@ -29,27 +29,16 @@ extern "C" {
 #endif
 
 #include <stdlib.h>
-#include <pthread.h>
+#include <stdint.h>
+#include "mcusim/ioloop.h"
 
-/* Size of the buffers to read/write data from/to pty. */
-#define MSIM_PTY_BUFSIZE	16384
-
-/* Thread with buffer to read/write data from/to pty. */
-typedef struct MSIM_PTY_Thread {
-	pthread_mutex_t mutex;		/* Lock before accessing any fields */
-	pthread_t thread;		/* Current thread handle */
-	uint8_t stop_thr;		/* Flag to exit the thread */
-	uint8_t buf[MSIM_PTY_BUFSIZE];	/* Buffer to read/write pty data */
-	uint32_t len;			/* Length of the data in buffer */
-} MSIM_PTY_Thread;
-
-/* A single pseudo-terminal (with master and slave parts) and additional data
- * to handle a separate thread to read from the master part of pty. */
+/* A single pseudo-terminal (with master and slave parts). Master part is
+ * serviced by the I/O loop shared by all the pseudo-terminals. */
 typedef struct MSIM_PTY {
 	char slave_name[128];
 	int32_t master_fd;
 	int32_t slave_fd;
-	struct MSIM_PTY_Thread read_thr;
+	struct MSIM_IOL_Chan *chan;	/* Master part, NULL if pty is closed */
 } MSIM_PTY;
 
 int MSIM_PTY_Open(struct MSIM_PTY *pty);
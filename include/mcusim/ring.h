@@ -0,0 +1,103 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lock-free ring buffer of bytes for a single producer and a single consumer
+ * (SPSC) running in different threads, i.e. the thread reading a
+ * pseudo-terminal and the simulation thread. Neither of them takes a lock,
+ * bytes are copied in batches.
+ */
+#ifndef MSIM_RING_H_
+#define MSIM_RING_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Size of a cache line to keep indexes of the producer and the consumer
+ * apart. */
+#define MSIM_RING_CACHELINE	64
+
+/* Return codes of the ring functions. */
+#define MSIM_RING_OK		0
+#define MSIM_RING_ERR		75
+
+/* Structure to describe a ring buffer.
+ *
+ * Buffer itself is provided by the owner of the ring, its size is a power
+ * of two. Indexes are free-running, i.e. they're masked on access only.
+ *
+ * head			Index of the next byte to dequeue (consumer).
+ * tail_cache		Last tail seen by the consumer.
+ * tail			Index of the next byte to enqueue (producer).
+ * head_cache		Last head seen by the producer.
+ * buf			Buffer the ring is based upon.
+ * mask			Size of the buffer minus one. */
+struct MSIM_RING {
+	uint32_t head;
+	uint32_t tail_cache;
+	uint8_t pad0[MSIM_RING_CACHELINE - 2 * sizeof(uint32_t)];
+	uint32_t tail;
+	uint32_t head_cache;
+	uint8_t pad1[MSIM_RING_CACHELINE - 2 * sizeof(uint32_t)];
+	uint8_t *buf;
+	uint32_t mask;
+};
+
+/* Initializes ring before any usage.
+ *
+ * This function is not thread-safe.
+ *
+ * Returns:
+ * MSIM_RING_OK		If a ring was initialized correctly.
+ * MSIM_RING_ERR	If size of the buffer isn't a power of two. */
+int MSIM_RING_Init(struct MSIM_RING *r, uint8_t *buf, uint32_t size);
+
+/* Adds up to 'len' bytes to the tail of the ring without blocking. It's
+ * called by the producer only.
+ *
+ * Returns a number of bytes enqueued, it's less than 'len' if the ring
+ * is full. */
+uint32_t MSIM_RING_TryEnq(struct MSIM_RING *r, const uint8_t *e, uint32_t len);
+
+/* Takes up to 'len' bytes from the head of the ring without blocking. It's
+ * called by the consumer only.
+ *
+ * Returns a number of bytes dequeued, zero if the ring is empty. */
+uint32_t MSIM_RING_TryDeq(struct MSIM_RING *r, uint8_t *e, uint32_t len);
+
+/* Adds 'len' bytes to the tail of the ring. The calling thread yields
+ * until the ring can accommodate all of them. */
+void MSIM_RING_Enqb(struct MSIM_RING *r, const uint8_t *e, uint32_t len);
+
+/* Takes 'len' bytes from the head of the ring. The calling thread yields
+ * until all of them are available. */
+void MSIM_RING_Deqb(struct MSIM_RING *r, uint8_t *e, uint32_t len);
+
+/* Returns a number of bytes in the ring. It's exact for the consumer and
+ * approximate for any other thread. */
+uint32_t MSIM_RING_Len(struct MSIM_RING *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSIM_RING_H_ */
@@ -0,0 +1,118 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Example of a native device model. It checks that PD1 of ATmega8A is
+ * toggled by the firmware (see tests/atmega8a/toggle-pin) and stops the
+ * simulation once enough edges are seen. The test fails if there are no
+ * such edges within 100 ms.
+ *
+ *	cc -shared -fPIC -I<mcusim>/include -o toggle-check.so toggle-check.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mcusim/mcusim.h"
+
+#define PORT_D			2	/* Ports are B, C and D */
+#define PIN			1	/* PD1 */
+#define EDGES			1000	/* Edges to stop the test after */
+
+int	module_conf(MSIM_AVR_NativeMCU *mcu);
+void	module_on_pin_edge(MSIM_AVR_NativeMCU *mcu, uint32_t port,
+	                   uint8_t bit, uint8_t level);
+void	module_close(MSIM_AVR_NativeMCU *mcu);
+
+/* State of the model, it's kept per MCU */
+struct toggle_check {
+	uint32_t portd;			/* Address of PORTD */
+	uint32_t edges;			/* Edges seen */
+	uint8_t level;			/* Level of the pin */
+};
+
+static void	timeout(MSIM_AVR_NativeMCU *mcu);
+
+int
+module_conf(MSIM_AVR_NativeMCU *mcu)
+{
+	const MSIM_AVR_IOPort *p;
+	struct toggle_check *tc;
+
+	/* Model is built against a known version of the interface only */
+	if (mcu->abi != MSIM_AVR_NATIVE_ABI) {
+		printf("[toggle-check] unknown ABI: %u\n", mcu->abi);
+		return 1;
+	}
+	p = MSIM_AVR_NativePort(mcu, PORT_D);
+	if (p == NULL) {
+		printf("[toggle-check] %s doesn't have PORTD\n", mcu->name);
+		return 1;
+	}
+
+	tc = malloc(sizeof *tc);
+	if (tc == NULL) {
+		return 1;
+	}
+	tc->portd = p->port.reg;
+	tc->edges = 0;
+	tc->level = 0;
+	mcu->data = tc;
+
+	return mcu->schedule(mcu, *mcu->freq / 10U, timeout);
+}
+
+void
+module_on_pin_edge(MSIM_AVR_NativeMCU *mcu, uint32_t port, uint8_t bit,
+                   uint8_t level)
+{
+	struct toggle_check *tc = mcu->data;
+
+	if ((port != tc->portd) || (bit != PIN)) {
+		return;
+	}
+	if ((tc->edges > 0U) && (level == tc->level)) {
+		printf("[toggle-check] PD1 isn't toggled: %u\n", level);
+		mcu->set_state(mcu, AVR_MSIM_TESTFAIL);
+		return;
+	}
+	tc->level = level;
+
+	if (++tc->edges == EDGES) {
+		printf("[toggle-check] %u edges of PD1 at cycle %llu\n",
+		       tc->edges, (unsigned long long)*mcu->tick);
+		mcu->set_state(mcu, AVR_MSIM_STOP);
+	}
+}
+
+void
+module_close(MSIM_AVR_NativeMCU *mcu)
+{
+	free(mcu->data);
+	mcu->data = NULL;
+}
+
+static void
+timeout(MSIM_AVR_NativeMCU *mcu)
+{
+	struct toggle_check *tc = mcu->data;
+
+	printf("[toggle-check] %u edges of PD1 only\n", tc->edges);
+	mcu->set_state(mcu, AVR_MSIM_TESTFAIL);
+}
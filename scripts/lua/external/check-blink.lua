@@ -0,0 +1,49 @@
+--[[
+
+  This file is part of MCUSim, an XSPICE library with microcontrollers.
+
+  Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+
+  MCUSim is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  MCUSim is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+--]]
+
+--[[ Scenario which checks that PB0 is toggled twice a second and the
+     firmware replies to "ping" sent via USART. --]]
+
+HALF_PERIOD = 0.5		-- Half period of PB0, in seconds
+TOLERANCE = 0.01		-- Tolerance of the period, in seconds
+
+-- This function is run by the simulator as a coroutine. It's resumed only
+-- when something it waits for happens, the model isn't ticked every cycle.
+function module_scenario(mcu)
+	local freq = MSIM_Freq(mcu)
+	local early = (HALF_PERIOD - TOLERANCE)*freq
+	local late = 2*TOLERANCE*freq
+
+	expect_pin("B", 0, 1, HALF_PERIOD*freq)
+	for i = 1, 4 do
+		-- Pin shouldn't change too early...
+		if run_until(function(mcu)
+			return AVR_IOBit(mcu, PINB, 0) == (i % 2 == 0)
+		end, early) then
+			error("PB0 has been toggled too early")
+		end
+		-- ...and too late
+		expect_pin("B", 0, (i + 1) % 2, late)
+	end
+
+	send_uart("ping\r")
+	expect_uart("pong", 0.1*freq)
+end
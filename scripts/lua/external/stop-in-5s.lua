@@ -40,14 +40,12 @@ function module_conf(mcu)
 		print("[stop-in-5s] Ticks left: " .. ticks_left)
 		print("[stop-in-5s] Actual timeout: " .. timeout .. "us")
 	end
+
+	-- The model isn't ticked every cycle, the simulator calls the
+	-- function below once the timeout is over.
+	module_schedule(ticks_left, stop)
 end
 
--- This function will be called by the simulator periodically according to the
--- main simulation loop, i.e. time passed between two neighbor calls to the
--- function is a period.
-function module_tick(mcu)
-	ticks_left = ticks_left - 1
-	if ticks_left == 0 then
-		MSIM_SetState(mcu, AVR_MSIM_STOP)
-	end
+function stop(mcu)
+	MSIM_SetState(mcu, AVR_MSIM_STOP)
 end
@@ -0,0 +1,421 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Interpreter of the GDB agent expressions. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/agent.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+/* Opcodes of the agent expressions (see "Bytecode Descriptions" of GDB) */
+enum ax_op {
+	AX_ADD		= 0x02,
+	AX_SUB		= 0x03,
+	AX_MUL		= 0x04,
+	AX_DIV_S	= 0x05,
+	AX_DIV_U	= 0x06,
+	AX_REM_S	= 0x07,
+	AX_REM_U	= 0x08,
+	AX_LSH		= 0x09,
+	AX_RSH_S	= 0x0A,
+	AX_RSH_U	= 0x0B,
+	AX_TRACE	= 0x0C,
+	AX_TRACE_QUICK	= 0x0D,
+	AX_LOG_NOT	= 0x0E,
+	AX_BIT_AND	= 0x0F,
+	AX_BIT_OR	= 0x10,
+	AX_BIT_XOR	= 0x11,
+	AX_BIT_NOT	= 0x12,
+	AX_EQUAL	= 0x13,
+	AX_LESS_S	= 0x14,
+	AX_LESS_U	= 0x15,
+	AX_EXT		= 0x16,
+	AX_REF8		= 0x17,
+	AX_REF16	= 0x18,
+	AX_REF32	= 0x19,
+	AX_REF64	= 0x1A,
+	AX_IF_GOTO	= 0x20,
+	AX_GOTO		= 0x21,
+	AX_CONST8	= 0x22,
+	AX_CONST16	= 0x23,
+	AX_CONST32	= 0x24,
+	AX_CONST64	= 0x25,
+	AX_REG		= 0x26,
+	AX_END		= 0x27,
+	AX_DUP		= 0x28,
+	AX_POP		= 0x29,
+	AX_ZERO_EXT	= 0x2A,
+	AX_SWAP		= 0x2B,
+	AX_GETV		= 0x2C,
+	AX_SETV		= 0x2D,
+	AX_TRACEV	= 0x2E,
+	AX_TRACENZ	= 0x2F,
+	AX_TRACE16	= 0x30,
+	AX_PICK		= 0x32,
+	AX_ROT		= 0x33
+};
+
+#define SP(mcu)			((uint32_t)((*mcu->spl) | (*mcu->sph << 8)))
+
+/*
+ * Helpers to access the value stack of the expression. They break out of
+ * the opcode switch on stack underflow or overflow.
+ */
+#define NEED(num)		if (sp < (num)) { rc = 1; break; }
+#define ROOM(num)		if ((sp + (num)) > MSIM_AVR_AX_STACK) {	\
+					rc = 1; break;			\
+				}
+#define TOP			st[sp-1]
+#define BINOP(expr)		NEED(2); a = (uint64_t)st[sp-2];	\
+				b = (uint64_t)st[sp-1]; sp--;		\
+				TOP = (int64_t)(expr)
+
+static int	fetch(const uint8_t *ax, uint32_t len, uint32_t *pc,
+		      uint32_t n, uint64_t *v);
+
+/*
+ * Evaluates the agent expression. Value on top of the stack is returned
+ * when the expression ends. Floating point operations and printf aren't
+ * supported; they (as well as any malformed expression or the one which
+ * doesn't end in MSIM_AVR_AX_STEPS opcodes) make evaluation fail with
+ * a non-zero code.
+ */
+int
+MSIM_AVR_AXEval(MSIM_AVR_AXEnv *env, const uint8_t *ax, uint32_t len,
+                int64_t *val)
+{
+	struct MSIM_AVR *mcu = env->mcu;
+	int64_t st[MSIM_AVR_AX_STACK];
+	uint32_t sp = 0, pc = 0, steps = 0;
+	uint64_t a, b, n;
+	uint32_t c;
+	uint8_t mem[8];
+	uint8_t op;
+	int rc = 0;
+
+	while (rc == 0) {
+		if (pc >= len) {
+			rc = 1;
+			break;
+		}
+		/* Backward jumps may loop forever */
+		if (++steps > MSIM_AVR_AX_STEPS) {
+			MSIM_LOG_DEBUG("agent expression: too many steps");
+			rc = 1;
+			break;
+		}
+		op = ax[pc++];
+
+		switch (op) {
+		case AX_ADD:
+			BINOP(a + b);
+			break;
+		case AX_SUB:
+			BINOP(a - b);
+			break;
+		case AX_MUL:
+			BINOP(a * b);
+			break;
+		case AX_DIV_S:
+		case AX_REM_S:
+			NEED(2);
+			if ((st[sp-1] == 0) || ((st[sp-1] == -1) &&
+			                        (st[sp-2] == INT64_MIN))) {
+				rc = 1;
+				break;
+			}
+			st[sp-2] = (op == AX_DIV_S) ? (st[sp-2] / st[sp-1]) :
+			           (st[sp-2] % st[sp-1]);
+			sp--;
+			break;
+		case AX_DIV_U:
+		case AX_REM_U:
+			NEED(2);
+			if (st[sp-1] == 0) {
+				rc = 1;
+				break;
+			}
+			BINOP((op == AX_DIV_U) ? (a / b) : (a % b));
+			break;
+		case AX_LSH:
+			BINOP((b < 64U) ? (a << b) : 0U);
+			break;
+		case AX_RSH_S:
+			NEED(2);
+			b = (uint64_t)st[sp-1];
+			st[sp-2] = st[sp-2] >> ((b < 64U) ? b : 63U);
+			sp--;
+			break;
+		case AX_RSH_U:
+			BINOP((b < 64U) ? (a >> b) : 0U);
+			break;
+		case AX_LOG_NOT:
+			NEED(1);
+			TOP = (TOP == 0);
+			break;
+		case AX_BIT_AND:
+			BINOP(a & b);
+			break;
+		case AX_BIT_OR:
+			BINOP(a | b);
+			break;
+		case AX_BIT_XOR:
+			BINOP(a ^ b);
+			break;
+		case AX_BIT_NOT:
+			NEED(1);
+			TOP = ~TOP;
+			break;
+		case AX_EQUAL:
+			BINOP(a == b);
+			break;
+		case AX_LESS_S:
+			NEED(2);
+			st[sp-2] = (st[sp-2] < st[sp-1]);
+			sp--;
+			break;
+		case AX_LESS_U:
+			BINOP(a < b);
+			break;
+		case AX_EXT:
+		case AX_ZERO_EXT:
+			NEED(1);
+			if ((rc = fetch(ax, len, &pc, 1, &n)) != 0) {
+				break;
+			}
+			if ((n == 0U) || (n >= 64U)) {
+				break;
+			}
+			a = (uint64_t)TOP & ((1ULL << n) - 1U);
+			if ((op == AX_EXT) && (a & (1ULL << (n - 1U)))) {
+				a |= ~((1ULL << n) - 1U);
+			}
+			TOP = (int64_t)a;
+			break;
+		case AX_REF8:
+		case AX_REF16:
+		case AX_REF32:
+		case AX_REF64:
+			NEED(1);
+			n = 1U << (op - AX_REF8);
+			if (MSIM_AVR_AXMem(mcu, (uint32_t)TOP, mem,
+			                   (uint32_t)n) != 0) {
+				rc = 1;
+				break;
+			}
+			a = 0;
+			for (uint32_t i = (uint32_t)n; i > 0U; i--) {
+				a = (a << 8) | mem[i-1];
+			}
+			TOP = (int64_t)a;
+			break;
+		case AX_IF_GOTO:
+		case AX_GOTO:
+			if ((rc = fetch(ax, len, &pc, 2, &n)) != 0) {
+				break;
+			}
+			if (op == AX_IF_GOTO) {
+				NEED(1);
+				a = (uint64_t)st[--sp];
+				if (a == 0U) {
+					break;
+				}
+			}
+			pc = (uint32_t)n;
+			break;
+		case AX_CONST8:
+		case AX_CONST16:
+		case AX_CONST32:
+		case AX_CONST64:
+			ROOM(1);
+			rc = fetch(ax, len, &pc, 1U << (op - AX_CONST8), &n);
+			if (rc == 0) {
+				st[sp++] = (int64_t)n;
+			}
+			break;
+		case AX_REG:
+			ROOM(1);
+			if ((rc = fetch(ax, len, &pc, 2, &n)) != 0) {
+				break;
+			}
+			rc = MSIM_AVR_AXReg(mcu, (uint32_t)n, &st[sp++]);
+			break;
+		case AX_END:
+			*val = (sp > 0U) ? TOP : 0;
+			return 0;
+		case AX_DUP:
+			NEED(1);
+			ROOM(1);
+			st[sp] = st[sp-1];
+			sp++;
+			break;
+		case AX_POP:
+			NEED(1);
+			sp--;
+			break;
+		case AX_SWAP:
+			NEED(2);
+			a = (uint64_t)st[sp-1];
+			st[sp-1] = st[sp-2];
+			st[sp-2] = (int64_t)a;
+			break;
+		case AX_PICK:
+			if ((rc = fetch(ax, len, &pc, 1, &n)) != 0) {
+				break;
+			}
+			NEED(n + 1U);
+			ROOM(1);
+			st[sp] = st[sp-1-n];
+			sp++;
+			break;
+		case AX_ROT:
+			NEED(3);
+			a = (uint64_t)st[sp-1];
+			st[sp-1] = st[sp-2];
+			st[sp-2] = st[sp-3];
+			st[sp-3] = (int64_t)a;
+			break;
+		case AX_GETV:
+		case AX_SETV:
+		case AX_TRACEV:
+			if ((rc = fetch(ax, len, &pc, 2, &n)) != 0) {
+				break;
+			}
+			if (n >= env->tsv_num) {
+				rc = 1;
+				break;
+			}
+			if (op == AX_GETV) {
+				ROOM(1);
+				st[sp++] = env->tsv[n];
+			} else if (op == AX_SETV) {
+				NEED(1);
+				env->tsv[n] = TOP;
+			} else if (env->tracev != NULL) {
+				env->tracev(env->arg, (uint32_t)n,
+				            env->tsv[n]);
+			}
+			break;
+		case AX_TRACE:
+			NEED(2);
+			if (env->trace != NULL) {
+				env->trace(env->arg, (uint32_t)st[sp-2],
+				           (uint32_t)st[sp-1]);
+			}
+			sp -= 2;
+			break;
+		case AX_TRACE_QUICK:
+		case AX_TRACE16:
+			NEED(1);
+			rc = fetch(ax, len, &pc,
+			           (op == AX_TRACE16) ? 2U : 1U, &n);
+			if ((rc == 0) && (env->trace != NULL)) {
+				a = (uint64_t)TOP;
+				env->trace(env->arg, (uint32_t)a, (uint32_t)n);
+			}
+			break;
+		case AX_TRACENZ:
+			NEED(2);
+			if (env->trace != NULL) {
+				a = (uint64_t)st[sp-2];
+				b = (uint64_t)st[sp-1];
+				for (n = 0; n < b; n++) {
+					c = (uint32_t)(a + n);
+					if (MSIM_AVR_AXMem(mcu, c, mem, 1) ||
+					                (mem[0] == 0U)) {
+						break;
+					}
+				}
+				env->trace(env->arg, (uint32_t)a, (uint32_t)n);
+			}
+			sp -= 2;
+			break;
+		default:
+			snprintf(LOG, LOGSZ, "agent expression: unsupported "
+			         "opcode 0x%02" PRIX8, op);
+			MSIM_LOG_DEBUG(LOG);
+			rc = 1;
+			break;
+		}
+	}
+
+	return rc;
+}
+
+/* Reads a register in the order of the GDB 'g' packet. */
+int
+MSIM_AVR_AXReg(struct MSIM_AVR *mcu, uint32_t n, int64_t *val)
+{
+	if (n <= 31U) {
+		*val = mcu->dm[n];
+	} else if (n == 32U) {
+		*val = *mcu->sreg;
+	} else if (n == 33U) {
+		*val = SP(mcu);
+	} else if (n == 34U) {
+		*val = (int64_t)mcu->pc << 1;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Reads bytes of the program or data memory at the avr-gdb address. */
+int
+MSIM_AVR_AXMem(struct MSIM_AVR *mcu, uint32_t addr, uint8_t *buf,
+               uint32_t len)
+{
+	uint32_t a;
+
+	for (uint32_t i = 0; i < len; i++) {
+		a = addr + i;
+		if (a >= MSIM_AVR_AX_DATA) {
+			a -= MSIM_AVR_AX_DATA;
+			if (a > mcu->ramend) {
+				return -1;
+			}
+			buf[i] = mcu->dm[a];
+		} else {
+			if (a > mcu->flashend) {
+				return -1;
+			}
+			buf[i] = (uint8_t)(mcu->pm[a >> 1] >> ((a & 1U) * 8U));
+		}
+	}
+	return 0;
+}
+
+/* Fetches a big-endian immediate operand of N bytes. */
+static int
+fetch(const uint8_t *ax, uint32_t len, uint32_t *pc, uint32_t n,
+      uint64_t *v)
+{
+	if ((*pc + n) > len) {
+		return 1;
+	}
+	*v = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		*v = (*v << 8) | ax[(*pc)++];
+	}
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Code coverage of the AVR firmware. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/coverage.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+/* Header: magic with version, PM words, PM hash, name of the MCU */
+#define HEADER_MAGICSZ		8
+#define HEADER_NAMESZ		20
+#define HEADER_SZ		(HEADER_MAGICSZ + 4 + 4 + HEADER_NAMESZ)
+
+#define BIT_SET(bm, n)		((bm)[(n) >> 3] |= (uint8_t)(1U << ((n) & 7U)))
+
+static void	put_u32(uint8_t *buf, uint32_t v);
+static uint32_t	get_u32(const uint8_t *buf);
+static uint32_t	pm_hash(const struct MSIM_AVR *mcu, uint32_t words);
+
+int
+MSIM_AVR_CovOpen(struct MSIM_AVR *mcu, const char *f)
+{
+	struct MSIM_AVR_Cov *cov = &mcu->cov;
+
+	memset(cov, 0, sizeof *cov);
+	if (snprintf(cov->file, sizeof cov->file, "%s", f) >=
+	                (int)sizeof cov->file) {
+		snprintf(LOG, LOGSZ, "name of coverage file is too long: %s",
+		         f);
+		MSIM_LOG_ERROR(LOG);
+		cov->file[0] = 0;
+		return 75;
+	}
+	snprintf(cov->name, sizeof cov->name, "%s", mcu->name);
+
+	cov->words = (mcu->flashend + 1U) / 2U;
+	if (cov->words > MSIM_AVR_COV_WORDS) {
+		cov->words = MSIM_AVR_COV_WORDS;
+	}
+
+	cov->hash = pm_hash(mcu, cov->words);
+	cov->on = 1;
+
+	return 0;
+}
+
+/*
+ * Starts coverage of the firmware loaded again (by GDB client, for
+ * example). Coverage of the previous firmware is dropped, the hash is
+ * calculated for the new one.
+ */
+void
+MSIM_AVR_CovReset(struct MSIM_AVR *mcu)
+{
+	struct MSIM_AVR_Cov *cov = &mcu->cov;
+
+	if (cov->on == 0U) {
+		return;
+	}
+	memset(cov->exec, 0, sizeof cov->exec);
+	memset(cov->taken, 0, sizeof cov->taken);
+	memset(cov->ntaken, 0, sizeof cov->ntaken);
+	cov->hash = pm_hash(mcu, cov->words);
+}
+
+int
+MSIM_AVR_CovSave(struct MSIM_AVR *mcu)
+{
+	struct MSIM_AVR_Cov *cov = &mcu->cov;
+	int rc = 0;
+
+	if (cov->on != 0U) {
+		rc = MSIM_AVR_CovWrite(cov, cov->file);
+		if (rc != 0) {
+			snprintf(LOG, LOGSZ, "can't save coverage to: %s",
+			         cov->file);
+			MSIM_LOG_ERROR(LOG);
+		}
+	}
+	return rc;
+}
+
+/*
+ * Marks the completed instruction as executed. Conditional branches and
+ * skips are marked as taken if the PC doesn't point to the next word after
+ * the instruction.
+ */
+void
+MSIM_AVR_CovInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst)
+{
+	struct MSIM_AVR_Cov *cov = &mcu->cov;
+
+	if (pc >= cov->words) {
+		return;
+	}
+	BIT_SET(cov->exec, pc);
+
+	if (MSIM_AVR_IsCond(inst) != 0) {
+		if (mcu->pc != (pc + 1U)) {
+			BIT_SET(cov->taken, pc);
+		} else {
+			BIT_SET(cov->ntaken, pc);
+		}
+	}
+}
+
+int
+MSIM_AVR_CovWrite(const MSIM_AVR_Cov *cov, const char *f)
+{
+	uint8_t hdr[HEADER_SZ];
+	const uint32_t n = (cov->words + 7U) / 8U;
+	FILE *file;
+	int rc = 0;
+
+	do {
+		file = fopen(f, "wb");
+		if (file == NULL) {
+			rc = 75;
+			break;
+		}
+
+		memset(hdr, 0, sizeof hdr);
+		memcpy(hdr, MSIM_AVR_COV_MAGIC, HEADER_MAGICSZ - 1);
+		hdr[HEADER_MAGICSZ - 1] = MSIM_AVR_COV_VER;
+		put_u32(&hdr[HEADER_MAGICSZ], cov->words);
+		put_u32(&hdr[HEADER_MAGICSZ + 4], cov->hash);
+		snprintf((char *)&hdr[HEADER_MAGICSZ + 8], HEADER_NAMESZ,
+		         "%s", cov->name);
+
+		if ((fwrite(hdr, sizeof hdr, 1, file) != 1) ||
+		                (fwrite(cov->exec, n, 1, file) != 1) ||
+		                (fwrite(cov->taken, n, 1, file) != 1) ||
+		                (fwrite(cov->ntaken, n, 1, file) != 1)) {
+			rc = 75;
+		}
+		if (fclose(file) != 0) {
+			rc = 75;
+		}
+	} while (0);
+
+	return rc;
+}
+
+int
+MSIM_AVR_CovRead(MSIM_AVR_Cov *cov, const char *f)
+{
+	uint8_t hdr[HEADER_SZ];
+	uint32_t n;
+	FILE *file;
+	int rc = 0;
+
+	do {
+		memset(cov, 0, sizeof *cov);
+		file = fopen(f, "rb");
+		if (file == NULL) {
+			rc = 75;
+			break;
+		}
+
+		if ((fread(hdr, sizeof hdr, 1, file) != 1) ||
+		                (memcmp(hdr, MSIM_AVR_COV_MAGIC,
+		                        HEADER_MAGICSZ - 1) != 0) ||
+		                (hdr[HEADER_MAGICSZ - 1] != MSIM_AVR_COV_VER)) {
+			rc = 75;
+		} else {
+			cov->words = get_u32(&hdr[HEADER_MAGICSZ]);
+			cov->hash = get_u32(&hdr[HEADER_MAGICSZ + 4]);
+			memcpy(cov->name, &hdr[HEADER_MAGICSZ + 8],
+			       HEADER_NAMESZ - 1);
+			if ((snprintf(cov->file, sizeof cov->file, "%s",
+			               f) >= (int)sizeof cov->file) ||
+			                (cov->words > MSIM_AVR_COV_WORDS)) {
+				rc = 75;
+			}
+		}
+
+		n = (cov->words + 7U) / 8U;
+		if ((rc == 0) && ((fread(cov->exec, n, 1, file) != 1) ||
+		                  (fread(cov->taken, n, 1, file) != 1) ||
+		                  (fread(cov->ntaken, n, 1, file) != 1))) {
+			rc = 75;
+		}
+		fclose(file);
+	} while (0);
+
+	return rc;
+}
+
+/* Merges coverage of the same firmware, returns non-zero otherwise. */
+int
+MSIM_AVR_CovMerge(MSIM_AVR_Cov *dst, const MSIM_AVR_Cov *src)
+{
+	const uint32_t n = (src->words + 7U) / 8U;
+
+	if ((dst->words != src->words) || (dst->hash != src->hash)) {
+		return 1;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		dst->exec[i] |= src->exec[i];
+		dst->taken[i] |= src->taken[i];
+		dst->ntaken[i] |= src->ntaken[i];
+	}
+	return 0;
+}
+
+static void
+put_u32(uint8_t *buf, uint32_t v)
+{
+	buf[0] = (uint8_t)(v & 0xFF);
+	buf[1] = (uint8_t)((v >> 8) & 0xFF);
+	buf[2] = (uint8_t)((v >> 16) & 0xFF);
+	buf[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+static uint32_t
+get_u32(const uint8_t *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+	       ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/* FNV-1a hash of the firmware to merge coverage of the same one */
+static uint32_t
+pm_hash(const struct MSIM_AVR *mcu, uint32_t words)
+{
+	uint32_t hash = 2166136261U;
+
+	for (uint32_t i = 0; i < words; i++) {
+		hash = (hash ^ (mcu->pm[i] & 0xFFU)) * 16777619U;
+		hash = (hash ^ ((mcu->pm[i] >> 8) & 0xFFU)) * 16777619U;
+	}
+	return hash;
+}
@@ -149,6 +149,7 @@ static void	exec_ld(MSIM_AVR *, const uint32_t, uint8_t *, uint8_t *, uint8_t);
 int
 MSIM_AVR_Step(MSIM_AVR *mcu)
 {
+	uint32_t pc = mcu->pc;
 	uint16_t i = 0;
 	int rc = 0;
 
@@ -159,31 +160,42 @@ MSIM_AVR_Step(MSIM_AVR *mcu)
 	for (uint32_t j = 0; j < ARRSZ(mcu->read_io); j++) {
 		mcu->read_io[j] = 0;
 	}
+	/* Stack written on interrupt entry is traced along with the first
+	 * instruction of the handler */
+	if (!mcu->mci) {
+		mcu->writ_ds_num = mcu->writ_irq;
+		mcu->writ_irq = 0;
+	}
 
 	/* Find instruction to decode */
-	i = (!mcu->read_from_mpm) ? PM(mcu->pc) : MPM(mcu->pc);
-
-	/* Reset 'read from MPM' flag */
-	if (mcu->read_from_mpm) {
-		mcu->read_from_mpm = 0;
+	i = PM(mcu->pc);
+	if (mcu->prof != NULL) {
+		mcu->prof[pc]++;
 	}
 
 	if (decode_inst(mcu, i)) {
 		snprintf(LOG, LOGSZ, "unknown instruction: 0x%04"
 		         PRIx16 ", pc=0x%06" PRIx32, i, mcu->pc);
 		MSIM_LOG_FATAL(LOG);
-
-#ifdef DEBUG
-		for (uint32_t j = 0; j < ARRSZ(mcu->last_pc); j++) {
-			snprintf(LOG, LOGSZ, "previous pc=0x%06" PRIx32,
-			         mcu->last_pc[j]);
-			MSIM_LOG_FATAL(LOG);
-		}
-#endif
+		MSIM_AVR_FRDump(mcu, "unknown instruction");
 
 		rc = -1;
 	}
 
+	/* Trace instruction when all of its cycles are done */
+	if ((rc == 0) && !mcu->mci) {
+		mcu->insts++;
+		if (mcu->cov.on) {
+			MSIM_AVR_CovInst(mcu, pc, i);
+		}
+		if (mcu->trace.file != NULL) {
+			MSIM_AVR_TraceInst(mcu, pc, i);
+		}
+		if (mcu->san.on) {
+			MSIM_AVR_SanInst(mcu, pc, i);
+		}
+	}
+
 	return rc;
 }
 
@@ -197,6 +209,16 @@ MSIM_AVR_Is32(uint32_t inst)
 	       ((inst&0xFE0E) == 0x940E);		/* CALL */
 }
 
+/* Checks whether instruction is a conditional branch or skip. */
+int
+MSIM_AVR_IsCond(uint32_t inst)
+{
+	return ((inst&0xF800) == 0xF000) ||		/* BRBS, BRBC */
+	       ((inst&0xFC00) == 0x1000) ||		/* CPSE */
+	       ((inst&0xFC08) == 0xFC00) ||		/* SBRC, SBRS */
+	       ((inst&0xFD00) == 0x9900);		/* SBIC, SBIS */
+}
+
 static int
 decode_inst(MSIM_AVR *mcu, const uint32_t inst)
 {
@@ -733,6 +755,8 @@ exec_in_out(MSIM_AVR *mcu, const uint32_t inst, uint8_t reg, uint8_t io_loc)
 	switch (inst & 0xF800) {
 	/* IN - Load an I/O Location to Register */
 	case 0xB000:
+		SAN_READ(io_loc + mcu->sfr_off);
+		WATCH_READ(io_loc + mcu->sfr_off);
 		mcu->dm[reg] = mcu->dm[io_loc + mcu->sfr_off];
 		mcu->read_io[0] = io_loc + mcu->sfr_off;
 		break;
@@ -1098,7 +1122,7 @@ exec_sbis_sbic(MSIM_AVR *mcu, const uint32_t inst, uint8_t set_bit)
 	const uint8_t b = inst & 0x07;
 	const uint32_t ni = (uint32_t) PM(mcu->pc + 1);
 	const int is32 = MSIM_AVR_Is32(ni);
-	uint8_t pc_delta = 2;
+	uint8_t pc_delta = 1;
 
 	if (set_bit && (mcu->dm[reg] & (1 << b))) {
 		if (mcu->xmega) {
@@ -1107,7 +1131,7 @@ exec_sbis_sbic(MSIM_AVR *mcu, const uint32_t inst, uint8_t set_bit)
 			SKIP_CYCLES(mcu, 1, is32 ? 2 : 1);
 		}
 		pc_delta = is32 ? 3 : 2;
-	} else if (!set_bit && (mcu->dm[reg] ^ (1 << b))) {
+	} else if (!set_bit && !(mcu->dm[reg] & (1 << b))) {
 		if (mcu->xmega) {
 			SKIP_CYCLES(mcu, 1, is32 ? 3 : 2);
 		} else {
@@ -1224,6 +1248,8 @@ exec_ld(MSIM_AVR *mcu, const uint32_t inst,
 		                (addr >= mcu->ramstart)) {
 			SKIP_CYCLES(mcu, 1, 1);
 		}
+		SAN_READ(addr);
+		WATCH_READ(addr);
 		mcu->dm[regd] = mcu->dm[addr];
 		mcu->read_io[0] = addr;
 		break;
@@ -1235,6 +1261,8 @@ exec_ld(MSIM_AVR *mcu, const uint32_t inst,
 		} else {
 			/* Do not skip any cycles */;
 		}
+		SAN_READ(addr);
+		WATCH_READ(addr);
 		mcu->dm[regd] = mcu->dm[addr];
 		mcu->read_io[0] = addr;
 		addr++;
@@ -1254,6 +1282,8 @@ exec_ld(MSIM_AVR *mcu, const uint32_t inst,
 		addr--;
 		*addr_low = (uint8_t) (addr & 0xFF);
 		*addr_high = (uint8_t) (addr >> 8);
+		SAN_READ(addr);
+		WATCH_READ(addr);
 		mcu->dm[regd] = mcu->dm[addr];
 		mcu->read_io[0] = addr;
 		break;
@@ -1284,6 +1314,8 @@ exec_ld_ydisp(MSIM_AVR *mcu, const uint32_t i)
 	regd = (uint8_t)((i & 0x01F0)>>4);
 	disp = (uint8_t)((i & 0x07) | ((i & 0x0C00)>>7) | ((i & 0x2000)>>8));
 
+	SAN_READ(addr + disp);
+	WATCH_READ(addr + disp);
 	mcu->dm[regd] = mcu->dm[addr + disp];
 	mcu->read_io[0] = addr + disp;
 
@@ -1316,6 +1348,8 @@ exec_ld_zdisp(MSIM_AVR *mcu, const uint32_t inst)
 	                 ((inst & 0x0C00) >> 7) |
 	                 ((inst & 0x2000) >> 8));
 
+	SAN_READ(addr + disp);
+	WATCH_READ(addr + disp);
 	mcu->dm[regd] = mcu->dm[addr + disp];
 	mcu->read_io[0] = addr + disp;
 
@@ -1734,7 +1768,7 @@ exec_break(MSIM_AVR *mcu)
 {
 	/* BREAK – Break (the AVR CPU is set in the Stopped Mode). */
 	mcu->state = AVR_STOPPED;
-	mcu->read_from_mpm = 1;
+	mcu->pc++;
 }
 
 static void
@@ -2384,6 +2418,8 @@ exec_lds(MSIM_AVR *mcu, const uint32_t inst)
 		                      addr >= mcu->ramstart) ? 2 : 1));
 	}
 
+	SAN_READ(addr);
+	WATCH_READ(addr);
 	DM(rd_addr) = DM(addr);
 	mcu->read_io[0] = addr;
 	mcu->pc += 2;
@@ -2398,6 +2434,8 @@ exec_lds16(MSIM_AVR *mcu, const uint32_t inst)
 	addr = (uint16_t)((((~inst)>>1)&0x80) | ((inst>>2)&0x40) |
 	                  ((inst>>5)&0x30) | (inst&0x0F));
 	rd_addr = (uint16_t)(((inst>>4)&0x0F) + 16);
+	SAN_READ(addr);
+	WATCH_READ(addr);
 	mcu->dm[rd_addr] = mcu->dm[addr];
 	mcu->read_io[0] = addr;
 
@@ -0,0 +1,322 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Table-driven disassembler of the AVR instructions. */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+/* Formats of the instruction operands. */
+enum operands {
+	OP_NONE,		/* no operands */
+	OP_RD_RR,		/* Rd, Rr (r0-r31) */
+	OP_RD_K8,		/* Rd (r16-r31), K */
+	OP_RD,			/* Rd (r0-r31) */
+	OP_MOVW,		/* Rd+1:Rd, Rr+1:Rr */
+	OP_MULS,		/* Rd, Rr (r16-r31) */
+	OP_MULSU,		/* Rd, Rr (r16-r23) */
+	OP_ADIW,		/* Rd (r24-r30), K */
+	OP_REL12,		/* relative k, 12 bits */
+	OP_REL7,		/* relative k, 7 bits */
+	OP_IN,			/* Rd, A */
+	OP_OUT,			/* A, Rr */
+	OP_IO_BIT,		/* A, b */
+	OP_RD_BIT,		/* Rd, b */
+	OP_LD,			/* Rd, pointer */
+	OP_ST,			/* pointer, Rr */
+	OP_LDD,			/* Rd, pointer+q */
+	OP_STD,			/* pointer+q, Rr */
+	OP_LDS,			/* Rd, k (32-bit instruction) */
+	OP_STS,			/* k, Rr (32-bit instruction) */
+	OP_JMP,			/* k (32-bit instruction) */
+	OP_DES,			/* K */
+	OP_Z_RD			/* Z, Rd */
+};
+
+struct inst_desc {
+	uint16_t mask;
+	uint16_t match;
+	const char *mnem;
+	enum operands ops;
+	const char *ptr;	/* Pointer register of LD/ST/LPM */
+};
+
+/* Instructions are matched in order, specific ones go first. */
+static const struct inst_desc insts[] = {
+	{ 0xFFFF, 0x0000, "nop",	OP_NONE,	NULL },
+	{ 0xFF00, 0x0100, "movw",	OP_MOVW,	NULL },
+	{ 0xFF00, 0x0200, "muls",	OP_MULS,	NULL },
+	{ 0xFF88, 0x0300, "mulsu",	OP_MULSU,	NULL },
+	{ 0xFF88, 0x0308, "fmul",	OP_MULSU,	NULL },
+	{ 0xFF88, 0x0380, "fmuls",	OP_MULSU,	NULL },
+	{ 0xFF88, 0x0388, "fmulsu",	OP_MULSU,	NULL },
+	{ 0xFC00, 0x0400, "cpc",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x0800, "sbc",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x0C00, "add",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x1000, "cpse",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x1400, "cp",		OP_RD_RR,	NULL },
+	{ 0xFC00, 0x1800, "sub",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x1C00, "adc",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x2000, "and",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x2400, "eor",	OP_RD_RR,	NULL },
+	{ 0xFC00, 0x2800, "or",		OP_RD_RR,	NULL },
+	{ 0xFC00, 0x2C00, "mov",	OP_RD_RR,	NULL },
+	{ 0xF000, 0x3000, "cpi",	OP_RD_K8,	NULL },
+	{ 0xF000, 0x4000, "sbci",	OP_RD_K8,	NULL },
+	{ 0xF000, 0x5000, "subi",	OP_RD_K8,	NULL },
+	{ 0xF000, 0x6000, "ori",	OP_RD_K8,	NULL },
+	{ 0xF000, 0x7000, "andi",	OP_RD_K8,	NULL },
+	{ 0xFE0F, 0x8000, "ld",		OP_LD,		"Z" },
+	{ 0xFE0F, 0x8008, "ld",		OP_LD,		"Y" },
+	{ 0xFE0F, 0x8200, "st",		OP_ST,		"Z" },
+	{ 0xFE0F, 0x8208, "st",		OP_ST,		"Y" },
+	{ 0xD208, 0x8000, "ldd",	OP_LDD,		"Z" },
+	{ 0xD208, 0x8008, "ldd",	OP_LDD,		"Y" },
+	{ 0xD208, 0x8200, "std",	OP_STD,		"Z" },
+	{ 0xD208, 0x8208, "std",	OP_STD,		"Y" },
+	{ 0xFE0F, 0x9000, "lds",	OP_LDS,		NULL },
+	{ 0xFE0F, 0x9001, "ld",		OP_LD,		"Z+" },
+	{ 0xFE0F, 0x9002, "ld",		OP_LD,		"-Z" },
+	{ 0xFE0F, 0x9004, "lpm",	OP_LD,		"Z" },
+	{ 0xFE0F, 0x9005, "lpm",	OP_LD,		"Z+" },
+	{ 0xFE0F, 0x9006, "elpm",	OP_LD,		"Z" },
+	{ 0xFE0F, 0x9007, "elpm",	OP_LD,		"Z+" },
+	{ 0xFE0F, 0x9009, "ld",		OP_LD,		"Y+" },
+	{ 0xFE0F, 0x900A, "ld",		OP_LD,		"-Y" },
+	{ 0xFE0F, 0x900C, "ld",		OP_LD,		"X" },
+	{ 0xFE0F, 0x900D, "ld",		OP_LD,		"X+" },
+	{ 0xFE0F, 0x900E, "ld",		OP_LD,		"-X" },
+	{ 0xFE0F, 0x900F, "pop",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9200, "sts",	OP_STS,		NULL },
+	{ 0xFE0F, 0x9201, "st",		OP_ST,		"Z+" },
+	{ 0xFE0F, 0x9202, "st",		OP_ST,		"-Z" },
+	{ 0xFE0F, 0x9204, "xch",	OP_Z_RD,	NULL },
+	{ 0xFE0F, 0x9205, "las",	OP_Z_RD,	NULL },
+	{ 0xFE0F, 0x9206, "lac",	OP_Z_RD,	NULL },
+	{ 0xFE0F, 0x9207, "lat",	OP_Z_RD,	NULL },
+	{ 0xFE0F, 0x9209, "st",		OP_ST,		"Y+" },
+	{ 0xFE0F, 0x920A, "st",		OP_ST,		"-Y" },
+	{ 0xFE0F, 0x920C, "st",		OP_ST,		"X" },
+	{ 0xFE0F, 0x920D, "st",		OP_ST,		"X+" },
+	{ 0xFE0F, 0x920E, "st",		OP_ST,		"-X" },
+	{ 0xFE0F, 0x920F, "push",	OP_RD,		NULL },
+	{ 0xFFFF, 0x9408, "sec",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9418, "sez",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9428, "sen",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9438, "sev",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9448, "ses",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9458, "seh",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9468, "set",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9478, "sei",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9488, "clc",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9498, "clz",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94A8, "cln",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94B8, "clv",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94C8, "cls",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94D8, "clh",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94E8, "clt",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x94F8, "cli",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9409, "ijmp",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9419, "eijmp",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9508, "ret",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9509, "icall",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9518, "reti",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9519, "eicall",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9588, "sleep",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x9598, "break",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x95A8, "wdr",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x95C8, "lpm",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x95D8, "elpm",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x95E8, "spm",	OP_NONE,	NULL },
+	{ 0xFFFF, 0x95F8, "spm Z+",	OP_NONE,	NULL },
+	{ 0xFE0F, 0x9400, "com",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9401, "neg",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9402, "swap",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9403, "inc",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9405, "asr",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9406, "lsr",	OP_RD,		NULL },
+	{ 0xFE0F, 0x9407, "ror",	OP_RD,		NULL },
+	{ 0xFE0F, 0x940A, "dec",	OP_RD,		NULL },
+	{ 0xFF0F, 0x940B, "des",	OP_DES,		NULL },
+	{ 0xFE0E, 0x940C, "jmp",	OP_JMP,		NULL },
+	{ 0xFE0E, 0x940E, "call",	OP_JMP,		NULL },
+	{ 0xFF00, 0x9600, "adiw",	OP_ADIW,	NULL },
+	{ 0xFF00, 0x9700, "sbiw",	OP_ADIW,	NULL },
+	{ 0xFF00, 0x9800, "cbi",	OP_IO_BIT,	NULL },
+	{ 0xFF00, 0x9900, "sbic",	OP_IO_BIT,	NULL },
+	{ 0xFF00, 0x9A00, "sbi",	OP_IO_BIT,	NULL },
+	{ 0xFF00, 0x9B00, "sbis",	OP_IO_BIT,	NULL },
+	{ 0xFC00, 0x9C00, "mul",	OP_RD_RR,	NULL },
+	{ 0xF800, 0xB000, "in",		OP_IN,		NULL },
+	{ 0xF800, 0xB800, "out",	OP_OUT,		NULL },
+	{ 0xF000, 0xC000, "rjmp",	OP_REL12,	NULL },
+	{ 0xF000, 0xD000, "rcall",	OP_REL12,	NULL },
+	{ 0xF000, 0xE000, "ldi",	OP_RD_K8,	NULL },
+	{ 0xFC07, 0xF000, "brcs",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF001, "breq",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF002, "brmi",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF003, "brvs",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF004, "brlt",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF005, "brhs",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF006, "brts",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF007, "brie",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF400, "brcc",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF401, "brne",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF402, "brpl",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF403, "brvc",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF404, "brge",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF405, "brhc",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF406, "brtc",	OP_REL7,	NULL },
+	{ 0xFC07, 0xF407, "brid",	OP_REL7,	NULL },
+	{ 0xFE08, 0xF800, "bld",	OP_RD_BIT,	NULL },
+	{ 0xFE08, 0xFA00, "bst",	OP_RD_BIT,	NULL },
+	{ 0xFE08, 0xFC00, "sbrc",	OP_RD_BIT,	NULL },
+	{ 0xFE08, 0xFE00, "sbrs",	OP_RD_BIT,	NULL },
+};
+
+/*
+ * Prints a mnemonic of the AVR instruction to the buffer.
+ *
+ * Second word of the instruction is used by the 32-bit instructions only.
+ * Relative addresses are printed in bytes, like avr-objdump does. Function
+ * returns number of the 16-bit words occupied by the instruction.
+ */
+int
+MSIM_AVR_Disasm(char *buf, unsigned int len, unsigned int inst,
+                unsigned int inst2)
+{
+	const struct inst_desc *d = NULL;
+	uint32_t rd, rr, k, q, b;
+	int32_t rel;
+
+	for (uint32_t i = 0; i < ARRSZ(insts); i++) {
+		if ((inst & insts[i].mask) == insts[i].match) {
+			d = &insts[i];
+			break;
+		}
+	}
+	if (d == NULL) {
+		snprintf(buf, len, ".word 0x%04x", inst & 0xFFFF);
+		return 1;
+	}
+
+	rd = (inst >> 4) & 0x1F;
+	rr = (inst & 0x0F) | ((inst >> 5) & 0x10);
+
+	switch (d->ops) {
+	case OP_NONE:
+		snprintf(buf, len, "%s", d->mnem);
+		break;
+	case OP_RD_RR:
+		snprintf(buf, len, "%s r%u, r%u", d->mnem, rd, rr);
+		break;
+	case OP_RD_K8:
+		k = ((inst >> 4) & 0xF0) | (inst & 0x0F);
+		snprintf(buf, len, "%s r%u, 0x%02X", d->mnem,
+		         16 + (rd & 0x0F), k);
+		break;
+	case OP_RD:
+		snprintf(buf, len, "%s r%u", d->mnem, rd);
+		break;
+	case OP_MOVW:
+		snprintf(buf, len, "%s r%u, r%u", d->mnem,
+		         ((inst >> 4) & 0x0F) << 1, (inst & 0x0F) << 1);
+		break;
+	case OP_MULS:
+		snprintf(buf, len, "%s r%u, r%u", d->mnem,
+		         16 + ((inst >> 4) & 0x0F), 16 + (inst & 0x0F));
+		break;
+	case OP_MULSU:
+		snprintf(buf, len, "%s r%u, r%u", d->mnem,
+		         16 + ((inst >> 4) & 0x07), 16 + (inst & 0x07));
+		break;
+	case OP_ADIW:
+		k = ((inst >> 2) & 0x30) | (inst & 0x0F);
+		snprintf(buf, len, "%s r%u, 0x%02X", d->mnem,
+		         24 + (((inst >> 4) & 0x03) << 1), k);
+		break;
+	case OP_REL12:
+		rel = (int32_t)(inst & 0x0FFF);
+		rel = (rel & 0x0800) ? (rel - 0x1000) : rel;
+		snprintf(buf, len, "%s .%+d", d->mnem, (int)(rel * 2));
+		break;
+	case OP_REL7:
+		rel = (int32_t)((inst >> 3) & 0x7F);
+		rel = (rel & 0x40) ? (rel - 0x80) : rel;
+		snprintf(buf, len, "%s .%+d", d->mnem, (int)(rel * 2));
+		break;
+	case OP_IN:
+		snprintf(buf, len, "%s r%u, 0x%02X", d->mnem, rd,
+		         ((inst >> 5) & 0x30) | (inst & 0x0F));
+		break;
+	case OP_OUT:
+		snprintf(buf, len, "%s 0x%02X, r%u", d->mnem,
+		         ((inst >> 5) & 0x30) | (inst & 0x0F), rd);
+		break;
+	case OP_IO_BIT:
+		snprintf(buf, len, "%s 0x%02X, %u", d->mnem,
+		         (inst >> 3) & 0x1F, inst & 0x07);
+		break;
+	case OP_RD_BIT:
+		b = inst & 0x07;
+		snprintf(buf, len, "%s r%u, %u", d->mnem, rd, b);
+		break;
+	case OP_LD:
+		snprintf(buf, len, "%s r%u, %s", d->mnem, rd, d->ptr);
+		break;
+	case OP_ST:
+		snprintf(buf, len, "%s %s, r%u", d->mnem, d->ptr, rd);
+		break;
+	case OP_LDD:
+		q = ((inst >> 8) & 0x20) | ((inst >> 7) & 0x18) | (inst & 0x07);
+		snprintf(buf, len, "%s r%u, %s+%u", d->mnem, rd, d->ptr, q);
+		break;
+	case OP_STD:
+		q = ((inst >> 8) & 0x20) | ((inst >> 7) & 0x18) | (inst & 0x07);
+		snprintf(buf, len, "%s %s+%u, r%u", d->mnem, d->ptr, q, rd);
+		break;
+	case OP_LDS:
+		snprintf(buf, len, "%s r%u, 0x%04X", d->mnem, rd,
+		         inst2 & 0xFFFF);
+		break;
+	case OP_STS:
+		snprintf(buf, len, "%s 0x%04X, r%u", d->mnem,
+		         inst2 & 0xFFFF, rd);
+		break;
+	case OP_JMP:
+		k = ((((inst >> 3) & 0x3E) | (inst & 0x01)) << 16) |
+		    (inst2 & 0xFFFF);
+		snprintf(buf, len, "%s 0x%X", d->mnem, k << 1);
+		break;
+	case OP_DES:
+		snprintf(buf, len, "%s 0x%02X", d->mnem, (inst >> 4) & 0x0F);
+		break;
+	case OP_Z_RD:
+		snprintf(buf, len, "%s Z, r%u", d->mnem, rd);
+		break;
+	default:
+		snprintf(buf, len, ".word 0x%04x", inst & 0xFFFF);
+		break;
+	}
+
+	return ((d->ops == OP_LDS) || (d->ops == OP_STS) ||
+	        (d->ops == OP_JMP)) ? 2 : 1;
+}
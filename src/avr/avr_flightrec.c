@@ -0,0 +1,83 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Dump of the AVR flight recorder. */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+int
+MSIM_AVR_FRDump(struct MSIM_AVR *mcu, const char *reason)
+{
+	const struct MSIM_AVR_FR *fr = &mcu->fr;
+	const struct MSIM_AVR_FREntry *e;
+	const char sreg_bits[] = "ITHSVNZC";
+	const char *file = (fr->file[0] != 0) ? fr->file : MSIM_AVR_FRFILE;
+	char sreg[9];
+	char mnem[64];
+	uint64_t first;
+	uint32_t n;
+	FILE *f;
+	int rc = 0;
+
+	do {
+		f = fopen(file, "w");
+		if (f == NULL) {
+			snprintf(LOG, LOGSZ, "can't dump flight recorder to: "
+			         "%s", file);
+			MSIM_LOG_ERROR(LOG);
+			rc = 1;
+			break;
+		}
+
+		n = (fr->head < MSIM_AVR_FRSZ) ? (uint32_t)fr->head :
+		    MSIM_AVR_FRSZ;
+		first = fr->head - n;
+
+		fprintf(f, "# %s flight recorder: %s\n", mcu->name, reason);
+		fprintf(f, "# %" PRIu32 " instructions, oldest first\n", n);
+		fprintf(f, "# tick pc sp sreg instruction\n");
+
+		for (uint32_t i = 0; i < n; i++) {
+			e = &fr->ent[(first + i) & (MSIM_AVR_FRSZ - 1)];
+
+			for (uint32_t b = 0; b < 8; b++) {
+				sreg[b] = ((e->sreg >> (7 - b)) & 1) ?
+				          sreg_bits[b] : '-';
+			}
+			sreg[8] = 0;
+			MSIM_AVR_Disasm(mnem, sizeof mnem,
+			                PM(e->pc), PM(e->pc + 1));
+
+			fprintf(f, "%12" PRIu64 "  %06" PRIX32 "  %04" PRIX16
+			        "  %s  %s\n", e->tick, e->pc << 1, e->sp,
+			        sreg, mnem);
+		}
+		fclose(f);
+
+		snprintf(LOG, LOGSZ, "%s, last %" PRIu32 " instructions are "
+		         "dumped to: %s", reason, n, file);
+		MSIM_LOG_ERROR(LOG);
+	} while (0);
+
+	return rc;
+}
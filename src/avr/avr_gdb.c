@@ -16,10 +16,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <inttypes.h>
 #include <string.h>
+#include <time.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <string.h>
@@ -31,6 +36,7 @@
 
 #include "mcusim/mcusim.h"
 #include "mcusim/log.h"
+#include "mcusim/avr/sim/agent.h"
 #include "mcusim/avr/sim/private/macro.h"
 
 #ifndef WITH_POSIX_CYGWIN
@@ -38,11 +44,26 @@
 #endif
 
 #define AVRSIM_RSP_PROTOCOL		"tcp"
-#define BREAK_LOW			0x98
-#define BREAK_HIGH			0x95
-#define BREAK				((BREAK_HIGH<<8)|BREAK_LOW)
 #define GDB_BUF_MAX			(16*1024)
+#define RSP_RXBUF_MAX			(GDB_BUF_MAX)
+#define RSP_TXBUF_MAX			(2*GDB_BUF_MAX + 8)
 #define REG_BUF_MAX			32
+#define GDB_SIGINT			2	/* Interrupt (Ctrl-C) */
+#define GDB_SIGTRAP			5	/* Trace/breakpoint trap */
+#define GDB_DATA_OFF			0x800000UL /* Data space in GDB */
+#define WP_MAX				64	/* Max number of watchpoints */
+#define AX_MAX				256	/* Max length of expression */
+#define COND_MAX			64	/* Max number of conditions */
+#define TP_MAX				32	/* Max number of tracepoints */
+#define TP_MEM_MAX			8	/* Ranges per tracepoint */
+#define TP_EXPR_MAX			4	/* Expressions per tracepoint */
+#define TSV_MAX				32	/* Trace state vars */
+#define TBUF_MAX			(256*1024) /* Trace buffer size */
+#define FRAME_MAX			(8*1024) /* Max number of trace frames */
+#define FRAME_REGSZ			39	/* Registers in a trace frame */
+#define SNAP_MAX			8	/* Max number of snapshots */
+#define SNAP_NAMESZ			32	/* Max length of snapshot name */
+#define PROF_TOP			16	/* Hottest addresses to dump */
 
 /* Match point type */
 enum mp_type {
@@ -53,14 +74,143 @@ enum mp_type {
 	WP_ACCESS	= 4		/* Watch point (to access memory) */
 };
 
+/* Reason of the trace experiment to be stopped */
+enum trace_status {
+	TS_NOTRUN	= 0,		/* Not started yet */
+	TS_RUNNING	= 1,		/* Collecting trace frames */
+	TS_STOP		= 2,		/* Stopped by GDB client */
+	TS_FULL		= 3,		/* Trace buffer is full */
+	TS_PASS		= 4		/* Pass count of tracepoint reached */
+};
+
+/* Condition of a breakpoint, evaluated by the simulator */
+struct rsp_cond {
+	uint32_t word;			/* Breakpoint address, in words */
+	uint32_t len;			/* Length of the expression */
+	uint8_t ax[AX_MAX];		/* Agent expression */
+};
+
+/* Memory range collected by a tracepoint */
+struct rsp_tpmem {
+	uint32_t reg;			/* Base register, -1 if absolute */
+	uint32_t off;			/* Offset (or absolute address) */
+	uint32_t len;			/* Length, in bytes */
+};
+
+/* Tracepoint */
+struct rsp_tp {
+	uint32_t num;			/* Number of the tracepoint */
+	uint32_t word;			/* Address, in words */
+	uint8_t enabled;		/* Tracepoint is enabled */
+	uint8_t regs;			/* Collect registers */
+	uint32_t pass;			/* Pass count, 0 if none */
+	uint32_t hits;			/* Times the tracepoint was hit */
+	uint32_t cond_len;		/* Length of the condition */
+	uint8_t cond[AX_MAX];		/* Condition, if any */
+	struct rsp_tpmem mem[TP_MEM_MAX]; /* Memory ranges to collect */
+	uint32_t mem_num;		/* Number of memory ranges */
+	uint8_t expr[TP_EXPR_MAX][AX_MAX]; /* Expressions to collect */
+	uint32_t expr_len[TP_EXPR_MAX];	/* Lengths of the expressions */
+	uint32_t expr_num;		/* Number of expressions */
+};
+
+/*
+ * Trace frame. It's a sequence of blocks in the trace buffer: registers
+ * ('R' and FRAME_REGSZ bytes as in the 'g' packet), memory ('M', 32-bit
+ * address, 16-bit length and the bytes) or trace state variable ('V',
+ * 32-bit number and 64-bit value). Numbers are little-endian.
+ */
+struct rsp_frame {
+	uint32_t tp;			/* Number of the tracepoint */
+	uint32_t pc;			/* Address, in words */
+	uint32_t off;			/* First block in the trace buffer */
+	uint32_t len;			/* Length of the blocks */
+};
+
+/* Snapshot of the MCU state, saved by a monitor command */
+struct rsp_snap {
+	char name[SNAP_NAMESZ];		/* Name of the snapshot */
+	uint8_t used;			/* Snapshot is saved */
+	uint64_t tick;			/* Cycles passed since reset */
+	uint8_t tovf;			/* Cycles overflow flag */
+	uint64_t insts;			/* Instructions completed */
+	uint32_t freq;			/* Clock frequency, in Hz */
+	enum MSIM_AVR_ClkSource clk_source; /* MCU clock source */
+	uint8_t lockbits;		/* Lock bits */
+	uint8_t fuse[6];		/* Fuse bytes */
+	uint32_t pc;			/* Program counter, in words */
+	uint8_t ic_left;		/* Cycles to finish instruction */
+	uint8_t mci;			/* Multi-cycle instruction flag */
+	uint16_t *pm;			/* Program memory */
+	uint32_t pm_words;		/* Words of the program memory */
+	uint8_t *dm;			/* Data memory */
+	uint32_t dm_bytes;		/* Bytes of the data memory */
+	MSIM_AVR_BLD bls;		/* Bootloader section */
+	MSIM_AVR_INT intr;		/* IRQs */
+	MSIM_AVR_WDT wdt;		/* Watchdog timer */
+	MSIM_AVR_USART usart;		/* USART */
+	MSIM_AVR_TMR timers[MSIM_AVR_MAXTMRS]; /* Timers/counters */
+	MSIM_AVR_San *san;		/* Sanitizer, NULL if it's off */
+};
+
+/* Watchpoint over a region of the data space */
+struct rsp_wp {
+	enum mp_type type;		/* Write, read or access */
+	uint32_t loc;			/* First byte of the region */
+	uint32_t len;			/* Length of the region, in bytes */
+};
+
 struct rsp_state {
 	char client_waiting;
-	struct MSIM_AVR *mcu;		/* MCU instance */
+	struct MSIM_AVR *mcu;		/* MCU selected by GDB client */
+	struct MSIM_AVR *cmcu;		/* MCU to step and continue at addr */
+	struct MSIM_AVR *mcus[MSIM_AVR_MCUS]; /* MCUs, thread ID is index+1 */
+	uint32_t mcus_num;		/* Number of MCUs */
+	struct MSIM_AVR *stop_mcu;	/* MCU stopped first, if any */
 	int proto_num;
 	int fserv;			/* FD for incoming connections */
 	int fcli;			/* FD for talking to GDB client */
 	int sigval;			/* GDB signal for any exception */
 	unsigned long start_addr;	/* Start of last run */
+	uint8_t noack;			/* No acknowledgment mode */
+	uint32_t flash_bytes;		/* Flash bytes written by client */
+
+	struct rsp_wp wp[WP_MAX];	/* Watchpoints inserted */
+	uint32_t wp_num;		/* Number of watchpoints inserted */
+	enum mp_type wp_hit;		/* Watchpoint triggered, if any */
+	uint32_t wp_loc;		/* Location accessed */
+
+	uint8_t bp[MSIM_AVR_BPSZ];	/* Breakpoints inserted */
+	struct rsp_cond cond[COND_MAX];	/* Conditions of breakpoints */
+	uint32_t cond_num;		/* Number of conditions */
+
+	/* Trace experiment */
+	struct rsp_tp tp[TP_MAX];	/* Tracepoints defined */
+	uint32_t tp_num;		/* Number of tracepoints */
+	int64_t tsv[TSV_MAX];		/* Trace state variables */
+	int64_t tsv_init[TSV_MAX];	/* Initial values of variables */
+	enum trace_status tstatus;	/* Status of the experiment */
+	uint32_t tstop_tp;		/* Tracepoint which stopped it */
+	uint8_t tbuf[TBUF_MAX];		/* Trace buffer */
+	uint32_t tbuf_len;		/* Bytes used in the trace buffer */
+	uint8_t tbuf_full;		/* Block didn't fit into the buffer */
+	struct rsp_frame frame[FRAME_MAX]; /* Trace frames collected */
+	uint32_t frame_num;		/* Number of trace frames */
+	int32_t frame_cur;		/* Frame selected, -1 for live MCU */
+
+	/* Statistics, profile and snapshots (monitor commands) */
+	struct timespec run_ts;		/* Wall clock the MCU resumed at */
+	double run_time;		/* Seconds the MCU was running */
+	uint8_t running;		/* MCU is resumed by client */
+	uint64_t *prof;			/* Cycles per PM word */
+	struct rsp_snap snap[SNAP_MAX];	/* Snapshots of the MCU */
+
+	/* Buffered input and output of the client socket */
+	unsigned char rx[RSP_RXBUF_MAX]; /* Characters received */
+	uint32_t rx_pos;		/* Next character to read */
+	uint32_t rx_len;		/* Characters in the buffer */
+	unsigned char tx[RSP_TXBUF_MAX]; /* Characters to be sent */
+	uint32_t tx_len;		/* Characters in the buffer */
 };
 
 typedef struct rsp_buf {
@@ -77,13 +227,63 @@ static void		rsp_server_request(MSIM_AVR *mcu);
 static void		rsp_client_request(MSIM_AVR *mcu);
 static rsp_buf 	*get_packet(void);
 static int		get_rsp_char(void);
+static int		fill_rsp_buf(void);
+static int		append_rsp_buf(void);
+static int		rsp_packet_ready(void);
+static int		flush_rsp_buf(void);
+static int		wait_rsp_client(short events);
 static void		put_packet(MSIM_AVR *mcu, rsp_buf *buf);
 static void		put_rsp_char(char c);
 static void		put_str_packet(MSIM_AVR *mcu, const char *str);
 static void		rsp_report_exception(MSIM_AVR *mcu);
+static void		rsp_update_wp(void);
+static void		rsp_sync_bp(uint32_t word);
+static int		rsp_add_conds(uint32_t word, const char *p);
+static void		rsp_del_conds(uint32_t word);
+static const char	*rsp_parse_ax(const char *p, uint8_t *ax,
+			              uint32_t *len);
+static void		rsp_trace_query(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_trace_packet(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_define_tp(MSIM_AVR *mcu, const char *p);
+static void		rsp_find_frame(MSIM_AVR *mcu, const char *p);
+static void		rsp_trace_start(MSIM_AVR *mcu);
+static void		rsp_trace_stop(MSIM_AVR *mcu, enum trace_status st);
+static void		rsp_collect(MSIM_AVR *mcu, struct rsp_tp *tp);
+static void		rsp_collect_mem(void *arg, uint32_t addr, uint32_t len);
+static void		rsp_collect_tsv(void *arg, uint32_t n, int64_t val);
+static uint32_t		frame_block_len(const uint8_t *blk);
+static const uint8_t	*frame_regs(void);
+static int		read_frame_tsv(uint32_t n, int64_t *val);
+static int		read_frame_mem(uint32_t addr, uint8_t *buf,
+			               uint32_t len);
+static size_t		read_frame_reg(int n, char *buf, size_t blen);
 static void		rsp_continue(rsp_buf *buf);
+static void		rsp_vcont(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_resume(void);
+static void		rsp_stop_all(void);
+static int		rsp_running(void);
+static uint32_t		rsp_thread(const MSIM_AVR *mcu);
+static void		rsp_set_thread(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_threads(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_xfer(MSIM_AVR *mcu, rsp_buf *buf, const char *obj,
+			         const char *doc);
 static void		rsp_query(MSIM_AVR *mcu, rsp_buf *buf);
 static void		rsp_vpkt(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_command(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_print(MSIM_AVR *mcu, const char *fmt, ...)
+#ifdef __GNUC__
+			__attribute__((format(printf, 2, 3)))
+#endif
+			;
+static double		rsp_run_time(void);
+static int		rsp_stats(MSIM_AVR *mcu);
+static int		rsp_profile(MSIM_AVR *mcu, const char *arg);
+static int		rsp_snapshot(MSIM_AVR *mcu, const char *arg);
+static int		rsp_snapshot_save(MSIM_AVR *mcu, struct rsp_snap *s,
+			                  const char *name);
+static void		rsp_memory_map(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_flash_erase(MSIM_AVR *mcu, rsp_buf *buf);
+static void		rsp_flash_write(MSIM_AVR *mcu, rsp_buf *buf);
 static void		rsp_restart(void);
 static void		rsp_read_all_regs(MSIM_AVR *mcu);
 static void		rsp_write_all_regs(MSIM_AVR *mcu, rsp_buf *buf);
@@ -115,11 +315,27 @@ MSIM_AVR_RSPInit(struct MSIM_AVR *mcu, uint16_t portn)
 	/* Reset GDB RSP state */
 	rsp.client_waiting = 0;		/* GDB client is not waiting */
 	rsp.mcu = mcu;			/* MCU instance */
+	rsp.cmcu = mcu;			/* MCU to step */
+	rsp.mcus[0] = mcu;		/* The first thread */
+	rsp.mcus_num = 1;
+	rsp.stop_mcu = NULL;
 	rsp.proto_num = -1;		/* i.e. invalid */
 	rsp.fserv = -1;			/* i.e. invalid */
 	rsp.fcli = -1;			/* i.e. invalid */
 	rsp.sigval = 0;			/* No exceptions */
 	rsp.start_addr = mcu->intr.reset_pc;	/* Reset PC by default */
+	rsp.noack = 0;			/* Acknowledge packets */
+	rsp.wp_num = 0;			/* No watchpoints */
+	rsp.wp_hit = BP_SOFTWARE;	/* i.e. no watchpoint triggered */
+	rsp.cond_num = 0;		/* No conditional breakpoints */
+	rsp.tp_num = 0;			/* No tracepoints */
+	rsp.tstatus = TS_NOTRUN;
+	rsp.frame_num = 0;
+	rsp.frame_cur = -1;		/* Live MCU is inspected */
+	memset(rsp.bp, 0, sizeof rsp.bp);
+	rsp.rx_pos = 0;
+	rsp.rx_len = 0;
+	rsp.tx_len = 0;
 
 	protocol = getprotobyname(AVRSIM_RSP_PROTOCOL);
 	if (protocol == NULL) {
@@ -223,11 +439,99 @@ MSIM_AVR_RSPInit(struct MSIM_AVR *mcu, uint16_t portn)
 	}
 }
 
+/*
+ * Adds one more MCU to be debugged. MCUs are represented as threads
+ * to GDB client.
+ */
+int
+MSIM_AVR_RSPAddMCU(struct MSIM_AVR *mcu)
+{
+	if (rsp.mcus_num >= MSIM_AVR_MCUS) {
+		snprintf(LOG, LOGSZ, "too many MCUs to debug, %d at most",
+		         MSIM_AVR_MCUS);
+		MSIM_LOG_ERROR(LOG);
+		return -1;
+	}
+	rsp.mcus[rsp.mcus_num++] = mcu;
+	return 0;
+}
+
+/*
+ * Stops the other MCUs when one of them is stopped (all-stop mode). The
+ * first one stopped is reported to GDB client.
+ */
+void
+MSIM_AVR_RSPStop(struct MSIM_AVR *mcu)
+{
+	if (rsp.stop_mcu == NULL) {
+		rsp.stop_mcu = mcu;
+	}
+	rsp_stop_all();
+}
+
 void
 MSIM_AVR_RSPClose(struct MSIM_AVR *mcu)
 {
 	rsp_close_client();
 	rsp_close_server();
+
+	/* Free profile and snapshots */
+	mcu->prof = NULL;
+	free(rsp.prof);
+	rsp.prof = NULL;
+	for (uint32_t i = 0; i < SNAP_MAX; i++) {
+		free(rsp.snap[i].pm);
+		free(rsp.snap[i].dm);
+		free(rsp.snap[i].san);
+		memset(&rsp.snap[i], 0, sizeof rsp.snap[i]);
+	}
+}
+
+/*
+ * Checks the client socket without blocking while MCU is running. It lets
+ * GDB client interrupt the firmware (Ctrl-C), other packets are answered
+ * according to the running MCU.
+ */
+int
+MSIM_AVR_RSPPoll(struct MSIM_AVR *mcu)
+{
+	struct pollfd fds[1];
+
+	if (rsp.fcli == -1) {
+		return 0;
+	}
+
+	/* Packet may be received already */
+	if (!rsp_packet_ready()) {
+		fds[0].fd = rsp.fcli;
+		fds[0].events = POLLIN;
+
+		if (poll(fds, 1, 0) <= 0) {
+			return 0;
+		}
+		if (POLLIN != (fds[0].revents & POLLIN)) {
+			snprintf(LOG, LOGSZ, "RSP client received flags "
+			         "0x%08X: closing client connection",
+			         fds[0].revents);
+			MSIM_LOG_WARN(LOG);
+
+			rsp_close_client();
+			return -1;
+		}
+		if (append_rsp_buf() != 0) {
+			return -1;
+		}
+
+		/* Partial packet is kept until the rest of it is received,
+		 * the MCU isn't stopped to wait for it. */
+		if (!rsp_packet_ready()) {
+			return 0;
+		}
+	}
+
+	rsp_client_request(rsp.mcu);
+	flush_rsp_buf();
+	return 0;
 }
 
 int
@@ -254,8 +558,9 @@ MSIM_AVR_RSPHandle(struct MSIM_AVR *mcu)
 		switch (poll(fds, 1, -1)) {
 		case -1:
 			if (errno == EINTR) {
-				/* Ignore received signal while polling */
-				break;
+				/* Let the main loop handle the signal, it
+				 * calls us again otherwise */
+				return 0;
 			}
 
 			snprintf(LOG, LOGSZ, "Poll for RSP server failed: "
@@ -289,12 +594,25 @@ MSIM_AVR_RSPHandle(struct MSIM_AVR *mcu)
 		}
 	}
 
-	/* Response with signal 5 (TRAP exception) any time */
+	/* Account time the MCU was running for */
+	if (rsp.running) {
+		rsp.run_time = rsp_run_time();
+		rsp.running = 0;
+	}
+
+	/* Response with signal 5 (TRAP exception) or 2 (INT) on break */
 	if (rsp.client_waiting) {
-		put_str_packet(mcu, "S05");
+		rsp_report_exception(rsp.mcu);
 		rsp.client_waiting = 0;
 	}
 
+	/* Packets pipelined by GDB may be received already */
+	if (rsp.rx_pos < rsp.rx_len) {
+		rsp_client_request(rsp.mcu);
+		flush_rsp_buf();
+		return 0;
+	}
+
 	/* Poll the RSP client socket for a message from GDB */
 	fds[0].fd = rsp.fcli;
 	fds[0].events = POLLIN;
@@ -321,7 +639,11 @@ MSIM_AVR_RSPHandle(struct MSIM_AVR *mcu)
 	default:
 		/* Is there client activity due to input available? */
 		if (POLLIN == (fds[0].revents & POLLIN)) {
-			rsp_client_request(mcu);
+			rsp_client_request(rsp.mcu);
+
+			/* Send the rest, i.e. an acknowledgment of the packet
+			 * which doesn't need a reply */
+			flush_rsp_buf();
 		} else {
 			/*
 			 * Error leads to closing the client, but not
@@ -355,6 +677,10 @@ rsp_close_client(void)
 		close(rsp.fcli);
 		rsp.fcli = -1;
 	}
+	rsp.noack = 0;
+	rsp.rx_pos = 0;
+	rsp.rx_len = 0;
+	rsp.tx_len = 0;
 }
 
 static void
@@ -434,6 +760,7 @@ static void
 rsp_client_request(struct MSIM_AVR *mcu)
 {
 	struct rsp_buf *buf;
+	long tid;
 
 	buf = get_packet();
 
@@ -444,9 +771,11 @@ rsp_client_request(struct MSIM_AVR *mcu)
 	}
 
 	/* Process a limited GDB commands while MCU running */
-	if (rsp.mcu->state == AVR_RUNNING) {
+	if (rsp_running()) {
 		if (buf->data[0] == 0x03) {
-			rsp.mcu->state = AVR_STOPPED;
+			rsp.stop_mcu = rsp.mcu;
+			rsp.sigval = GDB_SIGINT;
+			rsp_stop_all();
 		} else {
 			put_str_packet(mcu, "O6154677274656e20746f73206f7470"
 			               "7064650a0d");
@@ -458,6 +787,15 @@ rsp_client_request(struct MSIM_AVR *mcu)
 		return;
 	}
 
+	/* Trace frame being inspected can't be modified */
+	if ((rsp.frame_cur >= 0) && ((buf->data[0] == 'G') ||
+	                             (buf->data[0] == 'P') ||
+	                             (buf->data[0] == 'M') ||
+	                             (buf->data[0] == 'X'))) {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+
 	switch (buf->data[0]) {
 	case 0x03:
 		MSIM_LOG_WARN("break command received (MCU stopped)");
@@ -494,14 +832,14 @@ rsp_client_request(struct MSIM_AVR *mcu)
 		rsp_write_all_regs(mcu, buf);
 		return;
 	case 'H':
-		/*
-		 * Set a thread number for subsequent operations.
-		 * Send OK to ignore silently. */
-		put_str_packet(mcu, "OK");
+		/* Set a thread (MCU) for subsequent operations */
+		rsp_set_thread(mcu, buf);
 		return;
 	case 'k':
 		/* Kill request. Terminate simulation. */
-		rsp.mcu->state = AVR_MSIM_STOP;
+		for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+			rsp.mcus[i]->state = AVR_MSIM_STOP;
+		}
 		return;
 	case 'm':
 		/* Read memory (symbolic) */
@@ -521,6 +859,18 @@ rsp_client_request(struct MSIM_AVR *mcu)
 		/* One of query packets */
 		rsp_query(mcu, buf);
 		return;
+	case 'Q':
+		if (!strcmp("QStartNoAckMode", buf->data)) {
+			/* Packets over TCP don't have to be acknowledged */
+			put_str_packet(mcu, "OK");
+			rsp.noack = 1;
+		} else if (!strncmp("QT", buf->data, strlen("QT"))) {
+			/* Trace experiment */
+			rsp_trace_packet(mcu, buf);
+		} else {
+			put_str_packet(mcu, "");
+		}
+		return;
 	case 'R':
 		/* Restart the MCU program */
 		rsp_restart();
@@ -532,6 +882,12 @@ rsp_client_request(struct MSIM_AVR *mcu)
 		/* Ignore signal and perform a step as usual */
 		rsp_step(buf);
 		return;
+	case 'T':
+		/* Is thread (MCU) alive? */
+		tid = strtol(&buf->data[1], NULL, 16);
+		put_str_packet(mcu, ((tid > 0) && (tid <= rsp.mcus_num))
+		               ? "OK" : "E01");
+		return;
 	case 'v':
 		/* One of execution control packets */
 		rsp_vpkt(mcu, buf);
@@ -610,11 +966,11 @@ rsp_insert_matchpoint(struct MSIM_AVR *mcu, struct rsp_buf *buf)
 {
 	enum mp_type type;
 	unsigned long addr;
-	int len, vals;
-	unsigned char llsb, lmsb, hlsb, hmsb;
-	unsigned short inst;
+	uint32_t word, i;
+	unsigned int len;
+	int vals;
 
-	vals = sscanf(buf->data, "Z%1d,%lx,%1d", (int *)&type, &addr, &len);
+	vals = sscanf(buf->data, "Z%1d,%lx,%x", (int *)&type, &addr, &len);
 	if (vals != 3) {
 		snprintf(LOG, LOGSZ, "RSP matchpoint insertion request not "
 		         "recognized: %s", buf->data);
@@ -624,47 +980,72 @@ rsp_insert_matchpoint(struct MSIM_AVR *mcu, struct rsp_buf *buf)
 		return;
 	}
 
-	if (len != 2) {
-		snprintf(LOG, LOGSZ, "RSP matchpoint length %d is not valid: "
-		         "2 assumed", len);
-		MSIM_LOG_WARN(LOG);
-
-		len = 2;
-	}
-
 	switch (type) {
 	case BP_SOFTWARE:
+	case BP_HARDWARE:
+		if (len != 2) {
+			snprintf(LOG, LOGSZ, "RSP matchpoint length %u is not "
+			         "valid: 2 assumed", len);
+			MSIM_LOG_WARN(LOG);
+		}
+
 		/*
-		 * This is the only type of matchpoints to be supported in
-		 * this minimal implementation. Insertion of a breakpoint at
-		 * the same location twice won't make any change.
+		 * Breakpoints are kept in a bitmap (bit per word of the
+		 * program memory) which is checked before an instruction
+		 * is started. Program memory isn't modified at all.
+		 * Insertion of a breakpoint at the same location twice
+		 * only replaces its conditions (agent expressions which
+		 * follow the address, if any).
 		 */
-		llsb = (unsigned char) mcu->pm[addr];
-		lmsb = (unsigned char) mcu->pm[addr+1];
-		inst = (unsigned short) (llsb | (lmsb << 8));
+		if (addr > mcu->flashend) {
+			snprintf(LOG, LOGSZ, "breakpoint 0x%8lX is out of "
+			         "flash memory", addr);
+			MSIM_LOG_ERROR(LOG);
 
-		if (inst == BREAK) {
-			snprintf(LOG, LOGSZ, "BREAK is already at 0x%8lX, "
-			         "ignoring", addr);
-			MSIM_LOG_WARN(LOG);
+			put_str_packet(mcu, "E01");
+			return;
+		}
 
-			put_str_packet(mcu, "OK");
+		word = (uint32_t)(addr >> 1);
+		rsp_del_conds(word);
+		if (rsp_add_conds(word, strchr(buf->data, ';')) != 0) {
+			rsp_del_conds(word);
+			put_str_packet(mcu, "E01");
 			return;
 		}
+		rsp.bp[word >> 3] |= (uint8_t)(1U << (word & 7U));
+		rsp_sync_bp(word);
+
+		put_str_packet(mcu, "OK");
+		break;
+	case WP_WRITE:
+	case WP_READ:
+	case WP_ACCESS:
+		/*
+		 * Watchpoints are set over the data space only. Accesses
+		 * are checked against bitmaps built from the watchpoints.
+		 */
+		if ((addr < GDB_DATA_OFF) || (len == 0U) ||
+		                ((addr - GDB_DATA_OFF + len) > MSIM_AVR_DMSZ)) {
+			snprintf(LOG, LOGSZ, "watchpoint 0x%8lX,%u is out of "
+			         "data memory", addr, len);
+			MSIM_LOG_ERROR(LOG);
 
-		mcu->pm[addr] = BREAK_LOW;
-		mcu->pm[addr+1] = BREAK_HIGH;
-		mcu->mpm[addr] = llsb;
-		mcu->mpm[addr+1] = lmsb;
-		if (MSIM_AVR_Is32(inst)) {
-			hlsb = (unsigned char) mcu->pm[addr+2];
-			hmsb = (unsigned char) mcu->pm[addr+3];
-			mcu->pm[addr+2] = 0;
-			mcu->pm[addr+3] = 0;
-			mcu->mpm[addr+2] = hlsb;
-			mcu->mpm[addr+3] = hmsb;
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		if (rsp.wp_num >= WP_MAX) {
+			MSIM_LOG_ERROR("too many watchpoints");
+			put_str_packet(mcu, "E01");
+			return;
 		}
 
+		i = rsp.wp_num++;
+		rsp.wp[i].type = type;
+		rsp.wp[i].loc = (uint32_t)(addr - GDB_DATA_OFF);
+		rsp.wp[i].len = len;
+		rsp_update_wp();
+
 		put_str_packet(mcu, "OK");
 		break;
 	default:
@@ -682,11 +1063,11 @@ rsp_remove_matchpoint(MSIM_AVR *mcu, rsp_buf *buf)
 {
 	enum mp_type type;
 	unsigned long addr;
-	int len, vals;
-	unsigned char llsb, lmsb, hlsb, hmsb;
-	unsigned short inst;
+	uint32_t word, i;
+	unsigned int len;
+	int vals;
 
-	vals = sscanf(buf->data, "z%1d,%lx,%1d", (int *)&type, &addr, &len);
+	vals = sscanf(buf->data, "z%1d,%lx,%x", (int *)&type, &addr, &len);
 	if (vals != 3) {
 		snprintf(LOG, LOGSZ, "RSP matchpoint insertion request not "
 		         "recognized: %s", buf->data);
@@ -696,46 +1077,56 @@ rsp_remove_matchpoint(MSIM_AVR *mcu, rsp_buf *buf)
 		return;
 	}
 
-	if (len != 2) {
-		snprintf(LOG, LOGSZ, "RSP matchpoint length %d is not valid: "
-		         "2 assumed", len);
-		MSIM_LOG_WARN(LOG);
-
-		len = 2;
-	}
-
 	switch (type) {
 	case BP_SOFTWARE:
-		/*
-		 * This is the only type of matchpoints to be supported in
-		 * this minimal implementation. Double check if breakpoint
-		 * exists at the given address.
-		 */
-		llsb = (unsigned char) mcu->pm[addr];
-		lmsb = (unsigned char) mcu->pm[addr+1];
-		inst = (unsigned short) (llsb | (lmsb << 8));
-		if (inst != BREAK) {
-			snprintf(LOG, LOGSZ, "there is no BREAK at 0x%8lX "
-			         "address, ignoring", addr);
+	case BP_HARDWARE:
+		if (len != 2) {
+			snprintf(LOG, LOGSZ, "RSP matchpoint length %u is not "
+			         "valid: 2 assumed", len);
+			MSIM_LOG_WARN(LOG);
+		}
+
+		/* Double check if breakpoint exists at the given address. */
+		word = (uint32_t)(addr >> 1);
+		if ((addr > mcu->flashend) ||
+		                !(rsp.bp[word >> 3] & (1U << (word & 7U)))) {
+			snprintf(LOG, LOGSZ, "there is no breakpoint at "
+			         "0x%8lX address, ignoring", addr);
 			MSIM_LOG_ERROR(LOG);
 
 			put_str_packet(mcu, "E01");
 			return;
 		}
 
-		llsb = (unsigned char) mcu->mpm[addr];
-		lmsb = (unsigned char) mcu->mpm[addr+1];
-		mcu->pm[addr] = llsb;
-		mcu->pm[addr+1] = lmsb;
+		rsp.bp[word >> 3] &= (uint8_t)~(1U << (word & 7U));
+		rsp_del_conds(word);
+		rsp_sync_bp(word);
+
+		put_str_packet(mcu, "OK");
+		break;
+	case WP_WRITE:
+	case WP_READ:
+	case WP_ACCESS:
+		for (i = 0; i < rsp.wp_num; i++) {
+			if ((rsp.wp[i].type == type) &&
+			                (rsp.wp[i].len == len) &&
+			                (addr == (GDB_DATA_OFF +
+			                          rsp.wp[i].loc))) {
+				break;
+			}
+		}
+		if (i == rsp.wp_num) {
+			snprintf(LOG, LOGSZ, "there is no watchpoint at "
+			         "0x%8lX address, ignoring", addr);
+			MSIM_LOG_ERROR(LOG);
 
-		inst = (unsigned short) (llsb | (lmsb << 8));
-		if (MSIM_AVR_Is32(inst)) {
-			hlsb = (unsigned char) mcu->mpm[addr+2];
-			hmsb = (unsigned char) mcu->mpm[addr+3];
-			mcu->pm[addr+2] = hlsb;
-			mcu->pm[addr+3] = hmsb;
+			put_str_packet(mcu, "E01");
+			return;
 		}
 
+		rsp.wp[i] = rsp.wp[--rsp.wp_num];
+		rsp_update_wp();
+
 		put_str_packet(mcu, "OK");
 		break;
 	default:
@@ -748,142 +1139,940 @@ rsp_remove_matchpoint(MSIM_AVR *mcu, rsp_buf *buf)
 	}
 }
 
-static struct rsp_buf *
-get_packet(void)
+/* Builds bitmaps of the watched data space locations of each MCU. */
+static void
+rsp_update_wp(void)
 {
-	static struct rsp_buf buf;
-	uint8_t checksum;
-	uint64_t count;			/* Index into the buffer */
-	int8_t ch;			/* Current character */
-
-	/* Keep getting packets, until one is found with a valid checksum */
-	while (1) {
-		/* Wait around for the start character ('$'). Ignore
-		 * all other characters. */
-		ch = (char)get_rsp_char();
-		while (ch != '$') {
-			if (ch == -1) {
-				return  NULL;
-			}
-
-			/* 0x03 is a special case, an out-of-band break when
-			 * running */
-			if (ch == 0x03) {
-				buf.data[0] = ch;
-				buf.len = 1;
-				return &buf;
+	struct MSIM_AVR *mcu;
+	struct rsp_wp *wp;
+	uint32_t loc;
+	uint8_t bit;
+
+	for (uint32_t j = 0; j < rsp.mcus_num; j++) {
+		mcu = rsp.mcus[j];
+		memset(mcu->wp_r, 0, sizeof mcu->wp_r);
+		memset(mcu->wp_w, 0, sizeof mcu->wp_w);
+
+		for (uint32_t i = 0; i < rsp.wp_num; i++) {
+			wp = &rsp.wp[i];
+			for (loc = wp->loc; loc < (wp->loc + wp->len); loc++) {
+				bit = (uint8_t)(1U << (loc & 7U));
+				if (wp->type != WP_WRITE) {
+					mcu->wp_r[loc >> 3] |= bit;
+				}
+				if (wp->type != WP_READ) {
+					mcu->wp_w[loc >> 3] |= bit;
+				}
 			}
-			ch = (char)get_rsp_char();
 		}
+		mcu->wp_num = rsp.wp_num;
+	}
+}
 
-		/* Read until a '#' or end of buffer is found */
-		checksum = 0;
-		count = 0;
-		while (count < GDB_BUF_MAX-1) {
-			ch = (char)get_rsp_char();
-
-			/* Check for connection failure */
-			if (ch == -1) {
-				return  NULL;
-			}
-			/*
-			 * If we hit a start of line char begin
-			 * all over again
-			 */
-			if (ch == '$') {
-				checksum = 0;
-				count = 0;
-				continue;
-			}
+/*
+ * Stops MCU when a watched data space location is accessed by the
+ * firmware. The instruction is completed, but MCU is stopped after it.
+ */
+void
+MSIM_AVR_RSPWatch(struct MSIM_AVR *mcu, uint32_t loc, uint8_t write)
+{
+	const enum mp_type type = write ? WP_WRITE : WP_READ;
+	struct rsp_wp *wp;
 
-			/* Break out if we get the end of line char */
-			if (ch == '#') {
-				break;
-			}
-			/* Update checksum and add the char to the buffer. */
-			checksum = (uint8_t)(checksum + (uint8_t)ch);
-			buf.data[count] = (char)ch;
-			count++;
+	rsp.wp_hit = BP_SOFTWARE;
+	for (uint32_t i = 0; i < rsp.wp_num; i++) {
+		wp = &rsp.wp[i];
+		if ((loc < wp->loc) || (loc >= (wp->loc + wp->len))) {
+			continue;
 		}
+		if (wp->type == type) {
+			rsp.wp_hit = type;
+			break;
+		} else if (wp->type == WP_ACCESS) {
+			rsp.wp_hit = WP_ACCESS;
+		}
+	}
+	if (rsp.wp_hit != BP_SOFTWARE) {
+		rsp.wp_loc = loc;
+		mcu->state = AVR_STOPPED;
+	}
+}
 
-		/*
-		 * Mark the end of the buffer with EOS - it's convenient
-		 * for non-binary data to be valid strings.
-		 */
-		buf.data[count] = 0;
-		buf.len = count;
-
-		/*
-		 * If we have a valid end of packet char, validate
-		 * the checksum
-		 */
-		if (ch == '#') {
-			uint8_t xmitcsum;
+/*
+ * Decides whether MCU should be stopped at a breakpoint (or a tracepoint)
+ * of the current PC. Tracepoints are collected here, conditions of the
+ * breakpoint are evaluated, MCU is stopped if any of them is true.
+ */
+int
+MSIM_AVR_RSPBreak(struct MSIM_AVR *mcu)
+{
+	const uint32_t word = mcu->pc;
+	MSIM_AVR_AXEnv env;
+	uint32_t i, conds = 0;
+	int64_t v;
+
+	for (i = 0; (i < rsp.tp_num) && (rsp.tstatus == TS_RUNNING); i++) {
+		if (rsp.tp[i].enabled && (rsp.tp[i].word == word)) {
+			rsp_collect(mcu, &rsp.tp[i]);
+		}
+	}
+	if (!(rsp.bp[word >> 3] & (1U << (word & 7U)))) {
+		return 0;
+	}
 
-			ch = (char)get_rsp_char();
-			if (ch == -1) {
-				return NULL;
-			}
+	env.mcu = mcu;
+	env.trace = NULL;
+	env.tracev = NULL;
+	env.arg = NULL;
+	env.tsv = rsp.tsv;
+	env.tsv_num = TSV_MAX;
 
-			xmitcsum = (unsigned char)(hex(ch)<<4);
+	for (i = 0; i < rsp.cond_num; i++) {
+		if (rsp.cond[i].word != word) {
+			continue;
+		}
+		conds++;
 
-			ch = (char)get_rsp_char();
-			if (ch == -1) {
-				return  NULL;
-			}
+		/* Stop if the condition can't be evaluated */
+		if (MSIM_AVR_AXEval(&env, rsp.cond[i].ax, rsp.cond[i].len,
+		                    &v) || (v != 0)) {
+			return 1;
+		}
+	}
+	return conds == 0U;
+}
 
-			xmitcsum = (uint8_t)(xmitcsum + (uint8_t)hex(ch));
+/*
+ * Updates a bit of the breakpoint at the given word of each MCU. It's set
+ * for a breakpoint inserted by GDB or an enabled tracepoint of the running
+ * trace experiment.
+ */
+static void
+rsp_sync_bp(uint32_t word)
+{
+	const uint8_t bit = (uint8_t)(1U << (word & 7U));
+	struct MSIM_AVR *mcu;
+	uint8_t set;
+
+	set = (rsp.bp[word >> 3] & bit) != 0U;
+	for (uint32_t i = 0; (i < rsp.tp_num) && !set; i++) {
+		set = (rsp.tstatus == TS_RUNNING) && rsp.tp[i].enabled &&
+		      (rsp.tp[i].word == word);
+	}
 
-			/*
-			 * If the checksums don't match print a warning,
-			 * and put the negative ack back to the client.
-			 * Otherwise put a positive ack.
-			 */
-			if (checksum != xmitcsum) {
-				fprintf(stderr, "Warning: Bad RSP "
-				        "checksum: Computed 0x%02X, "
-				        "received 0x%02X\n",
-				        checksum, xmitcsum);
-				put_rsp_char('-');
-			} else {
-				put_rsp_char('+');
-				break;
-			}
-		} else {
-			fprintf(stderr, "Warning: RSP packet overran "
-			        "buffer\n");
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		mcu = rsp.mcus[i];
+		if (set && !(mcu->bp[word >> 3] & bit)) {
+			mcu->bp[word >> 3] |= bit;
+			mcu->bp_num++;
+		} else if (!set && (mcu->bp[word >> 3] & bit)) {
+			mcu->bp[word >> 3] &= (uint8_t)~bit;
+			mcu->bp_num--;
 		}
 	}
-
-	return &buf;
 }
 
+/* Parses conditions of a breakpoint: ";X<len>,<expr>" each. */
 static int
-get_rsp_char(void)
+rsp_add_conds(uint32_t word, const char *p)
 {
-	unsigned char c;
-	ssize_t bytes;
-
-	if (rsp.fcli == -1) {
-		fprintf(stderr, "Attempt to read from unopened RSP "
-		        "client: Ignored\n");
-		return  -1;
-	}
+	struct rsp_cond *c;
+
+	while ((p != NULL) && (p[0] == ';') && (p[1] == 'X')) {
+		if (rsp.cond_num >= COND_MAX) {
+			MSIM_LOG_ERROR("too many breakpoint conditions");
+			return -1;
+		}
+
+		c = &rsp.cond[rsp.cond_num];
+		c->word = word;
+		p = rsp_parse_ax(&p[2], c->ax, &c->len);
+		if (p == NULL) {
+			MSIM_LOG_ERROR("breakpoint condition can't be parsed");
+			return -1;
+		}
+		rsp.cond_num++;
+	}
+	return 0;
+}
+
+static void
+rsp_del_conds(uint32_t word)
+{
+	uint32_t i = 0;
+
+	while (i < rsp.cond_num) {
+		if (rsp.cond[i].word == word) {
+			rsp.cond[i] = rsp.cond[--rsp.cond_num];
+		} else {
+			i++;
+		}
+	}
+}
+
+/*
+ * Parses agent expression "<len>,<hex bytes>". Returns a pointer to the
+ * character after the expression or NULL.
+ */
+static const char *
+rsp_parse_ax(const char *p, uint8_t *ax, uint32_t *len)
+{
+	unsigned long n;
+	char *end;
+
+	n = strtoul(p, &end, 16);
+	if ((end == p) || (*end != ',') || (n > AX_MAX)) {
+		return NULL;
+	}
+	p = end + 1;
+
+	for (uint32_t i = 0; i < n; i++) {
+		if ((hex(p[0]) < 0) || (hex(p[1]) < 0)) {
+			return NULL;
+		}
+		ax[i] = (uint8_t)((hex(p[0]) << 4) | hex(p[1]));
+		p += 2;
+	}
+	*len = (uint32_t)n;
+	return p;
+}
+
+/* Replies to the trace queries (qT...). */
+static void
+rsp_trace_query(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	char reply[256];
+	const char *st;
+	unsigned int n, addr;
+	int64_t v;
+
+	if (!strcmp("qTStatus", buf->data)) {
+		switch (rsp.tstatus) {
+		case TS_RUNNING:
+			st = "T1";
+			break;
+		case TS_STOP:
+			st = "T0;tstop::0";
+			break;
+		case TS_FULL:
+			st = "T0;tfull:0";
+			break;
+		case TS_PASS:
+			st = "T0;tpasscount";
+			break;
+		case TS_NOTRUN:
+		default:
+			st = "T0;tnotrun:0";
+			break;
+		}
+		if (rsp.tstatus == TS_PASS) {
+			snprintf(reply, sizeof reply, "%s:%" PRIX32, st,
+			         rsp.tstop_tp);
+			st = reply;
+		}
+		snprintf(buf->data, sizeof buf->data, "%s;tframes:%" PRIX32
+		         ";tcreated:%" PRIX32 ";tsize:%X;tfree:%" PRIX32
+		         ";circular:0;disconn:0", st, rsp.frame_num,
+		         rsp.frame_num, TBUF_MAX, TBUF_MAX - rsp.tbuf_len);
+		put_str_packet(mcu, buf->data);
+	} else if (sscanf(buf->data, "qTP:%x:%x", &n, &addr) == 2) {
+		/* Status of the tracepoint */
+		for (uint32_t i = 0; i < rsp.tp_num; i++) {
+			if ((rsp.tp[i].num == n) &&
+			                (rsp.tp[i].word == (addr >> 1))) {
+				snprintf(reply, sizeof reply, "V%" PRIX32 ":0",
+				         rsp.tp[i].hits);
+				put_str_packet(mcu, reply);
+				return;
+			}
+		}
+		put_str_packet(mcu, "E01");
+	} else if (sscanf(buf->data, "qTV:%x", &n) == 1) {
+		/* Value of the trace state variable, the one collected if
+		 * a trace frame is selected */
+		if ((n < TSV_MAX) && (rsp.frame_cur < 0)) {
+			v = rsp.tsv[n];
+		} else if ((n >= TSV_MAX) || (read_frame_tsv(n, &v) != 0)) {
+			put_str_packet(mcu, "U");
+			return;
+		}
+		snprintf(reply, sizeof reply, "V%s%" PRIX64,
+		         (v < 0) ? "-" : "",
+		         (v < 0) ? (uint64_t)0 - (uint64_t)v : (uint64_t)v);
+		put_str_packet(mcu, reply);
+	} else if (!strcmp("qTfP", buf->data) || !strcmp("qTsP", buf->data) ||
+	                !strcmp("qTfV", buf->data) ||
+	                !strcmp("qTsV", buf->data) ||
+	                !strcmp("qTfSTM", buf->data) ||
+	                !strcmp("qTsSTM", buf->data) ||
+	                !strncmp("qTBuffer:", buf->data, strlen("qTBuffer:"))) {
+		/* Nothing to upload to GDB client */
+		put_str_packet(mcu, "l");
+	} else {
+		put_str_packet(mcu, "");
+	}
+}
+
+/* Handles packets to set up and control the trace experiment (QT...). */
+static void
+rsp_trace_packet(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	unsigned int n, addr;
+	unsigned long long v;
+
+	if (!strcmp("QTinit", buf->data)) {
+		rsp_trace_stop(mcu, TS_NOTRUN);
+		rsp.tp_num = 0;
+		rsp.frame_num = 0;
+		rsp.tbuf_len = 0;
+		rsp.frame_cur = -1;
+		memset(rsp.tsv_init, 0, sizeof rsp.tsv_init);
+		put_str_packet(mcu, "OK");
+	} else if (!strncmp("QTDP:", buf->data, strlen("QTDP:"))) {
+		rsp_define_tp(mcu, &buf->data[strlen("QTDP:")]);
+	} else if (sscanf(buf->data, "QTDV:%x:%llx", &n, &v) == 2) {
+		if (n < TSV_MAX) {
+			rsp.tsv_init[n] = (int64_t)v;
+			rsp.tsv[n] = (int64_t)v;
+			put_str_packet(mcu, "OK");
+		} else {
+			put_str_packet(mcu, "E01");
+		}
+	} else if ((sscanf(buf->data, "QTEnable:%x:%x", &n, &addr) == 2) ||
+	                (sscanf(buf->data, "QTDisable:%x:%x", &n,
+	                        &addr) == 2)) {
+		for (uint32_t i = 0; i < rsp.tp_num; i++) {
+			if (rsp.tp[i].num == n) {
+				rsp.tp[i].enabled = (buf->data[2] == 'E');
+				rsp_sync_bp(rsp.tp[i].word);
+			}
+		}
+		put_str_packet(mcu, "OK");
+	} else if (!strcmp("QTStart", buf->data)) {
+		rsp_trace_start(mcu);
+		put_str_packet(mcu, "OK");
+	} else if (!strcmp("QTStop", buf->data)) {
+		rsp_trace_stop(mcu, TS_STOP);
+		put_str_packet(mcu, "OK");
+	} else if (!strncmp("QTFrame:", buf->data, strlen("QTFrame:"))) {
+		rsp_find_frame(mcu, &buf->data[strlen("QTFrame:")]);
+	} else if (!strncmp("QTDPsrc:", buf->data, strlen("QTDPsrc:")) ||
+	                !strncmp("QTro", buf->data, strlen("QTro")) ||
+	                !strncmp("QTDisconnected", buf->data,
+	                         strlen("QTDisconnected")) ||
+	                !strncmp("QTBuffer:", buf->data, strlen("QTBuffer:")) ||
+	                !strncmp("QTNotes:", buf->data, strlen("QTNotes:"))) {
+		/* Accepted, but not used by the simulator */
+		put_str_packet(mcu, "OK");
+	} else {
+		put_str_packet(mcu, "");
+	}
+}
+
+/*
+ * Defines a tracepoint "n:addr:E|D:step:pass[:X<len>,<cond>][-]" or
+ * appends an action to it "-n:addr:<action>[-]". Actions are registers
+ * (R<mask>), memory (M<basereg>,<offset>,<len>) and expressions
+ * (X<len>,<expr>). While-stepping actions (S...) are ignored.
+ */
+static void
+rsp_define_tp(MSIM_AVR *mcu, const char *p)
+{
+	struct rsp_tp *tp = NULL;
+	unsigned int n, addr, step, pass;
+	unsigned long reg, off, len;
+	char en;
+	char *end;
+
+	if (p[0] == '-') {
+		if (sscanf(p, "-%x:%x:", &n, &addr) != 2) {
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		for (uint32_t i = 0; i < rsp.tp_num; i++) {
+			if ((rsp.tp[i].num == n) &&
+			                (rsp.tp[i].word == (addr >> 1))) {
+				tp = &rsp.tp[i];
+				break;
+			}
+		}
+		/* Actions follow the number and address of the tracepoint */
+		p = strchr(p, ':');
+		if (p != NULL) {
+			p = strchr(p + 1, ':');
+		}
+		if (p == NULL) {
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		p++;
+
+		while ((tp != NULL) && (p[0] != 0) && (p[0] != '-')) {
+			if (p[0] == 'S') {
+				break;
+			} else if (p[0] == 'R') {
+				tp->regs = 1;
+				strtoul(&p[1], &end, 16);
+				p = end;
+			} else if ((p[0] == 'M') &&
+			                (tp->mem_num < TP_MEM_MAX)) {
+				if ((p[1] == '-') && (p[2] == '1') &&
+				                (p[3] == ',')) {
+					reg = UINT32_MAX;
+					off = strtoul(&p[4], &end, 16);
+				} else {
+					reg = strtoul(&p[1], &end, 16);
+					if (end[0] != ',') {
+						tp = NULL;
+						break;
+					}
+					off = strtoul(end + 1, &end, 16);
+				}
+				if (end[0] != ',') {
+					tp = NULL;
+					break;
+				}
+				len = strtoul(end + 1, &end, 16);
+				tp->mem[tp->mem_num].reg = (uint32_t)reg;
+				tp->mem[tp->mem_num].off = (uint32_t)off;
+				tp->mem[tp->mem_num].len = (uint32_t)len;
+				tp->mem_num++;
+				p = end;
+			} else if ((p[0] == 'X') &&
+			                (tp->expr_num < TP_EXPR_MAX)) {
+				p = rsp_parse_ax(&p[1], tp->expr[tp->expr_num],
+				                 &tp->expr_len[tp->expr_num]);
+				if (p == NULL) {
+					tp = NULL;
+					break;
+				}
+				tp->expr_num++;
+			} else {
+				tp = NULL;
+			}
+		}
+		put_str_packet(mcu, (tp != NULL) ? "OK" : "E01");
+		return;
+	}
+
+	if ((sscanf(p, "%x:%x:%c:%x:%x", &n, &addr, &en, &step,
+	                &pass) != 5) || (rsp.tp_num >= TP_MAX) ||
+	                (addr > mcu->flashend)) {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+	if (step != 0U) {
+		MSIM_LOG_WARN("while-stepping of tracepoints isn't supported");
+	}
+
+	tp = &rsp.tp[rsp.tp_num];
+	memset(tp, 0, sizeof *tp);
+	tp->num = n;
+	tp->word = addr >> 1;
+	tp->enabled = (en == 'E');
+	tp->pass = pass;
+
+	/*
+	 * Optional fields after the pass count: fast tracepoint (ignored)
+	 * and condition.
+	 */
+	for (uint32_t i = 0; i < 4U; i++) {
+		p = strchr(p, ':') + 1;
+	}
+	strtoul(p, &end, 16);
+	p = end;
+	while ((p != NULL) && (p[0] == ':')) {
+		if (p[1] == 'X') {
+			p = rsp_parse_ax(&p[2], tp->cond, &tp->cond_len);
+		} else if (p[1] == 'F') {
+			strtoul(&p[2], &end, 16);
+			p = end;
+		} else {
+			p = NULL;
+		}
+	}
+	if ((p == NULL) || ((p[0] != 0) && (p[0] != '-'))) {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+
+	rsp.tp_num++;
+	rsp_sync_bp(tp->word);
+	put_str_packet(mcu, "OK");
+}
+
+/*
+ * Selects a trace frame to be inspected by the 'g', 'p' and 'm' packets:
+ * by number, by PC (pc:, range:, outside:) or by tracepoint (tdp:).
+ * Frames are looked up after the current one.
+ */
+static void
+rsp_find_frame(MSIM_AVR *mcu, const char *p)
+{
+	struct rsp_frame *f;
+	unsigned int a, b;
+	uint32_t pc, i;
+	int found = 0;
+	char reply[64];
+
+	i = (uint32_t)(rsp.frame_cur + 1);
+	if (sscanf(p, "pc:%x", &a) == 1) {
+		for (; (i < rsp.frame_num) && !found; i++) {
+			found = (rsp.frame[i].pc << 1) == a;
+		}
+	} else if (sscanf(p, "tdp:%x", &a) == 1) {
+		for (; (i < rsp.frame_num) && !found; i++) {
+			found = rsp.frame[i].tp == a;
+		}
+	} else if (sscanf(p, "range:%x:%x", &a, &b) == 2) {
+		for (; (i < rsp.frame_num) && !found; i++) {
+			pc = rsp.frame[i].pc << 1;
+			found = (pc >= a) && (pc <= b);
+		}
+	} else if (sscanf(p, "outside:%x:%x", &a, &b) == 2) {
+		for (; (i < rsp.frame_num) && !found; i++) {
+			pc = rsp.frame[i].pc << 1;
+			found = (pc < a) || (pc > b);
+		}
+	} else if (sscanf(p, "%x", &a) == 1) {
+		i = a + 1U;
+		found = a < rsp.frame_num;
+	} else {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+
+	if (found) {
+		rsp.frame_cur = (int32_t)(i - 1U);
+		f = &rsp.frame[rsp.frame_cur];
+		snprintf(reply, sizeof reply, "F%" PRIX32 "T%" PRIX32,
+		         (uint32_t)rsp.frame_cur, f->tp);
+		put_str_packet(mcu, reply);
+	} else {
+		rsp.frame_cur = -1;
+		put_str_packet(mcu, "F-1");
+	}
+}
+
+static void
+rsp_trace_start(MSIM_AVR *mcu)
+{
+	rsp.frame_num = 0;
+	rsp.tbuf_len = 0;
+	rsp.frame_cur = -1;
+	memcpy(rsp.tsv, rsp.tsv_init, sizeof rsp.tsv);
+	rsp.tstatus = TS_RUNNING;
+
+	for (uint32_t i = 0; i < rsp.tp_num; i++) {
+		rsp.tp[i].hits = 0;
+		rsp_sync_bp(rsp.tp[i].word);
+	}
+}
+
+static void
+rsp_trace_stop(MSIM_AVR *mcu, enum trace_status st)
+{
+	if ((rsp.tstatus != TS_RUNNING) && (st != TS_NOTRUN)) {
+		return;
+	}
+	rsp.tstatus = st;
+
+	for (uint32_t i = 0; i < rsp.tp_num; i++) {
+		rsp_sync_bp(rsp.tp[i].word);
+	}
+}
+
+/* Collects a trace frame of the tracepoint without stopping MCU. */
+static void
+rsp_collect(MSIM_AVR *mcu, struct rsp_tp *tp)
+{
+	struct rsp_frame *f;
+	MSIM_AVR_AXEnv env;
+	uint8_t *regs;
+	int64_t v;
+
+	env.mcu = mcu;
+	env.trace = rsp_collect_mem;
+	env.tracev = rsp_collect_tsv;
+	env.arg = mcu;
+	env.tsv = rsp.tsv;
+	env.tsv_num = TSV_MAX;
+
+	if ((tp->cond_len > 0U) &&
+	                (MSIM_AVR_AXEval(&env, tp->cond, tp->cond_len, &v) ||
+	                 (v == 0))) {
+		return;
+	}
+	tp->hits++;
+
+	if (rsp.frame_num >= FRAME_MAX) {
+		rsp_trace_stop(mcu, TS_FULL);
+		return;
+	}
+	f = &rsp.frame[rsp.frame_num];
+	f->tp = tp->num;
+	f->pc = mcu->pc;
+	f->off = rsp.tbuf_len;
+	rsp.tbuf_full = 0;
+
+	if (tp->regs && ((rsp.tbuf_len + 1U + FRAME_REGSZ) <= TBUF_MAX)) {
+		regs = &rsp.tbuf[rsp.tbuf_len];
+		regs[0] = 'R';
+		memcpy(&regs[1], mcu->dm, 32);
+		regs[33] = *mcu->sreg;
+		regs[34] = *mcu->spl;
+		regs[35] = *mcu->sph;
+		regs[36] = (uint8_t)(mcu->pc << 1);
+		regs[37] = (uint8_t)(mcu->pc >> 7);
+		regs[38] = (uint8_t)(mcu->pc >> 15);
+		regs[39] = 0;
+		rsp.tbuf_len += 1U + FRAME_REGSZ;
+	} else if (tp->regs) {
+		rsp.tbuf_full = 1;
+	}
+
+	for (uint32_t i = 0; i < tp->mem_num; i++) {
+		v = 0;
+		if ((tp->mem[i].reg != UINT32_MAX) &&
+		                MSIM_AVR_AXReg(mcu, tp->mem[i].reg, &v)) {
+			continue;
+		}
+		rsp_collect_mem(mcu, (uint32_t)v + tp->mem[i].off,
+		                tp->mem[i].len);
+	}
+	for (uint32_t i = 0; i < tp->expr_num; i++) {
+		MSIM_AVR_AXEval(&env, tp->expr[i], tp->expr_len[i], &v);
+	}
+
+	f->len = rsp.tbuf_len - f->off;
+	rsp.frame_num++;
+
+	if (rsp.tbuf_full) {
+		rsp_trace_stop(mcu, TS_FULL);
+	} else if ((tp->pass > 0U) && (tp->hits >= tp->pass)) {
+		rsp.tstop_tp = tp->num;
+		rsp_trace_stop(mcu, TS_PASS);
+	}
+}
+
+/* Appends a memory block to the trace frame being collected. */
+static void
+rsp_collect_mem(void *arg, uint32_t addr, uint32_t len)
+{
+	struct MSIM_AVR *mcu = (struct MSIM_AVR *)arg;
+	uint8_t *blk = &rsp.tbuf[rsp.tbuf_len];
+
+	if ((len > UINT16_MAX) || ((rsp.tbuf_len + 7U + len) > TBUF_MAX)) {
+		rsp.tbuf_full = 1;
+		return;
+	}
+	if (MSIM_AVR_AXMem(mcu, addr, &blk[7], len) != 0) {
+		return;			/* Memory isn't available */
+	}
+
+	blk[0] = 'M';
+	for (uint32_t i = 0; i < 4U; i++) {
+		blk[1+i] = (uint8_t)(addr >> (i * 8U));
+	}
+	blk[5] = (uint8_t)(len & 0xFF);
+	blk[6] = (uint8_t)(len >> 8);
+	rsp.tbuf_len += 7U + len;
+}
+
+/* Appends a trace state variable to the trace frame being collected. */
+static void
+rsp_collect_tsv(void *arg, uint32_t n, int64_t val)
+{
+	uint8_t *blk = &rsp.tbuf[rsp.tbuf_len];
+
+	(void)arg;
+	if ((rsp.tbuf_len + 13U) > TBUF_MAX) {
+		rsp.tbuf_full = 1;
+		return;
+	}
+
+	blk[0] = 'V';
+	for (uint32_t i = 0; i < 4U; i++) {
+		blk[1+i] = (uint8_t)(n >> (i * 8U));
+	}
+	for (uint32_t i = 0; i < 8U; i++) {
+		blk[5+i] = (uint8_t)((uint64_t)val >> (i * 8U));
+	}
+	rsp.tbuf_len += 13U;
+}
+
+/* Returns length of the block of a trace frame. */
+static uint32_t
+frame_block_len(const uint8_t *blk)
+{
+	switch (blk[0]) {
+	case 'R':
+		return 1U + FRAME_REGSZ;
+	case 'V':
+		return 13U;
+	default:
+		return 7U + (uint32_t)(blk[5] | (blk[6] << 8));
+	}
+}
+
+/* Returns registers collected in the selected trace frame, if any. */
+static const uint8_t *
+frame_regs(void)
+{
+	const struct rsp_frame *f = &rsp.frame[rsp.frame_cur];
+	const uint8_t *p = &rsp.tbuf[f->off];
+	const uint8_t *end = p + f->len;
+
+	while (p < end) {
+		if (p[0] == 'R') {
+			return &p[1];
+		}
+		p += frame_block_len(p);
+	}
+	return NULL;
+}
+
+/* Reads a trace state variable collected in the selected trace frame. */
+static int
+read_frame_tsv(uint32_t n, int64_t *val)
+{
+	const struct rsp_frame *f = &rsp.frame[rsp.frame_cur];
+	const uint8_t *p = &rsp.tbuf[f->off];
+	const uint8_t *end = p + f->len;
+	uint64_t v;
+
+	while (p < end) {
+		if ((p[0] == 'V') && (n == (uint32_t)(p[1] | (p[2] << 8) |
+		                      (p[3] << 16) | ((uint32_t)p[4] << 24)))) {
+			v = 0;
+			for (uint32_t i = 8U; i > 0U; i--) {
+				v = (v << 8) | p[4+i];
+			}
+			*val = (int64_t)v;
+			return 0;
+		}
+		p += frame_block_len(p);
+	}
+	return -1;
+}
+
+/* Reads memory collected in the selected trace frame. */
+static int
+read_frame_mem(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	const struct rsp_frame *f = &rsp.frame[rsp.frame_cur];
+	const uint8_t *end = &rsp.tbuf[f->off + f->len];
+	const uint8_t *p;
+	uint32_t a, l, found;
+
+	for (uint32_t i = 0; i < len; i++) {
+		found = 0;
+		for (p = &rsp.tbuf[f->off]; p < end; ) {
+			if (p[0] != 'M') {
+				p += frame_block_len(p);
+				continue;
+			}
+			a = (uint32_t)(p[1] | (p[2] << 8) | (p[3] << 16) |
+			               ((uint32_t)p[4] << 24));
+			l = (uint32_t)(p[5] | (p[6] << 8));
+			if (((addr + i) >= a) && ((addr + i) < (a + l))) {
+				buf[i] = p[7 + (addr + i - a)];
+				found = 1;
+			}
+			p += 7U + l;
+		}
+		if (!found) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Reads a register of the selected trace frame. Registers which weren't
+ * collected are reported as unavailable, except PC which is known.
+ */
+static size_t
+read_frame_reg(int n, char *buf, size_t blen)
+{
+	const uint8_t *regs = frame_regs();
+	const uint32_t pc = rsp.frame[rsp.frame_cur].pc << 1;
+
+	if (n == 34) {
+		snprintf(buf, blen, "%02X%02X%02X00", pc & 0xFFU,
+		         (pc >> 8) & 0xFFU, (pc >> 16) & 0xFFU);
+	} else if ((n < 0) || (n > 33)) {
+		buf[0] = 0;
+	} else if (regs == NULL) {
+		snprintf(buf, blen, (n == 33) ? "xxxx" : "xx");
+	} else if (n == 33) {
+		snprintf(buf, blen, "%02X%02X", regs[33], regs[34]);
+	} else {
+		snprintf(buf, blen, "%02X", regs[n]);
+	}
+	return strlen(buf);
+}
+
+static struct rsp_buf *
+get_packet(void)
+{
+	static struct rsp_buf buf;
+	uint8_t checksum;
+	uint64_t count;			/* Index into the buffer */
+	int ch;				/* Current character */
+
+	/* Keep getting packets, until one is found with a valid checksum */
+	while (1) {
+		/* Wait around for the start character ('$'). Ignore
+		 * all other characters. */
+		ch = get_rsp_char();
+		while (ch != '$') {
+			if (ch == -1) {
+				return  NULL;
+			}
+
+			/* 0x03 is a special case, an out-of-band break when
+			 * running */
+			if (ch == 0x03) {
+				buf.data[0] = (char)ch;
+				buf.len = 1;
+				return &buf;
+			}
+			ch = get_rsp_char();
+		}
+
+		/* Read until a '#' or end of buffer is found */
+		checksum = 0;
+		count = 0;
+		while (count < GDB_BUF_MAX-1) {
+			ch = get_rsp_char();
+
+			/* Check for connection failure */
+			if (ch == -1) {
+				return  NULL;
+			}
+			/*
+			 * If we hit a start of line char begin
+			 * all over again
+			 */
+			if (ch == '$') {
+				checksum = 0;
+				count = 0;
+				continue;
+			}
+
+			/* Break out if we get the end of line char */
+			if (ch == '#') {
+				break;
+			}
+			/* Update checksum and add the char to the buffer. */
+			checksum = (uint8_t)(checksum + (uint8_t)ch);
+			buf.data[count] = (char)ch;
+			count++;
+		}
+
+		/*
+		 * Mark the end of the buffer with EOS - it's convenient
+		 * for non-binary data to be valid strings.
+		 */
+		buf.data[count] = 0;
+		buf.len = count;
+
+		/*
+		 * If we have a valid end of packet char, validate
+		 * the checksum
+		 */
+		if (ch == '#') {
+			uint8_t xmitcsum;
+
+			ch = get_rsp_char();
+			if (ch == -1) {
+				return NULL;
+			}
+
+			xmitcsum = (unsigned char)(hex(ch)<<4);
+
+			ch = get_rsp_char();
+			if (ch == -1) {
+				return  NULL;
+			}
+
+			xmitcsum = (uint8_t)(xmitcsum + (uint8_t)hex(ch));
+
+			/*
+			 * If the checksums don't match print a warning,
+			 * and put the negative ack back to the client.
+			 * Otherwise put a positive ack.
+			 */
+			if (rsp.noack) {
+				break;
+			} else if (checksum != xmitcsum) {
+				fprintf(stderr, "Warning: Bad RSP "
+				        "checksum: Computed 0x%02X, "
+				        "received 0x%02X\n",
+				        checksum, xmitcsum);
+				put_rsp_char('-');
+			} else {
+				put_rsp_char('+');
+				break;
+			}
+		} else {
+			fprintf(stderr, "Warning: RSP packet overran "
+			        "buffer\n");
+		}
+	}
+
+	return &buf;
+}
+
+/* Returns the next character received from the client, -1 on error. */
+static int
+get_rsp_char(void)
+{
+	if (rsp.fcli == -1) {
+		fprintf(stderr, "Attempt to read from unopened RSP "
+		        "client: Ignored\n");
+		return  -1;
+	}
+	if ((rsp.rx_pos == rsp.rx_len) && (fill_rsp_buf() != 0)) {
+		return -1;
+	}
+	return rsp.rx[rsp.rx_pos++];
+}
+
+/*
+ * Reads all of the characters available from the client at once. Pending
+ * output is sent before, because the client may wait for it.
+ */
+static int
+fill_rsp_buf(void)
+{
+	ssize_t bytes;
+
+	if (flush_rsp_buf() != 0) {
+		return -1;
+	}
 
 	/*
 	 * Read until successful (we retry after interrupts) or
 	 * catastrophic failure.
 	 */
 	while (1) {
-		bytes = read(rsp.fcli, &c, sizeof c);
+		bytes = read(rsp.fcli, rsp.rx, sizeof rsp.rx);
 
-		if (bytes == sizeof c) {
-			return c&0xFF;
+		if (bytes > 0) {
+			rsp.rx_pos = 0;
+			rsp.rx_len = (uint32_t)bytes;
+			return 0;
 		}
 
 		if (bytes == -1) {
 			/* Error: only allow interrupts or would block */
-			if (errno == EAGAIN || errno == EINTR) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (((errno == EAGAIN) || (errno == EWOULDBLOCK)) &&
+			                (wait_rsp_client(POLLIN) == 0)) {
 				continue;
 			}
 
@@ -899,38 +2088,151 @@ get_rsp_char(void)
 	}
 }
 
-static void
-put_rsp_char(char c)
+/*
+ * Appends the characters available from the client to the ones which
+ * haven't been read yet. It doesn't wait for the client.
+ */
+static int
+append_rsp_buf(void)
+{
+	ssize_t bytes;
+
+	/* Move the characters left to the beginning of the buffer */
+	if (rsp.rx_pos > 0U) {
+		memmove(rsp.rx, &rsp.rx[rsp.rx_pos], rsp.rx_len - rsp.rx_pos);
+		rsp.rx_len -= rsp.rx_pos;
+		rsp.rx_pos = 0;
+	}
+	if (rsp.rx_len == sizeof rsp.rx) {
+		return 0;
+	}
+
+	do {
+		bytes = read(rsp.fcli, &rsp.rx[rsp.rx_len],
+		             sizeof rsp.rx - rsp.rx_len);
+	} while ((bytes == -1) && (errno == EINTR));
+
+	if (bytes > 0) {
+		rsp.rx_len += (uint32_t)bytes;
+		return 0;
+	}
+	if ((bytes == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+		return 0;
+	}
+
+	if (bytes == -1) {
+		fprintf(stderr, "Failed to read from RSP client: Closing "
+		        "client connection: %s\n", strerror(errno));
+	}
+	rsp_close_client();
+	return -1;
+}
+
+/*
+ * Checks whether the characters received contain a whole packet
+ * ($...#xx) or an interrupt (0x03), i.e. get_packet() won't wait for the
+ * client. A packet which doesn't fit into the buffer is reported as ready,
+ * the rest of it is read by get_packet().
+ */
+static int
+rsp_packet_ready(void)
 {
+	uint32_t i = rsp.rx_pos;
+
+	while ((i < rsp.rx_len) && (rsp.rx[i] != '$') &&
+	                (rsp.rx[i] != 0x03)) {
+		i++;
+	}
+	if (i == rsp.rx_len) {
+		return 0;
+	}
+	if (rsp.rx[i] == 0x03) {
+		return 1;
+	}
+	if ((rsp.rx_pos == 0U) && (rsp.rx_len == sizeof rsp.rx)) {
+		return 1;
+	}
+
+	while ((i < rsp.rx_len) && (rsp.rx[i] != '#')) {
+		i++;
+	}
+	return ((i + 2U) < rsp.rx_len) ? 1 : 0;
+}
+
+/* Sends characters buffered for the client. */
+static int
+flush_rsp_buf(void)
+{
+	uint32_t off = 0;
+	ssize_t bytes;
+
 	if (rsp.fcli == -1) {
-		fprintf(stderr, "Attempt to write '%c' to unopened RSP "
-		        "client: Ignored\n", c);
-		return;
+		rsp.tx_len = 0;
+		return -1;
 	}
 
 	/*
 	 * Write until successful (we retry after interrupts) or
 	 * catastrophic failure.
 	 */
-	while (1) {
-		switch (write(rsp.fcli, &c, sizeof c)) {
-		case -1:
+	while (off < rsp.tx_len) {
+		bytes = write(rsp.fcli, &rsp.tx[off], rsp.tx_len - off);
+
+		if (bytes > 0) {
+			off += (uint32_t)bytes;
+			continue;
+		}
+		if (bytes == -1) {
 			/* Error: only allow interrupts or would block */
-			if (errno == EAGAIN || errno == EINTR) {
-				break;
+			if (errno == EINTR) {
+				continue;
+			}
+			if (((errno == EAGAIN) || (errno == EWOULDBLOCK)) &&
+			                (wait_rsp_client(POLLOUT) == 0)) {
+				continue;
 			}
 
 			fprintf(stderr, "Failed to write to RSP client: "
 			        "Closing client connection: %s\n",
 			        strerror(errno));
 			rsp_close_client();
-			return;
-		case 0:
-			break;		/* Nothing written! Try again */
-		default:
-			return;		/* Success, we can return */
+			return -1;
 		}
 	}
+	rsp.tx_len = 0;
+	return 0;
+}
+
+/* Waits for the client socket to become readable or writable. */
+static int
+wait_rsp_client(short events)
+{
+	struct pollfd fds[1];
+
+	fds[0].fd = rsp.fcli;
+	fds[0].events = events;
+
+	while (poll(fds, 1, -1) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return ((fds[0].revents & events) != 0) ? 0 : -1;
+}
+
+/* Puts a character to the output buffer, it's sent by flush_rsp_buf(). */
+static void
+put_rsp_char(char c)
+{
+	if (rsp.fcli == -1) {
+		fprintf(stderr, "Attempt to write '%c' to unopened RSP "
+		        "client: Ignored\n", c);
+		return;
+	}
+	if ((rsp.tx_len == sizeof rsp.tx) && (flush_rsp_buf() != 0)) {
+		return;
+	}
+	rsp.tx[rsp.tx_len++] = (unsigned char)c;
 }
 
 static int
@@ -955,12 +2257,13 @@ hex2reg(char *buf, const unsigned long dign)
 {
 	unsigned int n;			/* Counter for digits */
 	unsigned long val;		/* The result */
-	int nyb_shift;
 
+	/* Bytes are little-endian, the first one is the least
+	 * significant */
 	val = 0;
-	for (n = 0; n < dign; n++) {
-		nyb_shift = (int)(((dign-1)*4)-(n*4));
-		val |= (unsigned long)(hex(buf[n]) << nyb_shift);
+	for (n = 0; (n + 1U) < dign; n += 2U) {
+		val |= (unsigned long)((hex(buf[n]) << 4) | hex(buf[n+1]))
+		       << (n*4U);
 	}
 	return val;
 }
@@ -1001,73 +2304,269 @@ put_packet(MSIM_AVR *mcu, rsp_buf *buf)
 	do {
 		uint8_t checksum = 0;
 
-		put_rsp_char('$');		/* Start of the packet */
+		put_rsp_char('$');		/* Start of the packet */
+
+		/* Body of the packet */
+		for (count = 0; count < buf->len; count++) {
+			c = buf->data[count];
+			/* Check for escaped chars */
+			if (('$' == c) || ('#' == c) ||
+			                ('*' == c) || ('}' == c)) {
+				c ^= 0x20;
+				checksum = (uint8_t)(checksum + (uint8_t)'}');
+				put_rsp_char('}');
+			}
+			checksum = (uint8_t)(checksum + (uint8_t)c);
+			put_rsp_char(c);
+		}
+
+		put_rsp_char ('#');		/* End char */
+		/* Computed checksum */
+		put_rsp_char(hexchars[checksum >> 4]);
+		put_rsp_char(hexchars[checksum % 16]);
+
+		/* Whole packet is sent at once */
+		if (flush_rsp_buf() != 0) {
+			return;
+		}
+		if (rsp.noack) {
+			break;
+		}
+
+		/* Check for ack of connection failure */
+		ch = get_rsp_char();
+		if (ch == -1) {
+			return;			/* Fail the put silently. */
+		}
+	} while (ch != '+');
+}
+
+static void
+rsp_report_exception(MSIM_AVR *mcu)
+{
+	struct rsp_buf buf;
+
+	/* Construct a signal received packet with the MCU stopped */
+	snprintf(buf.data, sizeof buf.data, "T%02Xthread:%" PRIX32 ";",
+	         rsp.sigval, rsp_thread((rsp.stop_mcu != NULL) ?
+	                                rsp.stop_mcu : rsp.mcu));
+	buf.len = strlen(buf.data);
+
+	if (rsp.wp_hit != BP_SOFTWARE) {
+		/* Stop reply with the watchpoint triggered */
+		snprintf(&buf.data[buf.len], sizeof buf.data - buf.len,
+		         "%s:%lX;", (rsp.wp_hit == WP_WRITE) ? "watch" :
+		         (rsp.wp_hit == WP_READ) ? "rwatch" : "awatch",
+		         rsp.wp_loc + GDB_DATA_OFF);
+		buf.len = strlen(buf.data);
+	}
+
+	put_packet(mcu, &buf);
+}
+
+static void
+rsp_continue(struct rsp_buf *buf)
+{
+	uint32_t addr;
+
+	if (sscanf(buf->data, "c%" SCNx32, &addr) == 1) {
+		rsp.cmcu->pc = (addr >> 1);
+	}
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		rsp.mcus[i]->state = AVR_RUNNING;
+	}
+	rsp_resume();
+}
+
+/*
+ * Resumes MCUs according to the vCont actions (";action[:thread-id]"
+ * each). The first action which matches MCU is applied, MCUs without
+ * actions are left stopped.
+ */
+static void
+rsp_vcont(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	enum MSIM_AVR_State st[MSIM_AVR_MCUS], act;
+	uint8_t set[MSIM_AVR_MCUS];
+	const char *p = &buf->data[strlen("vCont")];
+	char *end;
+	long tid;
+
+	memset(set, 0, sizeof set);
+	while (p[0] == ';') {
+		switch (p[1]) {
+		case 'c':
+		case 'C':
+			act = AVR_RUNNING;
+			break;
+		case 's':
+		case 'S':
+			act = AVR_MSIM_STEP;
+			break;
+		case 't':
+			act = AVR_STOPPED;
+			break;
+		default:
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		/* Signal is ignored */
+		if ((p[1] == 'C') || (p[1] == 'S')) {
+			strtoul(&p[2], &end, 16);
+			p = end;
+		} else {
+			p = &p[2];
+		}
+
+		tid = -1;
+		if (p[0] == ':') {
+			tid = strtol(&p[1], &end, 16);
+			p = end;
+		}
+		for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+			if (!set[i] && ((tid == -1) || (tid == (long)i + 1))) {
+				st[i] = act;
+				set[i] = 1;
+			}
+		}
+	}
+	if (p[0] != 0) {
+		snprintf(LOG, LOGSZ, "vCont not recognized: %s", buf->data);
+		MSIM_LOG_ERROR(LOG);
+
+		put_str_packet(mcu, "E01");
+		return;
+	}
+
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		if (set[i]) {
+			rsp.mcus[i]->state = st[i];
+		}
+	}
+	rsp_resume();
+}
+
+/* Waits for MCUs to be stopped once they're resumed by GDB client. */
+static void
+rsp_resume(void)
+{
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		rsp.mcus[i]->rsp_poll = MSIM_AVR_RSP_POLL;
+	}
+	rsp.sigval = GDB_SIGTRAP;
+	rsp.wp_hit = BP_SOFTWARE;
+	rsp.stop_mcu = NULL;
+	rsp.client_waiting = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &rsp.run_ts);
+	rsp.running = 1;
+}
 
-		/* Body of the packet */
-		for (count = 0; count < buf->len; count++) {
-			c = buf->data[count];
-			/* Check for escaped chars */
-			if (('$' == c) || ('#' == c) ||
-			                ('*' == c) || ('}' == c)) {
-				c ^= 0x20;
-				checksum = (uint8_t)(checksum + (uint8_t)'}');
-				put_rsp_char('}');
-			}
-			checksum = (uint8_t)(checksum + (uint8_t)c);
-			put_rsp_char(c);
+/* Stops all of the running (or stepping) MCUs. */
+static void
+rsp_stop_all(void)
+{
+	struct MSIM_AVR *m;
+
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		m = rsp.mcus[i];
+		if ((m->state == AVR_RUNNING) || (m->state == AVR_MSIM_STEP)) {
+			m->state = AVR_STOPPED;
 		}
+	}
+}
 
-		put_rsp_char ('#');		/* End char */
-		/* Computed checksum */
-		put_rsp_char(hexchars[checksum >> 4]);
-		put_rsp_char(hexchars[checksum % 16]);
+/* Checks whether any MCU is running. */
+static int
+rsp_running(void)
+{
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		if (rsp.mcus[i]->state == AVR_RUNNING) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-		/* Check for ack of connection failure */
-		ch = get_rsp_char();
-		if (ch == -1) {
-			return;			/* Fail the put silently. */
+/* Returns thread ID of the MCU. */
+static uint32_t
+rsp_thread(const MSIM_AVR *mcu)
+{
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		if (rsp.mcus[i] == mcu) {
+			return i + 1;
 		}
-	} while (ch != '+');
+	}
+	return 1;
 }
 
+/*
+ * Selects MCU to read and write registers and memory of ('Hg'), or MCU to
+ * be stepped by 's' and to continue at the address of 'c' ('Hc'). All of
+ * the MCUs are resumed by 'c' anyway. Thread 0 (any) and -1 (all) select
+ * MCU which has stopped first, or the first MCU.
+ */
 static void
-rsp_report_exception(MSIM_AVR *mcu)
+rsp_set_thread(MSIM_AVR *mcu, rsp_buf *buf)
 {
-	struct rsp_buf buf;
+	const long tid = strtol(&buf->data[2], NULL, 16);
+	struct MSIM_AVR *sel;
 
-	/* Construct a signal received packet */
-	buf.data[0] = 'S';
-	buf.data[1] = hexchars[rsp.sigval >> 4];
-	buf.data[2] = hexchars[rsp.sigval % 16];
-	buf.data[3] = 0;
-	buf.len = strlen(buf.data);
+	if ((tid < -1) || (tid > (long)rsp.mcus_num)) {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+	if (tid > 0) {
+		sel = rsp.mcus[tid - 1];
+	} else {
+		sel = (rsp.stop_mcu != NULL) ? rsp.stop_mcu : rsp.mcus[0];
+	}
 
-	put_packet(mcu, &buf);
+	switch (buf->data[1]) {
+	case 'g':
+		rsp.mcu = sel;
+		break;
+	case 'c':
+		rsp.cmcu = sel;
+		break;
+	default:
+		put_str_packet(mcu, "E01");
+		return;
+	}
+	put_str_packet(mcu, "OK");
 }
 
+/* Replies with a list of threads (MCUs) in XML. */
 static void
-rsp_continue(struct rsp_buf *buf)
+rsp_threads(MSIM_AVR *mcu, rsp_buf *buf)
 {
-	uint32_t addr;
-
-	if (sscanf(buf->data, "c%" SCNx32, &addr) == 1) {
-		rsp.mcu->pc = (addr >> 1);
+	char doc[128 + MSIM_AVR_MCUS*64];
+	size_t len;
+
+	len = (size_t)snprintf(doc, sizeof doc, "<?xml version=\"1.0\"?>"
+	                       "<threads>");
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		len += (size_t)snprintf(&doc[len], sizeof doc - len,
+		                        "<thread id=\"%" PRIX32 "\" "
+		                        "name=\"%s\"/>", i + 1,
+		                        rsp.mcus[i]->name);
 	}
-	rsp.mcu->state = AVR_RUNNING;
-	rsp.client_waiting = 1;
+	snprintf(&doc[len], sizeof doc - len, "</threads>");
+
+	rsp_xfer(mcu, buf, "qXfer:threads:read::", doc);
 }
 
 static void
 rsp_query(MSIM_AVR *mcu, rsp_buf *buf)
 {
+	char reply[GDB_BUF_MAX];
+	size_t len;
+	long tid;
+
 	if (!strcmp("qC", buf->data)) {
-		/*
-		 * Return the current thread ID (unsigned hex). A null
-		 * response indicates to use the previously selected thread.
-		 * Since we do not support a thread concept, this is the
-		 * appropriate response.
-		 */
-		put_str_packet(mcu, "");
+		/* Return the current thread ID (unsigned hex) */
+		snprintf(reply, sizeof reply, "QC%" PRIX32, rsp_thread(mcu));
+		put_str_packet(mcu, reply);
 	} else if (!strcmp("qOffsets", buf->data)) {
 		/* Report any relocation */
 		put_str_packet(mcu, "Text=0;Data=0;Bss=0");
@@ -1080,9 +2579,11 @@ rsp_query(MSIM_AVR *mcu, rsp_buf *buf)
 		 * or a reply to 'g' with all the registers and an EOS so
 		 * the buffer is a well formed string.
 		 */
-		char reply[GDB_BUF_MAX];
-
-		snprintf(reply, GDB_BUF_MAX, "PacketSize=%X", GDB_BUF_MAX);
+		snprintf(reply, GDB_BUF_MAX, "PacketSize=%X;"
+		         "QStartNoAckMode+;ConditionalBreakpoints+;"
+		         "TracepointSource+;EnableDisableTracepoints+;"
+		         "qXfer:memory-map:read+;qXfer:threads:read+",
+		         GDB_BUF_MAX);
 		put_str_packet(mcu, reply);
 	} else if (!strncmp("qSymbol:", buf->data, strlen("qSymbol:"))) {
 		/*
@@ -1091,19 +2592,50 @@ rsp_query(MSIM_AVR *mcu, rsp_buf *buf)
 		 * looked up, but we didn't want to do that anyway!
 		 */
 		put_str_packet(mcu, "OK");
-	} else if (!strncmp("qTStatus", buf->data, strlen("qTStatus"))) {
-		/* Trace feature is not supported */
-		put_str_packet(mcu, "");
+	} else if (!strncmp("qXfer:memory-map:read::", buf->data,
+	                    strlen("qXfer:memory-map:read::"))) {
+		/* Memory map to let GDB load firmware to flash */
+		rsp_memory_map(mcu, buf);
+	} else if (!strncmp("qXfer:threads:read::", buf->data,
+	                    strlen("qXfer:threads:read::"))) {
+		rsp_threads(mcu, buf);
+	} else if (!strncmp("qThreadExtraInfo,", buf->data,
+	                    strlen("qThreadExtraInfo,"))) {
+		/* Name of the MCU, hex-encoded */
+		tid = strtol(&buf->data[strlen("qThreadExtraInfo,")], NULL,
+		             16);
+		if ((tid <= 0) || (tid > rsp.mcus_num)) {
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		len = 0;
+		for (const char *n = rsp.mcus[tid - 1]->name; *n; n++) {
+			reply[len++] = hexchars[((unsigned char)*n) >> 4];
+			reply[len++] = hexchars[((unsigned char)*n) & 0xF];
+		}
+		reply[len] = 0;
+		put_str_packet(mcu, reply);
+	} else if (!strncmp("qT", buf->data, strlen("qT"))) {
+		/* Trace experiment */
+		rsp_trace_query(mcu, buf);
 	} else if (!strncmp("qfThreadInfo", buf->data,
 	                    strlen("qfThreadInfo"))) {
-		/* Return info about active threads. */
-		put_str_packet(mcu, "m-1");
+		/* Return info about active threads, i.e. MCUs */
+		len = (size_t)snprintf(reply, sizeof reply, "m1");
+		for (uint32_t i = 1; i < rsp.mcus_num; i++) {
+			len += (size_t)snprintf(&reply[len], sizeof reply - len,
+			                        ",%" PRIX32, i + 1);
+		}
+		put_str_packet(mcu, reply);
 	} else if (!strncmp("qAttached", buf->data, strlen("qAttached"))) {
 		put_str_packet(mcu, "");
 	} else if (!strncmp("qsThreadInfo", buf->data,
 	                    strlen("qsThreadInfo"))) {
 		/* Return info about more active threads */
 		put_str_packet(mcu, "l");
+	} else if (!strncmp("qRcmd,", buf->data, strlen("qRcmd,"))) {
+		/* GDB 'monitor' command */
+		rsp_command(mcu, buf);
 	} else {
 		MSIM_LOG_WARN("unrecognized RSP query");
 	}
@@ -1121,15 +2653,10 @@ rsp_vpkt(MSIM_AVR *mcu, rsp_buf *buf)
 		put_str_packet(mcu, "S05");
 		return;
 	} else if (!strcmp("vCont?", buf->data)) {
-		/* There're no vCont actions supported at the moment. */
-		put_str_packet(mcu, "");
+		put_str_packet(mcu, "vCont;c;C;s;S;t");
 		return;
-	} else if (!strncmp("vCont", buf->data, strlen("vCont"))) {
-		/*
-		 * This shouldn't happen, because we've reported non-support
-		 * via vCont? above */
-		MSIM_LOG_WARN("RSP vCont is not supported: ignored");
-
+	} else if (!strncmp("vCont;", buf->data, strlen("vCont;"))) {
+		rsp_vcont(mcu, buf);
 		return;
 	} else if (!strncmp("vRun;", buf->data, strlen("vRun;"))) {
 		/* We shouldn't be given any args, but check for this */
@@ -1149,6 +2676,21 @@ rsp_vpkt(MSIM_AVR *mcu, rsp_buf *buf)
 		/* Restart MCU in stopped state on kill request */
 		rsp_restart();
 		put_str_packet(mcu, "OK");
+	} else if (!strncmp("vFlashErase:", buf->data,
+	                    strlen("vFlashErase:"))) {
+		rsp_flash_erase(mcu, buf);
+	} else if (!strncmp("vFlashWrite:", buf->data,
+	                    strlen("vFlashWrite:"))) {
+		rsp_flash_write(mcu, buf);
+	} else if (!strcmp("vFlashDone", buf->data)) {
+		/* Program memory is written directly, nothing to flush */
+		snprintf(LOG, LOGSZ, "firmware loaded by GDB client: %" PRIu32
+		         " bytes", rsp.flash_bytes);
+		MSIM_LOG_INFO(LOG);
+		MSIM_AVR_CovReset(mcu);
+
+		rsp.flash_bytes = 0;
+		put_str_packet(mcu, "OK");
 	} else {
 		fprintf(stderr, "Unknown RSP 'v' packet type %s: ignored\n",
 		        buf->data);
@@ -1157,11 +2699,462 @@ rsp_vpkt(MSIM_AVR *mcu, rsp_buf *buf)
 	}
 }
 
+/*
+ * Executes a command passed by GDB 'monitor' as hex-encoded string.
+ *
+ * An empty reply lets GDB know the command is not supported.
+ */
+static void
+rsp_command(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	char cmd[GDB_BUF_MAX];
+	const char *hcmd = &buf->data[strlen("qRcmd,")];
+	unsigned long len = strlen(hcmd)/2;
+
+	for (unsigned long i = 0; i < len; i++) {
+		cmd[i] = (char)((hex(hcmd[2*i]) << 4) | hex(hcmd[2*i+1]));
+	}
+	cmd[len] = 0;
+
+	if (!strcmp("flightrec", cmd)) {
+		/* Dump the flight recorder */
+		if (MSIM_AVR_FRDump(mcu, "requested by GDB") == 0) {
+			put_str_packet(mcu, "OK");
+		} else {
+			put_str_packet(mcu, "E01");
+		}
+	} else if (!strcmp("stats", cmd)) {
+		put_str_packet(mcu, rsp_stats(mcu) ? "E01" : "OK");
+	} else if (!strncmp("profile ", cmd, strlen("profile "))) {
+		put_str_packet(mcu, rsp_profile(mcu, &cmd[strlen("profile ")])
+		               ? "E01" : "OK");
+	} else if (!strncmp("snapshot ", cmd, strlen("snapshot "))) {
+		put_str_packet(mcu, rsp_snapshot(mcu,
+		                                 &cmd[strlen("snapshot ")])
+		               ? "E01" : "OK");
+	} else if (!strcmp("vcd on", cmd) || !strcmp("vcd off", cmd)) {
+		/* Pause or resume VCD dump */
+		if (mcu->vcd.dump == NULL) {
+			rsp_print(mcu, "VCD dump is not configured\n");
+			put_str_packet(mcu, "E01");
+		} else {
+			mcu->vcd.pause = !strcmp("vcd off", cmd);
+			put_str_packet(mcu, "OK");
+		}
+	} else if (!strcmp("speed max", cmd) ||
+	                !strcmp("speed realtime", cmd)) {
+		/* Run as fast as possible or at the MCU clock frequency */
+		mcu->realtime = !strcmp("speed realtime", cmd);
+		put_str_packet(mcu, "OK");
+	} else {
+		snprintf(LOG, LOGSZ, "unsupported monitor command: %s", cmd);
+		MSIM_LOG_WARN(LOG);
+		put_str_packet(mcu, "");
+	}
+}
+
+/* Prints a message to the GDB console ('O' packet). */
+static void
+rsp_print(MSIM_AVR *mcu, const char *fmt, ...)
+{
+	char msg[256];
+	rsp_buf buf;
+	va_list ap;
+	size_t len;
+	unsigned char c;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof msg, fmt, ap);
+	va_end(ap);
+
+	buf.data[0] = 'O';
+	for (len = 0; msg[len] != 0; len++) {
+		c = (unsigned char)msg[len];
+		buf.data[2*len+1] = hexchars[c >> 4];
+		buf.data[2*len+2] = hexchars[c & 0xF];
+	}
+	buf.len = 2*len + 1;
+	buf.data[buf.len] = 0;
+
+	put_packet(mcu, &buf);
+}
+
+/* Returns the time (in seconds) the MCU was running for. */
+static double
+rsp_run_time(void)
+{
+	struct timespec now;
+
+	if (!rsp.running) {
+		return rsp.run_time;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return rsp.run_time + (double)(now.tv_sec - rsp.run_ts.tv_sec) +
+	       (double)(now.tv_nsec - rsp.run_ts.tv_nsec) / 1e9;
+}
+
+/* Prints statistics of the simulation. */
+static int
+rsp_stats(MSIM_AVR *mcu)
+{
+	const double run = rsp_run_time();
+	const double sim = (mcu->freq > 0U)
+	                   ? ((double)mcu->tick / mcu->freq) : 0.0;
+
+	rsp_print(mcu, "cycles: %" PRIu64 " (%.6f s at %" PRIu32 " Hz)\n",
+	          mcu->tick, sim, mcu->freq);
+	rsp_print(mcu, "instructions: %" PRIu64 "\n", mcu->insts);
+	if (run > 0.0) {
+		rsp_print(mcu, "running: %.3f s, %.2f MIPS, %.1f%% of real "
+		          "time\n", run, (double)mcu->insts / run / 1e6,
+		          sim / run * 100.0);
+	}
+	for (uint32_t i = 0; i < MSIM_AVR_IRQNUM; i++) {
+		if (mcu->intr.served[i] > 0U) {
+			rsp_print(mcu, "interrupt %" PRIu32 ": %" PRIu64
+			          " served\n", i, mcu->intr.served[i]);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Collects cycles spent at each word of the program memory and dumps
+ * the hottest addresses.
+ */
+static int
+rsp_profile(MSIM_AVR *mcu, const char *arg)
+{
+	uint32_t top[PROF_TOP];
+	uint32_t top_num = 0, j;
+	uint64_t total = 0;
+
+	if (!strcmp("start", arg)) {
+		if (rsp.prof == NULL) {
+			rsp.prof = calloc(MSIM_AVR_PMSZ, sizeof rsp.prof[0]);
+			if (rsp.prof == NULL) {
+				rsp_print(mcu, "can't allocate profile\n");
+				return -1;
+			}
+		} else {
+			memset(rsp.prof, 0, MSIM_AVR_PMSZ*sizeof rsp.prof[0]);
+		}
+		mcu->prof = rsp.prof;
+		return 0;
+	} else if (!strcmp("stop", arg)) {
+		mcu->prof = NULL;
+		return 0;
+	} else if (strcmp("dump", arg) != 0) {
+		rsp_print(mcu, "usage: monitor profile start|stop|dump\n");
+		return -1;
+	}
+
+	if (rsp.prof == NULL) {
+		rsp_print(mcu, "no profile collected\n");
+		return -1;
+	}
+
+	/* Keep the hottest words sorted in descending order */
+	for (uint32_t i = 0; i < mcu->pm_size; i++) {
+		if (rsp.prof[i] == 0U) {
+			continue;
+		}
+		total += rsp.prof[i];
+
+		for (j = top_num; j > 0; j--) {
+			if (rsp.prof[top[j-1]] >= rsp.prof[i]) {
+				break;
+			}
+			if (j < PROF_TOP) {
+				top[j] = top[j-1];
+			}
+		}
+		if (j < PROF_TOP) {
+			top[j] = i;
+			top_num += (top_num < PROF_TOP) ? 1U : 0U;
+		}
+	}
+
+	rsp_print(mcu, "profile: %" PRIu64 " cycles\n", total);
+	for (uint32_t i = 0; i < top_num; i++) {
+		rsp_print(mcu, "  0x%06" PRIX32 ": %" PRIu64 " (%.1f%%)\n",
+		          top[i] << 1, rsp.prof[top[i]],
+		          (double)rsp.prof[top[i]] * 100.0 / (double)total);
+	}
+	return 0;
+}
+
+/*
+ * Saves the MCU state to a snapshot or restores it. Breakpoints,
+ * watchpoints, files and locks of the simulator itself are kept intact
+ * on restore. Lua and native models aren't a part of the snapshot, their
+ * timers are scheduled at absolute cycles, so a snapshot can't be restored
+ * while they're loaded.
+ */
+static int
+rsp_snapshot(MSIM_AVR *mcu, const char *arg)
+{
+	char name[SNAP_NAMESZ];
+	struct rsp_snap *s = NULL;
+	int save;
+
+	if (sscanf(arg, "save %31s", name) == 1) {
+		save = 1;
+	} else if (sscanf(arg, "restore %31s", name) == 1) {
+		save = 0;
+	} else {
+		rsp_print(mcu, "usage: monitor snapshot save|restore "
+		          "<name>\n");
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < SNAP_MAX; i++) {
+		if (rsp.snap[i].used && !strcmp(rsp.snap[i].name, name)) {
+			s = &rsp.snap[i];
+			break;
+		}
+		if (save && (s == NULL) && !rsp.snap[i].used) {
+			s = &rsp.snap[i];
+		}
+	}
+	if (s == NULL) {
+		rsp_print(mcu, "%s%s\n", save ? "too many snapshots" :
+		          "no such snapshot: ", save ? "" : name);
+		return -1;
+	}
+
+	if (save) {
+		return rsp_snapshot_save(mcu, s, name);
+	}
+
+	if ((mcu->mod_ticks > 0U) || (mcu->mod_events > 0U) ||
+	                (mcu->mod_next != TICKS_MAX)) {
+		rsp_print(mcu, "can't restore snapshot while device models "
+		          "are loaded\n");
+		return -1;
+	}
+
+	mcu->tick = s->tick;
+	mcu->tovf = s->tovf;
+	mcu->insts = s->insts;
+	mcu->freq = s->freq;
+	mcu->clk_source = s->clk_source;
+	mcu->lockbits = s->lockbits;
+	memcpy(mcu->fuse, s->fuse, sizeof mcu->fuse);
+	mcu->pc = s->pc;
+	mcu->ic_left = s->ic_left;
+	mcu->mci = s->mci;
+	memcpy(mcu->pm, s->pm, s->pm_words * sizeof mcu->pm[0]);
+	memcpy(mcu->dm, s->dm, s->dm_bytes);
+	mcu->bls = s->bls;
+	mcu->intr = s->intr;
+	mcu->wdt = s->wdt;
+	mcu->usart = s->usart;
+	memcpy(mcu->timers, s->timers, sizeof mcu->timers);
+	if (s->san != NULL) {
+		mcu->san = *s->san;
+	}
+	return 0;
+}
+
+/* Saves the state of the MCU restored from a snapshot. */
+static int
+rsp_snapshot_save(MSIM_AVR *mcu, struct rsp_snap *s, const char *name)
+{
+	uint32_t pm_words = (mcu->flashend + 1U) / 2U;
+	uint32_t dm_bytes = mcu->ramend + 1U;
+
+	if (pm_words > ARRSZ(mcu->pm)) {
+		pm_words = (uint32_t)ARRSZ(mcu->pm);
+	}
+	if (dm_bytes > ARRSZ(mcu->dm)) {
+		dm_bytes = (uint32_t)ARRSZ(mcu->dm);
+	}
+
+	if (!s->used) {
+		s->pm = malloc(pm_words * sizeof mcu->pm[0]);
+		s->dm = malloc(dm_bytes);
+		s->san = mcu->san.on ? malloc(sizeof *s->san) : NULL;
+		if ((s->pm == NULL) || (s->dm == NULL) ||
+		                (mcu->san.on && (s->san == NULL))) {
+			free(s->pm);
+			free(s->dm);
+			free(s->san);
+			memset(s, 0, sizeof *s);
+			rsp_print(mcu, "can't allocate snapshot\n");
+			return -1;
+		}
+		s->pm_words = pm_words;
+		s->dm_bytes = dm_bytes;
+		snprintf(s->name, sizeof s->name, "%s", name);
+		s->used = 1;
+	}
+
+	s->tick = mcu->tick;
+	s->tovf = mcu->tovf;
+	s->insts = mcu->insts;
+	s->freq = mcu->freq;
+	s->clk_source = mcu->clk_source;
+	s->lockbits = mcu->lockbits;
+	memcpy(s->fuse, mcu->fuse, sizeof s->fuse);
+	s->pc = mcu->pc;
+	s->ic_left = mcu->ic_left;
+	s->mci = mcu->mci;
+	memcpy(s->pm, mcu->pm, s->pm_words * sizeof mcu->pm[0]);
+	memcpy(s->dm, mcu->dm, s->dm_bytes);
+	s->bls = mcu->bls;
+	s->intr = mcu->intr;
+	s->wdt = mcu->wdt;
+	s->usart = mcu->usart;
+	memcpy(s->timers, mcu->timers, sizeof s->timers);
+	if (s->san != NULL) {
+		*s->san = mcu->san;
+	}
+	return 0;
+}
+
+/*
+ * Replies with a part of the memory map: flash (erased and written in
+ * pages by vFlash packets) and data memory.
+ */
+static void
+rsp_memory_map(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	char map[1024];
+
+	/* GDB refuses to access memory outside of the map, so EEPROM (at
+	 * 0x810000), fuses (0x820000) and lock bits (0x830000) are listed
+	 * in addition to the program and data memory. */
+	snprintf(map, sizeof map,
+	         "<?xml version=\"1.0\"?>"
+	         "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB "
+	         "Memory Map V1.0//EN\" \"http://sourceware.org/gdb/"
+	         "gdb-memory-map.dtd\">"
+	         "<memory-map>"
+	         "<memory type=\"flash\" start=\"0x0\" length=\"0x%" PRIX32
+	         "\"><property name=\"blocksize\">0x%" PRIX32 "</property>"
+	         "</memory>"
+	         "<memory type=\"ram\" start=\"0x800000\" length=\"0x%"
+	         PRIX32 "\"/>"
+	         "<memory type=\"ram\" start=\"0x810000\" length=\"0x%"
+	         PRIX32 "\"/>"
+	         "<memory type=\"ram\" start=\"0x820000\" length=\"0x%zX\"/>"
+	         "<memory type=\"ram\" start=\"0x830000\" length=\"0x1\"/>"
+	         "</memory-map>",
+	         mcu->flashend + 1U,
+	         (mcu->spm_pagesize > 0U) ? mcu->spm_pagesize : 2U,
+	         mcu->ramend + 1U, mcu->e2end + 1U, ARRSZ(mcu->fuse));
+
+	rsp_xfer(mcu, buf, "qXfer:memory-map:read::", map);
+}
+
+/* Replies with a part of the document requested by qXfer. */
+static void
+rsp_xfer(MSIM_AVR *mcu, rsp_buf *buf, const char *obj, const char *doc)
+{
+	const size_t doclen = strlen(doc);
+	unsigned long off, len;
+	char *end;
+
+	off = strtoul(&buf->data[strlen(obj)], &end, 16);
+	if (end[0] != ',') {
+		put_str_packet(mcu, "E01");
+		return;
+	}
+	len = strtoul(&end[1], NULL, 16);
+
+	if (off >= doclen) {
+		put_str_packet(mcu, "l");
+		return;
+	}
+	if (len > (GDB_BUF_MAX - 2U)) {
+		len = GDB_BUF_MAX - 2U;
+	}
+	if (len > (doclen - off)) {
+		len = doclen - off;
+	}
+
+	buf->data[0] = ((off + len) < doclen) ? 'm' : 'l';
+	memcpy(&buf->data[1], &doc[off], len);
+	buf->data[len + 1] = 0;
+	buf->len = len + 1;
+	put_packet(mcu, buf);
+}
+
+/* Erases (fills with 0xFF) a region of the program memory. */
+static void
+rsp_flash_erase(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	unsigned long addr, len;
+
+	if ((sscanf(buf->data, "vFlashErase:%lx,%lx", &addr, &len) != 2) ||
+	                ((addr + len) > (mcu->flashend + 1UL))) {
+		snprintf(LOG, LOGSZ, "flash erase request not recognized or "
+		         "out of flash memory: %s", buf->data);
+		MSIM_LOG_ERROR(LOG);
+
+		put_str_packet(mcu, "E01");
+		return;
+	}
+
+	for (unsigned long i = addr; i < (addr + len); i++) {
+		mcu->pm[i >> 1] |= (uint16_t)(0xFFU << ((i & 1U) * 8U));
+	}
+	put_str_packet(mcu, "OK");
+}
+
+/* Writes binary data to the program memory. */
+static void
+rsp_flash_write(MSIM_AVR *mcu, rsp_buf *buf)
+{
+	unsigned long addr, len;
+	uint16_t mask;
+	char *bindat;
+	uint8_t b;
+
+	bindat = memchr(&buf->data[strlen("vFlashWrite:")], ':',
+	                buf->len - strlen("vFlashWrite:"));
+	if ((bindat == NULL) ||
+	                (sscanf(buf->data, "vFlashWrite:%lx:", &addr) != 1)) {
+		snprintf(LOG, LOGSZ, "flash write request not recognized: "
+		         "%.32s", buf->data);
+		MSIM_LOG_ERROR(LOG);
+
+		put_str_packet(mcu, "E01");
+		return;
+	}
+	bindat++;
+	len = rsp_unescape(bindat, buf->len -
+	                   (unsigned long)(bindat - buf->data));
+
+	if ((addr + len) > (mcu->flashend + 1UL)) {
+		snprintf(LOG, LOGSZ, "flash write 0x%08lX,%lu is out of flash "
+		         "memory", addr, len);
+		MSIM_LOG_ERROR(LOG);
+
+		put_str_packet(mcu, "E03");
+		return;
+	}
+
+	for (unsigned long i = 0; i < len; i++) {
+		b = (uint8_t)bindat[i];
+		mask = (uint16_t)(0xFFU << (((addr + i) & 1U) * 8U));
+		mcu->pm[(addr + i) >> 1] = (uint16_t)(
+		        (mcu->pm[(addr + i) >> 1] & ~mask) |
+		        ((uint16_t)(b << (((addr + i) & 1U) * 8U)) & mask));
+	}
+	rsp.flash_bytes += (uint32_t)len;
+	put_str_packet(mcu, "OK");
+}
+
 static void
 rsp_restart(void)
 {
-	rsp.mcu->pc = rsp.mcu->intr.reset_pc;
-	rsp.mcu->state = AVR_STOPPED;
+	for (uint32_t i = 0; i < rsp.mcus_num; i++) {
+		rsp.mcus[i]->pc = rsp.mcus[i]->intr.reset_pc;
+		rsp.mcus[i]->state = AVR_STOPPED;
+	}
 }
 
 static size_t
@@ -1171,6 +3164,9 @@ read_reg(int n, char *buf, size_t blen)
 	 * This function reads registers in order required to reply to
 	 * GDB client. Remember that N is not an index in this case!
 	 */
+	if (rsp.frame_cur >= 0) {
+		return read_frame_reg(n, buf, blen);
+	}
 	if (n >= 0 && n <= 31) {	/* GPR0..31 */
 		snprintf(buf, blen, "%02X", rsp.mcu->dm[n]);
 
@@ -1211,8 +3207,8 @@ write_reg(int n, char *buf)
 		break;
 	case 33:			/* SPH and SPL */
 		v = hex2reg(buf, 4);
-		*rsp.mcu->sph = (unsigned char)(v&0xFF);
-		*rsp.mcu->spl = (unsigned char)((v>>8)&0xFF);
+		*rsp.mcu->sph = (unsigned char)((v>>8)&0xFF);
+		*rsp.mcu->spl = (unsigned char)(v&0xFF);
 		break;
 	case 34:			/* PC */
 		rsp.mcu->pc = (uint32_t) (hex2reg(buf, 8) >> 1);
@@ -1243,7 +3239,7 @@ rsp_write_all_regs(MSIM_AVR *mcu, rsp_buf *buf)
 	unsigned int n, off;
 	unsigned long v;
 
-	off = 0;
+	off = 1;			/* Skip 'G' */
 	for (n = 0; n < 35; n++) {
 		if (n <= 31) { /* General purpose regs 0..31 */
 			rsp.mcu->dm[n] = (unsigned char)
@@ -1261,8 +3257,8 @@ rsp_write_all_regs(MSIM_AVR *mcu, rsp_buf *buf)
 		case 33: /* SPH and SPL */
 			v = hex2reg(buf->data+off, 4);
 			off += 4;
-			*rsp.mcu->sph = (unsigned char)(v&0xFF);
-			*rsp.mcu->spl = (unsigned char)((v>>8)&0xFF);
+			*rsp.mcu->sph = (unsigned char)((v>>8)&0xFF);
+			*rsp.mcu->spl = (unsigned char)(v&0xFF);
 			break;
 		case 34: /* PC */
 			rsp.mcu->pc = (uint32_t)(hex2reg(buf->data+off, 8) >> 1);
@@ -1303,7 +3299,14 @@ rsp_read_mem(MSIM_AVR *mcu, rsp_buf *buf)
 	}
 
 	/* Find a memory to read from */
-	if (addr < rsp.mcu->flashend) {
+	if (rsp.frame_cur >= 0) {
+		/* Memory collected in the trace frame */
+		if (read_frame_mem(addr, tmp_buf, len) != 0) {
+			put_str_packet(mcu, "E01");
+			return;
+		}
+		src = &tmp_buf[0];
+	} else if (addr < rsp.mcu->flashend) {
 		pm = rsp.mcu->pm + (addr >> 1);
 
 		/* Prepare bytes of the progmem */
@@ -1325,6 +3328,11 @@ rsp_read_mem(MSIM_AVR *mcu, rsp_buf *buf)
 		//src = rsp.mcu->ee + addr - 0x810000;
 		put_str_packet(mcu, "E01");
 		return;
+	} else if ((addr >= 0x820000) &&
+	                ((addr-0x820000+len) <= ARRSZ(rsp.mcu->fuse))) {
+		src = rsp.mcu->fuse + addr - 0x820000;
+	} else if ((addr == 0x830000) && (len == 1U)) {
+		src = &rsp.mcu->lockbits;
 	} else {
 		snprintf(LOG, LOGSZ, "Unable to read memory %08X, %08X",
 		         addr, len);
@@ -1528,6 +3536,6 @@ rsp_unescape(char *data, unsigned long len)
 static void
 rsp_step(struct rsp_buf *buf)
 {
-	rsp.mcu->state = AVR_MSIM_STEP;
-	rsp.client_waiting = 1;
+	rsp.cmcu->state = AVR_MSIM_STEP;
+	rsp_resume();
 }
@@ -52,9 +52,14 @@ MSIM_AVR_IOSyncPinx(struct MSIM_AVR *mcu)
 			break;
 		}
 
-		/* Update PINx from a pending value */
+		/* Update PINx from a pending value. It's the port itself
+		 * which drives the pins, i.e. PINx is updated even if it's
+		 * read-only for the firmware (PINx_MASK is zero). */
 		if (p->pending == 1U) {
-			IOBIT_WR(mcu, &p->pin, p->ppin);
+			pinx = (uint32_t)p->pin.mask << p->pin.bit;
+			DM(p->pin.reg) = (uint8_t)((DM(p->pin.reg) & ~pinx) |
+			                 (((uint32_t)p->ppin << p->pin.bit) &
+			                  pinx));
 			p->pending = 0;
 		}
 
@@ -22,8 +22,67 @@
  * displays, etc.) connected to the simulated microcontroller.
  *
  * This file provides basic functions to load, run and unload these models.
+ *
+ * A model is called by the simulator only when something relevant to the
+ * model happens. It may define any of these functions:
+ *
+ *	module_tick(mcu)			- every cycle of the MCU;
+ *	module_on_write(mcu, reg, old, new)	- I/O register is written by
+ *						  the firmware;
+ *	module_on_pin_edge(mcu, port, bit, level) - level of the pin (bit of
+ *						  PORTx) has been changed.
+ *
+ * A model may also call a function once the given number of cycles passed
+ * using module_schedule(delay_cycles, fn). The function is called as fn(mcu).
+ *
+ * A model may run on a worker thread if module_thread(period_cycles) is
+ * called by its module_conf(mcu). The MCU and the model are synchronized
+ * every period_cycles, and earlier if too many events are queued for the
+ * model. The model sees a copy of the data memory, state, frequency and
+ * cycle of the MCU taken at the last sync point and receives the events
+ * occurred since the previous one, followed by the scheduled functions
+ * due and module_tick(mcu, cycles) with a number of cycles passed. Data
+ * memory and state of the MCU changed by the model are applied to the MCU
+ * at the next sync point, so the simulation is deterministic regardless of
+ * the speed of the thread.
+ *
+ * A model may define module_scenario(mcu) to script a test. It's started
+ * at the first cycle and may call these functions to wait for the MCU
+ * without ticking the model every cycle:
+ *
+ *	run_until(cond, max_cycles)	- waits for cond(mcu) to be true,
+ *					  returns false on timeout; cond is
+ *					  checked on pin edges and writes;
+ *	expect_pin(port, bit, level, within_cycles)
+ *					- waits for level of the pin (0 or 1);
+ *	send_uart(bytes)		- sends a string to the USART of
+ *					  the MCU, a byte per frame;
+ *	expect_uart(pattern, cycles)	- waits for the Lua pattern to be
+ *					  transmitted by the USART, returns
+ *					  the match.
+ *
+ * Failed expectation (or error) fails the test, i.e. the MCU is set to
+ * AVR_MSIM_TESTFAIL state. The MCU is stopped once the scenario returns.
+ * Timeouts are optional, nil means no timeout.
+ *
+ * Addresses of the I/O registers are available to the models as globals
+ * (PORTB, DDRB, etc.) and as fields of IO table (IO.PORTB, etc.). They're
+ * resolved on the first access using an index of the register names built
+ * once per MCU and shared by all of its models.
+ *
+ * Data memory and I/O ports of the MCU are available to the models as
+ * AVR_DM (uint8_t *) and AVR_PORTS (MSIM_AVR_IOPort *) cdata if MCUSim is
+ * built with LuaJIT. AVR_Read*, AVR_Write* and other functions to access
+ * registers are replaced by Lua ones in this case, i.e. they're compiled
+ * by JIT together with the model instead of calling C functions.
  */
+#if defined(WITH_POSIX)
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#endif
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "mcusim/mcusim.h"
 #include "mcusim/log.h"
@@ -33,102 +92,498 @@
 #include "lualib.h"
 #include "lauxlib.h"
 
-static lua_State *lua_states[MSIM_AVR_LUAMODELS];
-static uint64_t models_num;
+/* Functions of the model called by the simulator */
+enum {
+	FN_TICK = 0,
+	FN_WRITE,
+	FN_EDGE,
+	FN_NUM
+};
+
+/* Function of the model to be called at the given cycle */
+struct lua_timer {
+	uint64_t tick;			/* Cycle to call the function at */
+	int ref;			/* Reference to the function */
+	uint32_t id;			/* Identifier to cancel the call */
+};
+
+/* Event of the MCU to be delivered to a model */
+struct lua_event {
+	uint32_t fn;			/* Function of the model to call */
+	uint32_t a;			/* Register or port */
+	uint8_t b;			/* Old value or bit */
+	uint8_t c;			/* New value or level */
+};
+
+#if defined(WITH_POSIX)
+/* Worker thread of the model and data exchanged at the sync points */
+struct lua_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* Model is started or finished */
+	uint8_t busy;			/* Model is running */
+	uint8_t quit;			/* Thread should exit */
+	uint8_t *dm;			/* Data memory seen by the model */
+	uint8_t *base;			/* Data memory at the last sync */
+	uint32_t dm_size;		/* Size of the data memory to sync */
+	enum MSIM_AVR_State state;	/* State of the MCU at the last sync */
+	enum MSIM_AVR_State mstate;	/* State seen by the model */
+	uint64_t tick;			/* Cycle seen by the model */
+	uint32_t freq;			/* Frequency seen by the model */
+	uint64_t period;		/* Cycles between the sync points */
+	uint64_t sync_at;		/* Cycle of the next sync point */
+	uint64_t last;			/* Cycle of the last sync point */
+	uint64_t cycles;		/* Cycles passed to module_tick */
+	struct lua_event ev[MSIM_AVR_LUAEVENTS]; /* Events to be delivered */
+	uint32_t ev_num;
+	struct lua_event run[MSIM_AVR_LUAEVENTS]; /* Events being delivered */
+	uint32_t run_num;
+};
+#else
+struct lua_worker;
+#endif
+
+/* Device model defined as Lua script */
+struct lua_model {
+	lua_State *L;			/* Lua state of the model */
+	struct MSIM_AVR *mcu;		/* MCU the model is loaded for */
+	struct MSIM_AVR_LUAView view;	/* MCU as it's seen by the model */
+	int fn[FN_NUM];			/* References to the model functions */
+	struct lua_timer timers[MSIM_AVR_LUATIMERS]; /* Scheduled calls */
+	uint32_t timers_num;		/* Number of scheduled calls */
+	uint32_t timers_id;		/* Identifier of the last call */
+	int ffi_bind;			/* Binds FFI API to the data memory */
+	struct lua_worker *w;		/* Worker thread, NULL if there's none */
+};
+
+/* I/O register of the MCU known by its name */
+struct reg_name {
+	const char *name;		/* Name of the register */
+	int32_t off;			/* Address of the register */
+};
+
+/* Names of the I/O registers of the MCU sorted for a binary search */
+struct reg_index {
+	struct MSIM_AVR *mcu;		/* MCU the index is built for */
+	struct reg_name *regs;		/* Registers sorted by name */
+	uint32_t regs_num;		/* Number of registers */
+	struct reg_index *next;		/* Index of another MCU */
+};
+
+static const char *fn_names[FN_NUM] = {
+	"module_tick", "module_on_write", "module_on_pin_edge"
+};
+
+
+#ifdef WITH_LUAJIT
+/*
+ * Replaces functions of the MCUSim API by the ones which access memory of
+ * the MCU via FFI. C functions are still called to report access to
+ * unknown registers and arguments which aren't numbers, e.g. nil for
+ * a register name which isn't known.
+ *
+ * Chunk returns a function to bind these ones to the data memory and I/O
+ * ports, i.e. either to the MCU or to its copy seen by a worker thread.
+ */
+static const char ffi_api[] =
+	"local ffi = require('ffi')\n"
+	"local bit = require('bit')\n"
+	"local lo, hi, regs = ...\n"
+	"ffi.cdef[[\n"
+	"typedef struct { uint32_t reg; uint32_t mask; uint8_t bit;\n"
+	"                 uint8_t mbits; } MSIM_AVR_IOBit;\n"
+	"typedef struct { MSIM_AVR_IOBit port, ddr, pin; uint8_t pending;\n"
+	"                 uint8_t ppin; } MSIM_AVR_IOPort;\n"
+	"]]\n"
+	"local m, band, shl = nil, bit.band, bit.lshift\n"
+	"local c = {}\n"
+	"for _, f in ipairs({'ReadIO', 'ReadIO16', 'WriteIO', 'WriteIO16',\n"
+	"                    'IOBit', 'SetIOBit', 'ReadReg', 'WriteReg',\n"
+	"                    'RegBit', 'SetRegBit'}) do\n"
+	"  c[f] = _G['AVR_' .. f]\n"
+	"end\n"
+	"local function num(x) return type(x) == 'number' end\n"
+	"local function io(r) return num(r) and r >= lo and r < hi end\n"
+	"local function gp(r) return num(r) and r >= 0 and r < regs end\n"
+	"local function b8(b) return num(b) and b >= 0 and b < 8 end\n"
+	"local function set(r, b, v)\n"
+	"  if band(v, 1) ~= 0 then m[r] = bit.bor(m[r], shl(1, b))\n"
+	"  else m[r] = band(m[r], bit.bnot(shl(1, b))) end\n"
+	"end\n"
+	"function AVR_ReadIO(mcu, r)\n"
+	"  if io(r) then return m[r] end\n"
+	"  return c.ReadIO(mcu, r)\n"
+	"end\n"
+	"function AVR_ReadIO16(mcu, h, l)\n"
+	"  if io(h) and io(l) then return m[h] * 256 + m[l] end\n"
+	"  return c.ReadIO16(mcu, h, l)\n"
+	"end\n"
+	"function AVR_WriteIO(mcu, r, v)\n"
+	"  if io(r) and num(v) then m[r] = band(v, 0xFF)\n"
+	"  else c.WriteIO(mcu, r, v) end\n"
+	"end\n"
+	"function AVR_WriteIO16(mcu, h, l, v)\n"
+	"  if io(h) and io(l) and num(v) then\n"
+	"    m[h] = band(bit.rshift(v, 8), 0xFF); m[l] = band(v, 0xFF)\n"
+	"  else\n"
+	"    c.WriteIO16(mcu, h, l, v)\n"
+	"  end\n"
+	"end\n"
+	"function AVR_IOBit(mcu, r, b)\n"
+	"  if io(r) and b8(b) then return band(m[r], shl(1, b)) ~= 0 end\n"
+	"  return c.IOBit(mcu, r, b)\n"
+	"end\n"
+	"function AVR_SetIOBit(mcu, r, b, v)\n"
+	"  if io(r) and b8(b) and num(v) then set(r, b, v)\n"
+	"  else c.SetIOBit(mcu, r, b, v) end\n"
+	"end\n"
+	"function AVR_ReadReg(mcu, r)\n"
+	"  if gp(r) then return m[r] end\n"
+	"  return c.ReadReg(mcu, r)\n"
+	"end\n"
+	"function AVR_WriteReg(mcu, r, v)\n"
+	"  if gp(r) and num(v) then m[r] = band(v, 0xFF)\n"
+	"  else c.WriteReg(mcu, r, v) end\n"
+	"end\n"
+	"function AVR_RegBit(mcu, r, b)\n"
+	"  if gp(r) and b8(b) then return band(m[r], shl(1, b)) ~= 0 end\n"
+	"  return c.RegBit(mcu, r, b)\n"
+	"end\n"
+	"function AVR_SetRegBit(mcu, r, b, v)\n"
+	"  if gp(r) and b8(b) and num(v) then set(r, b, v)\n"
+	"  else c.SetRegBit(mcu, r, b, v) end\n"
+	"end\n"
+	"return function(dm, ports)\n"
+	"  AVR_DM = ffi.cast('uint8_t *', dm)\n"
+	"  AVR_PORTS = ffi.cast('MSIM_AVR_IOPort *', ports)\n"
+	"  m = AVR_DM\n"
+	"end\n";
+#endif
+
+/*
+ * Runs module_scenario(mcu) of the model as a coroutine which is resumed
+ * only when something it waits for happens (pin edge, register written,
+ * timeout), i.e. the model isn't ticked every cycle.
+ */
+static const char scenario_api[] =
+	"local mcu = ...\n"
+	"local scenario = module_scenario\n"
+	"if type(scenario) ~= 'function' then return end\n"
+	"local on_write, on_edge = module_on_write, module_on_pin_edge\n"
+	"local udr, ucsra = IO.UDR or IO.UDR0, IO.UCSRA or IO.UCSR0A\n"
+	"local ubrrl, ubrrh = IO.UBRRL or IO.UBRR0L, IO.UBRRH or IO.UBRR0H\n"
+	"local co, waiting, gen, timeout = nil, nil, 0, nil\n"
+	"local uart_in, uart_out, feeding = {}, '', false\n"
+	"local function resume(...)\n"
+	"  local ok, err = coroutine.resume(co, ...)\n"
+	"  if not ok then\n"
+	"    print('[scenario] failed: ' .. tostring(err))\n"
+	"    MSIM_SetState(mcu, AVR_MSIM_TESTFAIL)\n"
+	"  elseif coroutine.status(co) == 'dead' then\n"
+	"    MSIM_SetState(mcu, AVR_MSIM_STOP)\n"
+	"  end\n"
+	"end\n"
+	"local function wait(cond, cycles)\n"
+	"  if cond() then return true end\n"
+	"  gen = gen + 1\n"
+	"  local g = gen\n"
+	"  waiting = cond\n"
+	"  if cycles ~= nil then\n"
+	"    timeout = module_schedule(cycles, function(m)\n"
+	"      mcu = m\n"
+	"      if gen == g then\n"
+	"        timeout, waiting = nil, nil; resume(false)\n"
+	"      end\n"
+	"    end)\n"
+	"  end\n"
+	"  return coroutine.yield()\n"
+	"end\n"
+	"local function check()\n"
+	"  if waiting ~= nil and waiting() then\n"
+	"    waiting = nil; gen = gen + 1\n"
+	"    if timeout ~= nil then module_cancel(timeout); timeout = nil end\n"
+	"    resume(true)\n"
+	"  end\n"
+	"end\n"
+	"local function frame()\n"
+	"  local b = AVR_ReadIO(mcu, ubrrl)\n"
+	"  if ubrrh ~= nil then\n"
+	"    b = b + (AVR_ReadIO(mcu, ubrrh) % 16) * 256\n"
+	"  end\n"
+	"  local x2 = math.floor(AVR_ReadIO(mcu, ucsra) / 2) % 2\n"
+	"  return 10 * (16 - 8 * x2) * (b + 1)\n"
+	"end\n"
+	"local function feed(m)\n"
+	"  mcu = m\n"
+	"  if #uart_in == 0 then feeding = false; return end\n"
+	"  if AVR_ReadIO(mcu, ucsra) < 128 then\n"
+	"    AVR_WriteIO(mcu, udr, table.remove(uart_in, 1))\n"
+	"    AVR_SetIOBit(mcu, ucsra, 7, 1)\n"
+	"  end\n"
+	"  module_schedule(frame(), feed)\n"
+	"end\n"
+	"function run_until(cond, cycles)\n"
+	"  return wait(function() return cond(mcu) end, cycles)\n"
+	"end\n"
+	"function expect_pin(port, bit, level, cycles)\n"
+	"  local function cond()\n"
+	"    local pin = AVR_ReadPort(mcu, port)\n"
+	"    return pin ~= nil and math.floor(pin / 2 ^ bit) % 2 == level\n"
+	"  end\n"
+	"  if not wait(cond, cycles) then\n"
+	"    error(string.format('pin %s.%d is not %d within %s cycles',\n"
+	"                        tostring(port), bit, level,\n"
+	"                        tostring(cycles)), 2)\n"
+	"  end\n"
+	"  return true\n"
+	"end\n"
+	"function send_uart(bytes)\n"
+	"  if udr == nil then error('MCU has no USART', 2) end\n"
+	"  for i = 1, #bytes do\n"
+	"    uart_in[#uart_in + 1] = string.byte(bytes, i)\n"
+	"  end\n"
+	"  if not feeding then feeding = true; feed(mcu) end\n"
+	"end\n"
+	"function expect_uart(pattern, cycles)\n"
+	"  local s, e\n"
+	"  local function cond()\n"
+	"    s, e = string.find(uart_out, pattern)\n"
+	"    return s ~= nil\n"
+	"  end\n"
+	"  if not wait(cond, cycles) then\n"
+	"    error(string.format('%q is not received within %s cycles',\n"
+	"                        pattern, tostring(cycles)), 2)\n"
+	"  end\n"
+	"  local r = string.sub(uart_out, s, e)\n"
+	"  uart_out = string.sub(uart_out, e + 1)\n"
+	"  return r\n"
+	"end\n"
+	"function module_on_write(m, reg, old, val)\n"
+	"  mcu = m\n"
+	"  if on_write ~= nil then on_write(m, reg, old, val) end\n"
+	"  if reg == udr then uart_out = uart_out .. string.char(val) end\n"
+	"  check()\n"
+	"end\n"
+	"function module_on_pin_edge(m, port, bit, level)\n"
+	"  mcu = m\n"
+	"  if on_edge ~= nil then on_edge(m, port, bit, level) end\n"
+	"  check()\n"
+	"end\n"
+	"module_schedule(1, function(m)\n"
+	"  mcu = m\n"
+	"  co = coroutine.create(scenario)\n"
+	"  resume(m)\n"
+	"end)\n";
+
+static struct lua_model models[MSIM_AVR_LUAMODELS];
+static uint32_t models_num;
+static struct reg_index *indexes;	/* Indexes built for the MCUs */
+
+static int	schedule(lua_State *L);
+static int	cancel(lua_State *L);
+static int	thread(lua_State *L);
+static int	func_ref(lua_State *L, const char *name);
+static void	call_model(struct lua_model *m, int nargs, const char *fn);
+static void	call_event(struct lua_model *m, const struct lua_event *e);
+static void	notify(struct MSIM_AVR *mcu, uint32_t fn, uint32_t a,
+		       uint8_t b, uint8_t c);
+static void	bind_ffi(struct lua_model *m, uint8_t *dm);
+static struct reg_index *reg_index(struct MSIM_AVR *mcu);
+static void	bind_regs(lua_State *L, struct reg_index *idx);
+static int	reg_lookup(lua_State *L);
+static int	reg_cmp(const void *a, const void *b);
+static int	reg_sort(const void *a, const void *b);
+#if defined(WITH_POSIX)
+static void	sync_model(struct lua_model *m);
+static void	stop_worker(struct lua_model *m);
+static void	*run_worker(void *arg);
+#endif
 
 int
 MSIM_AVR_LUALoadModel(struct MSIM_AVR *mcu, char *model)
 {
+	struct lua_model *m;
+	struct reg_index *idx;
+	lua_State *L;
 	uint8_t err = 0;
-	uint64_t i = models_num;
+
+	if (models_num >= ARRSZ(models)) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: too "
+		         "many models", model);
+		MSIM_LOG_ERROR(LOG);
+		return 1;
+	}
+	m = &models[models_num];
+
+	idx = reg_index(mcu);
+	if (idx == NULL) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: no "
+		         "memory for names of the registers", model);
+		MSIM_LOG_ERROR(LOG);
+		return 1;
+	}
 
 	/* Initialize Lua */
-	lua_states[i] = luaL_newstate();
+	L = luaL_newstate();
 	/* Load various Lua libraries */
-	luaL_openlibs(lua_states[i]);
+	luaL_openlibs(L);
 
 	/* Load peripheral */
-	if (luaL_loadfile(lua_states[i], model) ||
-	                lua_pcall(lua_states[i], 0, 0, 0)) {
+	if (luaL_loadfile(L, model) || lua_pcall(L, 0, 0, 0)) {
 		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: %s",
-		         model, lua_tostring(lua_states[i], -1));
+		         model, lua_tostring(L, -1));
 		MSIM_LOG_ERROR(LOG);
+		lua_close(L);
 		err = 1;
 	} else {
 		models_num++;
+		m->L = L;
+		m->mcu = mcu;
+		m->view.avr = mcu;
+		m->view.dm = mcu->dm;
+		m->view.state = &mcu->state;
+		m->view.freq = &mcu->freq;
+		m->view.ramend = mcu->ramend;
+		m->view.sfr_off = mcu->sfr_off;
+		m->view.regs_num = mcu->regs_num;
+		m->view.ioregs_num = mcu->ioregs_num;
+		m->timers_num = 0;
+		m->ffi_bind = LUA_NOREF;
+		m->w = NULL;
 		/* Register MCUSim API functions */
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRIOBit);
-		lua_setglobal(lua_states[i], "AVR_IOBit");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRReadIO);
-		lua_setglobal(lua_states[i], "AVR_ReadIO");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRReadIO16);
-		lua_setglobal(lua_states[i], "AVR_ReadIO16");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRReadReg);
-		lua_setglobal(lua_states[i], "AVR_ReadReg");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRRegBit);
-		lua_setglobal(lua_states[i], "AVR_RegBit");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRSetIOBit);
-		lua_setglobal(lua_states[i], "AVR_SetIOBit");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRSetRegBit);
-		lua_setglobal(lua_states[i], "AVR_SetRegBit");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRWriteIO);
-		lua_setglobal(lua_states[i], "AVR_WriteIO");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRWriteIO16);
-		lua_setglobal(lua_states[i], "AVR_WriteIO16");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_AVRWriteReg);
-		lua_setglobal(lua_states[i], "AVR_WriteReg");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_SetState);
-		lua_setglobal(lua_states[i], "MSIM_SetState");
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_Freq);
-		lua_setglobal(lua_states[i], "MSIM_Freq");
+		lua_pushcfunction(L, MSIM_LUAF_AVRIOBit);
+		lua_setglobal(L, "AVR_IOBit");
+		lua_pushcfunction(L, MSIM_LUAF_AVRReadIO);
+		lua_setglobal(L, "AVR_ReadIO");
+		lua_pushcfunction(L, MSIM_LUAF_AVRReadIO16);
+		lua_setglobal(L, "AVR_ReadIO16");
+		lua_pushcfunction(L, MSIM_LUAF_AVRReadReg);
+		lua_setglobal(L, "AVR_ReadReg");
+		lua_pushcfunction(L, MSIM_LUAF_AVRRegBit);
+		lua_setglobal(L, "AVR_RegBit");
+		lua_pushcfunction(L, MSIM_LUAF_AVRSetIOBit);
+		lua_setglobal(L, "AVR_SetIOBit");
+		lua_pushcfunction(L, MSIM_LUAF_AVRSetRegBit);
+		lua_setglobal(L, "AVR_SetRegBit");
+		lua_pushcfunction(L, MSIM_LUAF_AVRWriteIO);
+		lua_setglobal(L, "AVR_WriteIO");
+		lua_pushcfunction(L, MSIM_LUAF_AVRWriteIO16);
+		lua_setglobal(L, "AVR_WriteIO16");
+		lua_pushcfunction(L, MSIM_LUAF_AVRWriteReg);
+		lua_setglobal(L, "AVR_WriteReg");
+		lua_pushcfunction(L, MSIM_LUAF_AVRReadBlock);
+		lua_setglobal(L, "AVR_ReadBlock");
+		lua_pushcfunction(L, MSIM_LUAF_AVRWriteBlock);
+		lua_setglobal(L, "AVR_WriteBlock");
+		lua_pushcfunction(L, MSIM_LUAF_AVRReadPort);
+		lua_setglobal(L, "AVR_ReadPort");
+		lua_pushcfunction(L, MSIM_LUAF_AVRWritePins);
+		lua_setglobal(L, "AVR_WritePins");
+		lua_pushcfunction(L, MSIM_LUAF_SetState);
+		lua_setglobal(L, "MSIM_SetState");
+		lua_pushcfunction(L, MSIM_LUAF_Freq);
+		lua_setglobal(L, "MSIM_Freq");
+		/* Scheduler knows the model it's called by */
+		lua_pushlightuserdata(L, m);
+		lua_pushcclosure(L, schedule, 1);
+		lua_setglobal(L, "module_schedule");
+		lua_pushlightuserdata(L, m);
+		lua_pushcclosure(L, cancel, 1);
+		lua_setglobal(L, "module_cancel");
+		lua_pushlightuserdata(L, m);
+		lua_pushcclosure(L, thread, 1);
+		lua_setglobal(L, "module_thread");
 		/* Override existing Lua functions */
-		lua_pushcfunction(lua_states[i], MSIM_LUAF_Print);
-		lua_setglobal(lua_states[i], "print");
-
-		/* Add registers available for the current MCU model to
-		 * the Lua state. */
-		for (uint32_t j = 0; j < MSIM_AVR_DMSZ; j++) {
-			if (mcu->ioregs[j].off < 0) {
-				continue;
-			}
-			if (mcu->ioregs[j].name[0] == 0) {
-				continue;
+		lua_pushcfunction(L, MSIM_LUAF_Print);
+		lua_setglobal(L, "print");
+#ifdef WITH_LUAJIT
+		/* Access memory of the MCU via FFI */
+		if (luaL_loadbuffer(L, ffi_api, sizeof ffi_api - 1U,
+		                    "=ffi_api") != 0) {
+			snprintf(LOG, LOGSZ, "cannot load FFI API: %s",
+			         lua_tostring(L, -1));
+			MSIM_LOG_ERROR(LOG);
+			lua_pop(L, 1);
+		} else {
+			lua_pushinteger(L, (lua_Integer)mcu->sfr_off);
+			lua_pushinteger(L, (lua_Integer)(mcu->sfr_off +
+			                                 mcu->ioregs_num));
+			lua_pushinteger(L, (lua_Integer)mcu->regs_num);
+			if (lua_pcall(L, 3, 1, 0) != 0) {
+				snprintf(LOG, LOGSZ, "cannot load FFI API: "
+				         "%s", lua_tostring(L, -1));
+				MSIM_LOG_ERROR(LOG);
+				lua_pop(L, 1);
+			} else {
+				m->ffi_bind = luaL_ref(L, LUA_REGISTRYINDEX);
+				bind_ffi(m, mcu->dm);
 			}
-
-			lua_pushinteger(lua_states[i],
-			                (int)mcu->ioregs[j].off);
-			lua_setglobal(lua_states[i], mcu->ioregs[j].name);
 		}
+#endif
+
+		/* Registers available for the current MCU model are
+		 * looked up on demand. */
+		bind_regs(L, idx);
 
 		/* Add available MCU states to the Lua state. */
-		lua_pushinteger(lua_states[i], AVR_RUNNING);
-		lua_setglobal(lua_states[i], "AVR_RUNNING");
-		lua_pushinteger(lua_states[i], AVR_STOPPED);
-		lua_setglobal(lua_states[i], "AVR_STOPPED");
-		lua_pushinteger(lua_states[i], AVR_SLEEPING);
-		lua_setglobal(lua_states[i], "AVR_SLEEPING");
-		lua_pushinteger(lua_states[i], AVR_MSIM_STEP);
-		lua_setglobal(lua_states[i], "AVR_MSIM_STEP");
-		lua_pushinteger(lua_states[i], AVR_MSIM_STOP);
-		lua_setglobal(lua_states[i], "AVR_MSIM_STOP");
-		lua_pushinteger(lua_states[i], AVR_MSIM_TESTFAIL);
-		lua_setglobal(lua_states[i], "AVR_MSIM_TESTFAIL");
+		lua_pushinteger(L, AVR_RUNNING);
+		lua_setglobal(L, "AVR_RUNNING");
+		lua_pushinteger(L, AVR_STOPPED);
+		lua_setglobal(L, "AVR_STOPPED");
+		lua_pushinteger(L, AVR_SLEEPING);
+		lua_setglobal(L, "AVR_SLEEPING");
+		lua_pushinteger(L, AVR_MSIM_STEP);
+		lua_setglobal(L, "AVR_MSIM_STEP");
+		lua_pushinteger(L, AVR_MSIM_STOP);
+		lua_setglobal(L, "AVR_MSIM_STOP");
+		lua_pushinteger(L, AVR_MSIM_TESTFAIL);
+		lua_setglobal(L, "AVR_MSIM_TESTFAIL");
 
 		/* Attempt to call configuration function of the
 		 * current model */
-		lua_getglobal(lua_states[i], "module_conf");
-		lua_pushlightuserdata(lua_states[i], mcu);
-		if (lua_pcall(lua_states[i], 1, 0, 0) != 0) {
+		lua_getglobal(L, "module_conf");
+		lua_pushlightuserdata(L, &m->view);
+		if (lua_pcall(L, 1, 0, 0) != 0) {
 #ifdef DEBUG
 			snprintf(LOG, LOGSZ, "model %s does not provide a "
 			         "configuration function: %s", model,
-			         lua_tostring(lua_states[i], -1));
+			         lua_tostring(L, -1));
 			MSIM_LOG_DEBUG(LOG);
 #endif
+			lua_pop(L, 1);
+		}
+
+		/* Scenario subscribes to the events it waits for */
+		if (luaL_loadbuffer(L, scenario_api, sizeof scenario_api - 1U,
+		                    "=scenario_api") != 0) {
+			snprintf(LOG, LOGSZ, "cannot load scenario API: %s",
+			         lua_tostring(L, -1));
+			MSIM_LOG_ERROR(LOG);
+			lua_pop(L, 1);
+		} else {
+			lua_pushlightuserdata(L, &m->view);
+			if (lua_pcall(L, 1, 0, 0) != 0) {
+				snprintf(LOG, LOGSZ, "cannot run scenario of "
+				         "model %s: %s", model,
+				         lua_tostring(L, -1));
+				MSIM_LOG_ERROR(LOG);
+				lua_pop(L, 1);
+			}
+		}
+
+		/* Find functions the model is subscribed to and keep
+		 * references to them. */
+		for (uint32_t j = 0; j < FN_NUM; j++) {
+			m->fn[j] = func_ref(L, fn_names[j]);
+		}
+		/* Model on a worker thread is ticked at the sync points */
+		if ((m->fn[FN_TICK] != LUA_NOREF) && (m->w == NULL)) {
+			mcu->mod_ticks++;
+		}
+		if ((m->fn[FN_WRITE] != LUA_NOREF) ||
+		                (m->fn[FN_EDGE] != LUA_NOREF)) {
+			mcu->mod_events++;
 		}
-		/* Find a "module_tick" function and push it onto a stack.
-		 * This is a cache mechanism of the function value. */
-		lua_getglobal(lua_states[i], "module_tick");
 	}
 	return err;
 }
@@ -136,36 +591,590 @@ MSIM_AVR_LUALoadModel(struct MSIM_AVR *mcu, char *model)
 void
 MSIM_AVR_LUACleanModels(void)
 {
-	for (uint64_t i = 0; i < models_num; i++) {
-		if (lua_states[i] != NULL) {
-			lua_close(lua_states[i]);
+	for (uint32_t i = 0; i < models_num; i++) {
+#if defined(WITH_POSIX)
+		if (models[i].w != NULL) {
+			stop_worker(&models[i]);
+		}
+#endif
+		if (models[i].L != NULL) {
+			lua_close(models[i].L);
+			models[i].L = NULL;
 		}
 	}
 	models_num = 0;
+
+	while (indexes != NULL) {
+		struct reg_index *next = indexes->next;
+
+		free(indexes->regs);
+		free(indexes);
+		indexes = next;
+	}
 }
 
 void
 MSIM_AVR_LUATickModels(struct MSIM_AVR *mcu)
 {
+	struct lua_model *m;
+
 	for (uint32_t i = 0; i < models_num; i++) {
-		if (lua_states[i] == NULL) {
-			break;
+		m = &models[i];
+
+		/* Models are ticked by MCU they're loaded for */
+		if ((m->mcu != mcu) || (m->fn[FN_TICK] == LUA_NOREF) ||
+		                (m->w != NULL)) {
+			continue;
+		}
+		lua_rawgeti(m->L, LUA_REGISTRYINDEX, m->fn[FN_TICK]);
+		lua_pushlightuserdata(m->L, &m->view);
+		call_model(m, 1, fn_names[FN_TICK]);
+	}
+}
+
+uint64_t
+MSIM_AVR_LUARunScheduled(struct MSIM_AVR *mcu)
+{
+	struct lua_model *m;
+	uint64_t next = TICKS_MAX;
+	uint32_t j;
+	int ref;
+
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if (m->mcu != mcu) {
+			continue;
+		}
+#if defined(WITH_POSIX)
+		/* Timers of the model on a worker thread are run by the
+		 * thread itself */
+		if (m->w != NULL) {
+			if (mcu->tick >= m->w->sync_at) {
+				sync_model(m);
+			}
+			if (m->w->sync_at < next) {
+				next = m->w->sync_at;
+			}
+			continue;
+		}
+#endif
+
+		j = 0;
+		while (j < m->timers_num) {
+			if (m->timers[j].tick > mcu->tick) {
+				j++;
+				continue;
+			}
+			/* Function is called once, but it's free to schedule
+			 * itself again. */
+			ref = m->timers[j].ref;
+			m->timers[j] = m->timers[--m->timers_num];
+
+			lua_rawgeti(m->L, LUA_REGISTRYINDEX, ref);
+			luaL_unref(m->L, LUA_REGISTRYINDEX, ref);
+			lua_pushlightuserdata(m->L, &m->view);
+			call_model(m, 1, "scheduled function");
+		}
+		for (j = 0; j < m->timers_num; j++) {
+			if (m->timers[j].tick < next) {
+				next = m->timers[j].tick;
+			}
 		}
-		/* Push a cached value of the "module_tick" function onto
-		 * the stack. */
-		lua_pushvalue(lua_states[i], -1);
-		/* Push argument to call the "module_tick" function. */
-		lua_pushlightuserdata(lua_states[i], mcu);
+	}
+	return next;
+}
+
+void
+MSIM_AVR_LUAOnWrite(struct MSIM_AVR *mcu, uint32_t reg, uint8_t old,
+                    uint8_t val)
+{
+	notify(mcu, FN_WRITE, reg, old, val);
+}
+
+void
+MSIM_AVR_LUAOnPinEdge(struct MSIM_AVR *mcu, uint32_t port, uint8_t bit,
+                      uint8_t level)
+{
+	notify(mcu, FN_EDGE, port, bit, level);
+}
+
+/*
+ * Calls the model function on top of the stack. It's a protected call in
+ * debug build, errors are logged and ignored.
+ */
+static void
+call_model(struct lua_model *m, int nargs, const char *fn)
+{
 #ifndef DEBUG
-		/* Call the "module_tick" function. */
-		lua_call(lua_states[i], 1, 0);
+	lua_call(m->L, nargs, 0);
 #else
-		/* Call the "module_tick" function (protected call). */
-		if (lua_pcall(lua_states[i], 1, 0, 0) != 0) {
-			snprintf(LOG, LOGSZ, "cannot run module_tick(): %s",
-			         lua_tostring(lua_states[i], -1));
-			MSIM_LOG_DEBUG(LOG);
+	/* Model logs to its own buffer, it may run on a worker thread */
+	struct MSIM_AVR_LUAView *mcu = &m->view;
+
+	if (lua_pcall(m->L, nargs, 0, 0) != 0) {
+		snprintf(LOG, LOGSZ, "cannot run %s(): %s", fn,
+		         lua_tostring(m->L, -1));
+		MSIM_LOG_DEBUG(LOG);
+		lua_pop(m->L, 1);
+	}
+#endif
+}
+
+/* Calls the event function of the model. */
+static void
+call_event(struct lua_model *m, const struct lua_event *e)
+{
+	lua_rawgeti(m->L, LUA_REGISTRYINDEX, m->fn[e->fn]);
+	lua_pushlightuserdata(m->L, &m->view);
+	lua_pushinteger(m->L, (lua_Integer)e->a);
+	lua_pushinteger(m->L, (lua_Integer)e->b);
+	lua_pushinteger(m->L, (lua_Integer)e->c);
+	call_model(m, 4, fn_names[e->fn]);
+}
+
+/*
+ * Calls the event function of all the models subscribed to it. Event is
+ * queued for a model on a worker thread till the next sync point.
+ */
+static void
+notify(struct MSIM_AVR *mcu, uint32_t fn, uint32_t a, uint8_t b,
+       uint8_t c)
+{
+	struct lua_model *m;
+	struct lua_event e;
+
+	e.fn = fn;
+	e.a = a;
+	e.b = b;
+	e.c = c;
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if ((m->mcu != mcu) || (m->fn[fn] == LUA_NOREF)) {
+			continue;
+		}
+#if defined(WITH_POSIX)
+		if (m->w != NULL) {
+			if (m->w->ev_num >= ARRSZ(m->w->ev)) {
+				sync_model(m);
+			}
+			m->w->ev[m->w->ev_num++] = e;
+			continue;
 		}
 #endif
+		call_event(m, &e);
+	}
+}
+
+/* Points FFI API of the model to the data memory seen by the model. */
+static void
+bind_ffi(struct lua_model *m, uint8_t *dm)
+{
+	if (m->ffi_bind == LUA_NOREF) {
+		return;
 	}
+	lua_rawgeti(m->L, LUA_REGISTRYINDEX, m->ffi_bind);
+	lua_pushlightuserdata(m->L, dm);
+	lua_pushlightuserdata(m->L, m->mcu->ioports);
+	lua_call(m->L, 2, 0);
 }
+
+/* Returns a reference to the global function, if it's defined. */
+static int
+func_ref(lua_State *L, const char *name)
+{
+	lua_getglobal(L, name);
+	if (!lua_isfunction(L, -1)) {
+		lua_pop(L, 1);
+		return LUA_NOREF;
+	}
+	return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+/*
+ * Returns an index of the registers of the MCU. It's built by the first
+ * model loaded for the MCU, NULL is returned if there is no memory for it.
+ */
+static struct reg_index *
+reg_index(struct MSIM_AVR *mcu)
+{
+	struct reg_index *idx;
+	uint32_t n = 0;
+
+	for (idx = indexes; idx != NULL; idx = idx->next) {
+		if (idx->mcu == mcu) {
+			return idx;
+		}
+	}
+
+	for (uint32_t j = 0; j < MSIM_AVR_DMSZ; j++) {
+		if ((mcu->ioregs[j].off >= 0) &&
+		                (mcu->ioregs[j].name[0] != 0)) {
+			n++;
+		}
+	}
+
+	idx = malloc(sizeof(*idx));
+	if (idx == NULL) {
+		return NULL;
+	}
+	idx->regs = malloc((n > 0U ? n : 1U) * sizeof(idx->regs[0]));
+	if (idx->regs == NULL) {
+		free(idx);
+		return NULL;
+	}
+	idx->mcu = mcu;
+	idx->regs_num = 0;
+	for (uint32_t j = 0; j < MSIM_AVR_DMSZ; j++) {
+		if ((mcu->ioregs[j].off >= 0) &&
+		                (mcu->ioregs[j].name[0] != 0)) {
+			idx->regs[idx->regs_num].name = mcu->ioregs[j].name;
+			idx->regs[idx->regs_num].off = mcu->ioregs[j].off;
+			idx->regs_num++;
+		}
+	}
+	qsort(idx->regs, idx->regs_num, sizeof(idx->regs[0]), reg_sort);
+	idx->next = indexes;
+	indexes = idx;
+	return idx;
+}
+
+/*
+ * Makes the registers available as globals and fields of IO table. Both
+ * of them look up the register on the first access and keep it.
+ */
+static void
+bind_regs(lua_State *L, struct reg_index *idx)
+{
+	/* Metatable shared by the globals and IO */
+	lua_newtable(L);
+	lua_pushlightuserdata(L, idx);
+	lua_pushcclosure(L, reg_lookup, 1);
+	lua_setfield(L, -2, "__index");
+
+	lua_newtable(L);
+	lua_pushvalue(L, -2);
+	lua_setmetatable(L, -2);
+	lua_setglobal(L, "IO");
+
+	lua_getglobal(L, "_G");
+	lua_pushvalue(L, -2);
+	lua_setmetatable(L, -2);
+	lua_pop(L, 2);
+}
+
+/* __index(t, name) - address of the register, or nil if there's none. */
+static int
+reg_lookup(lua_State *L)
+{
+	const struct reg_index *idx = lua_touserdata(L, lua_upvalueindex(1));
+	const struct reg_name *r, *end;
+	struct reg_name key;
+
+	if (lua_type(L, 2) != LUA_TSTRING) {
+		lua_pushnil(L);
+		return 1;
+	}
+	key.name = lua_tostring(L, 2);
+	key.off = 0;
+	r = bsearch(&key, idx->regs, idx->regs_num, sizeof(idx->regs[0]),
+	            reg_cmp);
+	if (r == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+	/* Register with the highest address wins if names are repeated */
+	end = idx->regs + idx->regs_num;
+	while (((r + 1) < end) && (strcmp((r + 1)->name, key.name) == 0)) {
+		r++;
+	}
+
+	lua_pushinteger(L, (lua_Integer)r->off);
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 1);
+	return 1;
+}
+
+static int
+reg_cmp(const void *a, const void *b)
+{
+	const struct reg_name *ra = a;
+	const struct reg_name *rb = b;
+
+	return strcmp(ra->name, rb->name);
+}
+
+static int
+reg_sort(const void *a, const void *b)
+{
+	const struct reg_name *ra = a;
+	const struct reg_name *rb = b;
+	int rc = strcmp(ra->name, rb->name);
+
+	if (rc == 0) {
+		rc = (ra->off > rb->off) - (ra->off < rb->off);
+	}
+	return rc;
+}
+
+/*
+ * module_schedule(delay_cycles, fn) - calls the function once the given
+ * number of MCU cycles passed (at least one). Returns an identifier of
+ * the call for module_cancel().
+ */
+static int
+schedule(lua_State *L)
+{
+	struct lua_model *m = lua_touserdata(L, lua_upvalueindex(1));
+	struct MSIM_AVR *mcu = m->mcu;
+	lua_Number delay = luaL_checknumber(L, 1);
+	uint64_t tick = mcu->tick;
+	struct lua_timer *t;
+
+#if defined(WITH_POSIX)
+	/* Model on a worker thread counts cycles seen at the sync point */
+	if (m->w != NULL) {
+		tick = m->w->tick;
+	}
+#endif
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (m->timers_num >= ARRSZ(m->timers)) {
+		return luaL_error(L, "too many functions scheduled");
+	}
+
+	t = &m->timers[m->timers_num++];
+	if (delay < 1.0) {
+		t->tick = tick + 1U;
+	} else if (delay >= (lua_Number)(TICKS_MAX - tick)) {
+		t->tick = TICKS_MAX;
+	} else {
+		t->tick = tick + (uint64_t)delay;
+	}
+	lua_pushvalue(L, 2);
+	t->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	t->id = ++m->timers_id;
+
+	if ((m->w == NULL) && (t->tick < mcu->mod_next)) {
+		mcu->mod_next = t->tick;
+	}
+	lua_pushnumber(L, (lua_Number)t->id);
+	return 1;
+}
+
+/*
+ * module_cancel(id) - cancels a call scheduled by module_schedule(). It's
+ * fine to cancel a call which is already done.
+ */
+static int
+cancel(lua_State *L)
+{
+	struct lua_model *m = lua_touserdata(L, lua_upvalueindex(1));
+	lua_Number id = luaL_checknumber(L, 1);
+
+	for (uint32_t i = 0; i < m->timers_num; i++) {
+		if ((lua_Number)m->timers[i].id == id) {
+			luaL_unref(L, LUA_REGISTRYINDEX, m->timers[i].ref);
+			m->timers[i] = m->timers[--m->timers_num];
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * module_thread(period_cycles) - runs the model on a worker thread which is
+ * synchronized with the MCU every period_cycles (at least one). It's called
+ * by module_conf(mcu) of the model.
+ */
+static int
+thread(lua_State *L)
+{
+	struct lua_model *m = lua_touserdata(L, lua_upvalueindex(1));
+	lua_Number period = luaL_checknumber(L, 1);
+#if defined(WITH_POSIX)
+	struct MSIM_AVR *mcu = m->mcu;
+	struct lua_worker *w;
+
+	if (m->w != NULL) {
+		return luaL_error(L, "model is already run by a thread");
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (w != NULL) {
+		w->dm_size = (mcu->ramend < ARRSZ(mcu->dm)) ?
+		             (mcu->ramend + 1U) : (uint32_t)ARRSZ(mcu->dm);
+		w->dm = malloc(w->dm_size);
+		w->base = malloc(w->dm_size);
+	}
+	if ((w == NULL) || (w->dm == NULL) || (w->base == NULL)) {
+		if (w != NULL) {
+			free(w->dm);
+			free(w->base);
+			free(w);
+		}
+		return luaL_error(L, "cannot allocate memory for a thread");
+	}
+
+	memcpy(w->dm, mcu->dm, w->dm_size);
+	memcpy(w->base, mcu->dm, w->dm_size);
+	w->state = w->mstate = mcu->state;
+	w->tick = mcu->tick;
+	w->freq = mcu->freq;
+	w->period = (period < 1.0) ? 1U : (uint64_t)period;
+	w->last = mcu->tick;
+	w->sync_at = (w->period < (TICKS_MAX - mcu->tick)) ?
+	             (mcu->tick + w->period) : TICKS_MAX;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	m->w = w;
+	if (pthread_create(&w->thread, NULL, run_worker, m) != 0) {
+		m->w = NULL;
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w->dm);
+		free(w->base);
+		free(w);
+		return luaL_error(L, "cannot create a thread");
+	}
+	m->view.dm = w->dm;
+	m->view.state = &w->mstate;
+	m->view.freq = &w->freq;
+	bind_ffi(m, w->dm);
+
+	if (w->sync_at < mcu->mod_next) {
+		mcu->mod_next = w->sync_at;
+	}
+	return 0;
+#else
+	(void)m;
+	(void)period;
+	return luaL_error(L, "threads aren't supported");
+#endif
+}
+
+#if defined(WITH_POSIX)
+/*
+ * Sync point of the MCU and the model on a worker thread. It waits for the
+ * model to finish, applies its changes to the MCU, takes a new copy of the
+ * data memory and state of the MCU and starts the model again.
+ */
+static void
+sync_model(struct lua_model *m)
+{
+	struct lua_worker *w = m->w;
+	struct MSIM_AVR *mcu = m->mcu;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->busy != 0U) {
+		pthread_cond_wait(&w->cond, &w->lock);
+	}
+
+	/* Outputs of the model */
+	for (uint32_t i = 0; i < w->dm_size; i++) {
+		if (w->dm[i] != w->base[i]) {
+			mcu->dm[i] = w->dm[i];
+		}
+	}
+	if (w->mstate != w->state) {
+		mcu->state = w->mstate;
+	}
+
+	/* Inputs of the model */
+	memcpy(w->dm, mcu->dm, w->dm_size);
+	memcpy(w->base, mcu->dm, w->dm_size);
+	w->mstate = w->state = mcu->state;
+	w->tick = mcu->tick;
+	w->freq = mcu->freq;
+	memcpy(w->run, w->ev, w->ev_num * sizeof(w->ev[0]));
+	w->run_num = w->ev_num;
+	w->ev_num = 0;
+	w->cycles = mcu->tick - w->last;
+	w->last = mcu->tick;
+	w->sync_at = (w->period < (TICKS_MAX - mcu->tick)) ?
+	             (mcu->tick + w->period) : TICKS_MAX;
+
+	w->busy = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Waits for the model to finish and terminates its worker thread. */
+static void
+stop_worker(struct lua_model *m)
+{
+	struct lua_worker *w = m->w;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w->dm);
+	free(w->base);
+	free(w);
+	m->w = NULL;
+	m->view.dm = m->mcu->dm;
+	m->view.state = &m->mcu->state;
+	m->view.freq = &m->mcu->freq;
+}
+
+/*
+ * Worker thread of the model. It delivers events, runs the scheduled
+ * functions and ticks the model once per sync point.
+ */
+static void *
+run_worker(void *arg)
+{
+	struct lua_model *m = arg;
+	struct lua_worker *w = m->w;
+	uint32_t j;
+	int ref;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while ((w->busy == 0U) && (w->quit == 0U)) {
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+		/* Started model is finished before the thread exits */
+		if (w->busy == 0U) {
+			break;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		for (j = 0; j < w->run_num; j++) {
+			call_event(m, &w->run[j]);
+		}
+		j = 0;
+		while (j < m->timers_num) {
+			if (m->timers[j].tick > w->tick) {
+				j++;
+				continue;
+			}
+			ref = m->timers[j].ref;
+			m->timers[j] = m->timers[--m->timers_num];
+
+			lua_rawgeti(m->L, LUA_REGISTRYINDEX, ref);
+			luaL_unref(m->L, LUA_REGISTRYINDEX, ref);
+			lua_pushlightuserdata(m->L, &m->view);
+			call_model(m, 1, "scheduled function");
+		}
+		if (m->fn[FN_TICK] != LUA_NOREF) {
+			lua_rawgeti(m->L, LUA_REGISTRYINDEX, m->fn[FN_TICK]);
+			lua_pushlightuserdata(m->L, &m->view);
+			lua_pushinteger(m->L, (lua_Integer)w->cycles);
+			call_model(m, 2, fn_names[FN_TICK]);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		w->busy = 0;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+#endif
@@ -20,6 +20,7 @@
 /* Implementation of the MCUSim API for device models written in Lua. */
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "mcusim/mcusim.h"
 #include "mcusim/log.h"
@@ -29,21 +30,24 @@
 #include "lualib.h"
 #include "lauxlib.h"
 
+static MSIM_AVR_IOPort	*find_port(lua_State *L, struct MSIM_AVR_LUAView *mcu,
+				   int i);
+
 int
 MSIM_LUAF_SetState(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned int s = (unsigned int)lua_tointeger(L, 2);
 
-	mcu->state = (enum MSIM_AVR_State)s;
+	*mcu->state = (enum MSIM_AVR_State)s;
 	return 0; /* Number of results */
 }
 
 int
 MSIM_LUAF_Freq(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
-	lua_pushinteger(L, (long)mcu->freq);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
+	lua_pushinteger(L, (long)*mcu->freq);
 	return 1; /* Number of results */
 }
 
@@ -58,7 +62,7 @@ MSIM_LUAF_Print(lua_State *L)
 int
 MSIM_LUAF_AVRRegBit(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char bit = (unsigned char)lua_tointeger(L, 3);
 
@@ -85,7 +89,7 @@ MSIM_LUAF_AVRRegBit(lua_State *L)
 int
 MSIM_LUAF_AVRIOBit(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short io_reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char bit = (unsigned char)lua_tointeger(L, 3);
 
@@ -114,7 +118,7 @@ MSIM_LUAF_AVRIOBit(lua_State *L)
 int
 MSIM_LUAF_AVRReadReg(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short reg = (unsigned short)lua_tointeger(L, 2);
 
 	/* Model is trying to read something else. */
@@ -132,7 +136,7 @@ MSIM_LUAF_AVRReadReg(lua_State *L)
 int
 MSIM_LUAF_AVRReadIO(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short io_reg = (unsigned short)lua_tointeger(L, 2);
 
 	/* Model is trying to read something else. */
@@ -153,7 +157,7 @@ MSIM_LUAF_AVRReadIO(lua_State *L)
 int
 MSIM_LUAF_AVRReadIO16(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	uint16_t io_high = (uint16_t)lua_tointeger(L, 2);
 	uint16_t io_low = (uint16_t)lua_tointeger(L, 3);
 	const uint32_t l = mcu->sfr_off;
@@ -176,7 +180,7 @@ MSIM_LUAF_AVRReadIO16(lua_State *L)
 int
 MSIM_LUAF_AVRSetRegBit(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char bit = (unsigned char)lua_tointeger(L, 3);
 	unsigned char val = (unsigned char)lua_tointeger(L, 4);
@@ -206,7 +210,7 @@ MSIM_LUAF_AVRSetRegBit(lua_State *L)
 int
 MSIM_LUAF_AVRSetIOBit(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short io_reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char bit = (unsigned char)lua_tointeger(L, 3);
 	unsigned char val = (unsigned char)lua_tointeger(L, 4);
@@ -238,7 +242,7 @@ MSIM_LUAF_AVRSetIOBit(lua_State *L)
 int
 MSIM_LUAF_AVRWriteReg(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char val = (unsigned char)lua_tointeger(L, 3);
 
@@ -256,7 +260,7 @@ MSIM_LUAF_AVRWriteReg(lua_State *L)
 int
 MSIM_LUAF_AVRWriteIO(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	unsigned short io_reg = (unsigned short)lua_tointeger(L, 2);
 	unsigned char val = (unsigned char)lua_tointeger(L, 3);
 
@@ -276,7 +280,7 @@ MSIM_LUAF_AVRWriteIO(lua_State *L)
 int
 MSIM_LUAF_AVRWriteIO16(lua_State *L)
 {
-	struct MSIM_AVR *mcu = lua_touserdata(L, 1);
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
 	uint16_t io_high = (uint16_t)lua_tointeger(L, 2);
 	uint16_t io_low = (uint16_t)lua_tointeger(L, 3);
 	uint16_t val = (uint16_t)lua_tointeger(L, 4);
@@ -295,3 +299,133 @@ MSIM_LUAF_AVRWriteIO16(lua_State *L)
 	mcu->dm[io_low] = (uint8_t)(val&0xFF);
 	return 0;
 }
+
+int
+MSIM_LUAF_AVRReadBlock(lua_State *L)
+{
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
+	uint32_t addr = (uint32_t)lua_tointeger(L, 2);
+	uint32_t len = (uint32_t)lua_tointeger(L, 3);
+	const uint32_t end = mcu->ramend + 1U;
+
+	/* Model is trying to read beyond the data space. */
+	if ((end > MSIM_AVR_DMSZ) || (addr > end) || (len > (end - addr))) {
+		snprintf(LOG, LOGSZ, "lua model is reading beyond the data "
+		         "space: 0x%" PRIX32 ", %" PRIu32 " bytes", addr, len);
+		MSIM_LOG_ERROR(LOG);
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushlstring(L, (const char *)&mcu->dm[addr], len);
+	return 1;
+}
+
+int
+MSIM_LUAF_AVRWriteBlock(lua_State *L)
+{
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
+	uint32_t addr = (uint32_t)lua_tointeger(L, 2);
+	size_t len = 0;
+	const char *buf = lua_tolstring(L, 3, &len);
+	const uint32_t end = mcu->ramend + 1U;
+
+	/* Model is trying to write beyond the data space. */
+	if ((buf == NULL) || (end > MSIM_AVR_DMSZ) || (addr > end) ||
+	                (len > (end - addr))) {
+		snprintf(LOG, LOGSZ, "lua model is writing beyond the data "
+		         "space: 0x%" PRIX32 ", %zu bytes", addr, len);
+		MSIM_LOG_ERROR(LOG);
+		return 0;
+	}
+
+	memcpy(&mcu->dm[addr], buf, len);
+	return 0;
+}
+
+int
+MSIM_LUAF_AVRReadPort(lua_State *L)
+{
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
+	MSIM_AVR_IOPort *p = find_port(L, mcu, 2);
+
+	if (p == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushinteger(L, (mcu->dm[p->pin.reg] >> p->pin.bit) &
+	                p->pin.mask);
+	lua_pushinteger(L, (mcu->dm[p->port.reg] >> p->port.bit) &
+	                p->port.mask);
+	lua_pushinteger(L, (mcu->dm[p->ddr.reg] >> p->ddr.bit) &
+	                p->ddr.mask);
+	return 3;
+}
+
+int
+MSIM_LUAF_AVRWritePins(lua_State *L)
+{
+	struct MSIM_AVR_LUAView *mcu = lua_touserdata(L, 1);
+	MSIM_AVR_IOPort *p = find_port(L, mcu, 2);
+	uint32_t mask = (uint32_t)lua_tointeger(L, 3);
+	uint32_t val = (uint32_t)lua_tointeger(L, 4);
+	uint8_t *pin;
+
+	if (p == NULL) {
+		return 0;
+	}
+
+	pin = &mcu->dm[p->pin.reg];
+	mask = (mask & p->pin.mask) << p->pin.bit;
+	val = val << p->pin.bit;
+	*pin = (uint8_t)((*pin & ~mask) | (val & mask));
+	return 0;
+}
+
+/*
+ * Finds I/O port by its name or address of any of its registers given as
+ * i-th argument of the function.
+ */
+static MSIM_AVR_IOPort *
+find_port(lua_State *L, struct MSIM_AVR_LUAView *mcu, int i)
+{
+	MSIM_AVR_IOPort *p;
+	const char *name = NULL;
+	uint32_t reg = 0;
+	char buf[16];
+
+	if (lua_type(L, i) == LUA_TSTRING) {
+		snprintf(buf, sizeof buf, "PORT%s", lua_tostring(L, i));
+		name = buf;
+	} else {
+		reg = (uint32_t)lua_tointeger(L, i);
+	}
+
+	for (uint32_t j = 0; j < ARRSZ(mcu->avr->ioports); j++) {
+		p = &mcu->avr->ioports[j];
+		if (p->port.mask == 0U) {
+			break;
+		}
+		if ((name != NULL) &&
+		                (strcmp(mcu->avr->ioregs[p->port.reg].name,
+		                        name) == 0)) {
+			return p;
+		}
+		if ((name == NULL) && ((p->port.reg == reg) ||
+		                       (p->ddr.reg == reg) ||
+		                       (p->pin.reg == reg))) {
+			return p;
+		}
+	}
+
+	if (name != NULL) {
+		snprintf(LOG, LOGSZ, "lua model is accessing unknown I/O "
+		         "port: %s", name);
+	} else {
+		snprintf(LOG, LOGSZ, "lua model is accessing unknown I/O "
+		         "port: 0x%" PRIX32, reg);
+	}
+	MSIM_LOG_ERROR(LOG);
+	return NULL;
+}
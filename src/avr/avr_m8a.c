@@ -58,7 +58,10 @@ static uint8_t spmen_clear = 0;	/* Flag to clear SPMEN in # of cycles */
 static void update_watched(struct MSIM_AVR *mcu);
 
 static void tick_usart(struct MSIM_AVR *mcu);
-#if defined(MSIM_POSIX) && defined(MSIM_POSIX_PTY)
+static void usart_frame(struct MSIM_AVR *mcu);
+static uint8_t usart_ucsrc(struct MSIM_AVR *mcu);
+static uint8_t usart_ucsz(struct MSIM_AVR *mcu);
+#if defined(WITH_POSIX) && defined(WITH_POSIX_PTY)
 	static void usart_transmit(struct MSIM_AVR *mcu);
 	static void usart_receive(struct MSIM_AVR *mcu);
 #endif
@@ -92,6 +95,10 @@ MSIM_M8AInit(struct MSIM_AVR *mcu, struct MSIM_InitArgs *args)
 
 		/* Set USART registers */
 		ubrrh_buf = 0;
+		mcu->usart.tx_busy = 0;
+		mcu->usart.rx_next = 0;
+		mcu->usart.next = 0;
+		usart_frame(mcu);
 
 		/* Create a pseudo-terminal for this MCU */
 		mcu->pty.master_fd = -1;
@@ -181,64 +188,33 @@ update_watched(struct MSIM_AVR *mcu)
 static void
 tick_usart(struct MSIM_AVR *mcu)
 {
-	/* You may think about this function as a programmable prescaler or
-	 * baud rate generator.
+	/* USART is modelled as a sequence of events rather than a baud rate
+	 * generator running at the system clock (Fosc). A frame loaded into
+	 * the Transmit Shift Register is completed in a frame time, i.e.
+	 * (start+data+parity+stop) bits multiplied by the clock prescaler,
+	 * and a frame is received once per the frame time at most.
 	 *
-	 * It is running at the system clock (Fosc) and is loaded with the
-	 * 12-bit UBRR register value each time the counter has counted down
-	 * to zero or when the UBRRL register is written.
-	 * (see 24.3.1. Internal Clock Generation... for details) */
-	uint32_t *rx_ticks = &mcu->usart.rx_ticks;
-	uint32_t *tx_ticks = &mcu->usart.tx_ticks;
-	uint32_t *baud = &mcu->usart.baud;
-	uint32_t *rx_presc = &mcu->usart.rx_presc;
-	uint32_t *tx_presc = &mcu->usart.tx_presc;
-	uint8_t mult = 1;
-
-	if ((ubrrl_buf != DM(UBRRL)) || (*tx_ticks == 0U)) {
-		/* Load a new baud rate value */
-		if (((DM(UBRRH)>>UMSEL)&1) == 0U) {
-			/* There is a UBRRH value stored in data memory after
-			 * the last tick of the AVR decoder. */
-			if (DM(UBRRH) != ubrrh_buf) {
-				*baud = (uint32_t)((DM(UBRRH)&0x0F)<<8) |
-				        (uint32_t)DM(UBRRL);
-			} else {
-				*baud = (uint32_t)((ubrrh_buf&0x0F)<<8) |
-				        (uint32_t)DM(UBRRL);
-			}
-		} else {
-			/* There is a UCSRC value stored in data memory after
-			 * the last tick of the AVR decoder. */
-			*baud = (uint32_t)((ubrrh_buf&0x0F)<<8) |
-			        (uint32_t)DM(UBRRL);
-		}
+	 * Nothing is done between these events unless the firmware accesses
+	 * an I/O register. */
+	MSIM_AVR_USART *u = &mcu->usart;
 
-		/* Update Rx clock prescaler (and ticks?) */
-		*rx_presc = *baud+1;
-		*rx_ticks = *rx_presc;
+	if ((mcu->writ_io[0] == 0U) && (mcu->read_io[0] == 0U) &&
+	                (mcu->tick < u->next)) {
+		return;
+	}
 
-		if (((DM(UCSRC)>>UMSEL)&1) == 0U) {
-			if (((DM(UCSRA)>>U2X)&1) == 0U) {
-				mult = 16; /* Asynchronous Normal mode */
-			} else {
-				mult = 8; /* Asynchronous Double Speed mode */
-			}
-		} else {
-			mult = 1; /* Synchronous mode */
-			MSIM_LOG_WARN("USART synchronous mode is not "
-			              "supported yet, Txclk=Fosc/(UBRR+1)");
-		}
-		/* Update Tx clock prescaler (and ticks?) */
-		*tx_presc = mult*(*baud+1);
-		*tx_ticks = *tx_presc;
+	/* Frame time is changed when the baud rate or frame format is
+	 * changed. UBRRH shares the I/O location with UCSRC. */
+	if (IS_WRIT(mcu, UBRRL) || IS_WRIT(mcu, UBRRH) ||
+	                IS_WRIT(mcu, UCSRA) || IS_WRIT(mcu, UCSRB)) {
+		usart_frame(mcu);
 	}
 
 	/* UDR has been written with UDRE flag set. It means that the Transmit
 	 * Data Buffer Register (TXB) is a destination for data stored in the
 	 * UDR Register location. */
 	if ((IS_WRIT(mcu, UDR)) && (IS_SET(DM(UCSRA), UDRE) == 1U)) {
-		mcu->usart.txb = DM(UDR);
+		u->txb = DM(UDR);
 		/* Clear UDRE flag */
 		DM(UCSRA) = (uint8_t)(DM(UCSRA)&(uint8_t)(~(1<<UDRE)));
 	}
@@ -247,35 +223,126 @@ tick_usart(struct MSIM_AVR *mcu)
 		DM(UCSRA) = (uint8_t)(DM(UCSRA)&(uint8_t)(~(1<<RXC)));
 	}
 
-	/* Count-down Rx ticks */
-	if (*rx_ticks > 0) {
-		(*rx_ticks)--;
+	/* Frame in the Shift Register has been transmitted */
+	if ((u->tx_busy == 1U) && (mcu->tick >= u->tx_done)) {
+#if defined(WITH_POSIX) && defined(WITH_POSIX_PTY)
+		usart_transmit(mcu);
+#endif
+		u->tx_busy = 0;
+		if (IS_SET(DM(UCSRA), UDRE) == 1U) {
+			/* Should TXC be cleared here? */
+			DM(UCSRA) |= (1<<TXC);
+		}
+	}
+
+	/* Move a new frame from the Transmit Buffer to the Shift Register */
+	if ((u->tx_busy == 0U) && (IS_CLEAR(DM(UCSRA), UDRE) == 1U) &&
+	                (((DM(UCSRB)>>TXEN)&1) == 1U)) {
+		u->tsr = u->txb;
+		u->tx_busy = 1;
+		u->tx_done = mcu->tick + u->frame;
+		/* Set UDRE flag */
+		DM(UCSRA) |= (1<<UDRE);
 	}
-	if ((*rx_ticks == 0U) && (((DM(UCSRB)>>RXEN)&1) == 1U)) {
-		/* Generate Rx clock */
-#if defined(MSIM_POSIX) && defined(MSIM_POSIX_PTY)
+
+	/* Next frame may be received one frame time after the previous one
+	 * at least. */
+	if ((((DM(UCSRB)>>RXEN)&1) == 1U) && (mcu->tick >= u->rx_next)) {
+#if defined(WITH_POSIX) && defined(WITH_POSIX_PTY)
 		usart_receive(mcu);
 #endif
-		*rx_ticks = *rx_presc;
+		u->rx_next = mcu->tick + u->frame;
+	}
+
+	/* Find the next event */
+	u->next = (u->tx_busy == 1U) ? u->tx_done : TICKS_MAX;
+	if ((((DM(UCSRB)>>RXEN)&1) == 1U) && (u->rx_next < u->next)) {
+		u->next = u->rx_next;
+	}
+}
+
+static void
+usart_frame(struct MSIM_AVR *mcu)
+{
+	MSIM_AVR_USART *u = &mcu->usart;
+	uint8_t ucsrc = usart_ucsrc(mcu);
+	uint8_t ubrrh;
+	uint32_t mult, bits;
+
+	/* Load a new baud rate value */
+	if (((DM(UBRRH)>>URSEL)&1) == 0U) {
+		/* There is a UBRRH value stored in data memory after
+		 * the last tick of the AVR decoder. */
+		ubrrh = DM(UBRRH);
 	} else {
-		/* USART Rx inactive, do nothing */
+		ubrrh = ubrrh_buf;
 	}
+	u->baud = (uint32_t)((ubrrh&0x0F)<<8) | (uint32_t)DM(UBRRL);
 
-	/* Count-down Tx ticks */
-	if (*tx_ticks > 0) {
-		(*tx_ticks)--;
+	if (((ucsrc>>UMSEL)&1) == 0U) {
+		if (((DM(UCSRA)>>U2X)&1) == 0U) {
+			mult = 16; /* Asynchronous Normal mode */
+		} else {
+			mult = 8; /* Asynchronous Double Speed mode */
+		}
+	} else {
+		mult = 1; /* Synchronous mode */
+		MSIM_LOG_WARN("USART synchronous mode is not "
+		              "supported yet, Txclk=Fosc/(UBRR+1)");
 	}
-	if ((*tx_ticks == 0U) && (((DM(UCSRB)>>TXEN)&1) == 1U)) {
-		/* Generate Tx clock */
-#if defined(MSIM_POSIX) && defined(MSIM_POSIX_PTY)
-		usart_transmit(mcu);
-#endif
+
+	/* Start bit, data bits, parity bit and stop bits */
+	switch (usart_ucsz(mcu)) {
+	case 0:
+		bits = 5;
+		break;
+	case 1:
+		bits = 6;
+		break;
+	case 2:
+		bits = 7;
+		break;
+	case 7:
+		bits = 9;
+		break;
+	default:
+		bits = 8;
+		break;
+	}
+	bits += 1U;
+	if (((ucsrc>>UPM0)&3U) != 0U) {
+		bits += 1U;
+	}
+	bits += ((ucsrc>>USBS)&1U) + 1U;
+
+	u->frame = bits*mult*(u->baud+1);
+}
+
+static uint8_t
+usart_ucsrc(struct MSIM_AVR *mcu)
+{
+	if (((DM(UBRRH)>>URSEL)&1) == 0U) {
+		/* There is a UBRRH value stored in data memory after
+		 * the last tick of the AVR decoder. */
+		return ucsrc_buf;
 	} else {
-		/* USART Tx inactive, do nothing */
+		/* There is a UCSRC value stored in data memory after
+		 * the last tick of the AVR decoder. */
+		return DM(UCSRC);
 	}
 }
 
-#if defined(MSIM_POSIX) && defined(MSIM_POSIX_PTY)
+static uint8_t
+usart_ucsz(struct MSIM_AVR *mcu)
+{
+	uint8_t ucsrc = usart_ucsrc(mcu);
+
+	return (uint8_t)((uint8_t)(((DM(UCSRB)>>UCSZ2)&1U)<<2) |
+	                 (uint8_t)(((ucsrc>>UCSZ1)&1U)<<1) |
+	                 (uint8_t)((ucsrc>>UCSZ0)&1U));
+}
+
+#if defined(WITH_POSIX) && defined(WITH_POSIX_PTY)
 static void
 usart_transmit(struct MSIM_AVR *mcu)
 {
@@ -286,38 +353,26 @@ usart_transmit(struct MSIM_AVR *mcu)
 	int written;
 
 	/* Find how many bits to transmit */
-	if (((DM(UBRRH)>>UMSEL)&1) == 0U) {
-		/* There is a UBRRH value stored in data memory after
-		 * the last tick of the AVR decoder. */
-		ucsz = (uint8_t)((uint8_t)(((DM(UCSRB)>>UCSZ2)&1U)<<2) |
-		                 (uint8_t)(((ucsrc_buf>>UCSZ1)&1U)<<1) |
-		                 (uint8_t)((ucsrc_buf>>UCSZ0)&1U));
-	} else {
-		/* There is a UCSRC value stored in data memory after
-		 * the last tick of the AVR decoder. */
-		ucsz = (uint8_t)((uint8_t)(((DM(UCSRB)>>UCSZ2)&1U)<<2) |
-		                 (uint8_t)(((DM(UCSRC)>>UCSZ1)&1U)<<1) |
-		                 (uint8_t)((DM(UCSRC)>>UCSZ0)&1U));
-	}
+	ucsz = usart_ucsz(mcu);
 
 	buf[1] = 0;
 	switch (ucsz) {
 	case 0:			/* 5-bit */
-		buf[0] = mcu->usart.txb&0x1F;
+		buf[0] = mcu->usart.tsr&0x1F;
 		break;
 	case 1:			/* 6-bit */
-		buf[0] = mcu->usart.txb&0x3F;
+		buf[0] = mcu->usart.tsr&0x3F;
 		break;
 	case 2:			/* 7-bit */
-		buf[0] = mcu->usart.txb&0x7F;
+		buf[0] = mcu->usart.tsr&0x7F;
 		break;
 	case 3:			/* 8-bit */
-		buf[0] = mcu->usart.txb;
+		buf[0] = mcu->usart.tsr;
 		break;
 	case 7:			/* 9-bit */
 		/* NOTE: Should all other bits of buf[1] be filled from the
 		 * next portion of USART transmit data (and not with zeroes)?*/
-		buf[0] = mcu->usart.txb;
+		buf[0] = mcu->usart.tsr;
 		buf[1] = (DM(UCSRB)>>TXB8)&1;
 		buf_len = 2;
 		break;
@@ -330,7 +385,7 @@ usart_transmit(struct MSIM_AVR *mcu)
 		break;
 	}
 
-	if ((err == 0) && (IS_CLEAR(DM(UCSRA), UDRE) == 1)) {
+	if (err == 0) {
 		if (mcu->pty.master_fd >= 0) {
 			written = MSIM_PTY_Write(&mcu->pty, buf, buf_len);
 			if (written != (int)buf_len) {
@@ -344,10 +399,6 @@ usart_transmit(struct MSIM_AVR *mcu)
 			         PRIX8 ", pc=0x%06" PRIX32, buf[0], mcu->pc);
 			MSIM_LOG_DEBUG(mcu->log);
 #endif
-			/* Set UDRE flag */
-			DM(UCSRA) |= (1<<UDRE);
-			/* Should TXC be cleared here? */
-			DM(UCSRA) |= (1<<TXC);
 		} else {
 			MSIM_LOG_DEBUG("cannot feed PTY master with USART "
 			               "data: master_fd < 0");
@@ -366,19 +417,7 @@ usart_receive(struct MSIM_AVR *mcu)
 	int recv;
 
 	/* Find how many bits to receive */
-	if (((DM(UBRRH)>>UMSEL)&1) == 0U) {
-		/* There is a UBRRH value stored in data memory after
-		 * the last tick of the AVR decoder. */
-		ucsz = (uint8_t)((uint8_t)(((DM(UCSRB)>>UCSZ2)&1U)<<2) |
-		                 (uint8_t)(((ucsrc_buf>>UCSZ1)&1U)<<1) |
-		                 (uint8_t)((ucsrc_buf>>UCSZ0)&1U));
-	} else {
-		/* There is a UCSRC value stored in data memory after
-		 * the last tick of the AVR decoder. */
-		ucsz = (uint8_t)((uint8_t)(((DM(UCSRB)>>UCSZ2)&1U)<<2) |
-		                 (uint8_t)(((DM(UCSRC)>>UCSZ1)&1U)<<1) |
-		                 (uint8_t)((DM(UCSRC)>>UCSZ0)&1U));
-	}
+	ucsz = usart_ucsz(mcu);
 
 	switch (ucsz) {
 	case 0:			/* 5-bit */
@@ -435,7 +474,7 @@ usart_receive(struct MSIM_AVR *mcu)
 		}
 	}
 }
-#endif /* defined(MSIM_POSIX) && defined(MSIM_POSIX_PTY) */
+#endif /* defined(WITH_POSIX) && defined(WITH_POSIX_PTY) */
 
 int
 MSIM_M8ASetFuse(struct MSIM_AVR *mcu, struct MSIM_AVRConf *cnf)
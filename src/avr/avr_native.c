@@ -0,0 +1,296 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Device models compiled as shared objects. They're called by the
+ * simulator directly, without marshalling of the arguments Lua models
+ * require, which matters for the models called at high rate (SPI displays,
+ * external SRAM, encoders, etc.).
+ *
+ * This file provides basic functions to load, run and unload these models.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef WITH_POSIX_DL
+#include <dlfcn.h>
+#endif
+
+#include "mcusim/mcusim.h"
+#include "mcusim/log.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+/* Function of the model to be called at the given cycle */
+struct native_timer {
+	uint64_t tick;			/* Cycle to call the function at */
+	MSIM_AVR_NativeFunc fn;		/* Function to call */
+};
+
+/* Device model loaded from a shared object */
+struct native_model {
+	void *dl;			/* Handle of the shared object */
+	struct MSIM_AVR *mcu;		/* MCU the model is loaded for */
+	MSIM_AVR_NativeMCU view;	/* MCU as it's seen by the model */
+	MSIM_AVR_NativeFunc tick;	/* module_tick */
+	MSIM_AVR_NativeWriteFunc on_write; /* module_on_write */
+	MSIM_AVR_NativeEdgeFunc on_edge; /* module_on_pin_edge */
+	MSIM_AVR_NativeFunc close;	/* module_close */
+	struct native_timer timers[MSIM_AVR_NATIVETIMERS]; /* Scheduled calls */
+	uint32_t timers_num;		/* Number of scheduled calls */
+};
+
+static struct native_model models[MSIM_AVR_NATIVEMODELS];
+static uint32_t models_num;
+
+static int	schedule(MSIM_AVR_NativeMCU *v, uint64_t delay,
+		         MSIM_AVR_NativeFunc fn);
+static void	set_state(MSIM_AVR_NativeMCU *v, enum MSIM_AVR_State s);
+
+#ifdef WITH_POSIX_DL
+/* Symbol of the shared object. ISO C doesn't allow to convert an object
+ * pointer returned by dlsym() to a function pointer. */
+union native_sym {
+	void *p;
+	MSIM_AVR_NativeFunc fn;
+	MSIM_AVR_NativeConfFunc conf;
+	MSIM_AVR_NativeWriteFunc on_write;
+	MSIM_AVR_NativeEdgeFunc on_edge;
+};
+
+static union native_sym	sym(void *dl, const char *name);
+#endif
+
+int
+MSIM_AVR_NativeLoadModel(struct MSIM_AVR *mcu, const char *model)
+{
+#ifdef WITH_POSIX_DL
+	struct native_model *m;
+	MSIM_AVR_NativeMCU *v;
+	MSIM_AVR_NativeConfFunc conf;
+	void *dl;
+
+	if (models_num >= ARRSZ(models)) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: too "
+		         "many models", model);
+		MSIM_LOG_ERROR(LOG);
+		return 1;
+	}
+
+	dl = dlopen(model, RTLD_NOW | RTLD_LOCAL);
+	if (dl == NULL) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: %s",
+		         model, dlerror());
+		MSIM_LOG_ERROR(LOG);
+		return 1;
+	}
+	conf = sym(dl, "module_conf").conf;
+	if (conf == NULL) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: "
+		         "module_conf isn't exported", model);
+		MSIM_LOG_ERROR(LOG);
+		dlclose(dl);
+		return 1;
+	}
+
+	m = &models[models_num];
+	m->dl = dl;
+	m->mcu = mcu;
+	m->tick = sym(dl, "module_tick").fn;
+	m->on_write = sym(dl, "module_on_write").on_write;
+	m->on_edge = sym(dl, "module_on_pin_edge").on_edge;
+	m->close = sym(dl, "module_close").fn;
+	m->timers_num = 0;
+
+	/* Views of the data memory and I/O ports */
+	v = &m->view;
+	v->abi = MSIM_AVR_NATIVE_ABI;
+	v->name = mcu->name;
+	v->freq = &mcu->freq;
+	v->tick = &mcu->tick;
+	v->dm = mcu->dm;
+	v->dm_size = (mcu->ramend < ARRSZ(mcu->dm)) ? (mcu->ramend + 1U) :
+	             (uint32_t)ARRSZ(mcu->dm);
+	v->ports = mcu->ioports;
+	v->ports_num = 0;
+	while ((v->ports_num < ARRSZ(mcu->ioports)) &&
+	                (mcu->ioports[v->ports_num].port.mask != 0U)) {
+		v->ports_num++;
+	}
+	v->schedule = schedule;
+	v->set_state = set_state;
+	v->data = NULL;
+	v->sim = m;
+
+	if (conf(v) != 0) {
+		snprintf(LOG, LOGSZ, "cannot load model: %s, reason: "
+		         "module_conf failed", model);
+		MSIM_LOG_ERROR(LOG);
+		dlclose(dl);
+		return 1;
+	}
+	models_num++;
+
+	if (m->tick != NULL) {
+		mcu->mod_ticks++;
+	}
+	if ((m->on_write != NULL) || (m->on_edge != NULL)) {
+		mcu->mod_events++;
+	}
+	return 0;
+#else
+	snprintf(LOG, LOGSZ, "cannot load model: %s, reason: native models "
+	         "aren't supported", model);
+	MSIM_LOG_ERROR(LOG);
+	return 1;
+#endif
+}
+
+void
+MSIM_AVR_NativeCleanModels(void)
+{
+	for (uint32_t i = 0; i < models_num; i++) {
+		if (models[i].close != NULL) {
+			models[i].close(&models[i].view);
+		}
+#ifdef WITH_POSIX_DL
+		dlclose(models[i].dl);
+#endif
+		models[i].dl = NULL;
+	}
+	models_num = 0;
+}
+
+void
+MSIM_AVR_NativeTickModels(struct MSIM_AVR *mcu)
+{
+	struct native_model *m;
+
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if ((m->mcu == mcu) && (m->tick != NULL)) {
+			m->tick(&m->view);
+		}
+	}
+}
+
+uint64_t
+MSIM_AVR_NativeRunScheduled(struct MSIM_AVR *mcu)
+{
+	struct native_model *m;
+	MSIM_AVR_NativeFunc fn;
+	uint64_t next = TICKS_MAX;
+	uint32_t j;
+
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if (m->mcu != mcu) {
+			continue;
+		}
+
+		j = 0;
+		while (j < m->timers_num) {
+			if (m->timers[j].tick > mcu->tick) {
+				j++;
+				continue;
+			}
+			/* Function is called once, but it's free to schedule
+			 * itself again. */
+			fn = m->timers[j].fn;
+			m->timers[j] = m->timers[--m->timers_num];
+			fn(&m->view);
+		}
+		for (j = 0; j < m->timers_num; j++) {
+			if (m->timers[j].tick < next) {
+				next = m->timers[j].tick;
+			}
+		}
+	}
+	return next;
+}
+
+void
+MSIM_AVR_NativeOnWrite(struct MSIM_AVR *mcu, uint32_t reg, uint8_t old,
+                       uint8_t val)
+{
+	struct native_model *m;
+
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if ((m->mcu == mcu) && (m->on_write != NULL)) {
+			m->on_write(&m->view, reg, old, val);
+		}
+	}
+}
+
+void
+MSIM_AVR_NativeOnPinEdge(struct MSIM_AVR *mcu, uint32_t port, uint8_t bit,
+                         uint8_t level)
+{
+	struct native_model *m;
+
+	for (uint32_t i = 0; i < models_num; i++) {
+		m = &models[i];
+		if ((m->mcu == mcu) && (m->on_edge != NULL)) {
+			m->on_edge(&m->view, port, bit, level);
+		}
+	}
+}
+
+static int
+schedule(MSIM_AVR_NativeMCU *v, uint64_t delay, MSIM_AVR_NativeFunc fn)
+{
+	struct native_model *m = v->sim;
+	struct MSIM_AVR *mcu = m->mcu;
+	struct native_timer *t;
+
+	if ((fn == NULL) || (m->timers_num >= ARRSZ(m->timers))) {
+		return 1;
+	}
+
+	t = &m->timers[m->timers_num++];
+	if (delay == 0U) {
+		delay = 1;
+	}
+	t->tick = (delay < (TICKS_MAX - mcu->tick)) ? (mcu->tick + delay) :
+	          TICKS_MAX;
+	t->fn = fn;
+
+	if (t->tick < mcu->mod_next) {
+		mcu->mod_next = t->tick;
+	}
+	return 0;
+}
+
+static void
+set_state(MSIM_AVR_NativeMCU *v, enum MSIM_AVR_State s)
+{
+	struct native_model *m = v->sim;
+
+	m->mcu->state = s;
+}
+
+#ifdef WITH_POSIX_DL
+static union native_sym
+sym(void *dl, const char *name)
+{
+	union native_sym s;
+
+	s.p = dlsym(dl, name);
+	return s;
+}
+#endif
@@ -0,0 +1,162 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Memory sanitizer of the AVR firmware. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/sanitizer.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+#define SP(mcu)			((uint32_t)((*mcu->spl) | (*mcu->sph << 8)))
+
+static void	report(struct MSIM_AVR *mcu, const char *what, uint32_t loc);
+
+void
+MSIM_AVR_SanInit(struct MSIM_AVR *mcu, uint8_t ft)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+
+	memset(san, 0, sizeof *san);
+	san->on = 1;
+	san->ft = ft;
+
+	/* General purpose and I/O registers are always initialized */
+	for (uint32_t i = 0; (i < mcu->ramstart) && (i < ARRSZ(san->sh)); i++) {
+		san->sh[i] = MSIM_AVR_SAN_INIT;
+	}
+}
+
+/* Checks a data space location written by the firmware. */
+void
+MSIM_AVR_SanWrite(struct MSIM_AVR *mcu, uint32_t loc, uint8_t push)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+	uint8_t stack;
+
+	if ((loc > mcu->ramend) || (loc >= ARRSZ(san->sh))) {
+		report(mcu, "write beyond RAMEND", loc);
+	} else if (loc < mcu->ramstart) {
+		if (push != 0U) {
+			report(mcu, "stack pointer below RAMSTART", loc);
+		} else if (IS_IO(mcu, loc) && (mcu->ioregs[loc].off < 0)) {
+			report(mcu, "write to unknown I/O register", loc);
+		}
+	} else {
+		stack = (push != 0U) || (loc > SP(mcu));
+		if ((stack != 0U) && (san->sh[loc] & MSIM_AVR_SAN_DATA)) {
+			report(mcu, "stack overflows static data", loc);
+		}
+		san->sh[loc] = (uint8_t)(MSIM_AVR_SAN_INIT |
+		                         (stack ? MSIM_AVR_SAN_STACK :
+		                          MSIM_AVR_SAN_DATA));
+	}
+}
+
+/* Checks a data space location read by the firmware. */
+void
+MSIM_AVR_SanRead(struct MSIM_AVR *mcu, uint32_t loc)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+
+	if ((loc > mcu->ramend) || (loc >= ARRSZ(san->sh))) {
+		report(mcu, "read beyond RAMEND", loc);
+	} else if (loc < mcu->ramstart) {
+		if (IS_IO(mcu, loc) && (mcu->ioregs[loc].off < 0)) {
+			report(mcu, "read of unknown I/O register", loc);
+		}
+	} else if ((san->sh[loc] & MSIM_AVR_SAN_INIT) == 0U) {
+		report(mcu, "read of uninitialized memory", loc);
+	}
+}
+
+/*
+ * Keeps the call stack of the firmware up to date. It is called when
+ * the instruction is completed.
+ */
+void
+MSIM_AVR_SanInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+	const uint32_t sp = SP(mcu);
+
+	if (((inst&0xFE0E) == 0x940E) ||		/* CALL */
+	                ((inst&0xF000) == 0xD000) ||	/* RCALL */
+	                (inst == 0x9509) ||		/* ICALL */
+	                (inst == 0x9519)) {		/* EICALL */
+		MSIM_AVR_SanEnter(mcu, pc);
+	} else if ((inst == 0x9508) || (inst == 0x9518)) {
+		/* RET, RETI: drop frames above the stack pointer */
+		while ((san->calls_num > 0U) &&
+		                (san->calls[san->calls_num-1].sp < sp)) {
+			san->calls_num--;
+		}
+	}
+}
+
+/*
+ * Pushes a subroutine (or an interrupt handler) to the call stack. Frames
+ * abandoned by the firmware (longjmp, context switch, etc.) are dropped by
+ * comparing stack pointers.
+ */
+void
+MSIM_AVR_SanEnter(struct MSIM_AVR *mcu, uint32_t pc)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+	const uint32_t sp = SP(mcu);
+
+	while ((san->calls_num > 0U) &&
+	                (san->calls[san->calls_num-1].sp <= sp)) {
+		san->calls_num--;
+	}
+	if (san->calls_num < MSIM_AVR_SAN_CALLS) {
+		san->calls[san->calls_num].pc = pc;
+		san->calls[san->calls_num].sp = sp;
+		san->calls_num++;
+	}
+}
+
+static void
+report(struct MSIM_AVR *mcu, const char *what, uint32_t loc)
+{
+	struct MSIM_AVR_San *san = &mcu->san;
+
+	/* Only the first violation is reported */
+	if (san->failed != 0U) {
+		return;
+	}
+	san->failed = 1;
+
+	snprintf(LOG, LOGSZ, "sanitizer: %s: 0x%04" PRIX32 ", pc=0x%06"
+	         PRIX32 ", sp=0x%04" PRIX32, what, loc, mcu->pc << 1,
+	         SP(mcu));
+	MSIM_LOG_ERROR(LOG);
+	for (uint32_t i = san->calls_num; i > 0U; i--) {
+		snprintf(LOG, LOGSZ, "sanitizer: #%" PRIu32 " called from "
+		         "pc=0x%06" PRIX32, san->calls_num - i,
+		         san->calls[i-1].pc << 1);
+		MSIM_LOG_ERROR(LOG);
+	}
+	MSIM_AVR_FRDump(mcu, what);
+
+	mcu->state = san->ft ? AVR_MSIM_TESTFAIL : AVR_STOPPED;
+}
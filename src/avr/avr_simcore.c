@@ -16,12 +16,16 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <time.h>
+#include <signal.h>
 
 #include "mcusim/mcusim.h"
 #include "mcusim/hex/ihex.h"
@@ -33,6 +37,9 @@
 
 #define FLASH_FILE		".mcusim.flash"
 #define EEP_FILE		".mcusim.eeprom"
+#define NSEC			1000000000L
+#define RT_CHECKS		1000	/* Wall clock checks per second */
+#define RT_LAG			(NSEC/10) /* Lag to give up catching up */
 
 /* Macros to read and update AVR status register (SREG) */
 #define UPDATE_SREG(mcu, flag, set_f) do {				\
@@ -44,15 +51,29 @@
 } while (0)
 #define READ_SREG(mcu, flag) ((uint8_t)((*mcu->sreg>>(flag))&1))
 
-#define IS_MCU_ACTIVE(mcu) 	(((mcu)->state == AVR_RUNNING) ||	\
-                                 ((mcu)->state == AVR_MSIM_STEP))
-
 typedef int (*init_func)(MSIM_AVR *mcu, MSIM_InitArgs *args);
 
+/* Wall clock reference to run the simulation in real time */
+struct rt_ref {
+	uint8_t on;			/* Reference is set */
+	struct timespec ts;		/* Wall clock of the reference */
+	uint64_t tick;			/* Cycle of the reference */
+	uint64_t next;			/* Cycle to check wall clock at */
+};
+
 /* Function to process interrupt request according to the order */
 static int	pass_irqs(struct MSIM_AVR *);
 static int	handle_irq(struct MSIM_AVR *);
 
+/* Function to slow the simulation down to the MCU clock frequency */
+static void	keep_pace(struct MSIM_AVR *, struct rt_ref *);
+
+/* Function to select MCU to perform the next cycle */
+static uint32_t	next_mcu(struct MSIM_AVR *, uint32_t);
+
+/* Functions to let device models know about events of the MCU */
+static void	notify_models(struct MSIM_AVR *, uint32_t, uint8_t);
+
 /* Function to setup AVR instance. */
 static int	set_fuse(MSIM_AVR *, uint32_t, uint8_t);
 static int	set_lock(MSIM_AVR *, uint8_t);
@@ -61,7 +82,7 @@ static int	load_mem8(MSIM_AVR *, const char *, uint8_t *, const char *);
 static int	load_mem16(MSIM_AVR *, const char *, uint16_t *, const char *);
 static int	setup_avr(MSIM_AVR *, const char *,
                           uint8_t *, uint32_t, uint8_t *, uint32_t,
-                          uint8_t *, const char *);
+                          const char *);
 
 /* Init function per AVR chip */
 struct init_func_info {
@@ -79,6 +100,9 @@ static struct init_func_info init_funcs[] = {
 //	{ "m2560",	"ATmega2560",	MSIM_M2560Init }
 };
 
+/* Signal caught by the simulator, it's checked by the main loop. */
+static volatile sig_atomic_t sim_signal = 0;
+
 /*
  * Starts the main simualtion loop for the AVR microcontroller.
  *
@@ -88,35 +112,115 @@ static struct init_func_info init_funcs[] = {
 int
 MSIM_AVR_Simulate(struct MSIM_AVR *mcu, uint8_t ft)
 {
-	const struct MSIM_AVR_VCD *vcd = &mcu->vcd;
+	return MSIM_AVR_SimulateAll(mcu, 1, ft);
+}
+
+/*
+ * Asks the main simulation loop to dump the flight recorders and to stop.
+ * It only sets a flag, so it's safe to be called from a signal handler.
+ */
+void
+MSIM_AVR_Signal(int s)
+{
+	sim_signal = s;
+}
+
+/*
+ * Starts the main simulation loop for several AVR microcontrollers. Cycles
+ * are performed in order of the simulated time, so MCUs clocked at
+ * different frequencies are kept in sync.
+ *
+ * MCUs are stopped together (all-stop mode of GDB), i.e. once one of them
+ * is stopped, the others are stopped too.
+ */
+int
+MSIM_AVR_SimulateAll(struct MSIM_AVR *mcus, uint32_t n, uint8_t ft)
+{
+	struct rt_ref rt[MSIM_AVR_MCUS];
+	struct MSIM_AVR *mcu;
+	uint8_t active;
 	int rc = 0;
 
-	if (vcd->regs[0].i >= 0) {
-		/* Open VCD file if there are registers to dump. */
-		rc = MSIM_AVR_VCDOpen(mcu);
-		if (rc != 0) {
-			snprintf(LOG, LOGSZ, "can't open VCD file: '%s'",
-			         vcd->dump_file);
-			MSIM_LOG_FATAL(LOG);
+	if ((n == 0U) || (n > MSIM_AVR_MCUS)) {
+		/* There is no MCU to log the message with */
+		char log[128];
 
-			return -1;
-		}
+		snprintf(log, sizeof log, "%" PRIu32 " MCUs can't be "
+		         "simulated, %d at most", n, MSIM_AVR_MCUS);
+		MSIM_LOG_FATAL(log);
+		return -1;
 	}
-	if (ft) {
-		mcu->state = AVR_RUNNING;
+
+	for (uint32_t i = 0; i < n; i++) {
+		mcu = &mcus[i];
+		rt[i].on = 0;
+
+		if (mcu->vcd.regs[0].i >= 0) {
+			/* Open VCD file if there are registers to dump. */
+			rc = MSIM_AVR_VCDOpen(mcu);
+			if (rc != 0) {
+				snprintf(LOG, LOGSZ, "can't open VCD file: "
+				         "'%s'", mcu->vcd.dump_file);
+				MSIM_LOG_FATAL(LOG);
+
+				return -1;
+			}
+		}
+		if (ft) {
+			mcu->state = AVR_RUNNING;
+		}
+		if (i > 0U) {
+			/* Each MCU dumps to a file of its own */
+			snprintf(mcu->fr.file, sizeof mcu->fr.file,
+			         MSIM_AVR_FRFILE ".%" PRIu32, i);
+		}
 	}
 
 	/* Main simulation loop. */
 	while (1) {
+		if (sim_signal != 0) {
+			char why[32];
+
+			snprintf(why, sizeof why, "signal %d caught",
+			         (int)sim_signal);
+			for (uint32_t i = 0; i < n; i++) {
+				MSIM_AVR_FRDump(&mcus[i], why);
+			}
+			rc = 1;
+			break;
+		}
+
+		mcu = &mcus[next_mcu(mcus, n)];
+		active = IS_MCU_ACTIVE(mcu);
+
 		rc = MSIM_AVR_SimStep(mcu, ft);
 		if (rc != 0) {
 			rc = (rc == 2) ? 0 : rc;
 			break;
 		}
+
+		/* Stop the other MCUs */
+		if (!ft && active && (mcu->state == AVR_STOPPED)) {
+			MSIM_AVR_RSPStop(mcu);
+		}
+
+		/* Run in real time if it's requested */
+		if (mcu->realtime && (mcu->state == AVR_RUNNING)) {
+			if (!rt[mcu - mcus].on ||
+			                (mcu->tick >= rt[mcu - mcus].next)) {
+				keep_pace(mcu, &rt[mcu - mcus]);
+			}
+		} else {
+			rt[mcu - mcus].on = 0;
+		}
 	}
 
-	/* We may need to close a previously initialized VCD dump. */
-	MSIM_AVR_VCDClose(mcu);
+	for (uint32_t i = 0; i < n; i++) {
+		/* We may need to close a previously initialized VCD dump. */
+		MSIM_AVR_VCDClose(&mcus[i]);
+		MSIM_AVR_TraceClose(&mcus[i]);
+		MSIM_AVR_CovSave(&mcus[i]);
+	}
 
 	return rc;
 }
@@ -166,6 +270,27 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 			break;
 		}
 
+		/*
+		 * Stop at a breakpoint before its instruction is started,
+		 * peripherals aren't ticked during the cycle then. The
+		 * breakpoint is passed once the MCU is resumed at the same
+		 * PC. Conditions of the breakpoint are evaluated and
+		 * tracepoints are collected by the GDB stub.
+		 */
+		if (IS_MCU_ACTIVE(mcu) && !mcu->mci && !mcu->ic_left) {
+			uint8_t pass = mcu->bp_pass && (mcu->pc == mcu->bp_pc);
+
+			mcu->bp_pass = 0;
+			if (!pass && (mcu->state == AVR_RUNNING) &&
+			                (mcu->bp_num > 0U) &&
+			                BP_ISSET(mcu->pc) &&
+			                MSIM_AVR_RSPBreak(mcu)) {
+				mcu->state = AVR_STOPPED;
+				mcu->bp_pass = 1;
+				mcu->bp_pc = mcu->pc;
+			}
+		}
+
 		/* Update timers */
 		if (IS_MCU_ACTIVE(mcu)) {
 			MSIM_AVR_TMRUpdate(mcu);
@@ -183,13 +308,23 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 			mcu->tick_perf(mcu, &cnf);
 		}
 
-		/* Tick peripherals written in Lua */
-		if (IS_MCU_ACTIVE(mcu)) {
+		/* Tick peripherals written in Lua (or native ones) and call
+		 * their functions scheduled for this cycle */
+		if (IS_MCU_ACTIVE(mcu) && (mcu->mod_ticks > 0U)) {
 			MSIM_AVR_LUATickModels(mcu);
+			MSIM_AVR_NativeTickModels(mcu);
+		}
+		if (IS_MCU_ACTIVE(mcu) && (*tick >= mcu->mod_next)) {
+			uint64_t lua_next = MSIM_AVR_LUARunScheduled(mcu);
+			uint64_t nat_next = MSIM_AVR_NativeRunScheduled(mcu);
+
+			mcu->mod_next = (lua_next < nat_next) ? lua_next :
+			                nat_next;
 		}
 
 		/* Dump registers to VCD */
-		if (vcd->dump && !(*tovf) && IS_MCU_ACTIVE(mcu)) {
+		if (vcd->dump && !vcd->pause && !(*tovf) &&
+		                IS_MCU_ACTIVE(mcu)) {
 			MSIM_AVR_VCDDumpFrame(mcu, *tick);
 		}
 
@@ -199,6 +334,7 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 			         "memory: pc=0x%06" PRIx32 ", flashend=0x%06"
 			         PRIx32, mcu->pc, mcu->flashend >> 1);
 			MSIM_LOG_FATAL(LOG);
+			MSIM_AVR_FRDump(mcu, "program counter is out of flash");
 
 			rc = 1;
 			break;
@@ -208,21 +344,23 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 			         "pc=0x%06" PRIx32 ", pm_size=0x%06" PRIx32,
 			         mcu->pc, mcu->pm_size);
 			MSIM_LOG_FATAL(LOG);
+			MSIM_AVR_FRDump(mcu, "program counter is out of scope");
 
 			rc = 1;
 			break;
 		}
 
-#ifdef DEBUG
-		/* Save previous PC value */
-		if (IS_MCU_ACTIVE(mcu)) {
-			for (uint32_t i = ARRSZ(mcu->last_pc) - 1; i > 0; i--) {
-				mcu->last_pc[i] = mcu->last_pc[i-1];
-				/* what about indentation at this line? */
-			}
-			mcu->last_pc[0] = mcu->pc;
+		/* Save state before a new instruction to flight recorder */
+		if (IS_MCU_ACTIVE(mcu) && !mcu->mci) {
+			struct MSIM_AVR_FREntry *e;
+
+			e = &mcu->fr.ent[mcu->fr.head & (MSIM_AVR_FRSZ - 1)];
+			e->tick = *tick;
+			e->pc = mcu->pc;
+			e->sp = (uint16_t)((*mcu->spl) | (*mcu->sph << 8));
+			e->sreg = *mcu->sreg;
+			mcu->fr.head++;
 		}
-#endif
 
 		/*
 		 * Decode next instruction.
@@ -258,7 +396,16 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 		}
 
 		if (mcu->ic_left || IS_MCU_ACTIVE(mcu)) {
+			/* Locations written by the instruction itself */
+			uint32_t writ = mcu->writ_ds_num;
+
 			MSIM_AVR_IOSyncPinx(mcu);
+
+			/* Let models know about registers written and pins
+			 * changed */
+			if (mcu->mod_events > 0U) {
+				notify_models(mcu, writ, 1);
+			}
 		}
 
 		/*
@@ -300,6 +447,19 @@ MSIM_AVR_SimStep(MSIM_AVR *mcu, uint8_t ft)
 			}
 		}
 
+		/*
+		 * Check for a break (Ctrl-C) from GDB client once in
+		 * a while. It's done at the instruction boundary only.
+		 */
+		if (!ft && (mcu->state == AVR_RUNNING)) {
+			if (mcu->rsp_poll > 0U) {
+				mcu->rsp_poll--;
+			} else if (!mcu->ic_left) {
+				mcu->rsp_poll = MSIM_AVR_RSP_POLL;
+				MSIM_AVR_RSPPoll(mcu);
+			}
+		}
+
 		/* Halt MCU after a single step performed */
 		if (!mcu->ic_left && mcu->state == AVR_MSIM_STEP) {
 			mcu->state = AVR_STOPPED;
@@ -397,7 +557,7 @@ MSIM_AVR_Init(MSIM_AVR *mcu, MSIM_CFG *conf)
 		mcu->intr.trap_at_isr = conf->trap_at_isr;
 		if (setup_avr(mcu, conf->mcu, NULL,
 		                MSIM_AVR_PMSZ, NULL,
-		                MSIM_AVR_DMSZ, NULL, frm_file) != 0) {
+		                MSIM_AVR_DMSZ, frm_file) != 0) {
 			snprintf(LOG, LOGSZ, "%s can't be initialized",
 			         conf->mcu);
 			MSIM_LOG_FATAL(LOG);
@@ -519,6 +679,17 @@ MSIM_AVR_Init(MSIM_AVR *mcu, MSIM_CFG *conf)
 			}
 		}
 
+		/* Load native peripherals if it is required */
+		for (uint32_t k = 0; k < conf->native_models_num; k++) {
+			if (MSIM_AVR_NativeLoadModel(mcu,
+			                             conf->native_models[k])) {
+				MSIM_LOG_FATAL("loading native model failed");
+			}
+		}
+
+		/* Pin edges are reported to the models from now on */
+		notify_models(mcu, 0, 0);
+
 		/* Do we have registers to dump? */
 		if (vcd->regs[0].i >= 0) {
 			rc = MSIM_AVR_VCDOpen(mcu);
@@ -531,6 +702,26 @@ MSIM_AVR_Init(MSIM_AVR *mcu, MSIM_CFG *conf)
 			}
 		}
 
+		/* Record a trace of the executed instructions */
+		if (conf->trace_file[0] != 0) {
+			rc = MSIM_AVR_TraceOpen(mcu, conf->trace_file,
+			                        conf->trace_state);
+			if (rc != 0) {
+				rc = 1;
+				break;
+			}
+		}
+
+		/* Check memory accesses of the firmware */
+		if (conf->sanitize_mem != 0U) {
+			MSIM_AVR_SanInit(mcu, conf->firmware_test);
+		}
+
+		/* Collect code coverage of the firmware */
+		if (conf->coverage_file[0] != 0) {
+			MSIM_AVR_CovOpen(mcu, conf->coverage_file);
+		}
+
 		/* Force MCU to run in a firmware-test mode. */
 		if (conf->firmware_test == 1U) {
 			MSIM_LOG_DEBUG("running in \"firmware test\" mode");
@@ -545,7 +736,7 @@ static int
 setup_avr(struct MSIM_AVR *mcu, const char *mcu_name,
           uint8_t *pm, uint32_t pm_size,
           uint8_t *dm, uint32_t dm_size,
-          uint8_t *mpm, const char *progfile)
+          const char *progfile)
 {
 	unsigned int i;
 	char mcu_found = 0;
@@ -579,7 +770,16 @@ setup_avr(struct MSIM_AVR *mcu, const char *mcu_name,
 		return -1;
 	}
 	mcu->state = AVR_STOPPED;
-	mcu->read_from_mpm = 0;
+	mcu->insts = 0;
+	mcu->prof = NULL;
+	mcu->realtime = 0;
+	mcu->mod_ticks = 0;
+	mcu->mod_events = 0;
+	mcu->mod_next = TICKS_MAX;
+	memset(mcu->intr.served, 0, sizeof mcu->intr.served);
+	mcu->bp_num = 0;
+	mcu->bp_pass = 0;
+	memset(mcu->bp, 0, sizeof mcu->bp);
 
 	return 0;
 }
@@ -603,6 +803,7 @@ handle_irq(struct MSIM_AVR *mcu)
 	if (i != MSIM_AVR_IRQNUM) {
 		/* Clear selected IRQ */
 		mcu->intr.irq[i] = 0;
+		mcu->intr.served[i]++;
 
 		/* Disable interrupts globally.
 		 * It is not applicable for the AVR XMEGA cores. */
@@ -610,12 +811,18 @@ handle_irq(struct MSIM_AVR *mcu)
 			UPDATE_SREG(mcu, SR_GLOBINT, 0);
 		}
 
-		/* Push PC onto the stack */
+		/* Push PC onto the stack, the locations written are kept
+		 * for the first instruction of the handler */
+		mcu->writ_ds_num = 0;
 		MSIM_AVR_StackPush(mcu, (uint8_t)(mcu->pc & 0xFF));
 		MSIM_AVR_StackPush(mcu, (uint8_t)((mcu->pc >> 8)&0xFF));
 		if (mcu->pc_bits > 16) {
 			MSIM_AVR_StackPush(mcu, (uint8_t)((mcu->pc>>16)&0xFF));
 		}
+		mcu->writ_irq = mcu->writ_ds_num;
+		if (mcu->san.on) {
+			MSIM_AVR_SanEnter(mcu, mcu->pc);
+		}
 
 		/* Load interrupt vector to PC */
 		mcu->pc = mcu->intr.ivt * i;
@@ -631,6 +838,127 @@ handle_irq(struct MSIM_AVR *mcu)
 	return ret;
 }
 
+/*
+ * Selects MCU which is behind the others in the simulated time. MCU which
+ * is finishing its instruction goes first. If all of them are stopped,
+ * the stopped one waits for a command from GDB client.
+ */
+static uint32_t
+next_mcu(struct MSIM_AVR *mcus, uint32_t n)
+{
+	struct MSIM_AVR *mcu;
+	uint32_t next = n, stopped = 0;
+	double t, tmin = 0.0;
+
+	if (n == 1U) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		mcu = &mcus[i];
+		if ((mcu->state == AVR_MSIM_STOP) ||
+		                (mcu->state == AVR_MSIM_TESTFAIL)) {
+			return i;
+		}
+		if (!mcu->ic_left && !IS_MCU_ACTIVE(mcu)) {
+			if ((mcu->state == AVR_STOPPED) &&
+			                (mcus[stopped].state != AVR_STOPPED)) {
+				stopped = i;
+			}
+			continue;
+		}
+
+		t = (mcu->freq > 0U) ? ((double)mcu->tick / mcu->freq) : 0.0;
+		if ((next == n) || (t < tmin)) {
+			next = i;
+			tmin = t;
+		}
+	}
+	return (next == n) ? stopped : next;
+}
+
+/*
+ * Reports I/O registers written by the instruction (first locations
+ * written during the cycle) and pins changed since the previous cycle to
+ * the Lua and native models. Levels of the pins are only remembered if
+ * nothing should be reported.
+ */
+static void
+notify_models(struct MSIM_AVR *mcu, uint32_t writ, uint8_t report)
+{
+	MSIM_AVR_IOPort *p;
+	uint32_t loc, pins, diff;
+
+	for (uint32_t i = 0; report && (i < writ); i++) {
+		loc = mcu->writ_ds[i];
+		if (IS_IO(mcu, loc)) {
+			MSIM_AVR_LUAOnWrite(mcu, loc, mcu->writ_old[i],
+			                    DM(loc));
+			MSIM_AVR_NativeOnWrite(mcu, loc, mcu->writ_old[i],
+			                       DM(loc));
+		}
+	}
+
+	for (uint32_t i = 0; i < ARRSZ(mcu->ioports); i++) {
+		p = &mcu->ioports[i];
+		if (IS_IONOBYTE(p->port) || IS_IONOBYTE(p->pin)) {
+			break;
+		}
+
+		pins = IOBIT_RD(mcu, &p->pin);
+		diff = pins ^ mcu->mod_pins[i];
+		mcu->mod_pins[i] = (uint8_t)pins;
+
+		for (uint8_t b = 0; report && (diff >> b); b++) {
+			if (((diff >> b) & 1U) == 0U) {
+				continue;
+			}
+			MSIM_AVR_LUAOnPinEdge(mcu, p->port.reg,
+			                      (uint8_t)(p->pin.bit + b),
+			                      (uint8_t)((pins >> b) & 1U));
+			MSIM_AVR_NativeOnPinEdge(mcu, p->port.reg,
+			                         (uint8_t)(p->pin.bit + b),
+			                         (uint8_t)((pins >> b) & 1U));
+		}
+	}
+}
+
+/*
+ * Sleeps if the simulation is ahead of the wall clock. The reference is
+ * set again when the MCU is resumed or the simulation is too slow to catch
+ * up with the wall clock.
+ */
+static void
+keep_pace(struct MSIM_AVR *mcu, struct rt_ref *ref)
+{
+	struct timespec now, ts;
+	double sim, wall;
+	long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ref->next = mcu->tick + (mcu->freq / RT_CHECKS);
+
+	if (ref->on && (mcu->freq > 0U)) {
+		sim = (double)(mcu->tick - ref->tick) / mcu->freq;
+		wall = (double)(now.tv_sec - ref->ts.tv_sec) +
+		       (double)(now.tv_nsec - ref->ts.tv_nsec) / NSEC;
+		ns = (long)((sim - wall) * NSEC);
+
+		if (ns > 0) {
+			ts.tv_sec = ns / NSEC;
+			ts.tv_nsec = ns % NSEC;
+			nanosleep(&ts, NULL);
+			return;
+		} else if (ns > -RT_LAG) {
+			return;
+		}
+	}
+
+	ref->on = 1;
+	ref->ts = now;
+	ref->tick = mcu->tick;
+}
+
 static int
 pass_irqs(struct MSIM_AVR *mcu)
 {
@@ -767,6 +1095,11 @@ MSIM_AVR_StackPush(MSIM_AVR *mcu, uint8_t val)
 	uint32_t sp;
 
 	sp = (uint32_t)((*mcu->spl) | (*mcu->sph<<8));
+	MARK_DS(sp);
+	if (mcu->san.on) {
+		MSIM_AVR_SanWrite(mcu, sp, 1);
+	}
+	WATCH_WRITE(sp);
 	mcu->dm[sp--] = val;
 	*mcu->spl = (uint8_t)(sp & 0xFF);
 	*mcu->sph = (uint8_t)(sp >> 8);
@@ -780,6 +1113,20 @@ MSIM_AVR_StackPop(MSIM_AVR *mcu)
 	uint8_t v;
 
 	sp = (uint32_t)((*mcu->spl) | (*mcu->sph<<8));
+	if (sp >= mcu->ramend) {
+		/* Report the first underflow only, the firmware keeps
+		 * running and reads zero beyond the end of SRAM. */
+		if (mcu->fr.underflow == 0U) {
+			snprintf(LOG, LOGSZ, "stack underflow: sp=0x%04"
+			         PRIX32 ", pc=0x%06" PRIx32, sp, mcu->pc);
+			MSIM_LOG_FATAL(LOG);
+			MSIM_AVR_FRDump(mcu, "stack underflow");
+			mcu->fr.underflow = 1;
+		}
+		return 0;
+	}
+	SAN_READ(sp + 1);
+	WATCH_READ(sp + 1);
 	v = mcu->dm[++sp];
 	*mcu->spl = (uint8_t)(sp & 0xFF);
 	*mcu->sph = (uint8_t)(sp >> 8);
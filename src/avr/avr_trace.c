@@ -0,0 +1,414 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Compact binary trace of the executed AVR instructions. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/avr/sim/trace.h"
+#include "mcusim/avr/sim/private/macro.h"
+
+/* Header: magic with version, frequency, name of the MCU */
+#define HEADER_MAGICSZ		8
+#define HEADER_NAMESZ		20
+
+/* Maximum length of a single record, in bytes */
+#define RECORD_MAX		(1 + 10 + 10 + 4 + 5 + MSIM_AVR_TRACE_RECW*(5+1))
+
+static uint32_t	put_varint(uint8_t *buf, uint64_t v);
+static int	get_varint(FILE *f, uint64_t *v);
+
+int
+MSIM_AVR_TraceOpen(struct MSIM_AVR *mcu, const char *f, uint8_t state)
+{
+	struct MSIM_AVR_Trace *tr = &mcu->trace;
+	uint8_t hdr[HEADER_MAGICSZ + 4 + HEADER_NAMESZ];
+	int rc = 0;
+
+	do {
+		if (snprintf(tr->file_name, sizeof tr->file_name, "%s", f) >=
+		                (int)sizeof tr->file_name) {
+			snprintf(LOG, LOGSZ, "name of trace file is too "
+			         "long: %s", f);
+			MSIM_LOG_ERROR(LOG);
+			tr->file_name[0] = 0;
+			rc = 75;
+			break;
+		}
+		tr->file = fopen(f, "wb");
+		if (tr->file == NULL) {
+			snprintf(LOG, LOGSZ, "can't open trace file: %s", f);
+			MSIM_LOG_ERROR(LOG);
+			rc = 75;
+			break;
+		}
+		tr->len = 0;
+		tr->next_pc = 0;
+		tr->tick = 0;
+		tr->state = state;
+		memset(tr->shadow, 0, sizeof tr->shadow);
+
+		memset(hdr, 0, sizeof hdr);
+		memcpy(hdr, MSIM_AVR_TRACE_MAGIC, HEADER_MAGICSZ - 1);
+		hdr[HEADER_MAGICSZ - 1] = MSIM_AVR_TRACE_VER;
+		hdr[HEADER_MAGICSZ + 0] = (uint8_t)(mcu->freq & 0xFF);
+		hdr[HEADER_MAGICSZ + 1] = (uint8_t)((mcu->freq >> 8) & 0xFF);
+		hdr[HEADER_MAGICSZ + 2] = (uint8_t)((mcu->freq >> 16) & 0xFF);
+		hdr[HEADER_MAGICSZ + 3] = (uint8_t)((mcu->freq >> 24) & 0xFF);
+		snprintf((char *)&hdr[HEADER_MAGICSZ + 4], HEADER_NAMESZ,
+		         "%s", mcu->name);
+
+		if (fwrite(hdr, sizeof hdr, 1, tr->file) != 1) {
+			snprintf(LOG, LOGSZ, "can't write trace header: %s", f);
+			MSIM_LOG_ERROR(LOG);
+			fclose(tr->file);
+			tr->file = NULL;
+			rc = 75;
+			break;
+		}
+	} while (0);
+
+	return rc;
+}
+
+int
+MSIM_AVR_TraceFlush(struct MSIM_AVR *mcu)
+{
+	struct MSIM_AVR_Trace *tr = &mcu->trace;
+	int rc = 0;
+
+	if ((tr->file != NULL) && (tr->len > 0U)) {
+		if (fwrite(tr->buf, tr->len, 1, tr->file) != 1) {
+			snprintf(LOG, LOGSZ, "can't write trace: %s",
+			         tr->file_name);
+			MSIM_LOG_ERROR(LOG);
+			rc = 75;
+		}
+		tr->len = 0;
+	}
+	return rc;
+}
+
+int
+MSIM_AVR_TraceClose(struct MSIM_AVR *mcu)
+{
+	struct MSIM_AVR_Trace *tr = &mcu->trace;
+	int rc = 0;
+
+	if (tr->file != NULL) {
+		rc = MSIM_AVR_TraceFlush(mcu);
+		if (fclose(tr->file) != 0) {
+			rc = 75;
+		}
+		tr->file = NULL;
+	}
+	return rc;
+}
+
+/*
+ * Appends a record of the completed instruction to the trace buffer.
+ *
+ * Data space locations written by the instruction are taken from the MCU
+ * instance (see WRITE_DS and stack functions), their values are read after
+ * the instruction has been executed. General purpose and I/O registers are
+ * compared against their previous values if the state is recorded.
+ */
+void
+MSIM_AVR_TraceInst(struct MSIM_AVR *mcu, uint32_t pc, uint16_t inst)
+{
+	struct MSIM_AVR_Trace *tr = &mcu->trace;
+	uint32_t waddr[MSIM_AVR_TRACE_RECW];
+	uint8_t *rec;
+	uint8_t tag;
+	uint32_t len, wnum, snum;
+	uint64_t dt;
+	int64_t dpc;
+
+	if ((tr->len + RECORD_MAX) > MSIM_AVR_TRACE_BUFSZ) {
+		MSIM_AVR_TraceFlush(mcu);
+	}
+	rec = &tr->buf[tr->len];
+	len = 1;
+
+	/* Locations written by the instruction */
+	snum = tr->state ? (mcu->regs_num + mcu->ioregs_num) : 0;
+	if (snum > MSIM_AVR_TRACE_STATESZ) {
+		snum = MSIM_AVR_TRACE_STATESZ;
+	}
+	wnum = 0;
+	for (uint32_t i = 0; i < mcu->writ_ds_num; i++) {
+		/* Registers are reported by comparison below */
+		if ((i < MSIM_AVR_TRACE_WRITES) && (mcu->writ_ds[i] >= snum)) {
+			waddr[wnum++] = mcu->writ_ds[i];
+		}
+	}
+
+	/* Registers changed since the previous record */
+	if ((snum > 0U) && (memcmp(tr->shadow, mcu->dm, snum) != 0)) {
+		for (uint32_t i = 0; i < snum; i++) {
+			if (tr->shadow[i] != mcu->dm[i]) {
+				tr->shadow[i] = mcu->dm[i];
+				waddr[wnum++] = i;
+			}
+		}
+	}
+	tag = (wnum < MSIM_AVR_TRACE_WMASK) ? (uint8_t)wnum :
+	      MSIM_AVR_TRACE_WMASK;
+
+	/* PC delta, zigzag-encoded */
+	dpc = (int64_t)pc - (int64_t)tr->next_pc;
+	if (dpc != 0) {
+		tag |= MSIM_AVR_TRACE_PCJMP;
+		len += put_varint(&rec[len], ((uint64_t)dpc << 1) ^
+		                  (uint64_t)(dpc >> 63));
+	}
+
+	/* Cycles delta */
+	dt = mcu->tick - tr->tick;
+	if (dt != 1U) {
+		tag |= MSIM_AVR_TRACE_TICKS;
+		len += put_varint(&rec[len], dt);
+	}
+
+	/* Opcode */
+	rec[len++] = (uint8_t)(inst & 0xFF);
+	rec[len++] = (uint8_t)((inst >> 8) & 0xFF);
+	if (MSIM_AVR_Is32(inst)) {
+		tag |= MSIM_AVR_TRACE_OP32;
+		rec[len++] = (uint8_t)(PM(pc + 1) & 0xFF);
+		rec[len++] = (uint8_t)((PM(pc + 1) >> 8) & 0xFF);
+		tr->next_pc = pc + 2;
+	} else {
+		tr->next_pc = pc + 1;
+	}
+
+	/* Data space writes */
+	if (wnum >= MSIM_AVR_TRACE_WMASK) {
+		len += put_varint(&rec[len], wnum);
+	}
+	for (uint32_t i = 0; i < wnum; i++) {
+		len += put_varint(&rec[len], waddr[i]);
+		rec[len++] = DM(waddr[i]);
+	}
+
+	rec[0] = tag;
+	tr->len += len;
+	tr->tick = mcu->tick;
+}
+
+int
+MSIM_AVR_TraceReadHeader(FILE *f, uint32_t *freq, char *name, uint32_t len)
+{
+	uint8_t hdr[HEADER_MAGICSZ + 4 + HEADER_NAMESZ];
+	uint32_t n;
+	int rc = 0;
+
+	do {
+		if (fread(hdr, sizeof hdr, 1, f) != 1) {
+			rc = 75;
+			break;
+		}
+		if ((memcmp(hdr, MSIM_AVR_TRACE_MAGIC, HEADER_MAGICSZ - 1)
+		                != 0) ||
+		                (hdr[HEADER_MAGICSZ-1] != MSIM_AVR_TRACE_VER)) {
+			rc = 75;
+			break;
+		}
+
+		*freq = (uint32_t)hdr[HEADER_MAGICSZ] |
+		        ((uint32_t)hdr[HEADER_MAGICSZ + 1] << 8) |
+		        ((uint32_t)hdr[HEADER_MAGICSZ + 2] << 16) |
+		        ((uint32_t)hdr[HEADER_MAGICSZ + 3] << 24);
+
+		if (len > 0U) {
+			n = (len < HEADER_NAMESZ) ? len : HEADER_NAMESZ;
+			memcpy(name, &hdr[HEADER_MAGICSZ + 4], n);
+			name[n - 1] = 0;
+		}
+	} while (0);
+
+	return rc;
+}
+
+/*
+ * Reads the next record from the trace file.
+ *
+ * Record is delta-encoded against the previous one, so the same 'rec' and
+ * 'next_pc' (both zeroed before the first call) should be passed each time.
+ * It returns 0 if record has been read, 76 at the end of file or 75 if
+ * the trace is corrupted.
+ */
+int
+MSIM_AVR_TraceReadRec(FILE *f, MSIM_AVR_TraceRec *rec, uint32_t *next_pc)
+{
+	uint8_t b[4];
+	uint64_t v;
+	int64_t dpc;
+	int tag;
+	int rc = 0;
+
+	do {
+		tag = fgetc(f);
+		if (tag == EOF) {
+			rc = 76;
+			break;
+		}
+
+		dpc = 0;
+		if ((tag & MSIM_AVR_TRACE_PCJMP) != 0) {
+			if (get_varint(f, &v) != 0) {
+				rc = 75;
+				break;
+			}
+			dpc = (int64_t)(v >> 1) ^ -(int64_t)(v & 1U);
+		}
+		rec->pc = (uint32_t)((int64_t)(*next_pc) + dpc);
+
+		v = 1;
+		if (((tag & MSIM_AVR_TRACE_TICKS) != 0) &&
+		                (get_varint(f, &v) != 0)) {
+			rc = 75;
+			break;
+		}
+		rec->tick += v;
+
+		rec->op32 = (tag & MSIM_AVR_TRACE_OP32) ? 1 : 0;
+		if (fread(b, rec->op32 ? 4U : 2U, 1, f) != 1) {
+			rc = 75;
+			break;
+		}
+		rec->op[0] = (uint16_t)(b[0] | (b[1] << 8));
+		rec->op[1] = rec->op32 ? (uint16_t)(b[2] | (b[3] << 8)) : 0;
+		*next_pc = rec->pc + (rec->op32 ? 2U : 1U);
+
+		rec->wnum = (uint32_t)(tag & MSIM_AVR_TRACE_WMASK);
+		if (rec->wnum == MSIM_AVR_TRACE_WMASK) {
+			if ((get_varint(f, &v) != 0) ||
+			                (v > MSIM_AVR_TRACE_RECW)) {
+				rc = 75;
+				break;
+			}
+			rec->wnum = (uint32_t)v;
+		}
+		for (uint32_t i = 0; i < rec->wnum; i++) {
+			int c;
+
+			if (get_varint(f, &v) != 0) {
+				rc = 75;
+				break;
+			}
+			c = fgetc(f);
+			if (c == EOF) {
+				rc = 75;
+				break;
+			}
+			rec->waddr[i] = (uint32_t)v;
+			rec->wval[i] = (uint8_t)c;
+		}
+	} while (0);
+
+	return rc;
+}
+
+/* Compares two trace records, returns 0 if they are equal. */
+int
+MSIM_AVR_TraceCmpRec(const MSIM_AVR_TraceRec *a, const MSIM_AVR_TraceRec *b)
+{
+	int rc = 0;
+
+	if ((a->tick != b->tick) || (a->pc != b->pc) ||
+	                (a->op32 != b->op32) || (a->op[0] != b->op[0]) ||
+	                (a->op[1] != b->op[1]) || (a->wnum != b->wnum)) {
+		rc = 1;
+	} else {
+		for (uint32_t i = 0; i < a->wnum; i++) {
+			if ((a->waddr[i] != b->waddr[i]) ||
+			                (a->wval[i] != b->wval[i])) {
+				rc = 1;
+				break;
+			}
+		}
+	}
+	return rc;
+}
+
+/* Prints a trace record as a single line: cycle, PC (in bytes), opcode,
+ * optional mnemonic and the written locations. */
+void
+MSIM_AVR_TracePrintRec(FILE *f, const MSIM_AVR_TraceRec *r, uint8_t disasm)
+{
+	char mnem[64];
+
+	fprintf(f, "%12" PRIu64 "  %06" PRIX32 "  %04" PRIX16, r->tick,
+	        r->pc << 1, r->op[0]);
+	if (r->op32 != 0) {
+		fprintf(f, " %04" PRIX16, r->op[1]);
+	} else {
+		fprintf(f, "     ");
+	}
+	if (disasm != 0) {
+		MSIM_AVR_Disasm(mnem, sizeof mnem, r->op[0], r->op[1]);
+		if (r->wnum > 0U) {
+			fprintf(f, "  %-20s", mnem);
+		} else {
+			fprintf(f, "  %s", mnem);
+		}
+	}
+	for (uint32_t i = 0; i < r->wnum; i++) {
+		fprintf(f, "  [%04" PRIX32 "]=%02" PRIX8, r->waddr[i],
+		        r->wval[i]);
+	}
+	fprintf(f, "\n");
+}
+
+static uint32_t
+put_varint(uint8_t *buf, uint64_t v)
+{
+	uint32_t n = 0;
+
+	while (v >= 0x80U) {
+		buf[n++] = (uint8_t)((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (uint8_t)v;
+
+	return n;
+}
+
+static int
+get_varint(FILE *f, uint64_t *v)
+{
+	uint32_t shift = 0;
+	int c;
+
+	*v = 0;
+	do {
+		c = fgetc(f);
+		if ((c == EOF) || (shift > 63U)) {
+			return 75;
+		}
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		shift += 7;
+	} while ((c & 0x80) != 0);
+
+	return 0;
+}
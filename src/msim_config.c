@@ -97,6 +97,7 @@ read_file(MSIM_CFG *cfg, const char *cf)
 		rc = 1;
 	} else {
 		cfg->lua_models_num = 0;
+		cfg->native_models_num = 0;
 		cfg->dump_regs_num = 0;
 		cfg->has_lockbits = 0;
 		cfg->has_efuse = 0;
@@ -105,6 +106,10 @@ read_file(MSIM_CFG *cfg, const char *cf)
 		cfg->has_firmware_file = 0;
 		cfg->firmware_test = 0;
 		cfg->reset_flash = 1;
+		cfg->trace_file[0] = 0;
+		cfg->trace_state = 0;
+		cfg->coverage_file[0] = 0;
+		cfg->sanitize_mem = 0;
 
 		rc = read_lines(cfg, buf, buflen, f, cf);
 	}
@@ -274,11 +279,46 @@ read_line(struct MSIM_CFG *cfg, char *parm, char *val,
 		} else {
 			rc = 2;
 		}
+	} else if (CMPL(parm, "native_model", plen) == 0) {
+		cmp_rc = 0;
+		if (cfg->native_models_num < ARRSZ(cfg->native_models)) {
+			cmp_rc = sscanf(val, "%4095s", cfg->native_models[
+			                        cfg->native_models_num]);
+		}
+		if (cmp_rc == 1) {
+			cfg->native_models_num++;
+		} else {
+			rc = 2;
+		}
 	} else if (CMPL(parm, "vcd_file", plen) == 0) {
 		cmp_rc = sscanf(val, "%4096s", &cfg->vcd_file[0]);
 		if (cmp_rc != 1) {
 			rc = 2;
 		}
+	} else if (CMPL(parm, "trace_file", plen) == 0) {
+		cmp_rc = sscanf(val, "%4095s", &cfg->trace_file[0]);
+		if (cmp_rc != 1) {
+			rc = 2;
+		}
+	} else if (CMPL(parm, "coverage_file", plen) == 0) {
+		cmp_rc = sscanf(val, "%4095s", &cfg->coverage_file[0]);
+		if (cmp_rc != 1) {
+			rc = 2;
+		}
+	} else if (CMPL(parm, "sanitize_mem", plen) == 0) {
+		cmp_rc = sscanf(val, "%4095s", buf);
+		if (cmp_rc == 1) {
+			parse_bool(buf, buflen, &cfg->sanitize_mem);
+		} else {
+			rc = 2;
+		}
+	} else if (CMPL(parm, "trace_state", plen) == 0) {
+		cmp_rc = sscanf(val, "%4095s", buf);
+		if (cmp_rc == 1) {
+			parse_bool(buf, buflen, &cfg->trace_state);
+		} else {
+			rc = 2;
+		}
 	} else if (CMPL(parm, "dump_reg", plen) == 0) {
 		cmp_rc = sscanf(val, "%16s",
 		                &cfg->dump_regs[cfg->dump_regs_num][0]);
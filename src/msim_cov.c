@@ -0,0 +1,441 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Utility to merge code coverage files saved by MCUSim and convert them to
+ * a tracefile of lcov. Instructions are mapped to the source lines using
+ * the DWARF line table of the firmware ELF file.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/getopt.h"
+#include "mcusim/elf.h"
+#include "mcusim/avr/sim/coverage.h"
+
+/* Command line options */
+#define CLI_OPTIONS		":o:e:l:t:"
+#define PRINT_USAGE_OPT		7580
+
+#define BIT(bm, n)		(((bm)[(n) >> 3] >> ((n) & 7U)) & 1U)
+
+/* Long command line options */
+static struct MSIM_OPT_Option longopts[] = {
+	{ "help", MSIM_OPT_NO_ARGUMENT, NULL, PRINT_USAGE_OPT },
+	{ "output", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'o' },
+	{ "elf", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'e' },
+	{ "lcov", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'l' },
+	{ "test", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 't' },
+};
+
+/* Instruction mapped to a source line */
+struct line_inst {
+	uint32_t file;			/* Index of the source file */
+	uint32_t line;			/* Source line */
+	uint32_t pc;			/* Instruction address, in words */
+	uint8_t exec;			/* Instruction executed */
+	uint8_t cond;			/* Conditional branch or skip */
+	uint8_t taken;			/* Branch taken */
+	uint8_t ntaken;			/* Branch not taken */
+};
+
+/* State of the conversion to lcov tracefile */
+struct lcov {
+	const MSIM_AVR_Cov *cov;	/* Merged coverage */
+	const uint8_t *text;		/* Program memory (.text section) */
+	uint32_t text_words;		/* Size of .text, in words */
+	char **files;			/* Names of the source files */
+	uint32_t files_num;
+	struct line_inst *inst;		/* Instructions of all lines */
+	uint32_t inst_num;
+	uint32_t inst_cap;
+	uint32_t row_addr;		/* Previous row of the line table */
+	uint32_t row_file;
+	uint32_t row_line;
+	uint8_t has_row;
+	uint8_t err;
+	uint32_t lf, lh;		/* Lines found and hit */
+	uint32_t brf, brh;		/* Branches found and hit */
+};
+
+/* Coverage files are too large to be kept on stack */
+static MSIM_AVR_Cov merged, cov;
+
+static void	print_usage(void);
+static int	write_lcov(const char *elf_file, const char *lcov_file,
+                           const char *test);
+static uint32_t	print_line(FILE *f, struct lcov *lc, uint32_t i);
+static void	line_row(void *arg, uint32_t addr, const char *file,
+                         uint32_t line, uint8_t end_seq);
+static void	add_range(struct lcov *lc, uint32_t from, uint32_t to);
+static uint32_t	file_index(struct lcov *lc, const char *file);
+static int	cmp_inst(const void *a, const void *b);
+static uint32_t	count_bits(const uint8_t *bm, uint32_t words);
+
+int
+main(int argc, char *argv[])
+{
+	const char *out = NULL, *elf = NULL, *lcov = NULL, *test = "";
+	char log[1024];
+	int c, rc = 0;
+
+	c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS, longopts, NULL);
+	while (c != -1) {
+		switch (c) {
+		case 'o':
+			out = MSIM_OPT_optarg;
+			break;
+		case 'e':
+			elf = MSIM_OPT_optarg;
+			break;
+		case 'l':
+			lcov = MSIM_OPT_optarg;
+			break;
+		case 't':
+			test = MSIM_OPT_optarg;
+			break;
+		case PRINT_USAGE_OPT:
+			print_usage();
+			return 2;
+		default:
+			snprintf(log, sizeof log, "unknown option or missing "
+			         "operand: -%c", MSIM_OPT_optopt);
+			MSIM_LOG_FATAL(log);
+			return 1;
+		}
+		c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS,
+		                         longopts, NULL);
+	}
+
+	do {
+		if (MSIM_OPT_optind >= argc) {
+			print_usage();
+			rc = 1;
+			break;
+		}
+
+		/* Merge all of the coverage files */
+		for (int i = MSIM_OPT_optind; i < argc; i++) {
+			MSIM_AVR_Cov *dst = (i == MSIM_OPT_optind) ?
+			                    &merged : &cov;
+
+			if (MSIM_AVR_CovRead(dst, argv[i]) != 0) {
+				snprintf(log, sizeof log, "can't read coverage "
+				         "file: %s", argv[i]);
+				MSIM_LOG_FATAL(log);
+				rc = 1;
+				break;
+			}
+			if ((i != MSIM_OPT_optind) &&
+			                (MSIM_AVR_CovMerge(&merged,
+			                                   dst) != 0)) {
+				snprintf(log, sizeof log, "coverage of another "
+				         "firmware: %s", argv[i]);
+				MSIM_LOG_FATAL(log);
+				rc = 1;
+				break;
+			}
+		}
+		if (rc != 0) {
+			break;
+		}
+
+		/* Summary doesn't belong to lcov tracefile printed */
+		if ((elf == NULL) || (lcov != NULL)) {
+			printf("# %s, %d file(s), %" PRIu32 " instruction(s) "
+			       "executed, %" PRIu32 " branch(es) taken, %"
+			       PRIu32 " not taken\n", merged.name,
+			       argc - MSIM_OPT_optind,
+			       count_bits(merged.exec, merged.words),
+			       count_bits(merged.taken, merged.words),
+			       count_bits(merged.ntaken, merged.words));
+		}
+
+		if ((out != NULL) && (MSIM_AVR_CovWrite(&merged, out) != 0)) {
+			snprintf(log, sizeof log, "can't write coverage file: "
+			         "%s", out);
+			MSIM_LOG_FATAL(log);
+			rc = 1;
+			break;
+		}
+		if (elf != NULL) {
+			rc = write_lcov(elf, lcov, test);
+		}
+	} while (0);
+
+	return rc;
+}
+
+static void
+print_usage(void)
+{
+	printf("Usage: mcusim-cov [options] <coverage_file> ...\n"
+	       "Options:\n"
+	       "  -o, --output <file>  Save merged coverage to a file.\n"
+	       "  -e, --elf <file>     Firmware ELF file to map "
+	       "instructions to source lines.\n"
+	       "  -l, --lcov <file>    Write lcov tracefile (stdout by "
+	       "default).\n"
+	       "  -t, --test <name>    Test name of the lcov tracefile.\n"
+	       "  --help               Print this message.\n");
+}
+
+static int
+write_lcov(const char *elf_file, const char *lcov_file, const char *test)
+{
+	struct lcov lc;
+	MSIM_ELF elf;
+	uint32_t text_addr, text_size;
+	uint32_t file;
+	char log[1024];
+	FILE *f = stdout;
+	int rc = 0;
+
+	memset(&lc, 0, sizeof lc);
+	lc.cov = &merged;
+	elf.buf = NULL;
+
+	do {
+		if (MSIM_ELF_Load(&elf, elf_file) != 0) {
+			snprintf(log, sizeof log, "can't load ELF file: %s",
+			         elf_file);
+			MSIM_LOG_FATAL(log);
+			rc = 1;
+			break;
+		}
+		lc.text = MSIM_ELF_Section(&elf, ".text", &text_addr,
+		                           &text_size);
+		if ((lc.text == NULL) || (text_addr != 0U)) {
+			MSIM_LOG_FATAL("no .text section at address 0");
+			rc = 1;
+			break;
+		}
+		lc.text_words = text_size / 2U;
+
+		if ((MSIM_ELF_Lines(&elf, line_row, &lc) != 0) ||
+		                (lc.err != 0)) {
+			MSIM_LOG_FATAL("can't read DWARF line table");
+			rc = 1;
+			break;
+		}
+		qsort(lc.inst, lc.inst_num, sizeof lc.inst[0], cmp_inst);
+
+		if (lcov_file != NULL) {
+			f = fopen(lcov_file, "w");
+			if (f == NULL) {
+				snprintf(log, sizeof log, "can't open lcov "
+				         "file: %s", lcov_file);
+				MSIM_LOG_FATAL(log);
+				rc = 1;
+				break;
+			}
+		}
+
+		/* One record per source file, instructions are sorted by
+		 * file and line already */
+		for (uint32_t i = 0; i < lc.inst_num; ) {
+			file = lc.inst[i].file;
+			lc.lf = lc.lh = lc.brf = lc.brh = 0;
+			fprintf(f, "TN:%s\nSF:%s\n", test, lc.files[file]);
+
+			while ((i < lc.inst_num) && (lc.inst[i].file == file)) {
+				i = print_line(f, &lc, i);
+			}
+			fprintf(f, "BRF:%" PRIu32 "\nBRH:%" PRIu32 "\n"
+			        "LF:%" PRIu32 "\nLH:%" PRIu32 "\n"
+			        "end_of_record\n", lc.brf, lc.brh, lc.lf,
+			        lc.lh);
+		}
+	} while (0);
+
+	if ((f != NULL) && (f != stdout)) {
+		fclose(f);
+	}
+	for (uint32_t i = 0; i < lc.files_num; i++) {
+		free(lc.files[i]);
+	}
+	free(lc.files);
+	free(lc.inst);
+	MSIM_ELF_Free(&elf);
+	return rc;
+}
+
+/* Prints instructions of a source line starting from the i-th one, returns
+ * index of the first instruction of the next line. */
+static uint32_t
+print_line(FILE *f, struct lcov *lc, uint32_t i)
+{
+	const uint32_t file = lc->inst[i].file;
+	const uint32_t line = lc->inst[i].line;
+	const struct line_inst *li;
+	uint32_t n;
+	uint8_t hit = 0;
+
+	for (n = i; n < lc->inst_num; n++) {
+		li = &lc->inst[n];
+		if ((li->file != file) || (li->line != line)) {
+			break;
+		}
+		hit |= li->exec;
+	}
+	fprintf(f, "DA:%" PRIu32 ",%u\n", line, hit);
+	lc->lf++;
+	lc->lh += hit;
+
+	/* Branch 0 is taken, branch 1 is not taken */
+	for (; i < n; i++) {
+		li = &lc->inst[i];
+		if (li->cond == 0U) {
+			continue;
+		}
+		if (li->exec == 0U) {
+			fprintf(f, "BRDA:%" PRIu32 ",%" PRIu32 ",0,-\n"
+			        "BRDA:%" PRIu32 ",%" PRIu32 ",1,-\n",
+			        line, li->pc << 1, line, li->pc << 1);
+		} else {
+			fprintf(f, "BRDA:%" PRIu32 ",%" PRIu32 ",0,%u\n"
+			        "BRDA:%" PRIu32 ",%" PRIu32 ",1,%u\n",
+			        line, li->pc << 1, li->taken,
+			        line, li->pc << 1, li->ntaken);
+		}
+		lc->brf += 2;
+		lc->brh += (uint32_t)(li->taken + li->ntaken);
+	}
+	return n;
+}
+
+/* Rows of the line table delimit address ranges of the source lines. */
+static void
+line_row(void *arg, uint32_t addr, const char *file, uint32_t line,
+         uint8_t end_seq)
+{
+	struct lcov *lc = (struct lcov *)arg;
+
+	if (lc->has_row != 0U) {
+		add_range(lc, lc->row_addr, addr);
+	}
+	if (end_seq != 0U) {
+		lc->has_row = 0;
+	} else {
+		lc->row_addr = addr;
+		lc->row_file = file_index(lc, file);
+		lc->row_line = line;
+		lc->has_row = 1;
+	}
+}
+
+static void
+add_range(struct lcov *lc, uint32_t from, uint32_t to)
+{
+	struct line_inst *li;
+	uint32_t pc = from >> 1;
+	uint16_t inst;
+
+	if (lc->err != 0U) {
+		return;
+	}
+	while ((pc < (to >> 1)) && (pc < lc->text_words) &&
+	                (pc < lc->cov->words)) {
+		if (lc->inst_num == lc->inst_cap) {
+			lc->inst_cap = lc->inst_cap ? lc->inst_cap*2U : 1024U;
+			li = realloc(lc->inst, lc->inst_cap * sizeof *li);
+			if (li == NULL) {
+				lc->err = 1;
+				return;
+			}
+			lc->inst = li;
+		}
+
+		inst = (uint16_t)(lc->text[2*pc] | (lc->text[2*pc+1] << 8));
+		li = &lc->inst[lc->inst_num++];
+		li->file = lc->row_file;
+		li->line = lc->row_line;
+		li->pc = pc;
+		li->exec = (uint8_t)BIT(lc->cov->exec, pc);
+		li->cond = (uint8_t)(MSIM_AVR_IsCond(inst) ? 1 : 0);
+		li->taken = (uint8_t)BIT(lc->cov->taken, pc);
+		li->ntaken = (uint8_t)BIT(lc->cov->ntaken, pc);
+
+		pc += MSIM_AVR_Is32(inst) ? 2U : 1U;
+	}
+}
+
+static uint32_t
+file_index(struct lcov *lc, const char *file)
+{
+	char **files;
+
+	/* Rows of the same file usually follow each other */
+	if ((lc->files_num > 0U) &&
+	                (strcmp(lc->files[lc->row_file], file) == 0)) {
+		return lc->row_file;
+	}
+	for (uint32_t i = 0; i < lc->files_num; i++) {
+		if (strcmp(lc->files[i], file) == 0) {
+			return i;
+		}
+	}
+
+	files = realloc(lc->files, (lc->files_num + 1U) * sizeof *files);
+	if (files == NULL) {
+		lc->err = 1;
+		return 0;
+	}
+	lc->files = files;
+	lc->files[lc->files_num] = malloc(strlen(file) + 1U);
+	if (lc->files[lc->files_num] == NULL) {
+		lc->err = 1;
+		return 0;
+	}
+	strcpy(lc->files[lc->files_num], file);
+	return lc->files_num++;
+}
+
+static int
+cmp_inst(const void *a, const void *b)
+{
+	const struct line_inst *x = (const struct line_inst *)a;
+	const struct line_inst *y = (const struct line_inst *)b;
+
+	if (x->file != y->file) {
+		return (x->file < y->file) ? -1 : 1;
+	}
+	if (x->line != y->line) {
+		return (x->line < y->line) ? -1 : 1;
+	}
+	if (x->pc != y->pc) {
+		return (x->pc < y->pc) ? -1 : 1;
+	}
+	return 0;
+}
+
+static uint32_t
+count_bits(const uint8_t *bm, uint32_t words)
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < words; i++) {
+		n += BIT(bm, i);
+	}
+	return n;
+}
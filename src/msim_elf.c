@@ -0,0 +1,660 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Reader of ELF sections and DWARF line number tables. */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcusim/elf.h"
+
+/* ELF header and section header fields */
+#define EI_CLASS		4
+#define EI_DATA			5
+#define ELFCLASS32		1
+#define ELFDATA2LSB		1
+#define E_SHOFF			0x20
+#define E_SHENTSIZE		0x2E
+#define E_SHNUM			0x30
+#define E_SHSTRNDX		0x32
+#define E_HDRSZ			0x34
+#define SH_NAME			0
+#define SH_ADDR			12
+#define SH_OFFSET		16
+#define SH_SIZE			20
+#define SH_ENTSZ		40
+
+/* DWARF standard opcodes of the line number program */
+#define DW_LNS_copy		1
+#define DW_LNS_advance_pc	2
+#define DW_LNS_advance_line	3
+#define DW_LNS_set_file		4
+#define DW_LNS_const_add_pc	8
+#define DW_LNS_fixed_advance_pc	9
+
+/* DWARF extended opcodes */
+#define DW_LNE_end_sequence	1
+#define DW_LNE_set_address	2
+#define DW_LNE_define_file	3
+
+/* DWARF 5 line table entry formats */
+#define DW_LNCT_path		1
+#define DW_LNCT_directory_index	2
+#define DW_FORM_block		0x09
+#define DW_FORM_data1		0x0b
+#define DW_FORM_data2		0x05
+#define DW_FORM_data4		0x06
+#define DW_FORM_data8		0x07
+#define DW_FORM_data16		0x1e
+#define DW_FORM_string		0x08
+#define DW_FORM_strp		0x0e
+#define DW_FORM_line_strp	0x1f
+#define DW_FORM_udata		0x0f
+
+/* Cursor to read a section, 'err' is set if it's read beyond the end. */
+struct cursor {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint8_t err;
+};
+
+/* Sections referenced by the line number program */
+struct sections {
+	const uint8_t *str;		/* .debug_str */
+	uint32_t str_len;
+	const uint8_t *line_str;	/* .debug_line_str */
+	uint32_t line_str_len;
+};
+
+/* Header of the line number program */
+struct line_hdr {
+	uint16_t ver;
+	uint8_t off64;
+	uint8_t min_len;
+	uint8_t def_stmt;
+	int8_t line_base;
+	uint8_t line_range;
+	uint8_t op_base;
+	uint8_t op_len[256];
+	uint32_t dirs_num;
+	uint32_t files_num;
+	const char *dirs[MSIM_ELF_MAXFILES];
+	const char *files[MSIM_ELF_MAXFILES];
+	uint32_t file_dir[MSIM_ELF_MAXFILES];
+};
+
+static uint64_t	rd_uint(struct cursor *c, uint32_t n);
+static uint64_t	rd_uleb(struct cursor *c);
+static int64_t	rd_sleb(struct cursor *c);
+static const char *rd_str(struct cursor *c);
+static const char *rd_strp(struct cursor *c, const uint8_t *s, uint32_t slen,
+                           uint8_t off64);
+static int	rd_entries(struct cursor *c, struct line_hdr *h,
+                           const struct sections *sec, uint8_t dirs);
+static int	rd_header(struct cursor *c, struct line_hdr *h,
+                          const struct sections *sec);
+static void	run_program(struct cursor *c, struct line_hdr *h,
+                            MSIM_ELF_LineFunc f, void *arg);
+static const char *file_path(const struct line_hdr *h, uint64_t file,
+                             char *buf, uint32_t len);
+
+int
+MSIM_ELF_Load(MSIM_ELF *elf, const char *file)
+{
+	FILE *f;
+	long len;
+	int rc = 0;
+
+	elf->buf = NULL;
+	elf->len = 0;
+
+	do {
+		f = fopen(file, "rb");
+		if (f == NULL) {
+			rc = 1;
+			break;
+		}
+		if ((fseek(f, 0, SEEK_END) != 0) || ((len = ftell(f)) < 0) ||
+		                (fseek(f, 0, SEEK_SET) != 0)) {
+			rc = 1;
+			break;
+		}
+		if ((uint64_t)len < E_HDRSZ) {
+			rc = 1;
+			break;
+		}
+
+		elf->buf = malloc((size_t)len);
+		if (elf->buf == NULL) {
+			rc = 1;
+			break;
+		}
+		elf->len = (uint32_t)len;
+		if (fread(elf->buf, elf->len, 1, f) != 1) {
+			rc = 1;
+			break;
+		}
+
+		/* Only 32-bit little-endian files are supported */
+		if ((memcmp(elf->buf, "\177ELF", 4) != 0) ||
+		                (elf->buf[EI_CLASS] != ELFCLASS32) ||
+		                (elf->buf[EI_DATA] != ELFDATA2LSB)) {
+			rc = 1;
+			break;
+		}
+	} while (0);
+
+	if (f != NULL) {
+		fclose(f);
+	}
+	if (rc != 0) {
+		MSIM_ELF_Free(elf);
+	}
+	return rc;
+}
+
+void
+MSIM_ELF_Free(MSIM_ELF *elf)
+{
+	free(elf->buf);
+	elf->buf = NULL;
+	elf->len = 0;
+}
+
+/* Looks up a section by its name, returns NULL if it isn't found. */
+const uint8_t *
+MSIM_ELF_Section(const MSIM_ELF *elf, const char *name, uint32_t *addr,
+                 uint32_t *size)
+{
+	struct cursor c;
+	uint32_t shoff, shnum, shstrndx, strtab, strsz, off, sz;
+	const uint8_t *sh;
+
+	c.p = &elf->buf[E_SHOFF];
+	c.end = &elf->buf[elf->len];
+	c.err = 0;
+	shoff = (uint32_t)rd_uint(&c, 4);
+	c.p = &elf->buf[E_SHENTSIZE];
+	if ((rd_uint(&c, 2) != SH_ENTSZ) || (c.err != 0)) {
+		return NULL;
+	}
+	shnum = (uint32_t)rd_uint(&c, 2);
+	shstrndx = (uint32_t)rd_uint(&c, 2);
+	if ((shoff > elf->len) || (shstrndx >= shnum) ||
+	                (((uint64_t)shnum * SH_ENTSZ) > (elf->len - shoff))) {
+		return NULL;
+	}
+
+	/* Section names */
+	c.p = &elf->buf[shoff + shstrndx*SH_ENTSZ + SH_OFFSET];
+	strtab = (uint32_t)rd_uint(&c, 4);
+	strsz = (uint32_t)rd_uint(&c, 4);
+	if ((strtab > elf->len) || (strsz > (elf->len - strtab))) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < shnum; i++) {
+		sh = &elf->buf[shoff + i*SH_ENTSZ];
+
+		c.p = &sh[SH_NAME];
+		off = (uint32_t)rd_uint(&c, 4);
+		if ((off >= strsz) || (strncmp((const char *)
+		                               &elf->buf[strtab + off], name,
+		                               strsz - off) != 0)) {
+			continue;
+		}
+
+		c.p = &sh[SH_OFFSET];
+		off = (uint32_t)rd_uint(&c, 4);
+		sz = (uint32_t)rd_uint(&c, 4);
+		if ((off > elf->len) || (sz > (elf->len - off))) {
+			return NULL;
+		}
+		if (addr != NULL) {
+			c.p = &sh[SH_ADDR];
+			*addr = (uint32_t)rd_uint(&c, 4);
+		}
+		if (size != NULL) {
+			*size = sz;
+		}
+		return &elf->buf[off];
+	}
+	return NULL;
+}
+
+/* Decodes line number programs of all compilation units. */
+int
+MSIM_ELF_Lines(const MSIM_ELF *elf, MSIM_ELF_LineFunc f, void *arg)
+{
+	static struct line_hdr h;
+	struct sections sec;
+	struct cursor c, unit;
+	uint32_t len;
+	uint64_t ulen;
+	const uint8_t *line;
+	int rc = 0;
+
+	line = MSIM_ELF_Section(elf, ".debug_line", NULL, &len);
+	if (line == NULL) {
+		return 1;
+	}
+	sec.str = MSIM_ELF_Section(elf, ".debug_str", NULL, &sec.str_len);
+	sec.line_str = MSIM_ELF_Section(elf, ".debug_line_str", NULL,
+	                                &sec.line_str_len);
+
+	c.p = line;
+	c.end = line + len;
+	c.err = 0;
+
+	while ((rc == 0) && (c.p < c.end)) {
+		h.off64 = 0;
+		ulen = rd_uint(&c, 4);
+		if (ulen == 0xFFFFFFFFU) {
+			h.off64 = 1;
+			ulen = rd_uint(&c, 8);
+		}
+		if ((c.err != 0) || (ulen > (uint64_t)(c.end - c.p))) {
+			rc = 1;
+			break;
+		}
+
+		unit.p = c.p;
+		unit.end = c.p + ulen;
+		unit.err = 0;
+		c.p = unit.end;
+
+		if (rd_header(&unit, &h, &sec) != 0) {
+			rc = 1;
+			break;
+		}
+		run_program(&unit, &h, f, arg);
+		if (unit.err != 0) {
+			rc = 1;
+		}
+	}
+	return rc;
+}
+
+static int
+rd_header(struct cursor *c, struct line_hdr *h, const struct sections *sec)
+{
+	struct cursor hc;
+	uint64_t hlen;
+	int rc = 0;
+
+	do {
+		h->ver = (uint16_t)rd_uint(c, 2);
+		if ((h->ver < 2) || (h->ver > 5)) {
+			rc = 1;
+			break;
+		}
+		if (h->ver >= 5) {
+			rd_uint(c, 1);			/* address_size */
+			rd_uint(c, 1);			/* seg_sel_size */
+		}
+		hlen = rd_uint(c, h->off64 ? 8 : 4);
+		if ((c->err != 0) || (hlen > (uint64_t)(c->end - c->p))) {
+			rc = 1;
+			break;
+		}
+		hc.p = c->p;
+		hc.end = c->p + hlen;
+		hc.err = 0;
+		c->p = hc.end;
+
+		h->min_len = (uint8_t)rd_uint(&hc, 1);
+		if (h->ver >= 4) {
+			rd_uint(&hc, 1);		/* max_ops_per_inst */
+		}
+		h->def_stmt = (uint8_t)rd_uint(&hc, 1);
+		h->line_base = (int8_t)rd_uint(&hc, 1);
+		h->line_range = (uint8_t)rd_uint(&hc, 1);
+		h->op_base = (uint8_t)rd_uint(&hc, 1);
+		if ((h->line_range == 0U) || (h->op_base == 0U)) {
+			rc = 1;
+			break;
+		}
+		h->op_len[0] = 0;
+		for (uint32_t i = 1; i < h->op_base; i++) {
+			h->op_len[i] = (uint8_t)rd_uint(&hc, 1);
+		}
+
+		h->dirs_num = 0;
+		h->files_num = 0;
+		if (h->ver >= 5) {
+			if ((rd_entries(&hc, h, sec, 1) != 0) ||
+			                (rd_entries(&hc, h, sec, 0) != 0)) {
+				rc = 1;
+				break;
+			}
+		} else {
+			/* Index 0 is a compilation directory or unit, it
+			 * isn't listed in the older versions of DWARF */
+			h->dirs[h->dirs_num++] = "";
+			h->files[h->files_num] = "";
+			h->file_dir[h->files_num++] = 0;
+
+			while (1) {
+				const char *d = rd_str(&hc);
+
+				if ((d == NULL) || (d[0] == 0)) {
+					break;
+				}
+				if (h->dirs_num < MSIM_ELF_MAXFILES) {
+					h->dirs[h->dirs_num++] = d;
+				}
+			}
+			while (1) {
+				const char *fn = rd_str(&hc);
+				uint64_t dir;
+
+				if ((fn == NULL) || (fn[0] == 0)) {
+					break;
+				}
+				dir = rd_uleb(&hc);
+				rd_uleb(&hc);			/* mtime */
+				rd_uleb(&hc);			/* length */
+				if (h->files_num < MSIM_ELF_MAXFILES) {
+					h->files[h->files_num] = fn;
+					h->file_dir[h->files_num++] =
+					        (uint32_t)dir;
+				}
+			}
+		}
+		if (hc.err != 0) {
+			rc = 1;
+			break;
+		}
+	} while (0);
+
+	return rc;
+}
+
+/* Reads directory or file name entries of the DWARF 5 line table header. */
+static int
+rd_entries(struct cursor *c, struct line_hdr *h, const struct sections *sec,
+           uint8_t dirs)
+{
+	uint64_t fmt[16][2];
+	uint64_t num, val;
+	uint32_t fmt_num;
+	const char *path, *s;
+	uint32_t dir;
+
+	fmt_num = (uint32_t)rd_uint(c, 1);
+	if (fmt_num > 16U) {
+		return 1;
+	}
+	for (uint32_t i = 0; i < fmt_num; i++) {
+		fmt[i][0] = rd_uleb(c);
+		fmt[i][1] = rd_uleb(c);
+	}
+
+	num = rd_uleb(c);
+	for (uint64_t n = 0; (n < num) && (c->err == 0); n++) {
+		path = "";
+		dir = 0;
+		for (uint32_t i = 0; i < fmt_num; i++) {
+			s = NULL;
+			val = 0;
+			switch (fmt[i][1]) {
+			case DW_FORM_string:
+				s = rd_str(c);
+				break;
+			case DW_FORM_strp:
+				s = rd_strp(c, sec->str, sec->str_len,
+				            h->off64);
+				break;
+			case DW_FORM_line_strp:
+				s = rd_strp(c, sec->line_str,
+				            sec->line_str_len, h->off64);
+				break;
+			case DW_FORM_udata:
+				val = rd_uleb(c);
+				break;
+			case DW_FORM_data1:
+				val = rd_uint(c, 1);
+				break;
+			case DW_FORM_data2:
+				val = rd_uint(c, 2);
+				break;
+			case DW_FORM_data4:
+				val = rd_uint(c, 4);
+				break;
+			case DW_FORM_data8:
+				val = rd_uint(c, 8);
+				break;
+			case DW_FORM_data16:
+				rd_uint(c, 8);
+				rd_uint(c, 8);
+				break;
+			case DW_FORM_block:
+				val = rd_uleb(c);
+				if (val > (uint64_t)(c->end - c->p)) {
+					c->err = 1;
+				} else {
+					c->p += val;
+				}
+				break;
+			default:
+				/* Unknown form, the size can't be skipped */
+				return 1;
+			}
+			if ((fmt[i][0] == DW_LNCT_path) && (s != NULL)) {
+				path = s;
+			} else if (fmt[i][0] == DW_LNCT_directory_index) {
+				dir = (uint32_t)val;
+			}
+		}
+
+		if (dirs != 0U) {
+			if (h->dirs_num < MSIM_ELF_MAXFILES) {
+				h->dirs[h->dirs_num++] = path;
+			}
+		} else if (h->files_num < MSIM_ELF_MAXFILES) {
+			h->files[h->files_num] = path;
+			h->file_dir[h->files_num++] = dir;
+		}
+	}
+	return (c->err != 0) ? 1 : 0;
+}
+
+/* Runs the line number program and reports rows of the line table. */
+static void
+run_program(struct cursor *c, struct line_hdr *h, MSIM_ELF_LineFunc f,
+            void *arg)
+{
+	char path[4096];
+	uint64_t addr = 0, file = 1, len;
+	int64_t line = 1;
+	const uint8_t *next;
+	uint8_t op, adj;
+
+	while ((c->p < c->end) && (c->err == 0)) {
+		op = (uint8_t)rd_uint(c, 1);
+
+		if (op >= h->op_base) {
+			/* Special opcode */
+			adj = (uint8_t)(op - h->op_base);
+			addr += (uint64_t)(adj / h->line_range) * h->min_len;
+			line += h->line_base + (adj % h->line_range);
+			f(arg, (uint32_t)addr, file_path(h, file, path,
+			                                  sizeof path),
+			  (uint32_t)line, 0);
+			continue;
+		}
+
+		switch (op) {
+		case 0:
+			/* Extended opcode */
+			len = rd_uleb(c);
+			if ((len == 0U) || (len > (uint64_t)(c->end - c->p))) {
+				c->err = 1;
+				break;
+			}
+			next = c->p + len;
+			op = (uint8_t)rd_uint(c, 1);
+			if (op == DW_LNE_end_sequence) {
+				f(arg, (uint32_t)addr, "", (uint32_t)line, 1);
+				addr = 0;
+				file = 1;
+				line = 1;
+			} else if (op == DW_LNE_set_address) {
+				addr = rd_uint(c, (uint32_t)(len - 1U));
+			}
+			c->p = next;
+			break;
+		case DW_LNS_copy:
+			f(arg, (uint32_t)addr, file_path(h, file, path,
+			                                  sizeof path),
+			  (uint32_t)line, 0);
+			break;
+		case DW_LNS_advance_pc:
+			addr += rd_uleb(c) * h->min_len;
+			break;
+		case DW_LNS_advance_line:
+			line += rd_sleb(c);
+			break;
+		case DW_LNS_set_file:
+			file = rd_uleb(c);
+			break;
+		case DW_LNS_const_add_pc:
+			addr += (uint64_t)((255U - h->op_base) /
+			                   h->line_range) * h->min_len;
+			break;
+		case DW_LNS_fixed_advance_pc:
+			addr += rd_uint(c, 2);
+			break;
+		default:
+			/* Skip arguments of the other standard opcodes */
+			for (uint32_t i = 0; i < h->op_len[op]; i++) {
+				rd_uleb(c);
+			}
+			break;
+		}
+	}
+}
+
+static const char *
+file_path(const struct line_hdr *h, uint64_t file, char *buf, uint32_t len)
+{
+	const char *name, *dir;
+
+	if (file >= h->files_num) {
+		return "??";
+	}
+	name = h->files[file];
+	dir = (h->file_dir[file] < h->dirs_num) ?
+	      h->dirs[h->file_dir[file]] : "";
+
+	if ((name[0] == '/') || (dir[0] == 0)) {
+		return name;
+	}
+	snprintf(buf, len, "%s/%s", dir, name);
+	return buf;
+}
+
+static uint64_t
+rd_uint(struct cursor *c, uint32_t n)
+{
+	uint64_t v = 0;
+
+	if ((n > 8U) || ((uint64_t)(c->end - c->p) < n)) {
+		c->err = 1;
+		c->p = c->end;
+		return 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		v |= (uint64_t)c->p[i] << (8U*i);
+	}
+	c->p += n;
+	return v;
+}
+
+static uint64_t
+rd_uleb(struct cursor *c)
+{
+	uint64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if ((c->p >= c->end) || (shift > 63U)) {
+			c->err = 1;
+			return 0;
+		}
+		b = *c->p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while ((b & 0x80) != 0);
+
+	return v;
+}
+
+static int64_t
+rd_sleb(struct cursor *c)
+{
+	uint64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if ((c->p >= c->end) || (shift > 63U)) {
+			c->err = 1;
+			return 0;
+		}
+		b = *c->p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while ((b & 0x80) != 0);
+
+	if ((shift < 64U) && ((b & 0x40) != 0)) {
+		v |= ~(uint64_t)0 << shift;
+	}
+	return (int64_t)v;
+}
+
+static const char *
+rd_str(struct cursor *c)
+{
+	const char *s = (const char *)c->p;
+	const uint8_t *z;
+
+	z = memchr(c->p, 0, (size_t)(c->end - c->p));
+	if (z == NULL) {
+		c->err = 1;
+		c->p = c->end;
+		return NULL;
+	}
+	c->p = z + 1;
+	return s;
+}
+
+static const char *
+rd_strp(struct cursor *c, const uint8_t *s, uint32_t slen, uint8_t off64)
+{
+	const uint64_t off = rd_uint(c, off64 ? 8 : 4);
+
+	if ((s == NULL) || (off >= slen) ||
+	                (memchr(&s[off], 0, slen - off) == NULL)) {
+		return NULL;
+	}
+	return (const char *)&s[off];
+}
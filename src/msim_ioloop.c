@@ -0,0 +1,457 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * I/O loop to exchange bytes between descriptors and the simulation
+ * thread. It's based on epoll(7) if available and poll(2) otherwise.
+ *
+ * Simulation thread doesn't make system calls while the loop is busy:
+ * the loop flushes rings written by the simulation every MSIM_IOL_FLUSHMS
+ * until they're empty. It's woken up via a pipe only when the ring is
+ * written after the loop went idle or the ring is half full.
+ *
+ * Descriptor isn't read while its ring is full. The loop doesn't wait for
+ * the simulation to read the ring on a timer, it's woken up via the same
+ * pipe once the ring is drained to a half.
+ */
+#if defined(WITH_POSIX)
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#ifdef WITH_EPOLL
+#include <sys/epoll.h>
+#endif
+#include "mcusim/ioloop.h"
+#include "mcusim/log.h"
+
+#define ARRSZ(a)	(sizeof(a) / sizeof((a)[0]))
+
+/* Idle (full) flag is checked by the simulation thread after the tail
+ * (head) of the ring is stored and set by the loop before the ring is
+ * checked for data (space). Full barriers keep one of them to notice
+ * the other. */
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD(p)		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define LOAD(p)		(*(volatile uint32_t *)(p))
+#define STORE(p, v)	(*(volatile uint32_t *)(p) = (v))
+#define FENCE()
+#endif
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static MSIM_IOL_Chan *chans[MSIM_IOL_CHANS];
+static uint32_t chans_num;
+static int wake[2] = { -1, -1 };	/* Pipe to wake the loop up */
+static uint8_t quit;			/* Flag to exit the loop */
+static uint8_t running;			/* Thread of the loop is created */
+#ifdef WITH_EPOLL
+static int epfd = -1;
+#endif
+
+static void	*run_loop(void *arg);
+static int	start_loop(void);
+static void	stop_loop(void);
+static void	wake_loop(void);
+static int	watch(MSIM_IOL_Chan *c);
+static void	recv_chan(MSIM_IOL_Chan *c);
+static uint8_t	has_space(MSIM_IOL_Chan *c);
+static uint32_t	flush_chan(MSIM_IOL_Chan *c);
+static int	nonblock(int fd);
+
+int
+MSIM_IOL_Add(MSIM_IOL_Chan *c, int32_t fd)
+{
+	int rc = MSIM_IOL_OK;
+
+	pthread_mutex_lock(&lock);
+	if (chans_num >= ARRSZ(chans)) {
+		MSIM_LOG_ERROR("too many descriptors in the I/O loop");
+		rc = MSIM_IOL_ERR;
+	} else if ((chans_num == 0U) && (start_loop() != 0)) {
+		MSIM_LOG_ERROR("cannot start the I/O loop");
+		rc = MSIM_IOL_ERR;
+	}
+
+	if (rc == MSIM_IOL_OK) {
+		c->fd = fd;
+		MSIM_RING_Init(&c->rx, c->rx_buf, sizeof c->rx_buf);
+		MSIM_RING_Init(&c->tx, c->tx_buf, sizeof c->tx_buf);
+		c->idle = 0;
+		c->full = 0;
+		c->events = 0;
+		c->eof = 0;
+		c->out_off = 0;
+		c->out_len = 0;
+
+		if ((nonblock(fd) != 0) || (watch(c) != 0)) {
+			MSIM_LOG_ERROR("cannot add descriptor to the I/O loop");
+			rc = MSIM_IOL_ERR;
+		} else {
+			chans[chans_num++] = c;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (rc == MSIM_IOL_OK) {
+		wake_loop();
+	} else if (chans_num == 0U) {
+		stop_loop();
+	}
+	return rc;
+}
+
+int
+MSIM_IOL_Remove(MSIM_IOL_Chan *c)
+{
+	uint32_t i;
+	uint8_t last;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < chans_num; i++) {
+		if (chans[i] == c) {
+			break;
+		}
+	}
+	if (i == chans_num) {
+		pthread_mutex_unlock(&lock);
+		return MSIM_IOL_ERR;
+	}
+
+	flush_chan(c);
+#ifdef WITH_EPOLL
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
+	chans[i] = chans[--chans_num];
+	last = (chans_num == 0U);
+	pthread_mutex_unlock(&lock);
+
+	if (last) {
+		stop_loop();
+	} else {
+		wake_loop();
+	}
+	return MSIM_IOL_OK;
+}
+
+uint32_t
+MSIM_IOL_Write(MSIM_IOL_Chan *c, const uint8_t *buf, uint32_t len)
+{
+	uint32_t n = MSIM_RING_TryEnq(&c->tx, buf, len);
+
+	FENCE();
+	if ((LOAD(&c->idle) != 0U) ||
+	                (MSIM_RING_Len(&c->tx) > (sizeof c->tx_buf / 2U))) {
+		STORE(&c->idle, 0U);
+		wake_loop();
+	}
+	return n;
+}
+
+uint32_t
+MSIM_IOL_Read(MSIM_IOL_Chan *c, uint8_t *buf, uint32_t len)
+{
+	uint32_t n = MSIM_RING_TryDeq(&c->rx, buf, len);
+
+	FENCE();
+	if ((LOAD(&c->full) != 0U) &&
+	                (MSIM_RING_Len(&c->rx) <= (sizeof c->rx_buf / 2U))) {
+		STORE(&c->full, 0U);
+		wake_loop();
+	}
+	return n;
+}
+
+static void *
+run_loop(void *arg)
+{
+#ifdef WITH_EPOLL
+	struct epoll_event evs[MSIM_IOL_CHANS + 1];
+#else
+	struct pollfd pfds[MSIM_IOL_CHANS + 1];
+	nfds_t nfds;
+#endif
+	MSIM_IOL_Chan *c;
+	uint8_t buf[64];
+	uint32_t want;
+	int timeout;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	while (quit == 0U) {
+		/* Wait for the readable descriptors only if there is
+		 * a space to read to, flush written ones periodically while
+		 * the simulation is writing. */
+		timeout = -1;
+		for (uint32_t i = 0; i < chans_num; i++) {
+			c = chans[i];
+			want = 0;
+			if ((c->eof == 0U) && (has_space(c) != 0U)) {
+				want |= POLLIN;
+			}
+			if (c->out_off < c->out_len) {
+				want |= POLLOUT;
+			} else if (LOAD(&c->idle) == 0U) {
+				timeout = MSIM_IOL_FLUSHMS;
+			}
+#ifdef WITH_EPOLL
+			if (want != c->events) {
+				c->events = want;
+				watch(c);
+			}
+#else
+			pfds[i + 1].fd = (want != 0U) ? c->fd : -1;
+			pfds[i + 1].events = (short)want;
+#endif
+		}
+#ifndef WITH_EPOLL
+		pfds[0].fd = wake[0];
+		pfds[0].events = POLLIN;
+		nfds = (nfds_t)chans_num + 1U;
+#endif
+		pthread_mutex_unlock(&lock);
+
+		/* Descriptors are checked below regardless of the events */
+#ifdef WITH_EPOLL
+		epoll_wait(epfd, evs, (int)ARRSZ(evs), timeout);
+#else
+		poll(pfds, nfds, timeout);
+#endif
+
+		pthread_mutex_lock(&lock);
+		while (read(wake[0], buf, sizeof buf) > 0) {
+			/* Drain the pipe */
+		}
+		for (uint32_t i = 0; i < chans_num; i++) {
+			c = chans[i];
+			recv_chan(c);
+			if ((flush_chan(c) > 0U) || (c->out_off < c->out_len)) {
+				continue;
+			}
+			/* Nothing to write, simulation thread wakes the loop
+			 * up once it writes something. */
+			STORE(&c->idle, 1U);
+			FENCE();
+			if (MSIM_RING_Len(&c->tx) > 0U) {
+				STORE(&c->idle, 0U);
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* Creates a pipe to wake the loop up and starts the loop. It's called with
+ * the lock held. */
+static int
+start_loop(void)
+{
+	if (pipe(wake) != 0) {
+		wake[0] = wake[1] = -1;
+		return 1;
+	}
+	nonblock(wake[0]);
+	nonblock(wake[1]);
+#ifdef WITH_EPOLL
+	{
+		struct epoll_event ev;
+
+		epfd = epoll_create(MSIM_IOL_CHANS + 1);
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if ((epfd < 0) ||
+		                (epoll_ctl(epfd, EPOLL_CTL_ADD, wake[0],
+		                           &ev) != 0)) {
+			return 1;
+		}
+	}
+#endif
+	quit = 0;
+	running = (pthread_create(&thread, NULL, run_loop, NULL) == 0);
+	return (running == 0U);
+}
+
+/* Stops the loop and closes its descriptors. */
+static void
+stop_loop(void)
+{
+	if (running != 0U) {
+		pthread_mutex_lock(&lock);
+		quit = 1;
+		pthread_mutex_unlock(&lock);
+		wake_loop();
+		pthread_join(thread, NULL);
+		running = 0;
+	}
+
+#ifdef WITH_EPOLL
+	if (epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+#endif
+	if (wake[0] >= 0) {
+		close(wake[0]);
+		close(wake[1]);
+		wake[0] = wake[1] = -1;
+	}
+}
+
+static void
+wake_loop(void)
+{
+	const uint8_t b = 1;
+
+	/* Pipe may be full, the loop is going to be woken up anyway */
+	if (wake[1] >= 0) {
+		(void)!write(wake[1], &b, 1);
+	}
+}
+
+/* Updates events of the channel watched by epoll. Descriptor isn't watched
+ * at all without events, otherwise a hang-up would be reported again and
+ * again. */
+static int
+watch(MSIM_IOL_Chan *c)
+{
+#ifdef WITH_EPOLL
+	struct epoll_event ev;
+
+	if (c->events == 0U) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		return 0;
+	}
+	ev.events = 0;
+	if ((c->events & POLLIN) != 0U) {
+		ev.events |= EPOLLIN;
+	}
+	if ((c->events & POLLOUT) != 0U) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0) {
+		return 0;
+	}
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+#else
+	(void)c;
+	return 0;
+#endif
+}
+
+/* Reads the descriptor while there is a space in the ring. */
+static void
+recv_chan(MSIM_IOL_Chan *c)
+{
+	uint8_t buf[1024];
+	uint32_t space;
+	ssize_t n;
+
+	if (c->eof != 0U) {
+		return;
+	}
+	space = (uint32_t)sizeof c->rx_buf - MSIM_RING_Len(&c->rx);
+	while (space > 0U) {
+		n = read(c->fd, buf, (space < sizeof buf) ? space : sizeof buf);
+		if (n > 0) {
+			MSIM_RING_TryEnq(&c->rx, buf, (uint32_t)n);
+			space -= (uint32_t)n;
+		} else if ((n < 0) && ((errno == EAGAIN) ||
+		                       (errno == EWOULDBLOCK) ||
+		                       (errno == EINTR))) {
+			break;
+		} else {
+			/* Descriptor is closed by the other side */
+			c->eof = 1;
+			break;
+		}
+	}
+}
+
+/* Checks whether the ring of the channel can be read to. Simulation thread
+ * wakes the loop up once it drains the full ring. */
+static uint8_t
+has_space(MSIM_IOL_Chan *c)
+{
+	if (MSIM_RING_Len(&c->rx) < sizeof c->rx_buf) {
+		STORE(&c->full, 0U);
+		return 1;
+	}
+	STORE(&c->full, 1U);
+	FENCE();
+	if (MSIM_RING_Len(&c->rx) < sizeof c->rx_buf) {
+		STORE(&c->full, 0U);
+		return 1;
+	}
+	return 0;
+}
+
+/* Writes bytes from the ring to the descriptor while it doesn't block.
+ * Returns a number of bytes written. */
+static uint32_t
+flush_chan(MSIM_IOL_Chan *c)
+{
+	uint32_t total = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (c->out_off >= c->out_len) {
+			c->out_off = 0;
+			c->out_len = MSIM_RING_TryDeq(&c->tx, c->out,
+			                              sizeof c->out);
+			if (c->out_len == 0U) {
+				break;
+			}
+		}
+		n = write(c->fd, &c->out[c->out_off], c->out_len - c->out_off);
+		if (n > 0) {
+			c->out_off += (uint32_t)n;
+			total += (uint32_t)n;
+		} else if ((n < 0) && ((errno == EAGAIN) ||
+		                       (errno == EWOULDBLOCK) ||
+		                       (errno == EINTR))) {
+			break;
+		} else {
+			/* Nobody reads these bytes */
+			c->out_off = c->out_len;
+		}
+	}
+	return total;
+}
+
+static int
+nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0) {
+		return 1;
+	}
+	return (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0);
+}
+
+#endif /* defined(WITH_POSIX) */
@@ -56,39 +56,37 @@ static struct MSIM_OPT_Option longopts[] = {
 	{ "conf", MSIM_OPT_REQUIRED_ARGUMENT, NULL, CONF_FILE_OPT },
 };
 
-static struct MSIM_AVR avr_mcu;
-static struct MSIM_AVR *mcu = &avr_mcu;
-static struct MSIM_CFG conf;
+static struct MSIM_AVR avr_mcus[MSIM_AVR_MCUS];
+static struct MSIM_AVR *mcu = &avr_mcus[0];
+static struct MSIM_CFG confs[MSIM_AVR_MCUS];
 
 static void	print_usage(void);
 static void	print_short_usage(void);
-static void	dump_flash_handler(int s);
+static void	stop_handler(int s);
 
 int
 main(int argc, char *argv[])
 {
 	int c, rc;
-	char *conf_file = NULL;
-
-	conf.mcu_freq = 0;
-	conf.trap_at_isr = 0;
-	conf.firmware_test = 0;
-	conf.rsp_port = GDB_RSP_PORT;
+	char *conf_files[MSIM_AVR_MCUS] = { NULL };
+	uint32_t mcus_num = 0;
+	const struct MSIM_CFG *conf = &confs[0];
 
 #ifdef DEBUG
 	MSIM_LOG_SetLevel(MSIM_LOG_LVLDEBUG);
 #endif
 
-	/* Set up signals handlers. */
-	int signals[] = { SIGABRT, SIGKILL, SIGQUIT, SIGSEGV, SIGTERM };
-	struct sigaction dmpflash_act;
+	/* Set up signals handlers. The simulation is stopped and dumped
+	 * by the main loop, the handler only tells it to do so. */
+	int signals[] = { SIGQUIT, SIGTERM };
+	struct sigaction stop_act;
 
-	memset(&dmpflash_act, 0, sizeof dmpflash_act);
-	sigemptyset(&dmpflash_act.sa_mask);
-	dmpflash_act.sa_handler = dump_flash_handler;
+	memset(&stop_act, 0, sizeof stop_act);
+	sigemptyset(&stop_act.sa_mask);
+	stop_act.sa_handler = stop_handler;
 
 	for (uint32_t i = 0; i < ARRSZ(signals); i++) {
-		sigaction(signals[i], &dmpflash_act, NULL);
+		sigaction(signals[i], &stop_act, NULL);
 	}
 
 	MSIM_CFG_PrintVersion();
@@ -108,10 +106,15 @@ main(int argc, char *argv[])
 			MSIM_LOG_FATAL(LOG);
 			return 1;
 		case 'c':
-			conf_file = MSIM_OPT_optarg;
-			break;
 		case CONF_FILE_OPT:
-			conf_file = MSIM_OPT_optarg;
+			/* Each configuration file describes one more MCU */
+			if (mcus_num >= MSIM_AVR_MCUS) {
+				snprintf(LOG, LOGSZ, "%d MCUs can be simulated "
+				         "at most", MSIM_AVR_MCUS);
+				MSIM_LOG_FATAL(LOG);
+				return 1;
+			}
+			conf_files[mcus_num++] = MSIM_OPT_optarg;
 			break;
 		case VERSION_OPT:
 			print_short_usage();
@@ -129,33 +132,61 @@ main(int argc, char *argv[])
 		                         longopts, NULL);
 	}
 
+	if (mcus_num == 0U) {
+		mcus_num = 1;
+	}
+
 	do {
-		/* Read config file */
-		rc = MSIM_CFG_Read(&conf, conf_file);
-		if (rc != 0) {
-			break;
+		for (uint32_t i = 0; i < mcus_num; i++) {
+			confs[i].mcu_freq = 0;
+			confs[i].trap_at_isr = 0;
+			confs[i].firmware_test = 0;
+			confs[i].rsp_port = GDB_RSP_PORT;
+
+			/* Read config file */
+			rc = MSIM_CFG_Read(&confs[i], conf_files[i]);
+			if (rc != 0) {
+				break;
+			}
+
+			/* Utility file of the program memory is used by
+			 * the first MCU only */
+			if (i > 0U) {
+				confs[i].reset_flash = 1;
+			}
+
+			/* Initialize AVR */
+			rc = MSIM_AVR_Init(&avr_mcus[i], &confs[i]);
+			if (rc != 0) {
+				break;
+			}
 		}
-
-		/* Initialize AVR */
-		rc = MSIM_AVR_Init(mcu, &conf);
 		if (rc != 0) {
 			break;
 		}
 
-		/* Prepare and run AVR simulation */
-		if (conf.firmware_test == 0) {
+		/* Prepare and run AVR simulation. Port and mode of the
+		 * first MCU are used for all of them. */
+		if (conf->firmware_test == 0) {
 			snprintf(LOG, LOGSZ, "waiting for incoming GDB "
 			         "connections at localhost:%d...",
-			         conf.rsp_port);
+			         conf->rsp_port);
 			MSIM_LOG_INFO(LOG);
-			MSIM_AVR_RSPInit(mcu, (uint16_t)conf.rsp_port);
+			MSIM_AVR_RSPInit(mcu, (uint16_t)conf->rsp_port);
+			for (uint32_t i = 1; i < mcus_num; i++) {
+				MSIM_AVR_RSPAddMCU(&avr_mcus[i]);
+			}
 		}
 
-		rc = MSIM_AVR_Simulate(mcu, conf.firmware_test);
+		rc = MSIM_AVR_SimulateAll(avr_mcus, mcus_num,
+		                          conf->firmware_test);
 
-		MSIM_PTY_Close(&mcu->pty);
+		for (uint32_t i = 0; i < mcus_num; i++) {
+			MSIM_PTY_Close(&avr_mcus[i].pty);
+		}
 		MSIM_AVR_LUACleanModels();
-		if (conf.firmware_test == 0) {
+		MSIM_AVR_NativeCleanModels();
+		if (conf->firmware_test == 0) {
 			MSIM_AVR_RSPClose(mcu);
 		}
 
@@ -182,17 +213,14 @@ print_usage(void)
 	       "Options:\n"
 	       "  -c <config_file>     Run with this configuration file.\n"
 	       "  --conf <config_file> Run with this configuration file.\n"
+	       "                       Repeat to simulate several MCUs\n"
+	       "                       (threads in GDB).\n"
 	       "  --help               Print this message.\n"
 	       "  --version            Print version.\n");
 }
 
 static void
-dump_flash_handler(int s)
+stop_handler(int s)
 {
-	int rc;
-
-	rc = MSIM_AVR_SaveProgMem(mcu, FLASH_FILE);
-	if (rc != 0) {
-		MSIM_LOG_ERROR("failed to dump memory to: " FLASH_FILE);
-	}
+	MSIM_AVR_Signal(s);
 }
@@ -34,12 +34,9 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <errno.h>
-#include <pthread.h>
+#include <termios.h>
 #include "mcusim/mcusim.h"
 
-/* Thread function to read data from pty and populate a buffer. */
-static void *read_from_pty(void *arg);
-
 int
 MSIM_PTY_Open(struct MSIM_PTY *pty)
 {
@@ -48,8 +45,8 @@ MSIM_PTY_Open(struct MSIM_PTY *pty)
 	int pty_err = 0;
 	char *slavedevice;
 	char log[1024];
-	pthread_attr_t attr;
 
+	pty->chan = NULL;
 	masterfd = posix_openpt(O_RDWR|O_NOCTTY);
 	pty->master_fd = masterfd;
 	if (masterfd == -1) {
@@ -92,23 +89,45 @@ MSIM_PTY_Open(struct MSIM_PTY *pty)
 			snprintf(log, sizeof log, "cannot open pty slave "
 			         "device: %s", slavedevice);
 			MSIM_LOG_ERROR(log);
-		} else {
-			/* Slave device was opened correctly, do nothing */
 		}
 	}
 
-	/* Create a thread to read from pty */
+	/* USART frames are passed as is, i.e. the line discipline shouldn't
+	 * echo frames transmitted by the MCU back to its receiver or
+	 * translate them. A terminal program may change it later. */
 	if (pty_err == 0) {
-		/* Initialize a basic mutex */
-		pthread_mutex_init(&pty->read_thr.mutex, NULL);
-		/* Configure thread attributes */
-		pthread_attr_init(&attr);
-		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-		/* Create and start a thread to read */
-		pthread_create(&pty->read_thr.thread, &attr, read_from_pty,
-		               (void *)pty);
-		pthread_attr_destroy(&attr);
+		struct termios tio;
+
+		if (tcgetattr(slavefd, &tio) == 0) {
+			tio.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK |
+			                           ISTRIP | INLCR | IGNCR |
+			                           ICRNL | IXON);
+			tio.c_oflag &= (tcflag_t)~OPOST;
+			tio.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON |
+			                           ISIG | IEXTEN);
+			tio.c_cflag &= (tcflag_t)~(CSIZE | PARENB);
+			tio.c_cflag |= CS8;
+			tio.c_cc[VMIN] = 1;
+			tio.c_cc[VTIME] = 0;
+			if (tcsetattr(slavefd, TCSANOW, &tio) != 0) {
+				MSIM_LOG_WARN("failed to switch pty slave "
+				              "device to raw mode");
+			}
+		}
+	}
+
+	/* Master part is read and written by the I/O loop */
+	if (pty_err == 0) {
+		pty->chan = malloc(sizeof *pty->chan);
+		if (pty->chan == NULL) {
+			pty_err = 1;
+			MSIM_LOG_ERROR("failed to allocate buffers of the "
+			               "pseudo-terminal");
+		} else if (MSIM_IOL_Add(pty->chan, masterfd) != MSIM_IOL_OK) {
+			pty_err = 1;
+			free(pty->chan);
+			pty->chan = NULL;
+		}
 	}
 
 	/* Close master and slave devices in case of error */
@@ -126,32 +145,24 @@ MSIM_PTY_Open(struct MSIM_PTY *pty)
 int
 MSIM_PTY_Close(struct MSIM_PTY *pty)
 {
-	struct MSIM_PTY_Thread *t = &pty->read_thr;
-	char log[1024];
-	void *status;
-	int rc;
+	/* Nothing to do if pty hasn't been opened */
+	if (pty->chan == NULL) {
+		return 0;
+	}
 
-	/* Mark the reading thread to be stopped */
-	pthread_mutex_lock(&t->mutex);
-	t->stop_thr = 1;
-	pthread_mutex_unlock(&t->mutex);
+	/* Stop servicing the master part and close PTY files */
+	MSIM_IOL_Remove(pty->chan);
+	free(pty->chan);
+	pty->chan = NULL;
 
-	/* Close PTY files */
 	if (pty->slave_fd >= 0) {
 		close(pty->slave_fd);
 	}
 	if (pty->master_fd >= 0) {
 		close(pty->master_fd);
 	}
-
-	/* Wait for the reading thread and clear its mutex */
-	rc = pthread_join(t->thread, &status);
-	if (rc != 0) {
-		snprintf(log, sizeof log, "failed to join a thread (may not "
-		         "be created), return code: %d", rc);
-		MSIM_LOG_WARN(log);
-	}
-	pthread_mutex_destroy(&t->mutex);
+	pty->slave_fd = -1;
+	pty->master_fd = -1;
 
 	return 0;
 }
@@ -159,69 +170,21 @@ MSIM_PTY_Close(struct MSIM_PTY *pty)
 int
 MSIM_PTY_Write(struct MSIM_PTY *pty, uint8_t *buf, uint32_t len)
 {
-	return (int)write(pty->master_fd, buf, len);
+	if (pty->chan == NULL) {
+		return -1;
+	}
+	/* Data is written by the I/O loop in batches */
+	return (int)MSIM_IOL_Write(pty->chan, buf, len);
 }
 
 int
 MSIM_PTY_Read(struct MSIM_PTY *pty, uint8_t *buf, uint32_t len)
 {
-	struct MSIM_PTY_Thread *t = &pty->read_thr;
-	uint32_t i, l;
-
-	/* Lock the basic thread mutex */
-	pthread_mutex_lock(&t->mutex);
-
-	l = (len < (t->len)) ? len : t->len;
-	for (i = 0; i < l; i++) {
-		buf[i] = t->buf[i];
-	}
-	for (i = 0; i < (t->len-l); i++) {
-		t->buf[i] = t->buf[i+l];
-	}
-	t->len -= l;
-
-	/* Unlock the basic thread mutex */
-	pthread_mutex_unlock(&t->mutex);
-
-	return (int)l;
-}
-
-static void *
-read_from_pty(void *arg)
-{
-	struct MSIM_PTY *pty = (struct MSIM_PTY *)arg;
-	struct MSIM_PTY_Thread *t = &pty->read_thr;
-	uint8_t stop = 0;
-	uint8_t buf[1024];
-	int res = -1;
-
-	while (stop == 0U) {
-		res = (int)read(pty->master_fd, buf, sizeof buf);
-
-		/* Lock the basic thread mutex */
-		pthread_mutex_lock(&t->mutex);
-		/* Check the thread termination flag */
-		if (t->stop_thr > 0) {
-			stop = 1;
-		}
-
-		/* Append data to the thread buffer */
-		if (res > 0) {
-			if ((t->len+(uint32_t)res) > MSIM_PTY_BUFSIZE) {
-				/* Not enough space in the thread buffer */
-				MSIM_LOG_ERROR("not enough space in the "
-				               "thread buffer");
-			} else {
-				for (uint32_t i = 0; i < (uint32_t)res; i++) {
-					t->buf[t->len+i] = buf[i];
-				}
-				t->len += (uint32_t)res;
-			}
-		}
-		/* Unlock the basic thread mutex */
-		pthread_mutex_unlock(&t->mutex);
+	if (pty->chan == NULL) {
+		return 0;
 	}
-	pthread_exit(NULL);
+	/* Simulation thread doesn't block here */
+	return (int)MSIM_IOL_Read(pty->chan, buf, len);
 }
 
 #endif /* defined(WITH_POSIX) && defined(WITH_POSIX_PTY) */
@@ -0,0 +1,149 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Implementation of a lock-free SPSC ring buffer of bytes. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include "mcusim/ring.h"
+
+/* Only the producer writes the tail and only the consumer writes the head.
+ * Bytes are published by the release store of the index and seen by the
+ * other side after the acquire load of it. */
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD_ACQ(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQ(p)	(*(volatile uint32_t *)(p))
+#define STORE_REL(p, v)	(*(volatile uint32_t *)(p) = (v))
+#endif
+
+int
+MSIM_RING_Init(struct MSIM_RING *r, uint8_t *buf, uint32_t size)
+{
+	if ((buf == NULL) || (size == 0U) || ((size & (size - 1U)) != 0U) ||
+	                (size > 0x80000000U)) {
+		return MSIM_RING_ERR;
+	}
+
+	r->head = 0;
+	r->tail_cache = 0;
+	r->tail = 0;
+	r->head_cache = 0;
+	r->buf = buf;
+	r->mask = size - 1U;
+
+	return MSIM_RING_OK;
+}
+
+uint32_t
+MSIM_RING_TryEnq(struct MSIM_RING *r, const uint8_t *e, uint32_t len)
+{
+	const uint32_t size = r->mask + 1U;
+	const uint32_t tail = r->tail;
+	uint32_t space, off, n;
+
+	/* Head is loaded again only if the cached one says there is not
+	 * enough space. */
+	space = size - (tail - r->head_cache);
+	if (space < len) {
+		r->head_cache = LOAD_ACQ(&r->head);
+		space = size - (tail - r->head_cache);
+	}
+	len = (len < space) ? len : space;
+	if (len == 0U) {
+		return 0;
+	}
+
+	/* Copy bytes up to the end of the buffer and the rest to its start */
+	off = tail & r->mask;
+	n = ((size - off) < len) ? (size - off) : len;
+	memcpy(&r->buf[off], e, n);
+	memcpy(&r->buf[0], e + n, len - n);
+
+	STORE_REL(&r->tail, tail + len);
+	return len;
+}
+
+uint32_t
+MSIM_RING_TryDeq(struct MSIM_RING *r, uint8_t *e, uint32_t len)
+{
+	const uint32_t size = r->mask + 1U;
+	const uint32_t head = r->head;
+	uint32_t avail, off, n;
+
+	avail = r->tail_cache - head;
+	if (avail < len) {
+		r->tail_cache = LOAD_ACQ(&r->tail);
+		avail = r->tail_cache - head;
+	}
+	len = (len < avail) ? len : avail;
+	if (len == 0U) {
+		return 0;
+	}
+
+	off = head & r->mask;
+	n = ((size - off) < len) ? (size - off) : len;
+	memcpy(e, &r->buf[off], n);
+	memcpy(e + n, &r->buf[0], len - n);
+
+	STORE_REL(&r->head, head + len);
+	return len;
+}
+
+void
+MSIM_RING_Enqb(struct MSIM_RING *r, const uint8_t *e, uint32_t len)
+{
+	uint32_t n;
+
+	while (len > 0U) {
+		n = MSIM_RING_TryEnq(r, e, len);
+		if (n == 0U) {
+			sched_yield();
+		}
+		e += n;
+		len -= n;
+	}
+}
+
+void
+MSIM_RING_Deqb(struct MSIM_RING *r, uint8_t *e, uint32_t len)
+{
+	uint32_t n;
+
+	while (len > 0U) {
+		n = MSIM_RING_TryDeq(r, e, len);
+		if (n == 0U) {
+			sched_yield();
+		}
+		e += n;
+		len -= n;
+	}
+}
+
+uint32_t
+MSIM_RING_Len(struct MSIM_RING *r)
+{
+	/* Head is loaded first, it can't pass the tail loaded later */
+	const uint32_t head = LOAD_ACQ(&r->head);
+	const uint32_t tail = LOAD_ACQ(&r->tail);
+
+	return tail - head;
+}
@@ -0,0 +1,199 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Utility to decode a binary trace recorded by MCUSim. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/getopt.h"
+#include "mcusim/avr/sim/trace.h"
+
+/* Command line options */
+#define CLI_OPTIONS		":p:a:d"
+#define PRINT_USAGE_OPT		7580
+
+/* Long command line options */
+static struct MSIM_OPT_Option longopts[] = {
+	{ "help", MSIM_OPT_NO_ARGUMENT, NULL, PRINT_USAGE_OPT },
+	{ "pc", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'p' },
+	{ "addr", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'a' },
+	{ "disasm", MSIM_OPT_NO_ARGUMENT, NULL, 'd' },
+};
+
+/* Filters of the trace records */
+struct filter {
+	uint32_t pc_lo;			/* First PC, in bytes */
+	uint32_t pc_hi;			/* Last PC, in bytes */
+	uint32_t addr_lo;		/* First data memory address */
+	uint32_t addr_hi;		/* Last data memory address */
+	uint8_t has_addr;		/* Filter by data memory writes */
+	uint8_t disasm;			/* Print mnemonics */
+};
+
+static void	print_usage(void);
+static int	parse_range(const char *s, uint32_t *lo, uint32_t *hi);
+static int	match_rec(const struct filter *flt, const MSIM_AVR_TraceRec *r);
+
+int
+main(int argc, char *argv[])
+{
+	struct filter flt;
+	MSIM_AVR_TraceRec rec;
+	FILE *f = NULL;
+	char log[1024];
+	char name[32];
+	uint32_t freq, next_pc;
+	int c, rc = 0;
+
+	flt.pc_lo = 0;
+	flt.pc_hi = UINT32_MAX;
+	flt.addr_lo = 0;
+	flt.addr_hi = UINT32_MAX;
+	flt.has_addr = 0;
+	flt.disasm = 0;
+
+	c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS, longopts, NULL);
+	while (c != -1) {
+		switch (c) {
+		case 'p':
+			if (parse_range(MSIM_OPT_optarg, &flt.pc_lo,
+			                &flt.pc_hi) != 0) {
+				MSIM_LOG_FATAL("PC range should be: lo:hi");
+				return 1;
+			}
+			break;
+		case 'a':
+			if (parse_range(MSIM_OPT_optarg, &flt.addr_lo,
+			                &flt.addr_hi) != 0) {
+				MSIM_LOG_FATAL("address range should be: lo:hi");
+				return 1;
+			}
+			flt.has_addr = 1;
+			break;
+		case 'd':
+			flt.disasm = 1;
+			break;
+		case PRINT_USAGE_OPT:
+			print_usage();
+			return 2;
+		default:
+			snprintf(log, sizeof log, "unknown option or missing "
+			         "operand: -%c", MSIM_OPT_optopt);
+			MSIM_LOG_FATAL(log);
+			return 1;
+		}
+		c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS,
+		                         longopts, NULL);
+	}
+
+	do {
+		if (MSIM_OPT_optind >= argc) {
+			print_usage();
+			rc = 1;
+			break;
+		}
+
+		f = fopen(argv[MSIM_OPT_optind], "rb");
+		if (f == NULL) {
+			snprintf(log, sizeof log, "can't open trace: %s",
+			         argv[MSIM_OPT_optind]);
+			MSIM_LOG_FATAL(log);
+			rc = 1;
+			break;
+		}
+		if (MSIM_AVR_TraceReadHeader(f, &freq, name,
+		                             sizeof name) != 0) {
+			MSIM_LOG_FATAL("not an MCUSim trace file");
+			rc = 1;
+			break;
+		}
+		printf("# %s, %" PRIu32 " Hz\n", name, freq);
+
+		memset(&rec, 0, sizeof rec);
+		next_pc = 0;
+		while (1) {
+			rc = MSIM_AVR_TraceReadRec(f, &rec, &next_pc);
+			if (rc != 0) {
+				break;
+			}
+			if (match_rec(&flt, &rec) != 0) {
+				MSIM_AVR_TracePrintRec(stdout, &rec,
+				                       flt.disasm);
+			}
+		}
+		if (rc == 76) {
+			rc = 0;
+		} else {
+			MSIM_LOG_ERROR("trace is corrupted");
+			rc = 1;
+		}
+	} while (0);
+
+	if (f != NULL) {
+		fclose(f);
+	}
+	return rc;
+}
+
+static void
+print_usage(void)
+{
+	printf("Usage: mcusim-trace [options] <trace_file>\n"
+	       "Options:\n"
+	       "  -p, --pc <lo:hi>     Print instructions within PC range "
+	       "(in bytes).\n"
+	       "  -a, --addr <lo:hi>   Print instructions which write to "
+	       "data memory range.\n"
+	       "  -d, --disasm         Disassemble instructions.\n"
+	       "  --help               Print this message.\n");
+}
+
+static int
+parse_range(const char *s, uint32_t *lo, uint32_t *hi)
+{
+	if (sscanf(s, "%" SCNx32 ":%" SCNx32, lo, hi) != 2) {
+		return 1;
+	}
+	return (*lo <= *hi) ? 0 : 1;
+}
+
+static int
+match_rec(const struct filter *flt, const MSIM_AVR_TraceRec *r)
+{
+	const uint32_t pc = r->pc << 1;
+	int match = 0;
+
+	if ((pc >= flt->pc_lo) && (pc <= flt->pc_hi)) {
+		match = 1;
+	}
+	if ((match != 0) && (flt->has_addr != 0)) {
+		match = 0;
+		for (uint32_t i = 0; i < r->wnum; i++) {
+			if ((r->waddr[i] >= flt->addr_lo) &&
+			                (r->waddr[i] <= flt->addr_hi)) {
+				match = 1;
+				break;
+			}
+		}
+	}
+	return match;
+}
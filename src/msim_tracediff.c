@@ -0,0 +1,278 @@
+/*
+ * This file is part of MCUSim, an XSPICE library with microcontrollers.
+ *
+ * Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+ *
+ * MCUSim is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MCUSim is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Utility to compare a trace recorded by MCUSim against a golden one.
+ *
+ * Both traces are read record by record, so that the memory usage doesn't
+ * depend on the length of the traces. The first divergent record is printed
+ * together with the records preceding it, they're read from the golden
+ * trace again.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mcusim/mcusim.h"
+#include "mcusim/getopt.h"
+#include "mcusim/avr/sim/trace.h"
+
+/* Command line options */
+#define CLI_OPTIONS		":c:d"
+#define PRINT_USAGE_OPT		7580
+
+/* Records of the context to be printed before the divergence */
+#define CONTEXT_DEF		8
+#define CONTEXT_MAX		64
+
+/* Long command line options */
+static struct MSIM_OPT_Option longopts[] = {
+	{ "help", MSIM_OPT_NO_ARGUMENT, NULL, PRINT_USAGE_OPT },
+	{ "context", MSIM_OPT_REQUIRED_ARGUMENT, NULL, 'c' },
+	{ "disasm", MSIM_OPT_NO_ARGUMENT, NULL, 'd' },
+};
+
+/* Trace being read */
+struct trace {
+	FILE *file;			/* Trace file */
+	const char *name;		/* Name of the trace file */
+	uint32_t next_pc;		/* Expected PC of the next record */
+	int rc;				/* Last result of reading a record */
+	MSIM_AVR_TraceRec rec;		/* Last record read */
+};
+
+/* Location of a record of the golden trace to read it again. Records are
+ * delta-encoded, so the state of the reader is kept as well. */
+struct rec_pos {
+	long off;			/* Offset of the record in the file */
+	uint32_t next_pc;		/* Expected PC of the record */
+	uint64_t tick;			/* Cycle of the previous record */
+};
+
+/* Traces are too large to be kept on stack */
+static struct trace golden, actual;
+static MSIM_AVR_TraceRec rec;
+static struct rec_pos context[CONTEXT_MAX];
+
+static void	print_usage(void);
+static int	open_trace(struct trace *t, const char *name);
+static int	diff_traces(uint32_t ctx, uint8_t disasm);
+static void	print_context(const struct rec_pos *pos, uint8_t disasm);
+
+int
+main(int argc, char *argv[])
+{
+	char log[1024];
+	uint32_t ctx = CONTEXT_DEF;
+	uint8_t disasm = 0;
+	int c, rc = 0;
+
+	c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS, longopts, NULL);
+	while (c != -1) {
+		switch (c) {
+		case 'c':
+			if ((sscanf(MSIM_OPT_optarg, "%" SCNu32, &ctx) != 1) ||
+			                (ctx > CONTEXT_MAX)) {
+				snprintf(log, sizeof log, "context should be "
+				         "within 0..%d records", CONTEXT_MAX);
+				MSIM_LOG_FATAL(log);
+				return 2;
+			}
+			break;
+		case 'd':
+			disasm = 1;
+			break;
+		case PRINT_USAGE_OPT:
+			print_usage();
+			return 2;
+		default:
+			snprintf(log, sizeof log, "unknown option or missing "
+			         "operand: -%c", MSIM_OPT_optopt);
+			MSIM_LOG_FATAL(log);
+			return 2;
+		}
+		c = MSIM_OPT_Getopt_long(argc, argv, CLI_OPTIONS,
+		                         longopts, NULL);
+	}
+
+	do {
+		if ((argc - MSIM_OPT_optind) != 2) {
+			print_usage();
+			rc = 2;
+			break;
+		}
+		if ((open_trace(&golden, argv[MSIM_OPT_optind]) != 0) ||
+		                (open_trace(&actual,
+		                            argv[MSIM_OPT_optind+1]) != 0)) {
+			rc = 2;
+			break;
+		}
+		rc = diff_traces(ctx, disasm);
+	} while (0);
+
+	if (golden.file != NULL) {
+		fclose(golden.file);
+	}
+	if (actual.file != NULL) {
+		fclose(actual.file);
+	}
+	return rc;
+}
+
+static void
+print_usage(void)
+{
+	printf("Usage: mcusim-tracediff [options] <golden_trace> <trace>\n"
+	       "Options:\n"
+	       "  -c, --context <N>    Print N records before the first "
+	       "divergence (%d).\n"
+	       "  -d, --disasm         Disassemble instructions.\n"
+	       "  --help               Print this message.\n"
+	       "Exit status is 0 if traces are equal, 1 if they differ and "
+	       "2 in case of error.\n", CONTEXT_DEF);
+}
+
+static int
+open_trace(struct trace *t, const char *name)
+{
+	char log[1024];
+	char mcu[32];
+	uint32_t freq;
+	int rc = 0;
+
+	do {
+		t->name = name;
+		t->next_pc = 0;
+		t->rc = 0;
+		t->file = fopen(name, "rb");
+		if (t->file == NULL) {
+			snprintf(log, sizeof log, "can't open trace: %s", name);
+			MSIM_LOG_FATAL(log);
+			rc = 1;
+			break;
+		}
+		if (MSIM_AVR_TraceReadHeader(t->file, &freq, mcu,
+		                             sizeof mcu) != 0) {
+			snprintf(log, sizeof log, "not an MCUSim trace file: "
+			         "%s", name);
+			MSIM_LOG_FATAL(log);
+			rc = 1;
+			break;
+		}
+		printf("# %s: %s, %" PRIu32 " Hz\n", name, mcu, freq);
+	} while (0);
+
+	return rc;
+}
+
+static int
+diff_traces(uint32_t ctx, uint8_t disasm)
+{
+	char log[1024];
+	struct rec_pos pos;
+	uint64_t n = 0;
+	uint32_t i;
+	int rc = 0;
+
+	while (1) {
+		pos.off = ftell(golden.file);
+		pos.next_pc = golden.next_pc;
+		pos.tick = golden.rec.tick;
+		golden.rc = MSIM_AVR_TraceReadRec(golden.file, &golden.rec,
+		                                  &golden.next_pc);
+		actual.rc = MSIM_AVR_TraceReadRec(actual.file, &actual.rec,
+		                                  &actual.next_pc);
+
+		/* Trace of a killed simulation may end with a partial record */
+		if ((golden.rc == 75) && (feof(golden.file) != 0)) {
+			golden.rc = 76;
+		}
+		if ((actual.rc == 75) && (feof(actual.file) != 0)) {
+			actual.rc = 76;
+		}
+
+		/* Corrupted traces can't be compared */
+		if (((golden.rc != 0) && (golden.rc != 76)) ||
+		                ((actual.rc != 0) && (actual.rc != 76))) {
+			snprintf(log, sizeof log, "trace is corrupted at "
+			         "record #%" PRIu64 ": %s", n,
+			         (golden.rc != 0 && golden.rc != 76) ?
+			         golden.name : actual.name);
+			MSIM_LOG_ERROR(log);
+			rc = 2;
+			break;
+		}
+		if ((golden.rc == 76) && (actual.rc == 76)) {
+			printf("# traces are equal, %" PRIu64 " records\n", n);
+			rc = 0;
+			break;
+		}
+		if ((golden.rc == 0) && (actual.rc == 0) &&
+		                (MSIM_AVR_TraceCmpRec(&golden.rec,
+		                                      &actual.rec) == 0)) {
+			if (ctx > 0U) {
+				context[n % ctx] = pos;
+			}
+			n++;
+			continue;
+		}
+
+		/* First divergence found */
+		printf("# traces differ at record #%" PRIu64 "\n", n);
+		i = ((ctx > 0U) && (n > ctx)) ? (uint32_t)(n % ctx) : 0U;
+		for (uint64_t k = (n > ctx) ? ctx : n; k > 0U; k--) {
+			print_context(&context[i], disasm);
+			i = (i + 1U) % ctx;
+		}
+		if (golden.rc == 0) {
+			printf("- ");
+			MSIM_AVR_TracePrintRec(stdout, &golden.rec, disasm);
+		} else {
+			printf("- <end of trace>\n");
+		}
+		if (actual.rc == 0) {
+			printf("+ ");
+			MSIM_AVR_TracePrintRec(stdout, &actual.rec, disasm);
+		} else {
+			printf("+ <end of trace>\n");
+		}
+		rc = 1;
+		break;
+	}
+	return rc;
+}
+
+/* Reads a record of the golden trace again and prints it. */
+static void
+print_context(const struct rec_pos *pos, uint8_t disasm)
+{
+	uint32_t next_pc = pos->next_pc;
+
+	rec.tick = pos->tick;
+	if ((pos->off < 0) || (fseek(golden.file, pos->off, SEEK_SET) != 0) ||
+	                (MSIM_AVR_TraceReadRec(golden.file, &rec,
+	                                       &next_pc) != 0)) {
+		printf("  <record can't be read again>\n");
+		return;
+	}
+	printf("  ");
+	MSIM_AVR_TracePrintRec(stdout, &rec, disasm);
+}
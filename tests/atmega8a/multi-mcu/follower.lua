@@ -0,0 +1,47 @@
+--[[
+
+  This file is part of MCUSim, an XSPICE library with microcontrollers.
+
+  Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+
+  MCUSim is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  MCUSim is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+--]]
+
+--[[
+This model is loaded for the MCU clocked at 8 MHz. It writes a number of
+milliseconds simulated by the MCU to a file which is checked by the model
+of the other MCU.
+--]]
+
+SHARED = "follower.txt"
+
+local cycles, ticks, ms = 0, 0, 0
+
+function module_conf(mcu)
+	cycles = MSIM_Freq(mcu) / 1000
+end
+
+function module_tick(mcu)
+	ticks = ticks + 1
+	if ticks < cycles then
+		return
+	end
+	ticks = 0
+	ms = ms + 1
+
+	local f = assert(io.open(SHARED, "w"))
+	f:write(ms)
+	f:close()
+end
@@ -0,0 +1,66 @@
+--[[
+
+  This file is part of MCUSim, an XSPICE library with microcontrollers.
+
+  Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+
+  MCUSim is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  MCUSim is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+--]]
+
+--[[
+This model is loaded for the MCU clocked at 16 MHz. MCUs are simulated in
+order of the simulated time, so the MCU clocked at 8 MHz should have
+simulated the same number of milliseconds (or one less if it's its turn
+now) every time this model checks it.
+--]]
+
+SHARED = "follower.txt"
+DURATION = 100			-- milliseconds to simulate
+
+local cycles, ticks, ms = 0, 0, 0
+
+local function follower_ms()
+	local f = io.open(SHARED, "r")
+	if f == nil then
+		return 0
+	end
+	local v = f:read("*n")
+	f:close()
+	return v or 0
+end
+
+function module_conf(mcu)
+	os.remove(SHARED)
+	cycles = MSIM_Freq(mcu) / 1000
+end
+
+function module_tick(mcu)
+	ticks = ticks + 1
+	if (ticks < cycles) or (ms >= DURATION) then
+		return
+	end
+	ticks = 0
+	ms = ms + 1
+
+	local v = follower_ms()
+	if (v ~= ms) and (v ~= ms - 1) then
+		print("[Multi-MCU] follower is at " .. v .. "ms, leader " ..
+		      "is at " .. ms .. "ms")
+		MSIM_SetState(mcu, AVR_MSIM_TESTFAIL)
+	elseif ms >= DURATION then
+		print("[Multi-MCU] MCUs are in sync for " .. ms .. "ms")
+		MSIM_SetState(mcu, AVR_MSIM_STOP)
+	end
+end
@@ -0,0 +1,54 @@
+--[[
+
+  This file is part of MCUSim, an XSPICE library with microcontrollers.
+
+  Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+
+  MCUSim is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  MCUSim is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+--]]
+
+--[[
+This scenario checks timing of the USART transmitter (9600 baud, 8N1). The
+firmware writes two bytes back to back and sets PD3 once Transmit Complete
+flag is raised, i.e. two frames after the first write.
+--]]
+
+-- Cycles per frame: 10 bits, 16 cycles per bit, UBRR = 103
+FRAME = 10 * 16 * (103 + 1)
+
+local function pd3(m)
+	return math.floor(AVR_ReadIO(m, PORTD) / 8) % 2 == 1
+end
+
+function module_scenario(mcu)
+	-- The first byte is written right after USART is enabled
+	if not run_until(function(m)
+		return AVR_ReadIO(m, UCSRB) ~= 0
+	end, 100) then
+		error("USART is not enabled")
+	end
+
+	-- The second byte waits in the buffer while the first one is sent
+	if run_until(pd3, 2 * FRAME - 100) then
+		error("frames are sent faster than the baud rate")
+	end
+	expect_pin("D", 3, 1, 200)
+	print("[Frame scenario] TXC is set after two frames")
+
+	if expect_uart("\85\170", 10) ~= "\85\170" then
+		error("unexpected bytes are transmitted")
+	end
+	print("[Frame scenario] both bytes are transmitted")
+end
@@ -0,0 +1,58 @@
+--[[
+
+  This file is part of MCUSim, an XSPICE library with microcontrollers.
+
+  Copyright (C) 2017-2019 MCUSim Developers, see AUTHORS.txt for contributors.
+
+  MCUSim is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  MCUSim is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+--]]
+
+--[[
+This scenario checks the firmware which echoes bytes received by USART
+(9600 baud, 8N1) and toggles PD2 on each of them.
+--]]
+
+-- Cycles per frame: 10 bits, 16 cycles per bit, UBRR = 103
+FRAME = 10 * 16 * (103 + 1)
+
+function module_scenario(mcu)
+	-- USART is configured by the firmware at the start
+	if not run_until(function(m)
+		return AVR_ReadIO(m, UCSRB) ~= 0
+	end, 100) then
+		error("USART is not enabled")
+	end
+
+	-- Bytes are sent a frame apart, PD2 follows each of them
+	send_uart("ping")
+	expect_pin("D", 2, 1, 100)
+	expect_pin("D", 2, 0, FRAME + 100)
+	expect_uart("ping", 4 * FRAME)
+	print("[Echo scenario] ping is echoed")
+
+	send_uart("MCUSim\n")
+	local line = expect_uart("[^\n]*\n", 8 * FRAME)
+	if line ~= "MCUSim\n" then
+		error("unexpected echo: " .. line)
+	end
+	print("[Echo scenario] line is echoed")
+
+	-- Timeouts of the completed waits don't keep scheduled calls
+	for i = 1, 40 do
+		send_uart("x")
+		expect_uart("x", 100 * FRAME)
+	end
+	print("[Echo scenario] bytes are echoed one by one")
+end
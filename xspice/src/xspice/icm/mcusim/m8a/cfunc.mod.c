@@ -63,8 +63,28 @@
 static struct MSIM_AVR _mcu;
 static struct MSIM_CFG _cfg;
 
+/* Time the MCU is going to be called at in the internal clock mode. */
+static double wake_time;
+
+/* Levels and directions of the pins of ports B, C and D driven last. */
+static uint8_t drv_port[3];
+static uint8_t drv_ddr[3];
+
+/* States and strengths of the input pins of ports B, C and D sampled last. */
+static Digital_State_t smp_state[3][8];
+static Digital_Strength_t smp_strength[3][8];
+
+/* Levels of the input pins sampled last and the pins which are driven, i.e.
+ * they aren't in the high impedance state. */
+static uint8_t smp_level[3];
+static uint8_t smp_valid[3];
+
 static void setup_ports_load(ARGS);
 static void ports_not_changed(ARGS);
+static void read_ports(ARGS, struct MSIM_AVR *mcu);
+static void drive_ports(ARGS, struct MSIM_AVR *mcu, double delay);
+static int ports_changed(struct MSIM_AVR *mcu);
+static void run_internal(ARGS, struct MSIM_AVR *mcu, struct MSIM_CFG *cfg);
 
 void
 MSIM_CM_M8A(ARGS)
@@ -73,6 +93,9 @@ MSIM_CM_M8A(ARGS)
 	Digital_State_t *clk_old;	/* Previous clock value */
 	struct MSIM_AVR *mcu;		/* AVR MCU descriptor */
 	struct MSIM_CFG *cfg;		/* Configuration of the simulator */
+	int internal;			/* Clock is derived from MCU frequency */
+
+	internal = (PARAM(clk_internal) == MIF_TRUE) || PORT_NULL(clk);
 
 	if (INIT) {
 		MSIM_CFG_PrintVersion();
@@ -89,11 +112,23 @@ MSIM_CM_M8A(ARGS)
 
 		/* Set up capacitive load values. */
 		setup_ports_load(mif_private);
-		LOAD(clk) = PARAM(clk_load);
+		if (!PORT_NULL(clk)) {
+			LOAD(clk) = PARAM(clk_load);
+		}
 		if (!PORT_NULL(reset)) {
 			LOAD(reset) = PARAM(reset_load);
 		}
 
+		/* Input pins are sampled at the first event */
+		for (uint32_t i = 0; i < ARRSZ(smp_state); i++) {
+			for (uint32_t j = 0; j < ARRSZ(smp_state[i]); j++) {
+				smp_state[i][j] = UNKNOWN;
+				smp_strength[i][j] = UNDETERMINED;
+			}
+			smp_level[i] = 0;
+			smp_valid[i] = 0;
+		}
+
 		/* Read config file */
 		MSIM_CFG_Read(cfg, PARAM(config_file));
 
@@ -102,6 +137,12 @@ MSIM_CM_M8A(ARGS)
 
 		/* Set up an instance of the ATmega8A */
 		MSIM_AVR_Init(mcu, cfg);
+
+		/* Schedule the first cycle of the MCU */
+		if (internal && (mcu->freq > 0U)) {
+			wake_time = 1.0/(double)mcu->freq;
+			cm_event_queue(wake_time);
+		}
 	} else {
 		mcu = &_mcu;
 		cfg = &_cfg;
@@ -111,78 +152,23 @@ MSIM_CM_M8A(ARGS)
 	}
 
 	if (TIME != 0.0) {
+		if (internal) {
+			run_internal(mif_private, mcu, cfg);
+			return;
+		}
+
+		/* Obtain input values of ports. */
+		read_ports(mif_private, mcu);
+
 		/* Update clock and reset values. */
 		*clk = INPUT_STATE(clk);
 
 		if ((*clk != *clk_old) && (*clk == ONE)) {
-			Digital_State_t ns;
-			uint8_t pval, b;
-
-			/* Obtain input values of ports. */
-			pval = DM(PINB);
-			for (uint32_t i = 0; i < PORT_SIZE(Bin); i++) {
-				if ((PORT_NULL(Bin) == 0) &&
-				                (INPUT_STRENGTH(Bin[i]) != HI_IMPEDANCE)) {
-					TO_BIT(INPUT_STATE(Bin[i]), b);
-					UPDATE_BIT(&pval, i, b);
-				}
-			}
-			DM(PINB) = pval & (~DM(DDRB));
-
-			pval = DM(PINC);
-			for (uint32_t i = 0; i < PORT_SIZE(Cin); i++) {
-				if ((PORT_NULL(Cin) == 0) &&
-				                (INPUT_STRENGTH(Cin[i]) != HI_IMPEDANCE)) {
-					TO_BIT(INPUT_STATE(Cin[i]), b);
-					UPDATE_BIT(&pval, i, b);
-				}
-			}
-			DM(PINC) = pval & (~DM(DDRC));
-
-			pval = DM(PIND);
-			for (uint32_t i = 0; i < PORT_SIZE(Din); i++) {
-				if ((PORT_NULL(Din) == 0) &&
-				                (INPUT_STRENGTH(Din[i]) != HI_IMPEDANCE)) {
-					TO_BIT(INPUT_STATE(Din[i]), b);
-					UPDATE_BIT(&pval, i, b);
-				}
-			}
-			DM(PIND) = pval & (~DM(DDRD));
-
 			/* Update the microcontroller */
 			MSIM_AVR_SimStep(mcu, cfg->firmware_test);
 
 			/* Provide the updated values of the ports. */
-			for (uint32_t i = 0; i < PORT_SIZE(Bout); i++) {
-				if (((DM(DDRB)>>i)&1) == 0U) {
-					OUTPUT_CHANGED(Bout[i]) = FALSE;
-				} else {
-					ns = ((DM(PORTB)>>i)&1) ? ONE : ZERO;
-					OUTPUT_STATE(Bout[i]) = ns;
-					OUTPUT_STRENGTH(Bout[i]) = STRONG;
-					OUTPUT_DELAY(Bout[i]) = PARAM(clk_delay);
-				}
-			}
-			for (uint32_t i = 0; i < PORT_SIZE(Cout); i++) {
-				if (((DM(DDRC)>>i)&1) == 0U) {
-					OUTPUT_CHANGED(Cout[i]) = FALSE;
-				} else {
-					ns = ((DM(PORTC)>>i)&1) ? ONE : ZERO;
-					OUTPUT_STATE(Cout[i]) = ns;
-					OUTPUT_STRENGTH(Cout[i]) = STRONG;
-					OUTPUT_DELAY(Cout[i]) = PARAM(clk_delay);
-				}
-			}
-			for (uint32_t i = 0; i < PORT_SIZE(Dout); i++) {
-				if (((DM(DDRD)>>i)&1) == 0U) {
-					OUTPUT_CHANGED(Dout[i]) = FALSE;
-				} else {
-					ns = ((DM(PORTD)>>i)&1) ? ONE : ZERO;
-					OUTPUT_STATE(Dout[i]) = ns;
-					OUTPUT_STRENGTH(Dout[i]) = STRONG;
-					OUTPUT_DELAY(Dout[i]) = PARAM(clk_delay);
-				}
-			}
+			drive_ports(mif_private, mcu, PARAM(clk_delay));
 		} else {
 			ports_not_changed(mif_private);
 		}
@@ -209,6 +195,206 @@ MSIM_CM_M8A(ARGS)
 	}
 }
 
+/*
+ * Internal clock mode. The MCU isn't driven by the clock input, but it runs
+ * as many cycles as possible at its own frequency (mcu->freq) during a call:
+ * until an output pin changes or the MCU gets ahead of the simulator by
+ * clk_ahead seconds. The model wakes itself up at the time of the last
+ * cycle it's run, outputs changed are delayed by the same time.
+ *
+ * The model may also be called by an input event while the MCU is ahead of
+ * the simulator. Inputs are sampled in this case only, they're seen by the
+ * MCU starting from its next cycle.
+ *
+ * Cycles aren't counted while the MCU isn't active (stopped or put to sleep
+ * by a model), so it's only run again by the next input event.
+ */
+static void
+run_internal(ARGS, struct MSIM_AVR *mcu, struct MSIM_CFG *cfg)
+{
+	double freq = (double)mcu->freq;
+	double now = TIME;
+	uint64_t end;
+	int rc = 0;
+
+	read_ports(mif_private, mcu);
+
+	if ((freq <= 0.0) || (now < (wake_time - 0.5/freq))) {
+		ports_not_changed(mif_private);
+		return;
+	}
+
+	end = (uint64_t)((now + PARAM(clk_ahead))*freq);
+	do {
+		rc = MSIM_AVR_SimStep(mcu, cfg->firmware_test);
+	} while ((rc == 0) && (mcu->tick < end) && !ports_changed(mcu) &&
+	         (IS_MCU_ACTIVE(mcu) || mcu->ic_left));
+
+	wake_time = (double)mcu->tick/freq;
+	if (ports_changed(mcu)) {
+		drive_ports(mif_private, mcu,
+		            (wake_time - now) + PARAM(clk_delay));
+	} else {
+		ports_not_changed(mif_private);
+	}
+
+	/* MCU has been stopped or a test failed otherwise */
+	if ((rc == 0) && IS_MCU_ACTIVE(mcu)) {
+		cm_event_queue(wake_time);
+	}
+}
+
+/* Input values of the pins are updated when their states or strengths are
+ * changed only, i.e. an input event is reported by the simulator for the
+ * pin. A random level chosen for an unknown state is kept until the next
+ * event.
+ *
+ * Levels sampled are kept apart from PINx, so a pin which is switched from
+ * output to input gets its external level back. */
+static void
+read_ports(ARGS, struct MSIM_AVR *mcu)
+{
+	Digital_State_t st;
+	Digital_Strength_t sg;
+	uint8_t pval, b;
+
+	for (uint32_t i = 0; i < PORT_SIZE(Bin); i++) {
+		if (PORT_NULL(Bin) != 0) {
+			break;
+		}
+		st = INPUT_STATE(Bin[i]);
+		sg = INPUT_STRENGTH(Bin[i]);
+		if ((st != smp_state[0][i]) || (sg != smp_strength[0][i])) {
+			smp_state[0][i] = st;
+			smp_strength[0][i] = sg;
+			TO_BIT(st, b);
+			UPDATE_BIT(&smp_level[0], i, b);
+			UPDATE_BIT(&smp_valid[0], i,
+			           (sg != HI_IMPEDANCE));
+		}
+	}
+	pval = (uint8_t)((DM(PINB)&~smp_valid[0]) |
+	                 (smp_level[0]&smp_valid[0]));
+	DM(PINB) = pval & (~DM(DDRB));
+
+	for (uint32_t i = 0; i < PORT_SIZE(Cin); i++) {
+		if (PORT_NULL(Cin) != 0) {
+			break;
+		}
+		st = INPUT_STATE(Cin[i]);
+		sg = INPUT_STRENGTH(Cin[i]);
+		if ((st != smp_state[1][i]) || (sg != smp_strength[1][i])) {
+			smp_state[1][i] = st;
+			smp_strength[1][i] = sg;
+			TO_BIT(st, b);
+			UPDATE_BIT(&smp_level[1], i, b);
+			UPDATE_BIT(&smp_valid[1], i,
+			           (sg != HI_IMPEDANCE));
+		}
+	}
+	pval = (uint8_t)((DM(PINC)&~smp_valid[1]) |
+	                 (smp_level[1]&smp_valid[1]));
+	DM(PINC) = pval & (~DM(DDRC));
+
+	for (uint32_t i = 0; i < PORT_SIZE(Din); i++) {
+		if (PORT_NULL(Din) != 0) {
+			break;
+		}
+		st = INPUT_STATE(Din[i]);
+		sg = INPUT_STRENGTH(Din[i]);
+		if ((st != smp_state[2][i]) || (sg != smp_strength[2][i])) {
+			smp_state[2][i] = st;
+			smp_strength[2][i] = sg;
+			TO_BIT(st, b);
+			UPDATE_BIT(&smp_level[2], i, b);
+			UPDATE_BIT(&smp_valid[2], i,
+			           (sg != HI_IMPEDANCE));
+		}
+	}
+	pval = (uint8_t)((DM(PIND)&~smp_valid[2]) |
+	                 (smp_level[2]&smp_valid[2]));
+	DM(PIND) = pval & (~DM(DDRD));
+}
+
+/* Output pins are driven when their levels or directions are changed only.
+ * Pins of the output direction are driven strongly, the other ones are in
+ * the high impedance state. */
+static void
+drive_ports(ARGS, struct MSIM_AVR *mcu, double delay)
+{
+	uint8_t ddr, pval, chg;
+
+	ddr = DM(DDRB);
+	pval = DM(PORTB)&ddr;
+	chg = (uint8_t)((ddr^drv_ddr[0]) | (pval^drv_port[0]));
+	for (uint32_t i = 0; i < PORT_SIZE(Bout); i++) {
+		if (((chg>>i)&1) == 0U) {
+			OUTPUT_CHANGED(Bout[i]) = FALSE;
+		} else if (((ddr>>i)&1) == 0U) {
+			OUTPUT_STATE(Bout[i]) = UNKNOWN;
+			OUTPUT_STRENGTH(Bout[i]) = HI_IMPEDANCE;
+			OUTPUT_DELAY(Bout[i]) = delay;
+		} else {
+			OUTPUT_STATE(Bout[i]) = ((pval>>i)&1) ? ONE : ZERO;
+			OUTPUT_STRENGTH(Bout[i]) = STRONG;
+			OUTPUT_DELAY(Bout[i]) = delay;
+		}
+	}
+	drv_ddr[0] = ddr;
+	drv_port[0] = pval;
+
+	ddr = DM(DDRC);
+	pval = DM(PORTC)&ddr;
+	chg = (uint8_t)((ddr^drv_ddr[1]) | (pval^drv_port[1]));
+	for (uint32_t i = 0; i < PORT_SIZE(Cout); i++) {
+		if (((chg>>i)&1) == 0U) {
+			OUTPUT_CHANGED(Cout[i]) = FALSE;
+		} else if (((ddr>>i)&1) == 0U) {
+			OUTPUT_STATE(Cout[i]) = UNKNOWN;
+			OUTPUT_STRENGTH(Cout[i]) = HI_IMPEDANCE;
+			OUTPUT_DELAY(Cout[i]) = delay;
+		} else {
+			OUTPUT_STATE(Cout[i]) = ((pval>>i)&1) ? ONE : ZERO;
+			OUTPUT_STRENGTH(Cout[i]) = STRONG;
+			OUTPUT_DELAY(Cout[i]) = delay;
+		}
+	}
+	drv_ddr[1] = ddr;
+	drv_port[1] = pval;
+
+	ddr = DM(DDRD);
+	pval = DM(PORTD)&ddr;
+	chg = (uint8_t)((ddr^drv_ddr[2]) | (pval^drv_port[2]));
+	for (uint32_t i = 0; i < PORT_SIZE(Dout); i++) {
+		if (((chg>>i)&1) == 0U) {
+			OUTPUT_CHANGED(Dout[i]) = FALSE;
+		} else if (((ddr>>i)&1) == 0U) {
+			OUTPUT_STATE(Dout[i]) = UNKNOWN;
+			OUTPUT_STRENGTH(Dout[i]) = HI_IMPEDANCE;
+			OUTPUT_DELAY(Dout[i]) = delay;
+		} else {
+			OUTPUT_STATE(Dout[i]) = ((pval>>i)&1) ? ONE : ZERO;
+			OUTPUT_STRENGTH(Dout[i]) = STRONG;
+			OUTPUT_DELAY(Dout[i]) = delay;
+		}
+	}
+	drv_ddr[2] = ddr;
+	drv_port[2] = pval;
+}
+
+/* Tests whether levels or directions of the pins have been changed since
+ * they're driven last time. */
+static int
+ports_changed(struct MSIM_AVR *mcu)
+{
+	return (drv_ddr[0] != DM(DDRB)) ||
+	       (drv_ddr[1] != DM(DDRC)) ||
+	       (drv_ddr[2] != DM(DDRD)) ||
+	       (drv_port[0] != (DM(PORTB)&DM(DDRB))) ||
+	       (drv_port[1] != (DM(PORTC)&DM(DDRC))) ||
+	       (drv_port[2] != (DM(PORTD)&DM(DDRD)));
+}
+
 static void
 setup_ports_load(ARGS)
 {